@@ -0,0 +1,237 @@
+/**
+ * Throughput benchmarks
+ *
+ * Times every built-in force and operator, integrate_force with each REBOUNDx integrator,
+ * and the binary save/load path, sweeping the number of particles. Each line of output is
+ *
+ *     group,name,N,calls,ns_per_particle_call
+ *
+ * so runs can be saved and compared across versions, e.g. ./benchmark > results.csv
+ *
+ * Pass a list of particle numbers to override the default sweep (./benchmark 100 1000),
+ * or -b <name> to only run benchmarks whose name matches. Particle setups and parameters
+ * are fixed (seeded), and each measurement doubles its number of calls until it runs for
+ * at least BENCH_MIN_TIME, so results are reproducible on a given machine.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "rebound.h"
+#include "reboundx.h"
+
+#define BENCH_MIN_TIME 0.2          // seconds. Calls are doubled until a measurement takes at least this long
+#define BENCH_MAX_CALLS (1<<24)
+#define BENCH_BINARY "benchmark.bin"
+
+static const char* bench_filter = NULL;
+
+static double walltime(void){
+    struct timespec tim;
+    clock_gettime(CLOCK_MONOTONIC, &tim);
+    return tim.tv_sec + (tim.tv_nsec/1e9);
+}
+
+static int bench_skip(const char* const name){
+    return bench_filter != NULL && strstr(name, bench_filter) == NULL;
+}
+
+static void bench_print(const char* const group, const char* const name, const int N, const int calls, const double time){
+    printf("%s,%s,%d,%d,%.4f\n", group, name, N, calls, 1.e9*time/calls/N);
+    fflush(stdout);
+}
+
+// Star with N-1 low-mass planets on nearly circular, slightly inclined orbits spread between 0.1 and 10
+static struct reb_simulation* create_sim(const int N){
+    struct reb_simulation* sim = reb_create_simulation();
+    sim->G = 4*M_PI*M_PI;
+    sim->dt = 1.e-4;
+    struct reb_particle star = {0};
+    star.m = 1.;
+    reb_add(sim, star);
+    srand(1);
+    for (int i=1; i<N; i++){
+        const double a = 0.1 + 9.9*(double)i/N;
+        const double phi = 2.*M_PI*rand()/RAND_MAX;
+        const double inc = 0.01*rand()/RAND_MAX;
+        const double v = sqrt(sim->G*star.m/a);
+        struct reb_particle p = {0};
+        p.m = 1.e-9;
+        p.x = a*cos(phi);
+        p.y = a*sin(phi)*cos(inc);
+        p.z = a*sin(phi)*sin(inc);
+        p.vx = -v*sin(phi);
+        p.vy = v*cos(phi)*cos(inc);
+        p.vz = v*cos(phi)*sin(inc);
+        reb_add(sim, p);
+    }
+    reb_move_to_com(sim);
+    return sim;
+}
+
+// Sets the parameters every built-in effect needs, so any of them can act on the same setup
+static void set_params(struct rebx_extras* const rebx, struct reb_simulation* const sim){
+    struct reb_particle* const ps = sim->particles;
+    rebx_set_param_double(rebx, &ps[0].ap, "J2", 1.e-3);
+    rebx_set_param_double(rebx, &ps[0].ap, "J4", 1.e-4);
+    rebx_set_param_double(rebx, &ps[0].ap, "R_eq", 5.e-3);
+    rebx_set_param_double(rebx, &ps[0].ap, "R_tides", 5.e-3);
+    rebx_set_param_double(rebx, &ps[0].ap, "k1", 0.1);
+    rebx_set_param_double(rebx, &ps[0].ap, "Acentral", 1.e-4);
+    rebx_set_param_double(rebx, &ps[0].ap, "gammacentral", -3.);
+    rebx_set_param_int(rebx, &ps[0].ap, "radiation_source", 1);
+    rebx_set_param_double(rebx, &ps[0].ap, "tau_mass", -1.e6);
+    for (int i=1; i<sim->N; i++){
+        rebx_set_param_double(rebx, &ps[i].ap, "beta", 0.01);
+        rebx_set_param_double(rebx, &ps[i].ap, "R_tides", 1.e-5);
+        rebx_set_param_double(rebx, &ps[i].ap, "k1", 0.3);
+        rebx_set_param_double(rebx, &ps[i].ap, "tau_a", -1.e6);
+        rebx_set_param_double(rebx, &ps[i].ap, "tau_e", -1.e5);
+        rebx_set_param_double(rebx, &ps[i].ap, "min_distance", 1.e-3);
+    }
+}
+
+static void set_force_params(struct rebx_extras* const rebx, struct rebx_force* const force){
+    rebx_set_param_double(rebx, &force->ap, "c", 63197.8); // AU/yr
+}
+
+static void bench_force(const char* const name, const int N){
+    if (bench_skip(name)){
+        return;
+    }
+    struct reb_simulation* sim = create_sim(N);
+    struct rebx_extras* rebx = rebx_attach(sim);
+    set_params(rebx, sim);
+    struct rebx_force* force = rebx_load_force(rebx, name);
+    set_force_params(rebx, force);
+
+    force->update_accelerations(sim, force, sim->particles, N); // warm caches
+    int calls = 1;
+    double time;
+    do{
+        const double start = walltime();
+        for (int i=0; i<calls; i++){
+            force->update_accelerations(sim, force, sim->particles, N);
+        }
+        time = walltime()-start;
+    } while (time < BENCH_MIN_TIME && calls < BENCH_MAX_CALLS && (calls *= 2));
+    bench_print("force", name, N, calls, time);
+
+    rebx_free(rebx);
+    reb_free_simulation(sim);
+}
+
+// Operators are given the same short step each call. Forces passed to integrate_force are set up through the force argument
+static void bench_operator(const char* const group, const char* const name, const char* const label, const int integrator, const int N){
+    if (bench_skip(label)){
+        return;
+    }
+    struct reb_simulation* sim = create_sim(N);
+    struct rebx_extras* rebx = rebx_attach(sim);
+    set_params(rebx, sim);
+    struct rebx_operator* operator = rebx_load_operator(rebx, name);
+    if (integrator != REBX_INTEGRATOR_NONE){
+        struct rebx_force* gr = rebx_load_force(rebx, "gr");
+        set_force_params(rebx, gr);
+        rebx_set_param_pointer(rebx, &operator->ap, "force", gr);
+        rebx_set_param_int(rebx, &operator->ap, "integrator", integrator);
+    }
+
+    operator->step_function(sim, operator, sim->dt);
+    int calls = 1;
+    double time;
+    do{
+        const double start = walltime();
+        for (int i=0; i<calls; i++){
+            operator->step_function(sim, operator, sim->dt);
+        }
+        time = walltime()-start;
+    } while (time < BENCH_MIN_TIME && calls < BENCH_MAX_CALLS && (calls *= 2));
+    bench_print(group, label, N, calls, time);
+
+    rebx_free(rebx);
+    reb_free_simulation(sim);
+}
+
+static void bench_binary(const int N){
+    if (bench_skip("binary_save") && bench_skip("binary_load")){
+        return;
+    }
+    struct reb_simulation* sim = create_sim(N);
+    struct rebx_extras* rebx = rebx_attach(sim);
+    set_params(rebx, sim);
+    struct rebx_force* gr = rebx_load_force(rebx, "gr");
+    set_force_params(rebx, gr);
+    rebx_add_force(rebx, gr);
+
+    int calls = 1;
+    double time;
+    do{
+        const double start = walltime();
+        for (int i=0; i<calls; i++){
+            rebx_output_binary(rebx, BENCH_BINARY);
+        }
+        time = walltime()-start;
+    } while (time < BENCH_MIN_TIME && calls < BENCH_MAX_CALLS && (calls *= 2));
+    if (!bench_skip("binary_save")){
+        bench_print("io", "binary_save", N, calls, time);
+    }
+    rebx_free(rebx);
+
+    if (!bench_skip("binary_load")){
+        // Particle parameters are attached to the simulation's particles, so load into a fresh copy each time
+        struct reb_simulation* copy = create_sim(N);
+        calls = 1;
+        do{
+            time = 0.;
+            for (int i=0; i<calls; i++){
+                const double start = walltime();
+                struct rebx_extras* loaded = rebx_create_extras_from_binary(copy, BENCH_BINARY);
+                time += walltime()-start;
+                rebx_free(loaded);
+            }
+        } while (time < BENCH_MIN_TIME && calls < BENCH_MAX_CALLS && (calls *= 2));
+        bench_print("io", "binary_load", N, calls, time);
+        reb_free_simulation(copy);
+    }
+    remove(BENCH_BINARY);
+    reb_free_simulation(sim);
+}
+
+int main(int argc, char* argv[]){
+    int Ns[64] = {16, 128, 1024, 8192};
+    int N_Ns = 4;
+    int N_args = 0;
+    for (int i=1; i<argc; i++){
+        if (strcmp(argv[i], "-b") == 0 && i+1 < argc){
+            bench_filter = argv[++i];
+        }
+        else if (N_args < 64 && atoi(argv[i]) > 1){
+            Ns[N_args++] = atoi(argv[i]);
+        }
+    }
+    if (N_args > 0){
+        N_Ns = N_args;
+    }
+
+    // ephemeris_forces is left out since it needs the JPL kernels (see examples/ephem_forces)
+    const char* forces[] = {"gr", "gr_full", "gr_potential", "central_force", "gravitational_harmonics", "radiation_forces", "tides_precession", "modify_orbits_forces"};
+    const char* operators[] = {"modify_mass", "modify_orbits_direct", "track_min_distance", "drift", "kick", "kepler", "jump", "interaction", "ias15"};
+    const char* integrators[] = {"integrate_force_implicit_midpoint", "integrate_force_rk4", "integrate_force_euler", "integrate_force_rk2", "integrate_force_rk45"}; // indexed by enum rebx_integrator
+
+    printf("group,name,N,calls,ns_per_particle_call\n");
+    for (int k=0; k<N_Ns; k++){
+        const int N = Ns[k];
+        for (size_t i=0; i<sizeof(forces)/sizeof(forces[0]); i++){
+            bench_force(forces[i], N);
+        }
+        for (size_t i=0; i<sizeof(operators)/sizeof(operators[0]); i++){
+            bench_operator("operator", operators[i], operators[i], REBX_INTEGRATOR_NONE, N);
+        }
+        for (int i=0; i<(int)(sizeof(integrators)/sizeof(integrators[0])); i++){
+            bench_operator("integrate_force", "integrate_force", integrators[i], i, N);
+        }
+        bench_binary(N);
+    }
+}
@@ -42,3 +42,142 @@ def integration_function(tstart, tstep, trange,
 
     return times, states, n_out, n_particles
 
+def integration_function_parallel(tstart, tstep, trange,
+                                  geocentric,
+                                  n_particles,
+                                  instate_arr,
+                                  n_threads):
+
+    # Each object is integrated with its own time steps, so the output is
+    # one (times, states) pair per object rather than a single merged array.
+    instate_arr = np.ascontiguousarray(instate_arr, dtype=np.float64)
+    timestates = (n_particles*TimeState)()
+
+    _integration_function_parallel = rebx_lib.integration_function_parallel
+    _integration_function_parallel.argtypes = (c_double, c_double, c_double,
+                                               c_int,
+                                               c_int,
+                                               POINTER(c_double),
+                                               c_int,
+                                               POINTER(TimeState))
+
+    _integration_function_parallel.restype = c_int
+
+    return_value = _integration_function_parallel(tstart, tstep, trange, geocentric,
+                                                  n_particles,
+                                                  instate_arr.ctypes.data_as(POINTER(c_double)),
+                                                  n_threads,
+                                                  timestates)
+    if return_value == 0:
+        raise RuntimeError("could not load the ephemeris files")
+
+    results = []
+    for ts in timestates:
+        times = np.ctypeslib.as_array(ts.t, shape=(ts.n_out,))
+        states = np.ctypeslib.as_array(ts.state, shape=(ts.n_out, 6))
+        results.append((times, states))
+
+    return results
+
+def integration_function_epochs(tstart, tstep,
+                                geocentric,
+                                n_particles,
+                                instate_arr,
+                                epochs):
+
+    epochs = np.ascontiguousarray(epochs, dtype=np.float64)
+    n_epochs = len(epochs)
+    outstate = np.empty((n_epochs, n_particles, 6), dtype=np.float64)
+
+    _integration_function_epochs = rebx_lib.integration_function_epochs
+    _integration_function_epochs.argtypes = (c_double, c_double,
+                                             c_int,
+                                             c_int,
+                                             POINTER(c_double),
+                                             c_int,
+                                             POINTER(c_double),
+                                             POINTER(c_double))
+
+    _integration_function_epochs.restype = c_int
+
+    return_value = _integration_function_epochs(tstart, tstep, geocentric,
+                                                n_particles,
+                                                instate_arr.ctypes.data_as(POINTER(c_double)),
+                                                n_epochs,
+                                                epochs.ctypes.data_as(POINTER(c_double)),
+                                                outstate.ctypes.data_as(POINTER(c_double)))
+    if return_value == 0:
+        raise RuntimeError("integration failed; epochs must be sorted in the direction of integration and not precede tstart (see stderr)")
+
+    return outstate
+
+def integration_function_epochs_parallel(tstart, tstep,
+                                         geocentric,
+                                         n_particles,
+                                         instate_arr,
+                                         epochs,
+                                         n_threads):
+
+    epochs = np.ascontiguousarray(epochs, dtype=np.float64)
+    n_epochs = len(epochs)
+    outstate = np.empty((n_epochs, n_particles, 6), dtype=np.float64)
+
+    _integration_function_epochs_parallel = rebx_lib.integration_function_epochs_parallel
+    _integration_function_epochs_parallel.argtypes = (c_double, c_double,
+                                                      c_int,
+                                                      c_int,
+                                                      POINTER(c_double),
+                                                      c_int,
+                                                      POINTER(c_double),
+                                                      c_int,
+                                                      POINTER(c_double))
+
+    _integration_function_epochs_parallel.restype = c_int
+
+    return_value = _integration_function_epochs_parallel(tstart, tstep, geocentric,
+                                                         n_particles,
+                                                         instate_arr.ctypes.data_as(POINTER(c_double)),
+                                                         n_epochs,
+                                                         epochs.ctypes.data_as(POINTER(c_double)),
+                                                         n_threads,
+                                                         outstate.ctypes.data_as(POINTER(c_double)))
+    if return_value == 0:
+        raise RuntimeError("integration failed; epochs must be sorted in the direction of integration and not precede tstart (see stderr)")
+
+    return outstate
+
+def integration_function_spk(path,
+                             tstart, tstep, trange,
+                             geocentric,
+                             n_particles,
+                             instate_arr,
+                             record_length, n_coefficients,
+                             codes=None):
+
+    _integration_function_spk = rebx_lib.integration_function_spk
+    _integration_function_spk.argtypes = (c_char_p,
+                                          c_double, c_double, c_double,
+                                          c_int,
+                                          c_int,
+                                          POINTER(c_double),
+                                          POINTER(c_int),
+                                          c_double,
+                                          c_int)
+
+    _integration_function_spk.restype = c_int
+
+    if codes is not None:
+        codes = np.ascontiguousarray(codes, dtype=np.int32)
+        codes_ptr = codes.ctypes.data_as(POINTER(c_int))
+    else:
+        codes_ptr = None
+
+    return_value = _integration_function_spk(path.encode('ascii'),
+                                             tstart, tstep, trange, geocentric,
+                                             n_particles,
+                                             instate_arr.ctypes.data_as(POINTER(c_double)),
+                                             codes_ptr,
+                                             record_length, n_coefficients)
+    if return_value == 0:
+        raise RuntimeError("could not write SPK file {0}".format(path))
+
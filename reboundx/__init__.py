@@ -41,8 +41,8 @@ def params(self):
 rebound.Particle.params = params
 
 from .extras import Extras, Param, Node, Force, Operator, integrators
-from .simulationarchive import SimulationArchive
+from .simulationarchive import SimulationArchive, ExtrasArchive
 from .tools import coordinates, install_test
 from .params import Params
 
-__all__ = ["__version__", "__build__", "__githash__", "Extras", "SimulationArchive", "Param", "Params", "coordinates", "integrators"]
+__all__ = ["__version__", "__build__", "__githash__", "Extras", "SimulationArchive", "ExtrasArchive", "Param", "Params", "coordinates", "integrators"]
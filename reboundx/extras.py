@@ -1,10 +1,12 @@
 from . import clibreboundx
-from ctypes import Structure, c_double, POINTER, c_int, c_uint, c_long, c_ulong, c_void_p, c_char_p, CFUNCTYPE, byref, c_uint32, c_uint, cast, c_char
+from ctypes import Structure, c_double, POINTER, c_int, c_uint, c_long, c_ulong, c_void_p, c_char_p, CFUNCTYPE, byref, c_uint32, c_uint, cast, c_char, c_size_t
 import rebound
 import reboundx
 import warnings
+import os
+import numpy as np
 
-integrators = {"implicit_midpoint": 0, "rk4":1, "euler": 2, "rk2": 3, "none": -1}
+integrators = {"implicit_midpoint": 0, "rk4":1, "euler": 2, "rk2": 3, "rk45": 4, "none": -1}
 
 REBX_TIMING = {"pre":-1, "post":1}
 REBX_FORCE_TYPE = {"none":0, "pos":1, "vel":2}
@@ -36,11 +38,21 @@ class Extras(Structure):
     The fastest way to understand it is to follow the examples at :ref:`ipython_examples`.  
     """
     
-    def __new__(cls, sim, filename=None):
+    def __new__(cls, sim, filename=None, snapshot=None):
         rebx = super(Extras,cls).__new__(cls)
         return rebx
 
-    def __init__(self, sim, filename=None):
+    def __init__(self, sim, filename=None, snapshot=None):
+        """
+        Arguments
+        ---------
+        sim : rebound.Simulation
+            Simulation to attach to.
+        filename : str or reboundx.ExtrasArchive, optional
+            Binary (or archive) to load effects and parameters from.
+        snapshot : int, optional
+            Index of the snapshot to load from an archive written with simulationarchive_snapshot. Negative values count back from the last one.
+        """
         sim._extras_ref = self # add a reference to this instance in sim to make sure it's not garbage collected_ 
         clibreboundx.rebx_initialize(byref(sim), byref(self))
         # Create simulation
@@ -51,7 +63,13 @@ class Extras(Structure):
             # Recreate existing simulation.
             # Load registered parameters from binary
             w = c_int(0)
-            clibreboundx.rebx_init_extras_from_binary(byref(self), c_char_p(filename.encode('ascii')), byref(w))
+            if snapshot is None and isinstance(filename, str):
+                clibreboundx.rebx_init_extras_from_binary(byref(self), c_char_p(filename.encode('ascii')), byref(w))
+            else:
+                from .simulationarchive import ExtrasArchive
+                archive = filename if isinstance(filename, ExtrasArchive) else ExtrasArchive(filename)
+                buf, size, offset = archive._image(snapshot if snapshot is not None else 0)
+                clibreboundx.rebx_init_extras_from_archive(byref(self), buf, c_size_t(size), c_long(offset), byref(w))
             for majorerror, value, message in REBX_BINARY_WARNINGS:
                 if w.value & value:
                     if majorerror:
@@ -64,6 +82,19 @@ class Extras(Structure):
         if self._b_needsfree_ == 1:
             clibreboundx.rebx_free_pointers(byref(self))
 
+    def copy(self, sim):
+        """
+        Returns a deep copy of all effects and parameters attached to sim, which must have the same
+        number of particles (e.g. sim = self's simulation.copy()). Faster than saving and loading a
+        binary when spawning many copies of a configured simulation.
+        """
+        rebx = Extras.__new__(Extras, sim)
+        sim._extras_ref = rebx
+        clibreboundx.rebx_initialize(byref(sim), byref(rebx))
+        clibreboundx.rebx_init_extras_from_copy(byref(rebx), byref(self))
+        rebx.process_messages()
+        return rebx
+
     def detach(self, sim):
         sim._extras_ref = None # remove reference to rebx so it can be garbage collected 
         clibreboundx.rebx_detach(byref(sim), byref(self))
@@ -77,6 +108,53 @@ class Extras(Structure):
         clibreboundx.rebx_register_param(byref(self), c_char_p(name.encode('ascii')), c_int(type_enum))
         self.process_messages()
 
+    def set_particle_params(self, name, values, indices=None):
+        """
+        Sets the double or int param name on many particles in one call, e.g. rebx.set_particle_params("beta", betas).
+        values[k] goes on particle indices[k], or on particle k if indices is None. Much faster than setting
+        particle.params[name] in a loop over a large number of particles.
+        """
+        ctype, dtype = self._param_array_type(name)
+        values = np.ascontiguousarray(values, dtype=dtype)
+        indices = self._param_array_indices(indices, len(values))
+        func = clibreboundx.rebx_set_param_double_array if ctype == c_double else clibreboundx.rebx_set_param_int_array
+        iptr = None if indices is None else indices.ctypes.data_as(POINTER(c_int))
+        func(byref(self), c_char_p(name.encode('ascii')), values.ctypes.data_as(POINTER(ctype)), iptr, c_int(len(values)))
+        self.process_messages()
+
+    def get_particle_params(self, name, indices=None, default=None):
+        """
+        Returns a NumPy array with the double or int param name of particles indices (all particles if None).
+        Particles without the param get default (NaN for double params and 0 for int params if None).
+        """
+        ctype, dtype = self._param_array_type(name)
+        N = self._sim.contents.N if indices is None else len(indices)
+        if default is None:
+            default = np.nan if ctype == c_double else 0
+        values = np.full(N, default, dtype=dtype)
+        indices = self._param_array_indices(indices, N)
+        func = clibreboundx.rebx_get_param_double_array if ctype == c_double else clibreboundx.rebx_get_param_int_array
+        iptr = None if indices is None else indices.ctypes.data_as(POINTER(c_int))
+        func(byref(self), c_char_p(name.encode('ascii')), values.ctypes.data_as(POINTER(ctype)), iptr, c_int(N))
+        self.process_messages()
+        return values
+
+    def _param_array_type(self, name):
+        ctype = REBX_CTYPES[clibreboundx.rebx_get_type(byref(self), c_char_p(name.encode('ascii')))]
+        if ctype == c_double:
+            return c_double, np.float64
+        if ctype == c_int:
+            return c_int, np.intc
+        raise AttributeError("REBOUNDx Error: Parameter '{0}' must be registered as a double or int param for bulk access.".format(name))
+
+    def _param_array_indices(self, indices, N):
+        if indices is None:
+            return None
+        indices = np.ascontiguousarray(indices, dtype=np.intc)
+        if len(indices) != N:
+            raise ValueError("REBOUNDx Error: values and indices must have the same length.")
+        return indices
+
     def load_force(self, name):
         clibreboundx.rebx_load_force.restype = POINTER(Force)
         ptr = clibreboundx.rebx_load_force(byref(self), c_char_p(name.encode('ascii')))
@@ -117,6 +195,18 @@ class Extras(Structure):
             clibreboundx.rebx_add_operator_step(byref(self), byref(operator), c_double(dtfraction), c_int(timingint))
         self.process_messages()
 
+    def add_splitting_scheme(self, scheme, A, B, timing="pre"):
+        """
+        Adds the steps of a splitting scheme alternating between operators A and B, starting and
+        ending with A, e.g. rebx.add_splitting_scheme("saba4", kepler, interaction). Options are
+        leapfrog, yoshida4, yoshida6 and saba1 to saba4.
+        """
+        if not isinstance(A, reboundx.extras.Operator) or not isinstance(B, reboundx.extras.Operator):
+            raise TypeError("REBOUNDx Error: Objects passed to rebx.add_splitting_scheme are not reboundx.Operator instances.")
+        timingint = REBX_TIMING[timing]
+        clibreboundx.rebx_add_splitting_scheme(byref(self), c_char_p(scheme.encode('ascii')), byref(A), byref(B), c_int(timingint))
+        self.process_messages()
+
     def get_force(self, name):
         clibreboundx.rebx_get_force.restype = POINTER(Force)
         ptr = clibreboundx.rebx_get_force(byref(self), c_char_p(name.encode('ascii')))
@@ -148,6 +238,40 @@ class Extras(Structure):
         if not success:
             raise AttributeError("REBOUNDx Error: Operator {0} passed to rebx.remove_operator not found in simulation.")
 
+    #######################################
+    # Profiling
+    #######################################
+    @property
+    def profiling(self):
+        """
+        If True, every force and operator call made by REBOUNDx is counted and timed (see profiles).
+        """
+        return bool(self._profiling)
+
+    @profiling.setter
+    def profiling(self, value):
+        clibreboundx.rebx_enable_profiling(byref(self), c_int(1 if value else 0))
+
+    @property
+    def profiles(self):
+        """
+        Dictionary mapping the names of all forces and operators created with this instance to their Profile.
+        The shared sweep of forces with the "fused" parameter set is listed under "fused".
+        """
+        profiles = {}
+        for head, cls in [(self._allocated_forces, Force), (self._allocated_operators, Operator)]:
+            node = head
+            while node:
+                obj = cast(node.contents.object, POINTER(cls)).contents
+                profiles[obj.name.decode('ascii')] = obj.profile
+                node = node.contents.next
+        if self._fused_profile.N_calls > 0:
+            profiles["fused"] = self._fused_profile
+        return profiles
+
+    def reset_profiles(self):
+        clibreboundx.rebx_reset_profiles(byref(self))
+
     #######################################
     # Input/Output Routines
     #######################################
@@ -158,6 +282,17 @@ class Extras(Structure):
         clibreboundx.rebx_output_binary(byref(self), c_char_p(filename.encode("ascii")))
         self.process_messages()
 
+    def simulationarchive_snapshot(self, filename, deletefile=False):
+        """
+        Appends a snapshot of all effects and parameters to an archive, to go alongside
+        sim.simulationarchive_snapshot. Snapshots after the first only store the particle
+        parameters that changed. Load them with reboundx.SimulationArchive.
+        """
+        if deletefile and os.path.isfile(filename):
+            os.remove(filename)
+        clibreboundx.rebx_output_archive_snapshot(byref(self), c_char_p(filename.encode("ascii")))
+        self.process_messages()
+
     #######################################
     # Convenience Functions
     #######################################
@@ -212,11 +347,23 @@ class Extras(Structure):
 #################################################
 
 
+class Profile(Structure):
+    """
+    Counters for a force or operator, accumulated while rebx.profiling is True.
+    """
+    _fields_ = [("N_calls", c_ulong),
+                ("walltime", c_double),
+                ("N_particles", c_ulong)]
+
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, N_calls={3}, walltime={4}, N_particles={5}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.N_calls, self.walltime, self.N_particles)
+
 class Param(Structure): # need to define fields afterward because of circular ref in linked list
     pass    
 Param._fields_ =  [ ("name", c_char_p),
                     ("type", c_int),
-                    ("value", c_void_p)]
+                    ("value", c_void_p),
+                    ("key", c_int)]
 
 class Node(Structure): # need to define fields afterward because of circular ref in linked list
     pass    
@@ -249,13 +396,18 @@ class Operator(Structure):
         params = Params(self)
         return params
 
+    @property
+    def profile(self):
+        return self._profile
+
 STEPFUNCPTR = CFUNCTYPE(None, POINTER(rebound.Simulation), POINTER(Operator), c_double)
 
 Operator._fields_ = [   ("name", c_char_p),
                         ("ap", POINTER(Node)),
                         ("_sim", POINTER(rebound.Simulation)),
                         ("_operator_type", c_int),
-                        ("_step_function", STEPFUNCPTR)]
+                        ("_step_function", STEPFUNCPTR),
+                        ("_profile", Profile)]
 class Force(Structure):
     @property
     def force_type(self):
@@ -279,13 +431,23 @@ class Force(Structure):
         params = Params(self)
         return params
 
+    @property
+    def profile(self):
+        return self._profile
+
 FORCEFUNCPTR = CFUNCTYPE(None, POINTER(rebound.Simulation), POINTER(Force), POINTER(rebound.Particle), c_int)
 
 Force._fields_ = [  ("name", c_char_p),
                     ("ap", POINTER(Node)),
                     ("_sim", POINTER(rebound.Simulation)),
                     ("_force_type", c_int),
-                    ("_update_accelerations", FORCEFUNCPTR)]
+                    ("_update_accelerations", FORCEFUNCPTR),
+                    ("_profile", Profile)]
+
+class DispatchTable(Structure):
+    _fields_ = [("_entries", c_void_p),
+                ("_N", c_int),
+                ("_N_updaters", c_int)]
 
 # Need to put fields after class definition because of self-referencing
 Extras._fields_ =  [("_sim", POINTER(rebound.Simulation)),
@@ -294,7 +456,23 @@ Extras._fields_ =  [("_sim", POINTER(rebound.Simulation)),
                     ("_post_timestep_modifications", POINTER(Node)),
                     ("_registered_params", POINTER(Node)),
                     ("_allocated_forces", POINTER(Node)),
-                    ("_allocated_operators", POINTER(Node))]
+                    ("_allocated_operators", POINTER(Node)),
+                    ("_param_keys", POINTER(POINTER(Param))),
+                    ("_N_param_keys", c_int),
+                    ("_N_allocated_param_keys", c_int),
+                    ("_param_key_hash", POINTER(c_int)),
+                    ("_N_param_key_hash", c_int),
+                    ("_param_generation", c_ulong),
+                    ("_particle_lists", c_void_p),
+                    ("_N_particle_lists", c_int),
+                    ("_arena", c_void_p),
+                    ("_force_table", DispatchTable),
+                    ("_pre_table", DispatchTable),
+                    ("_post_table", DispatchTable),
+                    ("_profiling", c_int),
+                    ("_fused_profile", Profile),
+                    ("_copied_values", POINTER(Node)),
+                    ("_var_order_warned", c_int)]
 
 # This list keeps pairing from C rebx_param_type enum to ctypes type 1-to-1. Derive the required mappings from it
 REBX_C_TO_CTYPES = [["REBX_TYPE_NONE", None], ["REBX_TYPE_DOUBLE", c_double], ["REBX_TYPE_INT",c_int], ["REBX_TYPE_POINTER", c_void_p], ["REBX_TYPE_FORCE", Force], ["REBX_TYPE_UNIT32", c_uint32], ["REBX_TYPE_ORBIT", rebound.Orbit]]
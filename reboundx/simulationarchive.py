@@ -1,5 +1,126 @@
 import rebound
 import reboundx
+import math
+import struct
+from ctypes import Structure, c_double, c_int, c_long, sizeof, create_string_buffer
+
+class _Field(Structure):
+    _fields_ = [("type", c_int),
+                ("size", c_long)]
+
+_HEADER_SIZE = 64
+_FIELD_SNAPSHOT = 26
+_FIELD_SNAPSHOT_DIFF = 31
+_FIELD_SNAPSHOT_TIME = 32
+_FIELD_KEYFRAME_OFFSET = 33
+_FIELD_END = 8
+
+def _read_field(f):
+    data = f.read(sizeof(_Field))
+    if len(data) < sizeof(_Field):
+        return None
+    return _Field.from_buffer_copy(data)
+
+class ExtrasArchive(object):
+    """
+    REBOUNDx archive written with rebx.simulationarchive_snapshot (a binary from rebx.save also works, as a single snapshot).
+    Only the snapshot headers are read to index the file. Loading a snapshot then reads just that snapshot and the full one it refers to.
+    """
+    def __init__(self, filename):
+        """
+        Arguments
+        ---------
+        filename : str
+            Filename of the REBOUNDx archive.
+        """
+        self.filename = filename
+        self.times = []
+        self.offsets = []
+        self.ends = []
+        self.keyframe_positions = []    # file position of a diff's keyframe offset, None for full snapshots
+        try:
+            with open(filename, 'rb') as f:
+                f.seek(0, 2)
+                size = f.tell()
+                offset = _HEADER_SIZE
+                while offset < size:
+                    f.seek(offset)
+                    field = _read_field(f)
+                    if field is None or field.type not in (_FIELD_SNAPSHOT, _FIELD_SNAPSHOT_DIFF):
+                        break
+                    end = offset + sizeof(_Field) + field.size
+                    if field.size < 0 or end > size: # truncated, e.g. a write was interrupted
+                        break
+                    self._index(f, field.type, offset, end)
+                    offset = end
+        except (IOError, OSError):
+            raise RuntimeError(reboundx.extras.REBX_BINARY_WARNINGS[0][2])
+
+    def _index(self, f, snapshot_type, offset, end):
+        # Snapshots written with rebx.save don't have a time
+        t = float('nan')
+        keyframe_position = None
+        position = offset + sizeof(_Field)
+        while position + sizeof(_Field) <= end:
+            f.seek(position)
+            field = _read_field(f)
+            position += sizeof(_Field)
+            if field.type == _FIELD_SNAPSHOT_TIME and field.size == sizeof(c_double):
+                t = struct.unpack('d', f.read(sizeof(c_double)))[0]
+            elif field.type == _FIELD_KEYFRAME_OFFSET and field.size == sizeof(c_long):
+                keyframe_position = position
+            if snapshot_type == _FIELD_SNAPSHOT or keyframe_position is not None or field.type == _FIELD_END or field.size < 0:
+                break
+            position += field.size
+        self.times.append(t)
+        self.offsets.append(offset)
+        self.ends.append(end)
+        self.keyframe_positions.append(keyframe_position)
+
+    def __len__(self):
+        return len(self.offsets)
+
+    def snapshot_at(self, t):
+        """
+        Returns the index of the last snapshot at or before time t. Snapshots without a time (binaries from rebx.save) match any time.
+        """
+        index = 0
+        for i, ti in enumerate(self.times):
+            if not math.isnan(ti) and ti <= t:
+                index = i
+        return index
+
+    def _image(self, snapshot):
+        """
+        Returns a buffer holding the file header, the keyframe a diff refers to and the snapshot itself, with the diff's
+        keyframe offset pointing into the buffer, together with the buffer's size and the snapshot's offset in it.
+        """
+        try:
+            with open(self.filename, 'rb') as f:
+                data = bytearray(f.read(_HEADER_SIZE))
+                if not self.offsets:
+                    return create_string_buffer(bytes(data), len(data)), len(data), 0
+                offset, end = self.offsets[snapshot], self.ends[snapshot]
+                keyframe_position = self.keyframe_positions[snapshot]
+                keyframe = -1
+                if keyframe_position is not None:
+                    f.seek(keyframe_position)
+                    keyframe = struct.unpack('l', f.read(sizeof(c_long)))[0]
+                    if keyframe in self.offsets[:snapshot]:
+                        f.seek(keyframe)
+                        keyframe_data = f.read(self.ends[self.offsets.index(keyframe)] - keyframe)
+                        keyframe = len(data)
+                        data += keyframe_data
+                    else:   # left for the loader to report as corrupt
+                        keyframe = -1
+                f.seek(offset)
+                start = len(data)
+                data += f.read(end - offset)
+        except (IOError, OSError):
+            raise RuntimeError(reboundx.extras.REBX_BINARY_WARNINGS[0][2])
+        if keyframe_position is not None:
+            struct.pack_into('l', data, start + keyframe_position - offset, keyframe)
+        return create_string_buffer(bytes(data), len(data)), len(data), start
 
 class SimulationArchive(rebound.SimulationArchive):
     """
@@ -12,18 +133,19 @@ class SimulationArchive(rebound.SimulationArchive):
         filename : str
             Filename of the SimulationArchive file to be opened.
         rebxfilename : str
-            Filename of the REBOUNDx binary file.
+            Filename of the REBOUNDx binary file, or of an archive written with rebx.simulationarchive_snapshot.
         """
         super(SimulationArchive, self).__init__(filename, *args, **kwargs)
         self.rebxfilename = rebxfilename
+        self.rebxarchive = ExtrasArchive(rebxfilename)
         sim, rebx = self[0] # test you can open rebxfilename to warn user if not
 
     def __getitem__(self, key):
         sim = super(SimulationArchive, self).__getitem__(key)
-        rebx = reboundx.Extras(sim, self.rebxfilename)
+        rebx = reboundx.Extras(sim, self.rebxarchive, snapshot=self.rebxarchive.snapshot_at(sim.t))
         return sim, rebx
 
     def getSimulation(self, *args, **kwargs):
         sim = super(SimulationArchive, self).getSimulation(*args, **kwargs)
-        rebx = reboundx.Extras(sim, self.rebxfilename)
+        rebx = reboundx.Extras(sim, self.rebxarchive, snapshot=self.rebxarchive.snapshot_at(sim.t))
         return sim, rebx
@@ -2,6 +2,7 @@ import rebound
 import reboundx
 import unittest
 import os
+from ctypes import c_double
 
 THIS_DIR = os.path.dirname(os.path.abspath(__file__))
 binary = os.path.join(THIS_DIR, 'binaries/twoplanets.bin')
@@ -21,6 +22,25 @@ class TestConservation(unittest.TestCase):
         H = rebx.gr_full_hamiltonian(force)
         self.assertLess(abs((H-H0)/H0), 1.e-12)
     
+    def test_gr_full_threads(self):
+        H = []
+        ps = []
+        for n_threads in [1, 4]:
+            sim = rebound.Simulation(binary)
+            sim.integrator = "ias15"
+            rebx = reboundx.Extras(sim)
+            force = rebx.load_force('gr_full')
+            rebx.add_force(force)
+            force.params['c'] = 1.e4
+            force.params['n_threads'] = n_threads
+            H0 = rebx.gr_full_hamiltonian(force)
+            sim.integrate(1.e4)
+            H.append(rebx.gr_full_hamiltonian(force))
+            self.assertLess(abs((H[-1]-H0)/H0), 1.e-12)
+            ps.append([(p.x, p.y, p.z) for p in sim.particles])
+        self.assertEqual(H[0], H[1])
+        self.assertEqual(ps[0], ps[1])
+    
     def test_gr(self):
         name = 'gr'
         sim = rebound.Simulation(binary)
@@ -95,5 +115,115 @@ class TestConservation(unittest.TestCase):
         H = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
         self.assertLess(abs((H-H0)/H0), 1.e-12)
 
+    def test_gravitational_harmonics_float(self):
+        # J4 terms far below float_tolerance of the point-mass term go through the single precision pass
+        sim = rebound.Simulation(binary)
+        sim.integrator = "ias15"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('gravitational_harmonics')
+        rebx.add_force(force)
+        force.params['float_tolerance'] = 1.e-6
+        ps = sim.particles
+        ps[0].params['J2'] = 1.e-3
+        ps[0].params['J4'] = 1.e-3
+        ps[0].params['R_eq'] = 1.e-3
+        H0 = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
+        sim.integrate(1.e4)
+        H = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
+        self.assertLess(abs((H-H0)/H0), 1.e-12)
+
+    def test_gravitational_harmonics_tilted(self):
+        name = 'gravitational_harmonics'
+        sim = rebound.Simulation(binary)
+        sim.integrator = "ias15"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force(name)
+        rebx.add_force(force)
+        ps = sim.particles
+        ps[0].params['J2'] = 1.e-3
+        ps[0].params['J4'] = 1.e-3
+        ps[0].params['R_eq'] = 1.e-3
+        ps[0].params['pole_ra'] = 0.7
+        ps[0].params['pole_dec'] = 0.4
+        H0 = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
+        sim.integrate(1.e4)
+        H = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
+        self.assertLess(abs((H-H0)/H0), 1.e-12)
+
+    def test_gravitational_harmonics_higher_degree(self):
+        name = 'gravitational_harmonics'
+        sim = rebound.Simulation(binary)
+        sim.integrator = "ias15"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force(name)
+        rebx.add_force(force)
+        ps = sim.particles
+        J_n = (c_double*9)(0., 0., 1.e-3, 1.e-4, 1.e-3, 0., -1.e-4, 0., 1.e-4)
+        C_nm = (c_double*81)()
+        S_nm = (c_double*81)()
+        C_nm[2*9+2] = 1.e-4
+        S_nm[3*9+1] = -1.e-4
+        ps[0].params['R_eq'] = 1.e-3
+        ps[0].params['harmonics_degree'] = 8
+        ps[0].params['J_n'] = J_n
+        ps[0].params['C_nm'] = C_nm
+        ps[0].params['S_nm'] = S_nm
+        ps[0].params['pole_ra'] = 0.7
+        ps[0].params['pole_dec'] = 0.4
+        H0 = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
+        sim.integrate(1.e4)
+        H = sim.calculate_energy() + rebx.gravitational_harmonics_potential()
+        self.assertLess(abs((H-H0)/H0), 1.e-12)
+
+    def test_track_energy_conservative(self):
+        sim = rebound.Simulation(binary)
+        sim.integrator = "ias15"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('gr_potential')
+        rebx.add_force(force)
+        force.params['c'] = 1.e2
+        op = rebx.load_operator('track_energy')
+        rebx.add_operator(op)
+        U0 = rebx.gr_potential_potential(force)
+        sim.integrate(1.e3)
+        U = rebx.gr_potential_potential(force)
+        self.assertAlmostEqual(op.params['energy_offset'], U-U0, delta=1.e-3*abs(U0))
+
+    def test_track_energy_dissipative(self):
+        sim = rebound.Simulation(binary)
+        sim.integrator = "ias15"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('modify_orbits_forces')
+        rebx.add_force(force)
+        sim.particles[1].params['tau_a'] = -1.e4
+        op = rebx.load_operator('track_energy')
+        rebx.add_operator(op)
+        E0 = sim.calculate_energy()
+        sim.integrate(1.e3)
+        E = sim.calculate_energy()
+        self.assertLess(abs(E + op.params['energy_offset'] - E0), 1.e-3*abs(E-E0))
+
+    def test_track_energy_untracked(self):
+        # Evaluating the forces for the offset is left out of the force profiles and doesn't touch variational particles
+        def run(track):
+            sim = rebound.Simulation(binary)
+            sim.integrator = "ias15"
+            rebx = reboundx.Extras(sim)
+            force = rebx.load_force('gr')
+            rebx.add_force(force)
+            force.params['c'] = 1.e2
+            var = sim.add_variation()
+            var.vary(1, 'a')
+            if track:
+                rebx.add_operator(rebx.load_operator('track_energy'))
+            rebx.profiling = True
+            sim.integrate(1.e2)
+            return sim, rebx, var
+        sim, rebx, var = run(False)
+        tsim, trebx, tvar = run(True)
+        self.assertEqual(trebx.get_force('gr').profile.N_calls, rebx.get_force('gr').profile.N_calls)
+        self.assertEqual(tvar.particles[1].x, var.particles[1].x)
+        self.assertEqual(tvar.particles[1].ax, var.particles[1].ax)
+
 if __name__ == '__main__':
     unittest.main()
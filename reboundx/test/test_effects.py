@@ -1,6 +1,12 @@
 import rebound
 import reboundx
 import unittest
+import math
+import os
+import warnings
+import sys
+import tempfile
+from ctypes import Structure, POINTER, byref, cast, c_char_p, c_double, c_int, c_void_p
 
 class TestForces(unittest.TestCase):
     def setUp(self):
@@ -26,6 +32,20 @@ class TestForces(unittest.TestCase):
         self.sim.integrate(10)
         self.assertGreater(self.sim.particles[1].pomega, -0.01)
 
+    def test_customforcereassigned(self):
+        cust = self.rebx.create_force('myforce')
+        def myforce(sim, force, particles, N):
+            pass
+        cust.update_accelerations = myforce
+        cust.force_type = 'pos'
+        self.rebx.add_force(cust)
+        calls = []
+        def newforce(sim, force, particles, N):
+            calls.append(N)
+        cust.update_accelerations = newforce
+        self.sim.integrate(10)
+        self.assertGreater(len(calls), 0)
+
     def test_customnoforce(self):
         cust = self.rebx.create_force('myforce')
         cust.force_type = 'pos'
@@ -73,6 +93,41 @@ class TestForces(unittest.TestCase):
         self.rebx.add_force(cust)
         self.rebx.remove_force(gr)
     
+    def test_fusedmatchesunfused(self):
+        # Fused forces sharing a source give the same accelerations as running them one by one, also with a force
+        # between them that reads the accelerations the earlier forces added
+        def run(fused):
+            sim = rebound.Simulation()
+            sim.add(m=1., r=0.01)
+            sim.add(m=1e-4, a=0.1, e=0.2, inc=0.1)
+            sim.add(m=1e-5, a=0.3, e=0.1, inc=0.2)
+            sim.add(a=0.5, e=0.3, inc=0.3)
+            rebx = reboundx.Extras(sim)
+            ps = sim.particles
+            ps[0].params['J2'] = 1e-3
+            ps[0].params['J4'] = 2e-4
+            ps[0].params['R_eq'] = 0.05
+            ps[0].params['R_tides'] = 0.01
+            ps[0].params['k1'] = 0.1
+            ps[0].params['gr_source'] = 1
+            forces = [rebx.load_force(name) for name in ['gr_potential', 'gravitational_harmonics', 'tides_precession']]
+            forces[0].params['c'] = 10.
+            reader = rebx.create_force('reader')
+            def read_accelerations(sim, force, particles, N):
+                sim.contents.particles[3].ax += 0.5*sim.contents.particles[1].ax
+            reader.update_accelerations = read_accelerations
+            reader.force_type = 'pos'
+            for force in forces[:2] + [reader] + forces[2:]:
+                rebx.add_force(force)
+            if fused:
+                for force in forces:
+                    force.params['fused'] = 1
+            sim.integrate(1.)
+            return [(p.x, p.y, p.z) for p in sim.particles]
+        for p, q in zip(run(False), run(True)):
+            for x, y in zip(p, q):
+                self.assertAlmostEqual(x, y, delta=1e-10)
+
     def test_removenonforce(self):
         with self.assertRaises(TypeError):
             self.rebx.remove_force(self.sim)
@@ -106,6 +161,19 @@ class TestOperators(unittest.TestCase):
         self.sim.integrate(10)
         self.assertGreater(self.sim.particles[1].pomega, 1.e-3)
 
+    def test_customoperatorreassigned(self):
+        cust = self.rebx.create_operator('myoperator')
+        def mystep(sim, operator, dt):
+            pass
+        cust.step_function = mystep
+        cust.operator_type = 'updater'
+        self.rebx.add_operator(cust)
+        def newstep(sim, operator, dt):
+            sim.contents.particles[1].x += 1.e-4
+        cust.step_function = newstep
+        self.sim.integrate(10)
+        self.assertGreater(self.sim.particles[1].pomega, 1.e-3)
+
     def test_customopnostep(self):
         cust = self.rebx.create_operator('myoperator')
         cust.operator_type = 'updater'
@@ -137,6 +205,35 @@ class TestOperators(unittest.TestCase):
         with self.assertRaises(AttributeError):
             mm = self.rebx.get_operator('modify_mass')
     
+    def test_modifymassexact(self):
+        self.sim.integrator = "whfast"
+        self.sim.dt = 0.1
+        self.sim.move_to_com()
+        mm = self.rebx.load_operator('modify_mass')
+        mm.params['exact_mass_update'] = 1
+        self.rebx.add_operator(mm)
+        self.sim.particles[0].params['tau_mass'] = -2.
+        self.sim.integrate(3.)
+        self.assertAlmostEqual(self.sim.particles[0].m, math.exp(-self.sim.t/2.), delta=1.e-12)
+        com = self.sim.calculate_com()
+        self.assertAlmostEqual(com.x, 0., delta=1.e-14)
+        self.assertAlmostEqual(com.vx, 0., delta=1.e-14)
+
+    def test_modifymassincremental(self):
+        # Only the COM shift from the mass changes is removed, with the total mass tracked from the same changes
+        self.sim.integrator = "whfast"
+        self.sim.dt = 0.1
+        mm = self.rebx.load_operator('modify_mass')
+        mm.params['incremental_com'] = 1
+        self.rebx.add_operator(mm)
+        self.sim.particles[0].params['tau_mass'] = -2.
+        self.sim.integrate(3.)
+        M = sum(p.m for p in self.sim.particles)
+        self.assertAlmostEqual(mm.params['recentered_mass'], M, delta=1.e-14)
+        com = self.sim.calculate_com()
+        self.assertAlmostEqual(com.x, 0., delta=1.e-14)
+        self.assertAlmostEqual(com.vx, 0., delta=1.e-14)
+
     def test_removeoperator(self):
         mm = self.rebx.load_operator('modify_mass')
         self.rebx.add_operator(mm)
@@ -230,6 +327,922 @@ class TestAddOperator(unittest.TestCase):
         self.sim.step()
         self.assertEqual(self.cust.params['ctr'], 1)
 
+class TestSplittingScheme(unittest.TestCase):
+    def energy_error(self, scheme, Aname, Bname, planets, dt, tmax):
+        sim = rebound.Simulation()
+        sim.integrator = 'none'
+        sim.dt = dt
+        sim.add(m=1.)
+        for p in planets:
+            sim.add(**p)
+        sim.move_to_com()
+        rebx = reboundx.Extras(sim)
+        A = rebx.load_operator(Aname)
+        B = rebx.load_operator(Bname)
+        rebx.add_splitting_scheme(scheme, A, B)
+        E0 = sim.calculate_energy()
+        err = 0.
+        for i in range(int(round(tmax/dt))):
+            sim.step()
+            err = max(err, abs((sim.calculate_energy()-E0)/E0))
+        return err
+
+    def order(self, scheme, Aname, Bname, planets, dt, tmax):
+        err = self.energy_error(scheme, Aname, Bname, planets, dt, tmax)
+        return err, math.log(err/self.energy_error(scheme, Aname, Bname, planets, dt/2., tmax), 2.)
+
+    def test_compositionorders(self):
+        # Drift and kick on a Kepler orbit. Yoshida's compositions merge the A half steps of neighbouring leapfrogs
+        planets = [{'m':1e-3, 'a':1., 'e':0.1, 'inc':0.1}]
+        for scheme, expected in [('leapfrog', 2), ('yoshida4', 4), ('yoshida6', 6)]:
+            err, order = self.order(scheme, 'drift', 'kick', planets, 2.*math.pi/50., 2.*math.pi)
+            self.assertGreater(order, expected - 0.5, msg=scheme)
+
+    def test_sabaorders(self):
+        # SABAn has an error of order eps dt^2n + eps^2 dt^2, so the Kepler and interaction splitting of a weakly
+        # perturbed orbit shows its order n
+        planets = [{'m':1e-5, 'a':1., 'e':0.05, 'inc':0.1}, {'m':1e-5, 'a':3., 'e':0.05}]
+        errs = []
+        for n in range(1, 5):
+            err, order = self.order('saba{0}'.format(n), 'kepler', 'interaction', planets, 2.*math.pi/20., 4.*math.pi)
+            if n < 4:
+                self.assertGreater(order, 2*n - 1, msg='saba{0}'.format(n))
+            errs.append(err)
+        self.assertLess(errs[3], errs[2])
+
+    def counted_steps(self, scheme, same):
+        sim = rebound.Simulation()
+        sim.integrator = 'none'
+        sim.dt = 0.1
+        sim.add(m=1.)
+        sim.add(a=1.)
+        rebx = reboundx.Extras(sim)
+        rebx.register_param('ctr', 'REBX_TYPE_INT')
+        def mystep(sim, operator, dt):
+            operator.contents.params['ctr'] += 1
+        ops = []
+        for name in ['A', 'B']:
+            op = rebx.create_operator(name)
+            op.params['ctr'] = 0
+            op.step_function = mystep
+            op.operator_type = 'updater'
+            ops.append(op)
+        A, B = ops
+        rebx.add_splitting_scheme(scheme, A, A if same else B)
+        sim.step()
+        return A.params['ctr'], B.params['ctr']
+
+    def test_mergedsteps(self):
+        # yoshida4 is three leapfrogs whose touching A half steps merge into A B A B A B A
+        self.assertEqual(self.counted_steps('yoshida4', False), (4, 3))
+        self.assertEqual(self.counted_steps('yoshida6', False), (8, 7))
+        self.assertEqual(self.counted_steps('saba3', False), (4, 3))
+        # With the same operator for A and B every step merges into one
+        self.assertEqual(self.counted_steps('saba4', True), (1, 0))
+
+    def test_unknownscheme(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        rebx = reboundx.Extras(sim)
+        A = rebx.load_operator('drift')
+        B = rebx.load_operator('kick')
+        with self.assertRaises(RuntimeError):
+            rebx.add_splitting_scheme('yoshida8', A, B)
+
+class TestImplicitMidpoint(unittest.TestCase):
+    def make_sim(self, gamma, params):
+        # Only the operator moves the particles, so one step is one implicit midpoint solve for the damping force
+        sim = rebound.Simulation()
+        sim.integrator = 'none'
+        sim.dt = 0.1
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1., e=0.1, inc=0.1)
+        rebx = reboundx.Extras(sim)
+        self.calls = 0
+        damping = rebx.create_force('damping')
+        def damp(sim, force, particles, N):
+            self.calls += 1
+            for i in range(N):
+                p = particles[i]
+                p.ax += -gamma*p.vx
+                p.ay += -gamma*p.vy + 0.01*p.vx*p.vx
+                p.az += -gamma*p.vz
+        damping.update_accelerations = damp
+        damping.force_type = 'vel'
+        op = rebx.load_operator('integrate_force')
+        op.params['force'] = damping
+        op.params['integrator'] = reboundx.integrators['implicit_midpoint']
+        for name, value in params.items():
+            op.params[name] = value
+        rebx.add_operator(op, dtfraction=1., timing='post')
+        return sim, rebx, damp
+
+    def fixed_iterations(self, gamma):
+        # The previous implementation: at most 10 plain iterations on the midpoint velocities
+        sim, rebx, damp = self.make_sim(gamma, {})
+        dt = sim.dt
+        v0 = [(p.vx, p.vy, p.vz) for p in sim.particles]
+        ps = [p.copy() for p in sim.particles]
+        vf = list(v0)
+        for n in range(10):
+            prev = vf
+            for p in ps:
+                p.ax = p.ay = p.az = 0.
+            damp(None, None, ps, len(ps))
+            vf = [(v[0] + dt*p.ax, v[1] + dt*p.ay, v[2] + dt*p.az) for v, p in zip(v0, ps)]
+            tot2 = 0.
+            deltatot2 = 0.
+            for v, w in zip(vf, prev):
+                dvx, dvy, dvz = v[0] - w[0], v[1] - w[1], v[2] - w[2]
+                deltatot2 += dvx*dvx + dvy*dvy + dvz*dvz
+                tot2 += v[0]*v[0] + v[1]*v[1] + v[2]*v[2]
+            if deltatot2/tot2 < sys.float_info.epsilon**2:
+                break
+            for p, v, w in zip(ps, v0, vf):
+                p.vx, p.vy, p.vz = 0.5*(v[0] + w[0]), 0.5*(v[1] + w[1]), 0.5*(v[2] + w[2])
+        return vf
+
+    def test_depthzeroreproducesfixediterations(self):
+        for gamma in [0.5, 16.]:
+            expected = self.fixed_iterations(gamma)
+            for params in [{}, {'im_anderson_depth':0, 'im_max_iterations':10}]:
+                sim, rebx, damp = self.make_sim(gamma, params)
+                with warnings.catch_warnings():
+                    warnings.simplefilter("ignore")
+                    sim.step()
+                for p, v in zip(sim.particles, expected):
+                    self.assertEqual((p.vx, p.vy, p.vz), v)
+
+    def test_andersonfewercalls(self):
+        # gamma*dt/2 = 0.8, so the plain iteration only contracts slowly
+        results = []
+        calls = []
+        for depth in [0, 3]:
+            sim, rebx, damp = self.make_sim(16., {'im_anderson_depth':depth, 'im_max_iterations':200, 'im_tolerance':1e-12})
+            for i in range(20):
+                sim.step()
+            results.append([(p.vx, p.vy, p.vz) for p in sim.particles])
+            calls.append(self.calls)
+        self.assertLess(2*calls[1], calls[0])
+        for p, q in zip(results[0], results[1]):
+            for x, y in zip(p, q):
+                self.assertAlmostEqual(x, y, delta=1e-10)
+
+class TestGRSimAccelerations(unittest.TestCase):
+    def make_sim(self, use_sim_accelerations):
+        sim = rebound.Simulation()
+        sim.integrator = 'ias15'
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1., e=0.3, inc=0.1)
+        sim.move_to_com()
+        rebx = reboundx.Extras(sim)
+        gr = rebx.load_force('gr')
+        gr.params['c'] = 10.
+        if use_sim_accelerations:
+            gr.params['use_sim_accelerations'] = 1
+        rebx.add_force(gr)
+        return sim, rebx, gr
+
+    def check_force(self, softening=0., gravity=None):
+        # Hand gr the two body accelerations REBOUND would have computed with these settings. Unless they are the
+        # unsoftened Newtonian ones, gr must ignore them and give the same correction as recomputing them
+        sim, rebx, gr = self.make_sim(1)
+        ref, refrebx, refgr = self.make_sim(0)
+        sim.softening = softening
+        p0, p1 = sim.particles[0], sim.particles[1]
+        dx, dy, dz = p1.x - p0.x, p1.y - p0.y, p1.z - p0.z
+        r3 = (dx*dx + dy*dy + dz*dz + softening*softening)**1.5
+        newton = [[p1.m*dx/r3, p1.m*dy/r3, p1.m*dz/r3], [-p0.m*dx/r3, -p0.m*dy/r3, -p0.m*dz/r3]]
+        if gravity is not None:
+            sim.gravity = gravity
+            if gravity == 'none':
+                newton = [[0., 0., 0.], [0., 0., 0.]]
+        for p, a in zip(sim.particles, newton):
+            p.ax, p.ay, p.az = a
+        gr.update_accelerations(byref(sim), byref(gr), sim._particles, sim.N)
+        for p in ref.particles:
+            p.ax, p.ay, p.az = 0., 0., 0.
+        refgr.update_accelerations(byref(ref), byref(refgr), ref._particles, ref.N)
+        for p, q, a in zip(sim.particles, ref.particles, newton):
+            self.assertNotEqual(q.ax, 0.)
+            for got, expected, n in zip([p.ax, p.ay, p.az], [q.ax, q.ay, q.az], a):
+                self.assertLess(abs(got - n - expected), 1.e-12*abs(expected) + 1.e-16)
+
+    def test_force(self):
+        self.check_force()
+        self.check_force(gravity='compensated')
+
+    def test_fallback(self):
+        self.check_force(softening=0.2)
+        self.check_force(gravity='none')
+
+    def test_integrate(self):
+        sim, rebx, gr = self.make_sim(1)
+        ref, refrebx, refgr = self.make_sim(0)
+        sim.integrate(30.)
+        ref.integrate(30.)
+        self.assertGreater(abs(ref.particles[1].pomega), 1.e-3)
+        for p, q in zip(sim.particles, ref.particles):
+            self.assertLess(abs(p.x - q.x), 1.e-9)
+            self.assertLess(abs(p.y - q.y), 1.e-9)
+            self.assertLess(abs(p.z - q.z), 1.e-9)
+
+class TestGRFullThreads(unittest.TestCase):
+    def make_sim(self, n_threads):
+        sim = rebound.Simulation()
+        sim.integrator = 'ias15'
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=0.5, e=0.2)
+        sim.add(m=3.e-4, a=0.9, e=0.1, inc=0.2)
+        sim.add(m=1.e-3, a=1.4, e=0.05, inc=0.1, Omega=1.)
+        sim.add(m=5.e-4, a=2.2, e=0.3, omega=2.)
+        sim.move_to_com()
+        rebx = reboundx.Extras(sim)
+        gr = rebx.load_force('gr_full')
+        gr.params['c'] = 30.
+        gr.params['n_threads'] = n_threads
+        rebx.add_force(gr)
+        return sim, rebx, gr
+
+    def newtonian(self, ps):
+        acc = [[0., 0., 0.] for p in ps]
+        for i in range(len(ps)):
+            for j in range(len(ps)):
+                if j != i:
+                    d = [ps[j].x - ps[i].x, ps[j].y - ps[i].y, ps[j].z - ps[i].z]
+                    r3 = (d[0]*d[0] + d[1]*d[1] + d[2]*d[2])**1.5
+                    for k in range(3):
+                        acc[i][k] += ps[j].m*d[k]/r3
+        return acc
+
+    def baseline(self, ps, a_newton, C2):
+        # The pre-workspace gr_full, with the potential sums recomputed inside the pair loop
+        N = len(ps)
+        x = [[p.x, p.y, p.z] for p in ps]
+        v = [[p.vx, p.vy, p.vz] for p in ps]
+        m = [p.m for p in ps]
+        dr = [[[x[i][k] - x[j][k] for k in range(3)] for j in range(N)] for i in range(N)]
+        rs = [[math.sqrt(sum(c*c for c in dr[i][j])) for j in range(N)] for i in range(N)]
+        dot = lambda a, b: a[0]*b[0] + a[1]*b[1] + a[2]*b[2]
+        a_const = []
+        for i in range(N):
+            ac = [0., 0., 0.]
+            for j in range(N):
+                if j != i:
+                    a1 = sum(4./C2*m[k]/rs[i][k] for k in range(N) if k != i)
+                    a2 = sum(1./C2*m[l]/rs[l][j] for l in range(N) if l != j)
+                    factor1 = a1 + a2 - dot(v[i], v[i])/C2 - 2.*dot(v[j], v[j])/C2 + 4./C2*dot(v[i], v[j]) + 1.5/C2*dot(dr[i][j], v[j])**2/rs[i][j]**2
+                    factor2 = dot(dr[i][j], [4.*v[i][k] - 3.*v[j][k] for k in range(3)])
+                    rij3 = rs[i][j]**3
+                    for k in range(3):
+                        ac[k] += m[j]*dr[i][j][k]*factor1/rij3 + m[j]*factor2*(v[i][k] - v[j][k])/rij3/C2
+            a_const.append(ac)
+        a_new = [[0., 0., 0.] for i in range(N)]
+        for it in range(10):
+            a_old = a_new
+            a_new = []
+            for i in range(N):
+                nc = [0., 0., 0.]
+                for j in range(N):
+                    if j != i:
+                        aj = [a_newton[j][k] + a_old[j][k] for k in range(3)]
+                        for k in range(3):
+                            nc[k] += m[j]*dr[i][j][k]/rs[i][j]**3*dot(dr[i][j], aj)/(2.*C2) + 3.5/C2*m[j]*aj[k]/rs[i][j]
+                a_new.append([a_const[i][k] + nc[k] for k in range(3)])
+        return a_new
+
+    def corrections(self, n_threads):
+        sim, rebx, gr = self.make_sim(n_threads)
+        newton = self.newtonian(sim.particles)
+        for p, a in zip(sim.particles, newton):
+            p.ax, p.ay, p.az = a
+        with warnings.catch_warnings():
+            warnings.simplefilter('ignore')
+            gr.update_accelerations(byref(sim), byref(gr), sim._particles, sim.N)
+        return [[p.ax - a[0], p.ay - a[1], p.az - a[2]] for p, a in zip(sim.particles, newton)], sim, newton
+
+    def test_matchesbaseline(self):
+        acc1, sim, newton = self.corrections(1)
+        acc4, sim4, newton4 = self.corrections(4)
+        expected = self.baseline(sim.particles, newton, 30.**2)
+        self.assertGreater(abs(expected[1][0]), 1.e-4)
+        for a1, a4, e in zip(acc1, acc4, expected):
+            self.assertEqual(a1, a4)
+            for got, ref in zip(a1, e):
+                self.assertLess(abs(got - ref), 1.e-10*abs(ref) + 1.e-14)
+
+class TestHarmonicsOffload(unittest.TestCase):
+    # The offloaded J2 sweep must give the host accelerations, including the back reaction on a massive source.
+    # Without a device (or an offload build) it falls back to the host with a warning, so this also runs there
+    def accelerations(self, device):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=0.1, a=2., e=0.1, inc=0.2)
+        for i in range(6):
+            sim.add(m=1.e-4*(i+1), primary=sim.particles[1], a=0.1 + 0.02*i, e=0.05*i, inc=0.3*i, f=0.9*i)
+        sim.particles[1].params['J2'] = 0.02
+        sim.particles[1].params['R_eq'] = 0.03
+        rebx = reboundx.Extras(sim)
+        gh = rebx.load_force('gravitational_harmonics')
+        if device is not None:
+            gh.params['offload_device'] = device
+        for p in sim.particles:
+            p.ax = p.ay = p.az = 0.
+        with warnings.catch_warnings():
+            warnings.simplefilter('ignore')
+            gh.update_accelerations(byref(sim), byref(gh), sim._particles, sim.N)
+        return [(p.m, p.ax, p.ay, p.az) for p in sim.particles]
+
+    def test_matcheshost(self):
+        host = self.accelerations(None)
+        device = self.accelerations(0)
+        scale = max(abs(p[0]*a) for p in host for a in p[1:])
+        for c in range(1, 4):
+            momentum = sum(p[0]*p[c] for p in device)
+            self.assertLess(abs(momentum), 1.e-13*scale)
+        for p, q in zip(host, device):
+            for a, b in zip(p[1:], q[1:]):
+                self.assertLess(abs(a - b), 1.e-13*abs(a) + 1.e-16*scale)
+        self.assertGreater(abs(host[1][1]), 0.)
+
+class TestBackReactions(unittest.TestCase):
+    # Above REBX_BACK_REACTIONS_DIRECT_N (64) particles rebx_com_force and rebxtools_com_ptm sum the back reactions
+    # instead of applying each one to every particle it acts on. Both paths must agree with the per-pair result
+    def make_sim(self, N, N_massless=0):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(1, N):
+            sim.add(m=1.e-4*(1. + 0.1*(i % 7)), a=1. + 0.05*i, e=0.01*(i % 5), inc=0.01*(i % 3), f=0.7*i)
+        for i in range(N_massless):
+            sim.add(a=10. + 0.1*i, e=0.1, f=0.3*i)
+        sim.move_to_com()
+        rebx = reboundx.Extras(sim)
+        for i in range(1, N):
+            sim.particles[i].params['tau_a'] = -1.e3*(1. + 0.01*i)
+        return sim, rebx
+
+    def pair_accelerations(self, sim, coordinates):
+        # Each particle's force and its back reactions applied one pair at a time, as in the per-pair loop
+        ps = sim.particles
+        N = sim.N
+        acc = [[0., 0., 0.] for p in ps]
+        def com(indices):
+            m = sum(ps[j].m for j in indices)
+            return m, [sum(ps[j].m*getattr(ps[j], 'v'+c) for j in indices)/m for c in 'xyz']
+        for i in range(N-1, -1, -1):
+            p = ps[i]
+            tau_a = p.params['tau_a'] if i > 0 else math.inf
+            if coordinates == 'BARYCENTRIC':
+                m, vcom = com(range(N))
+                massratio = p.m/m
+                others = range(N)
+            else:
+                if i == 0:
+                    continue
+                m, vcom = com(range(i))
+                massratio = p.m/(m + p.m)
+                others = range(i+1)
+            a = [(getattr(p, 'v'+c) - vcom[k])/(2.*tau_a) for k, c in enumerate('xyz')]
+            for k in range(3):
+                acc[i][k] += a[k]
+                for j in others:
+                    acc[j][k] -= massratio*a[k]
+        return acc
+
+    def test_forcematchespairs(self):
+        for N in [20, 100]:
+            for coordinates in ['JACOBI', 'BARYCENTRIC']:
+                with self.subTest(N=N, coordinates=coordinates):
+                    sim, rebx = self.make_sim(N)
+                    mof = rebx.load_force('modify_orbits_forces')
+                    mof.params['coordinates'] = reboundx.coordinates[coordinates]
+                    for p in sim.particles:
+                        p.ax = p.ay = p.az = 0.
+                    mof.update_accelerations(byref(sim), byref(mof), sim._particles, sim.N)
+                    expected = self.pair_accelerations(sim, coordinates)
+                    scale = max(abs(x) for a in expected for x in a)
+                    for p, a in zip(sim.particles, expected):
+                        for x, y in zip((p.ax, p.ay, p.az), a):
+                            self.assertLess(abs(x - y), 1.e-13*scale)
+
+    def test_operatormatchesdirect(self):
+        # Massless particles without tau_a take the count past the threshold without adding back reactions, so the
+        # massive particles must end up where the per-pair path puts them without the massless ones
+        for coordinates in ['JACOBI', 'BARYCENTRIC']:
+            with self.subTest(coordinates=coordinates):
+                states = []
+                for N_massless in [0, 80]:
+                    sim, rebx = self.make_sim(20, N_massless)
+                    mod = rebx.load_operator('modify_orbits_direct')
+                    mod.params['coordinates'] = reboundx.coordinates[coordinates]
+                    mod.step(sim, 10.)
+                    states.append([(p.x, p.y, p.z, p.vx, p.vy, p.vz) for p in [sim.particles[i] for i in range(20)]])
+                for p, q in zip(*states):
+                    for x, y in zip(p, q):
+                        self.assertLess(abs(x - y), 1.e-12)
+
+class TestModifyOrbitsBatched(unittest.TestCase):
+    # The batched conversion must land where the per-particle reb_orbit conversion does
+    def make_sim(self, m, batched, coordinates):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=5., e=0.05, inc=0.02)
+        for i in range(40):
+            e = 0. if i % 7 == 0 else 0.6*(i % 5)/5.
+            inc = 0. if i % 4 == 0 else 0.3*(i % 3 + 1)
+            sim.add(m=m, a=0.5 + 0.1*i, e=e, inc=inc, Omega=0.3*i, omega=0.7*i, f=1.1*i)
+        sim.add(m=m, a=-2., e=1.3, inc=0.2, f=0.3)
+        sim.move_to_com()
+        rebx = reboundx.Extras(sim)
+        mod = rebx.load_operator('modify_orbits_direct')
+        mod.params['coordinates'] = reboundx.coordinates[coordinates]
+        mod.params['p'] = 0.5
+        if batched:
+            mod.params['batched'] = 1
+        if coordinates == 'PARTICLE':
+            sim.particles[0].params['primary'] = 1
+        for i in range(2, sim.N):
+            p = sim.particles[i]
+            p.params['tau_a'] = -1.e3*(1 + i % 3)
+            p.params['tau_e'] = -2.e3 if i % 2 else 3.e3
+            p.params['tau_inc'] = -4.e3
+            p.params['tau_omega'] = 5.e3
+            p.params['tau_Omega'] = -6.e3
+        return sim, rebx, mod
+
+    def stepped(self, m, coordinates):
+        states = []
+        for batched in [0, 1]:
+            sim, rebx, mod = self.make_sim(m, batched, coordinates)
+            initial = [(p.x, p.y, p.z, p.vx, p.vy, p.vz) for p in sim.particles]
+            mod.step(sim, 10.)
+            states.append([(p.x, p.y, p.z, p.vx, p.vy, p.vz) for p in sim.particles])
+        moved = max(abs(x - y) for p, q in zip(initial, states[0]) for x, y in zip(p, q))
+        self.assertGreater(moved, 1.e-3)
+        return states
+
+    def test_massless(self):
+        for coordinates in ['JACOBI', 'BARYCENTRIC', 'PARTICLE']:
+            with self.subTest(coordinates=coordinates):
+                ref, batched = self.stepped(0., coordinates)
+                for p, q in zip(ref, batched):
+                    for x, y in zip(p, q):
+                        self.assertLess(abs(x - y), 1.e-11*(1. + abs(x)))
+
+    def test_massive(self):
+        # Batching applies the back reactions together, which only changes terms of order m*dt/tau
+        for coordinates in ['JACOBI', 'BARYCENTRIC', 'PARTICLE']:
+            with self.subTest(coordinates=coordinates):
+                ref, batched = self.stepped(1.e-6, coordinates)
+                for p, q in zip(ref, batched):
+                    for x, y in zip(p, q):
+                        self.assertLess(abs(x - y), 1.e-6*(1. + abs(x)))
+
+class TestRadiationBetaArray(unittest.TestCase):
+    # The beta_array sweep must give the accelerations of the per-particle beta params it replaces
+    def make_sim(self, N):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=0.5, a=20., e=0.1)
+        for i in range(N-2):
+            sim.add(a=1. + 0.01*i, e=0.2*(i % 4)/4., inc=0.1*(i % 3), f=0.37*i)
+        rebx = reboundx.Extras(sim)
+        sim.particles[0].params['radiation_source'] = 1
+        sim.particles[1].params['radiation_source'] = 1
+        rad = rebx.load_force('radiation_forces')
+        rad.params['c'] = 1.e4
+        betas = [0., 0.] + [0. if i % 5 == 0 else 0.01*(1 + i % 9) for i in range(N-2)]
+        return sim, rebx, rad, betas
+
+    def accelerations(self, sim, rad):
+        for p in sim.particles:
+            p.ax = p.ay = p.az = 0.
+        rad.update_accelerations(byref(sim), byref(rad), sim._particles, sim.N)
+        return [(p.ax, p.ay, p.az) for p in sim.particles]
+
+    def test_matchesparams(self):
+        N = 600     # more than one block of particles
+        sim, rebx, rad, betas = self.make_sim(N)
+        for p, beta in zip(sim.particles, betas):
+            if beta != 0.:
+                p.params['beta'] = beta
+        expected = self.accelerations(sim, rad)
+        scale = max(abs(x) for a in expected for x in a)
+        self.assertGreater(scale, 0.)
+        for n_threads in [1, 3]:
+            with self.subTest(n_threads=n_threads):
+                sim, rebx, rad, betas = self.make_sim(N)
+                beta_array = (N*c_double)(*betas)
+                rad.params['beta_array'] = beta_array
+                rad.params['beta_array_length'] = N
+                rad.params['n_threads'] = n_threads
+                for a, b, beta in zip(self.accelerations(sim, rad), expected, betas):
+                    for x, y in zip(a, b):
+                        if beta == 0.:
+                            self.assertEqual(x, 0.)
+                        else:
+                            self.assertLess(abs(x - y), 1.e-15*scale)
+
+class TestRK45(unittest.TestCase):
+    def make_sim(self, epsilon):
+        sim = rebound.Simulation()
+        sim.integrator = 'whfast'
+        sim.dt = 0.5
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1.)
+        rebx = reboundx.Extras(sim)
+        gr = rebx.load_force('gr')
+        gr.params['c'] = 10.
+        op = rebx.load_operator('integrate_force')
+        op.params['force'] = gr
+        op.params['integrator'] = reboundx.integrators['rk45']
+        op.params['epsilon'] = epsilon
+        rebx.add_operator(op, dtfraction=1., timing='post')
+        return sim, rebx
+
+    def test_substeplimit(self):
+        # epsilon = 0 can never be met, but once the substep limit is reached the rest of the operator step must still be covered
+        ref, refrebx = self.make_sim(1.e-12)
+        sim, rebx = self.make_sim(0.)
+        with warnings.catch_warnings():
+            warnings.simplefilter('ignore')
+            ref.step()
+            sim.step()
+        self.assertNotEqual(ref.particles[1].vx, 0.)
+        self.assertLess(abs(sim.particles[1].vx - ref.particles[1].vx), 1.e-10)
+        self.assertLess(abs(sim.particles[1].vy - ref.particles[1].vy), 1.e-10)
+
+    def test_fromrest(self):
+        # Every particle starts at rest under a = 1 - v, so v = 1 - exp(-t) and the error scale comes from the floor
+        sim = rebound.Simulation()
+        sim.integrator = 'none'
+        sim.dt = 1.
+        sim.add(m=1.)
+        sim.add(m=1.e-3, x=1.)
+        rebx = reboundx.Extras(sim)
+        terminal = rebx.create_force('terminal')
+        def relax(sim, force, particles, N):
+            for i in range(N):
+                particles[i].ax += 1. - particles[i].vx
+        terminal.update_accelerations = relax
+        terminal.force_type = 'vel'
+        op = rebx.load_operator('integrate_force')
+        op.params['force'] = terminal
+        op.params['integrator'] = reboundx.integrators['rk45']
+        op.params['epsilon'] = 1.e-10
+        rebx.add_operator(op, dtfraction=1., timing='post')
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter('always')
+            sim.step()
+        self.assertEqual(len(w), 0)
+        for p in sim.particles:
+            self.assertLess(abs(p.vx - (1. - math.exp(-1.))), 1.e-8)
+            self.assertEqual(p.vy, 0.)
+
+class TestIAS15WarmStart(unittest.TestCase):
+    def make_sim(self, warm_start):
+        sim = rebound.Simulation()
+        sim.integrator = 'none'
+        sim.dt = 2.
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1., e=0.2)
+        sim.add(m=1.e-3, a=1.7, e=0.1, inc=0.1)
+        sim.move_to_com()
+        rebx = reboundx.Extras(sim)
+        op = rebx.load_operator('ias15')
+        op.params['ias15_warm_start'] = warm_start
+        rebx.add_operator(op, dtfraction=1., timing='post')
+        return sim, rebx, op
+
+    def assertMatches(self, sim, ref, tol):
+        for p, q in zip(sim.particles, ref.particles):
+            self.assertLess(abs(p.x - q.x), tol)
+            self.assertLess(abs(p.y - q.y), tol)
+            self.assertLess(abs(p.vx - q.vx), tol)
+
+    def test_dtlast(self):
+        sim, rebx, op = self.make_sim(1)
+        sim.step()
+        dt_last = op.params['ias15_dt_last']
+        self.assertGreater(dt_last, 1.e-4*sim.dt)
+        # With fixed IAS15 steps a call keeps its first step, so dt_last only survives if the call started from it
+        sim.ri_ias15.epsilon = 0.
+        sim.step()
+        self.assertEqual(op.params['ias15_dt_last'], dt_last)
+
+    def test_predictorkept(self):
+        sim, rebx, op = self.make_sim(2)
+        ref, refrebx, refop = self.make_sim(0)
+        sim.step()
+        ref.step()
+        ri = sim.ri_ias15
+        self.assertEqual(ri._allocatedN, 3*sim.N)
+        self.assertTrue(any(ri._b.p0[k] != 0. for k in range(3*sim.N)))
+        b = cast(ri._b.p0, c_void_p).value
+        # Leftover compensation terms would shift every particle by this much
+        for k in range(3*sim.N):
+            ri._csx[k] = 1.e-3
+            ri._csv[k] = 1.e-3
+        sim.step()
+        ref.step()
+        self.assertEqual(cast(sim.ri_ias15._b.p0, c_void_p).value, b)
+        self.assertMatches(sim, ref, 1.e-8)
+
+    def test_matchescoldstart(self):
+        ref, refrebx, refop = self.make_sim(0)
+        for i in range(5):
+            ref.step()
+        for warm_start in [1, 2]:
+            with self.subTest(warm_start=warm_start):
+                sim, rebx, op = self.make_sim(warm_start)
+                for i in range(5):
+                    sim.step()
+                self.assertMatches(sim, ref, 1.e-8)
+
+class TestTrackMinDistance(unittest.TestCase):
+    # Hyperbolic flyby of a test particle, so the minimum distance is the pericenter distance a(1-e), passed at tp
+    def make_sim(self, interpolate):
+        sim = rebound.Simulation()
+        sim.integrator = 'whfast'
+        sim.add(m=1.)
+        sim.add(a=-1., e=1.5, f=-1.5)
+        o = sim.particles[1].orbit()
+        tp = -o.M/o.n
+        sim.dt = tp/5.3 # pericenter falls between the 5th and 6th calls, closer to the 5th
+        rebx = reboundx.Extras(sim)
+        tmd = rebx.load_operator('track_min_distance')
+        tmd.params['min_distance_interpolate'] = interpolate
+        rebx.add_operator(tmd)
+        sim.particles[1].params['min_distance'] = 10.
+        sim.particles[1].params['min_distance_orbit'] = rebound.Orbit()
+        sim.integrate(10.*sim.dt)
+        return sim, rebx
+
+    def test_interpolate(self):
+        q = 0.5
+        sim, rebx = self.make_sim(0)
+        self.assertGreater(sim.particles[1].params['min_distance'], q + 2.e-3) # samples bracket the minimum and miss it
+        sim, rebx = self.make_sim(1)
+        dmin = sim.particles[1].params['min_distance']
+        orbit = sim.particles[1].params['min_distance_orbit']
+        self.assertLess(abs(dmin - q), 2.e-4)
+        self.assertLess(abs(orbit.d - dmin), 1.e-12)
+        # The refined point should sit at pericenter (along +x). Off by dt_err, it would be rotated by ~dt_err*v_p/q
+        self.assertGreater(math.cos(orbit.theta), 0.)
+        self.assertLess(abs(math.sin(orbit.theta)), 5.e-3)
+        self.assertLess(abs(orbit.e - 1.5), 5.e-3)
+
+class TestVariations(unittest.TestCase):
+    # A first order variational particle should follow the difference between two nearby simulations, forces included
+    def make_sim(self, name, da=0.):
+        sim = rebound.Simulation()
+        sim.integrator = 'ias15'
+        sim.add(m=1.)
+        sim.add(m=1.e-5, a=1.+da, e=0.1, inc=0.2)
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force(name)
+        rebx.add_force(force)
+        if name in ['gr', 'gr_potential']:
+            force.params['c'] = 30.
+        if name == 'gravitational_harmonics':
+            sim.particles[0].params['J2'] = 0.01
+            sim.particles[0].params['J4'] = -0.002
+            sim.particles[0].params['R_eq'] = 0.3
+        if name == 'tides_precession':
+            sim.particles[1].params['k1'] = 0.5
+            sim.particles[1].params['R_tides'] = 0.02
+        return sim, rebx
+
+    def test_variations(self):
+        da = 1.e-7
+        for name in ['gr', 'gr_potential', 'gravitational_harmonics', 'tides_precession']:
+            with self.subTest(force=name):
+                sim, rebx = self.make_sim(name)
+                var = sim.add_variation()
+                var.vary(1, 'a')
+                shadow, shadowrebx = self.make_sim(name, da)
+                sim.integrate(30.)
+                shadow.integrate(30.)
+                diff = (shadow.particles[1].x - sim.particles[1].x)/da
+                self.assertLess(abs(var.particles[1].x - diff), 1.e-4*abs(diff))
+
+EPHEM_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'examples', 'ephem_forces')
+
+class MPos(Structure):
+    _fields_ = [('u', c_double*3),
+                ('v', c_double*3),
+                ('w', c_double*3),
+                ('jde', c_double)]
+
+class TestSPKWriter(unittest.TestCase):
+    # Kernels from spk_write must read back through spk_init/spk_calc to the Chebyshev series they were given
+    def setUp(self):
+        self.lib = reboundx.clibreboundx
+        self.lib.spk_init.restype = c_void_p
+        self.lib.spk_init.argtypes = [c_char_p]
+        self.lib.spk_find.argtypes = [c_void_p, c_int]
+        self.lib.spk_calc.argtypes = [c_void_p, c_int, c_double, POINTER(MPos)]
+        self.lib.spk_free.argtypes = [c_void_p]
+        self.path = os.path.join(tempfile.mkdtemp(), 'test.bsp')
+
+    def tearDown(self):
+        if os.path.exists(self.path):
+            os.remove(self.path)
+        os.rmdir(os.path.dirname(self.path))
+
+    def test_roundtrip(self):
+        au_km = 149597870.7
+        num, nrec, ncf = 30, 4, 6     # more targets than fit one summary record
+        beg, length = 2458849.5, 8.
+        tar = [-(m+1) for m in range(num)]
+        cf = [au_km*math.sin(0.37*i + 1.)/(1 + i % (3*ncf)) for i in range(num*nrec*3*ncf)]
+        self.assertEqual(self.lib.spk_write(self.path.encode(), num, (num*c_int)(*tar), 0, c_double(beg), c_double(length), nrec, ncf, (len(cf)*c_double)(*cf)), 0)
+        pl = self.lib.spk_init(self.path.encode())
+        self.assertTrue(pl)
+        pos = MPos()
+        for m in [0, 24, 25, num-1]:
+            index = self.lib.spk_find(pl, tar[m])
+            self.assertGreaterEqual(index, 0)
+            for jde in [beg, beg + 3.1, beg + 8.5, beg + 31.9]:
+                self.assertEqual(self.lib.spk_calc(pl, index, jde, byref(pos)), 0)
+                b = min(int((jde - beg)/length), nrec - 1)
+                s = (jde - (beg + (b + 0.5)*length))/(0.5*length)
+                T, S = [1., s], [0., 1.]
+                for p in range(2, ncf):
+                    T.append(2.*s*T[p-1] - T[p-2])
+                    S.append(2.*s*S[p-1] + 2.*T[p-1] - S[p-2])
+                for c in range(3):
+                    cfr = cf[((m*nrec + b)*3 + c)*ncf:((m*nrec + b)*3 + c + 1)*ncf]
+                    x = sum(a*t for a, t in zip(cfr, T))/au_km
+                    v = sum(a*t for a, t in zip(cfr, S))/au_km/(0.5*length)
+                    self.assertLess(abs(pos.u[c] - x), 1.e-12*(1. + abs(x)))
+                    self.assertLess(abs(pos.v[c] - v), 1.e-12*(1. + abs(v)))
+        self.assertEqual(self.lib.spk_calc(pl, 0, beg + nrec*length + 1., byref(pos)), -1)
+        self.assertEqual(self.lib.spk_find(pl, 12345), -1)
+        self.lib.spk_free(pl)
+
+class TimeState(Structure):
+    _fields_ = [('t', POINTER(c_double)),
+                ('state', POINTER(c_double)),
+                ('n_out', c_int),
+                ('n_particles', c_int)]
+
+@unittest.skipUnless(os.path.exists(os.path.join(EPHEM_DIR, 'linux_p1550p2650.430')), 'needs the DE430 file in examples/ephem_forces')
+class TestEphemeris(unittest.TestCase):
+    # ephemeris_forces loads its default ephemeris files from the working directory
+    def setUp(self):
+        self.cwd = os.getcwd()
+        os.chdir(EPHEM_DIR)
+        self.lib = reboundx.clibreboundx
+        self.tstart, self.tstep, self.trange = 2458849.5, 20., 200.
+        self.n = 3
+        self.instate = (6*self.n*c_double)()
+        for j in range(self.n):
+            state = [3.338876057509365, -0.9176517956664152, -0.5038590450387491, 2.805663678557796e-3, 7.550408259144305e-3, 2.980028369986096e-3]
+            state[0] += 0.3*j
+            for k in range(6):
+                self.instate[6*j+k] = state[k]
+
+    def tearDown(self):
+        os.chdir(self.cwd)
+
+    def test_parallel_layout(self):
+        # One timestate per object, each identical to integrating that object on its own
+        ts = (self.n*TimeState)()
+        self.assertEqual(self.lib.integration_function_parallel(c_double(self.tstart), c_double(self.tstep), c_double(self.trange), 0, self.n, self.instate, 2, ts), 1)
+        for j in range(self.n):
+            ref = TimeState()
+            self.lib.integration_function(c_double(self.tstart), c_double(self.tstep), c_double(self.trange), 0, 1, byref(self.instate, 6*j*8), byref(ref))
+            self.assertEqual(ts[j].n_particles, 1)
+            self.assertEqual(ts[j].n_out, ref.n_out)
+            for k in range(ref.n_out):
+                self.assertEqual(ts[j].t[k], ref.t[k])
+                for c in range(6):
+                    self.assertEqual(ts[j].state[6*k+c], ref.state[6*k+c])
+
+    def test_epochs_parallel_layout(self):
+        # (epoch, particle, x/y/z/vx/vy/vz) ordered, with each object integrated on its own
+        n_epochs = 5
+        epochs = (n_epochs*c_double)(*[self.tstart + 40.*k for k in range(n_epochs)])
+        out = (n_epochs*self.n*6*c_double)()
+        self.assertEqual(self.lib.integration_function_epochs_parallel(c_double(self.tstart), c_double(self.tstep), 0, self.n, self.instate, n_epochs, epochs, 2, out), 1)
+        for j in range(self.n):
+            ref = (n_epochs*6*c_double)()
+            self.lib.integration_function_epochs(c_double(self.tstart), c_double(self.tstep), 0, 1, byref(self.instate, 6*j*8), n_epochs, epochs, ref)
+            for k in range(n_epochs):
+                for c in range(6):
+                    self.assertEqual(out[(k*self.n+j)*6+c], ref[6*k+c])
+
+    def test_spk_roundtrip(self):
+        # The kernel must reproduce the integration at epochs between its Chebyshev nodes
+        path = os.path.join(tempfile.mkdtemp(), 'test.bsp')
+        codes = (self.n*c_int)(*[-1000 - j for j in range(self.n)])
+        self.assertEqual(self.lib.integration_function_spk(path.encode(), c_double(self.tstart), c_double(self.tstep), c_double(self.trange), 0, self.n, self.instate, codes, c_double(10.), 14), 1)
+        n_epochs = 9
+        epochs = (n_epochs*c_double)(*[self.tstart + 0.3 + 22.1*k for k in range(n_epochs)])
+        ref = (n_epochs*self.n*6*c_double)()
+        self.assertEqual(self.lib.integration_function_epochs(c_double(self.tstart), c_double(self.tstep), 0, self.n, self.instate, n_epochs, epochs, ref), 1)
+        self.lib.spk_init.restype = c_void_p
+        self.lib.spk_calc.argtypes = [c_void_p, c_int, c_double, POINTER(MPos)]
+        pl = c_void_p(self.lib.spk_init(path.encode()))
+        self.assertTrue(pl)
+        pos = MPos()
+        for j in range(self.n):
+            index = self.lib.spk_find(pl, codes[j])
+            for k in range(n_epochs):
+                self.assertEqual(self.lib.spk_calc(pl, index, epochs[k], byref(pos)), 0)
+                for c in range(3):
+                    self.assertLess(abs(pos.u[c] - ref[(k*self.n + j)*6 + c]), 1.e-10)
+                    self.assertLess(abs(pos.v[c] - ref[(k*self.n + j)*6 + 3 + c]), 1.e-10)
+        self.lib.spk_free(pl)
+        os.remove(path)
+        os.rmdir(os.path.dirname(path))
+
+    def integrate_ephemeris(self, name, params):
+        sim = rebound.Simulation()
+        sim.G = 0.295912208285591100E-03
+        sim.integrator = "ias15"
+        sim.gravity = "none"
+        sim.t = self.tstart
+        for j in range(self.n):
+            sim.add(x=self.instate[6*j], y=self.instate[6*j+1], z=self.instate[6*j+2], vx=self.instate[6*j+3], vy=self.instate[6*j+4], vz=self.instate[6*j+5])
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force(name)
+        rebx.add_force(force)
+        force.params['c'] = 173.144632674
+        for key, value in params.items():
+            force.params[key] = value
+        sim.integrate(self.tstart + self.tstep)
+        return [(p.x, p.y, p.z, p.vx, p.vy, p.vz) for p in sim.particles]
+
+    def test_outside_coverage(self):
+        # linux_p1550p2650.430 ends in 2650, so an epoch in 3500 must raise rather than leave zeros
+        self.tstart = 3.0e6
+        for N_ast in [0, 16]:
+            with self.assertRaises(RuntimeError):
+                self.integrate_ephemeris('ephemeris_forces', {'geocentric':0, 'N_ephem':11, 'N_ast':N_ast})
+
+    def test_variants(self):
+        # Each specialized variant matches ephemeris_forces with the parameters it fixes
+        for name, geo, N_ast, params in [('ephemeris_forces_bary', 0, 16, {'N_ast':16}),
+                                         ('ephemeris_forces_geo', 1, 16, {'N_ast':16}),
+                                         ('ephemeris_forces_bary_noast', 0, 0, {}),
+                                         ('ephemeris_forces_geo_noast', 1, 0, {})]:
+            with self.subTest(force=name):
+                ref = self.integrate_ephemeris('ephemeris_forces', {'geocentric':geo, 'N_ephem':11, 'N_ast':N_ast})
+                self.assertEqual(self.integrate_ephemeris(name, params), ref)
+
+    def culled_accelerations(self, params):
+        # Main belt particles spread in angle and height, so blocks see asteroids at a range of distances
+        sim = rebound.Simulation()
+        sim.G = 0.295912208285591100E-03
+        sim.t = self.tstart
+        for j in range(64):
+            r = 2. + 1.5*j/64.
+            phi = 0.4*j
+            sim.add(x=r*math.cos(phi), y=r*math.sin(phi), z=0.1*math.sin(3.*phi), vx=-0.01*math.sin(phi), vy=0.01*math.cos(phi))
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('ephemeris_forces')
+        force.params['c'] = 173.144632674
+        force.params['geocentric'] = 0
+        force.params['N_ephem'] = 11
+        force.params['N_ast'] = 16
+        for key, value in params.items():
+            force.params[key] = value
+        for p in sim.particles:
+            p.ax = p.ay = p.az = 0.
+        force.update_accelerations(byref(sim), byref(force), sim._particles, sim.N)
+        return [(p.ax, p.ay, p.az) for p in sim.particles], sim, rebx, force
+
+    def test_culling_within_tolerance(self):
+        # Each skipped asteroid term is below ast_tolerance of the solar term, and each float term is off by a few
+        # FLT_EPSILON*float_tolerance of it. Away from the planets the solar term is the total to within 1%
+        flt_epsilon = 1.1920929e-07
+        ref, ref_sim, ref_rebx, ref_force = self.culled_accelerations({})
+        for ast_tolerance, float_tolerance in [(1.e-8, 0.), (0., 1.e-3), (1.e-8, 1.e-3)]:
+            with self.subTest(ast_tolerance=ast_tolerance, float_tolerance=float_tolerance):
+                params = {}
+                if ast_tolerance > 0.:
+                    params['ast_tolerance'] = ast_tolerance
+                if float_tolerance > 0.:
+                    params['float_tolerance'] = float_tolerance
+                acc, sim, rebx, force = self.culled_accelerations(params)
+                bound = 16*ast_tolerance + 27*4*flt_epsilon*float_tolerance + 1.e-14
+                for a, b in zip(acc, ref):
+                    norm = math.sqrt(sum(x*x for x in b))
+                    err = math.sqrt(sum((x - y)**2 for x, y in zip(a, b)))
+                    self.assertLess(err, 1.01*bound*norm)
+                if ast_tolerance > 0.:
+                    self.assertEqual(force.params['ast_terms'], 16*64)
+                    self.assertGreater(force.params['ast_terms_skipped'], 0)
+
+    def test_culling_counters_accumulate(self):
+        acc, sim, rebx, force = self.culled_accelerations({'ast_tolerance':1.e-8})
+        skipped = force.params['ast_terms_skipped']
+        force.update_accelerations(byref(sim), byref(force), sim._particles, sim.N)
+        self.assertEqual(force.params['ast_terms'], 2*16*64)
+        self.assertEqual(force.params['ast_terms_skipped'], 2*skipped)
+
 if __name__ == '__main__':
     unittest.main()
 
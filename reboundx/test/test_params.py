@@ -199,5 +199,25 @@ class TestParams(unittest.TestCase):
         with self.assertRaises(AttributeError):
             del self.gr.params["b"]
 
+    def test_bulk_params(self):
+        self.rebx.set_particle_params('beta', [0.1, 0.2])
+        self.assertAlmostEqual(self.sim.particles[0].params['beta'], 0.1, delta=1.e-15)
+        self.assertAlmostEqual(self.p.params['beta'], 0.2, delta=1.e-15)
+        self.rebx.set_particle_params('tau_mass', [-3.], indices=[1])
+        tau = self.rebx.get_particle_params('tau_mass')
+        self.assertTrue(math.isnan(tau[0]))
+        self.assertAlmostEqual(tau[1], -3., delta=1.e-15)
+        beta = self.rebx.get_particle_params('beta', indices=[1, 0])
+        self.assertAlmostEqual(beta[0], 0.2, delta=1.e-15)
+        self.assertAlmostEqual(beta[1], 0.1, delta=1.e-15)
+        self.rebx.set_particle_params('gr_source', [1], indices=[0])
+        self.assertEqual(list(self.rebx.get_particle_params('gr_source', default=-1)), [1, -1])
+
+    def test_bulk_params_errors(self):
+        with self.assertRaises(RuntimeError):
+            self.rebx.set_particle_params('beta', [0.1], indices=[5])
+        with self.assertRaises(ValueError):
+            self.rebx.set_particle_params('beta', [0.1, 0.2], indices=[0])
+
 if __name__ == '__main__':
     unittest.main()
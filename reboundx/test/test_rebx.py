@@ -1,6 +1,15 @@
 import rebound
 import reboundx
 import unittest
+from ctypes import Structure, CFUNCTYPE, POINTER, c_char_p, c_int, c_double, c_void_p, byref
+
+class EnsembleOverride(Structure):
+    _fields_ = [('object', c_char_p),
+                ('index', c_int),
+                ('name', c_char_p),
+                ('value', c_double)]
+
+ENSEMBLEOUTPUT = CFUNCTYPE(None, POINTER(rebound.Simulation), c_void_p, c_int, c_void_p)
 
 class TestRebx(unittest.TestCase):
     def setUp(self):
@@ -17,5 +26,95 @@ class TestRebx(unittest.TestCase):
         self.sim.integrate(10)
         self.assertGreater(self.sim.particles[1].pomega, 1.e-4)
 
+    def test_profiling(self):
+        gr = self.rebx.load_force('gr')
+        self.rebx.add_force(gr)
+        gr.params['c'] = 1e2
+        mod = self.rebx.load_operator('modify_mass')
+        self.rebx.add_operator(mod)
+
+        self.sim.integrate(1)
+        self.assertEqual(gr.profile.N_calls, 0)
+        
+        self.rebx.profiling = True
+        self.sim.integrate(2)
+        self.assertGreater(gr.profile.N_calls, 0)
+        self.assertEqual(gr.profile.N_particles, 2*gr.profile.N_calls)
+        self.assertGreaterEqual(gr.profile.walltime, 0.)
+        self.assertGreater(self.rebx.profiles['modify_mass'].N_calls, 0)
+
+        self.rebx.profiling = False
+        N_calls = gr.profile.N_calls
+        self.sim.integrate(3)
+        self.assertEqual(gr.profile.N_calls, N_calls)
+
+        self.rebx.reset_profiles()
+        self.assertEqual(gr.profile.N_calls, 0)
+        self.assertEqual(self.rebx.profiles['gr'].walltime, 0.)
+
+    def test_copy(self):
+        gr = self.rebx.load_force('gr')
+        self.rebx.add_force(gr)
+        gr.params['c'] = 1e2
+        mod = self.rebx.load_operator('modify_mass')
+        self.rebx.add_operator(mod)
+        self.sim.particles[1].params['tau_mass'] = -1e3
+        self.sim.integrate(1)
+
+        sim = self.sim.copy()
+        rebx = self.rebx.copy(sim)
+        self.assertEqual(rebx.get_force('gr').params['c'], 1e2)
+        self.assertEqual(sim.particles[1].params['tau_mass'], -1e3)
+        sim.particles[1].params['tau_mass'] = -2e3
+        self.assertEqual(self.sim.particles[1].params['tau_mass'], -1e3)
+        sim.particles[1].params['tau_mass'] = -1e3
+
+        self.sim.integrate(10)
+        sim.integrate(10)
+        self.assertEqual(self.sim.particles[1].x, sim.particles[1].x)
+        self.assertEqual(self.sim.particles[1].m, sim.particles[1].m)
+
+    def test_copyorbit(self):
+        tmd = self.rebx.load_operator('track_min_distance')
+        self.rebx.add_operator(tmd)
+        orbit = rebound.Orbit()
+        self.sim.particles[1].params['min_distance'] = 10.
+        self.sim.particles[1].params['min_distance_orbit'] = orbit
+
+        sim = self.sim.copy()
+        rebx = self.rebx.copy(sim)
+        sim.integrate(1)
+        self.assertGreater(sim.particles[1].params['min_distance_orbit'].a, 0.)
+        self.assertEqual(orbit.a, 0.)
+        self.assertEqual(self.sim.particles[1].params['min_distance_orbit'].a, 0.)
+
+    def test_ensembleorbit(self):
+        # Members each track into their own copy of min_distance_orbit and leave the base simulation's untouched
+        self.sim.add(a=2., e=0.5)
+        tmd = self.rebx.load_operator('track_min_distance')
+        self.rebx.add_operator(tmd)
+        orbit = rebound.Orbit()
+        self.sim.particles[2].params['min_distance'] = 10.
+        self.sim.particles[2].params['min_distance_orbit'] = orbit
+
+        N_members = 4
+        overrides = (N_members*EnsembleOverride)()
+        for m in range(N_members):
+            overrides[m] = EnsembleOverride(None, 2, b'min_distance', 10.)
+        results = [None]*N_members
+        def output(sim, rebx, member, data):
+            p = sim.contents.particles[2]
+            results[member] = (p.params['min_distance'], p.params['min_distance_orbit'].a)
+        cb = ENSEMBLEOUTPUT(output)
+
+        N_done = reboundx.clibreboundx.rebx_run_ensemble(byref(self.rebx), c_double(5.), N_members, overrides, 1, cb, None, 2)
+        self.assertEqual(N_done, N_members)
+        for m in range(N_members):
+            self.assertLess(results[m][0], 10.)
+            self.assertGreater(results[m][1], 0.)
+            self.assertEqual(results[m], results[0])
+        self.assertEqual(orbit.a, 0.)
+        self.assertEqual(self.sim.particles[2].params['min_distance'], 10.)
+
 if __name__ == '__main__':
     unittest.main()
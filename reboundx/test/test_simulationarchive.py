@@ -1,7 +1,9 @@
 import rebound
 import reboundx
 import unittest
+import os
 import numpy as np
+from ctypes import CDLL, POINTER, byref, c_char, c_int, c_size_t, c_void_p, string_at
 
 """
 Acts as both a test on various integration options for forces working (add_force vs step before/after/both)
@@ -143,6 +145,118 @@ class TestSimulationArchive(unittest.TestCase):
                 sim.integrate(tmax)
                 self.assertEqual(self.sim.particles[1].x, sim.particles[1].x, msg='REB integrator: {0}, REBX integrator: {1}'.format(integrator, rebxintegrator))
 
+    def test_buffer_roundtrip(self):
+        # a binary written to memory must be the same bytes as the file, and load back the same effects and params
+        self.sim.add(m=1.e-5, a=2.)
+        self.sim.integrator = 'whfast'
+        self.rebx.add_force(self.gr)
+        mm = self.rebx.load_operator('modify_mass')
+        self.rebx.add_operator(mm)
+        self.sim.particles[1].params['tau_mass'] = -1.e4
+        self.sim.particles[2].params['tau_mass'] = -3.e4
+        self.gr.params['max_iterations'] = 10
+        self.rebx.save('test.rebx')
+        bufp = POINTER(c_char)()
+        size = c_size_t(0)
+        reboundx.clibreboundx.rebx_output_binary_to_buffer(byref(self.rebx), byref(bufp), byref(size))
+        self.assertTrue(bufp)
+        with open('test.rebx', 'rb') as f:
+            self.assertEqual(string_at(bufp, size.value), f.read())
+
+        sim = rebound.Simulation()
+        sim.integrator = 'whfast'
+        sim.dt = self.sim.dt
+        for p in self.sim.particles:
+            sim.add(m=p.m, x=p.x, y=p.y, z=p.z, vx=p.vx, vy=p.vy, vz=p.vz)
+        rebx = reboundx.Extras.__new__(reboundx.Extras, sim)
+        sim._extras_ref = rebx
+        reboundx.clibreboundx.rebx_initialize(byref(sim), byref(rebx))
+        w = c_int(0)
+        reboundx.clibreboundx.rebx_init_extras_from_buffer(byref(rebx), bufp, size, byref(w))
+        libc = CDLL(None)
+        libc.free.argtypes = [c_void_p]
+        libc.free(bufp)
+        self.assertEqual(w.value, 0)
+        self.assertEqual(rebx.get_force('gr').params['c'], 1e2)
+        self.assertEqual(sim.particles[1].params['tau_mass'], -1.e4)
+        self.assertEqual(sim.particles[2].params['tau_mass'], -3.e4)
+        self.assertEqual(rebx.get_force('gr').params['max_iterations'], 10)
+        with self.assertRaises(AttributeError):
+            sim.particles[0].params['tau_mass']
+
+        self.sim.integrate(100.)
+        sim.integrate(100.)
+        self.assertEqual(self.sim.particles[1].x, sim.particles[1].x)
+        self.assertEqual(self.sim.particles[1].m, sim.particles[1].m)
+
+    def test_archive_params(self):
+        # particle params changed between snapshots should be loaded for the matching simulationarchive snapshot
+        self.sim.add(m=1.e-5, a=2.)
+        self.sim.integrator = 'whfast'
+        self.sim.simulationarchive_snapshot('test.sa', deletefile=True)
+        self.rebx.add_force(self.gr)
+        mm = self.rebx.load_operator('modify_mass')
+        self.rebx.add_operator(mm)
+        self.sim.particles[1].params['tau_mass'] = -1.e4
+        self.rebx.simulationarchive_snapshot('test.rebx', deletefile=True)
+        taus = [-1.e4]
+        for i in range(1, 5):
+            self.sim.integrate(100.*i)
+            taus.append(-1.e4*(i+1))
+            self.sim.particles[1].params['tau_mass'] = taus[-1]
+            if i == 2:
+                self.sim.particles[2].params['tau_mass'] = -5.e3
+            self.sim.simulationarchive_snapshot('test.sa')
+            self.rebx.simulationarchive_snapshot('test.rebx')
+
+        sa = reboundx.SimulationArchive('test.sa', 'test.rebx')
+        self.assertEqual(len(sa.rebxarchive), 5)
+        for i in range(5):
+            sim, rebx = sa[i]
+            self.assertEqual(sim.particles[1].params['tau_mass'], taus[i])
+            if i >= 2:
+                self.assertEqual(sim.particles[2].params['tau_mass'], -5.e3)
+            else:
+                with self.assertRaises(AttributeError):
+                    sim.particles[2].params['tau_mass']
+            self.assertEqual(rebx.get_force('gr').params['c'], 1e2)
+
+        sim = rebound.Simulation('test.sa', snapshot=-1)
+        rebx = reboundx.Extras(sim, 'test.rebx', snapshot=-1)
+        self.assertEqual(sim.particles[1].params['tau_mass'], taus[-1])
+
+    def test_archive_interrupted(self):
+        # a snapshot replacing an interrupted, longer one must not leave the old bytes after it
+        for i in range(50):
+            self.sim.add(m=1.e-8, a=2.+0.1*i)
+        self.rebx.add_force(self.gr)
+        self.rebx.simulationarchive_snapshot('test.rebx', deletefile=True)
+        for p in self.sim.particles[1:]:
+            p.params['tau_mass'] = -1.e4
+        self.rebx.simulationarchive_snapshot('test.rebx')
+        size = os.path.getsize('test.rebx')
+        with open('test.rebx', 'r+b') as f:
+            f.truncate(size - 10)
+
+        def copy_sim():
+            sim = rebound.Simulation()
+            for p in self.sim.particles:
+                sim.add(m=p.m, x=p.x, vx=p.vx)
+            return sim
+        sim = copy_sim()
+        rebx = reboundx.Extras(sim, 'test.rebx', snapshot=-1)
+        sim.particles[1].params['tau_mass'] = -2.e4
+        rebx.simulationarchive_snapshot('test.rebx')
+        self.assertLess(os.path.getsize('test.rebx'), size - 10)
+
+        archive = reboundx.ExtrasArchive('test.rebx')
+        self.assertEqual(len(archive), 2)
+        sim2 = copy_sim()
+        rebx2 = reboundx.Extras(sim2, archive, snapshot=-1)
+        self.assertEqual(sim2.particles[1].params['tau_mass'], -2.e4)
+        with self.assertRaises(AttributeError):
+            sim2.particles[2].params['tau_mass']
+
 if __name__ == '__main__':
     unittest.main()
 
@@ -35,6 +35,13 @@ REBX_BINARY_FIELD_TYPE = {
         24: 'Particles',
         25: 'Force',
         26: 'Snapshot',
+        27: 'Particle columns',
+        28: 'Particle column',
+        29: 'Column indices',
+        30: 'Column values',
+        31: 'Snapshot diff',
+        32: 'Snapshot time',
+        33: 'Keyframe offset',
         }
 
 class BinaryField(Structure):
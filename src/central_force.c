@@ -59,6 +59,7 @@
 #include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
 
 static void rebx_calculate_central_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double A, const double gamma, const int source_index){
     const struct reb_particle source = particles[source_index];
@@ -94,6 +95,47 @@ void rebx_central_force(struct reb_simulation* const sim, struct rebx_force* con
     }
 }
 
+static void rebx_central_force_term(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair){
+    const struct reb_particle p = particles[i];
+    const int source_index = term->source_index;
+    const double m0 = particles[source_index].m;
+    const double prefac = term->c[0]*pow(pair->r2, (term->c[1]-1.)/2.);
+    
+    particles[i].ax += prefac*pair->dx;
+    particles[i].ay += prefac*pair->dy;
+    particles[i].az += prefac*pair->dz;
+    particles[source_index].ax -= p.m/m0*prefac*pair->dx;
+    particles[source_index].ay -= p.m/m0*prefac*pair->dy;
+    particles[source_index].az -= p.m/m0*prefac*pair->dz;
+}
+
+int rebx_central_force_source_terms(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max){
+    struct rebx_extras* const rebx = sim->extras;
+    const int Acentral_key = rebx_get_param_key(rebx, "Acentral");
+    const int gammacentral_key = rebx_get_param_key(rebx, "gammacentral");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, Acentral_key, particles, N);
+    int N_terms = 0;
+    for (int k=0; k<sources->N_indices; k++){
+        const int i = sources->indices[k];
+        const double* const Acentral = rebx_get_param_by_key(rebx, particles[i].ap, Acentral_key);
+        const double* const gammacentral = rebx_get_param_by_key(rebx, particles[i].ap, gammacentral_key);
+        if (gammacentral == NULL){
+            continue;
+        }
+        if (N_terms == N_max){
+            return -1;
+        }
+        struct rebx_source_term* const term = &terms[N_terms++];
+        *term = (struct rebx_source_term){0};
+        term->accumulate = rebx_central_force_term;
+        term->rebx = rebx;
+        term->source_index = i;
+        term->c[0] = *Acentral;
+        term->c[1] = *gammacentral;
+    }
+    return N_terms;
+}
+
 static double rebx_calculate_central_force_potential(struct reb_simulation* const sim, const double A, const double gamma, const int source_index){
     const struct reb_particle* const particles = sim->particles;
 	const int _N_real = sim->N - sim->N_var;
@@ -31,9 +31,12 @@
 #include <string.h>
 #include <limits.h>
 #include <float.h>
+#include <time.h>
+#include <sys/time.h>
 #include "core.h"
 #include "rebound.h"
 #include "linkedlist.h"
+#include "rebxtools.h"
 
 #define STRINGIFY(s) str(s)
 #define str(s) #s
@@ -52,6 +55,10 @@ void rebx_register_default_params(struct rebx_extras* rebx){
     rebx_register_param(rebx, "c", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "gr_source", REBX_TYPE_INT);
     rebx_register_param(rebx, "tau_mass", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "exact_mass_update", REBX_TYPE_INT);
+    rebx_register_param(rebx, "incremental_com", REBX_TYPE_INT);
+    rebx_register_param(rebx, "recentered_N", REBX_TYPE_INT);
+    rebx_register_param(rebx, "recentered_mass", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "force", REBX_TYPE_FORCE);
     rebx_register_param(rebx, "particle", REBX_TYPE_POINTER);
     rebx_register_param(rebx, "Acentral", REBX_TYPE_DOUBLE);
@@ -60,6 +67,16 @@ void rebx_register_default_params(struct rebx_extras* rebx){
     rebx_register_param(rebx, "J2", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "J4", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "R_eq", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "pole_ra", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "pole_dec", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "pole_ra_dot", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "pole_dec_dot", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "harmonics_degree", REBX_TYPE_INT);
+    rebx_register_param(rebx, "J_n", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "C_nm", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "S_nm", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "prime_meridian", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "prime_meridian_dot", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "coordinates", REBX_TYPE_INT);
     rebx_register_param(rebx, "p", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "tau_a", REBX_TYPE_DOUBLE);
@@ -70,25 +87,111 @@ void rebx_register_default_params(struct rebx_extras* rebx){
     rebx_register_param(rebx, "primary", REBX_TYPE_INT);
     rebx_register_param(rebx, "radiation_source", REBX_TYPE_INT);
     rebx_register_param(rebx, "beta", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "beta_array", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "beta_array_length", REBX_TYPE_INT);
+    rebx_register_param(rebx, "radiation_forces_workspace", REBX_TYPE_POINTER);
     rebx_register_param(rebx, "tides_primary", REBX_TYPE_INT);
     rebx_register_param(rebx, "R_tides", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "k1", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "integrator", REBX_TYPE_INT);
     rebx_register_param(rebx, "free_arrays", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "im_ps_final", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "im_ps_prev", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "im_ps_avg", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "rk2_k2", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "rk4_k2", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "rk4_k3", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "free_arrays_chain", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "integrator_workspace", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "rk45_dt_last", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "im_tolerance", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "im_max_iterations", REBX_TYPE_INT);
+    rebx_register_param(rebx, "im_anderson_depth", REBX_TYPE_INT);
+    rebx_register_param(rebx, "im_warm_start", REBX_TYPE_INT);
+    rebx_register_param(rebx, "im_warm_start_state", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "ias15_warm_start", REBX_TYPE_INT);
+    rebx_register_param(rebx, "ias15_dt_last", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "epsilon", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "min_distance", REBX_TYPE_DOUBLE);
     rebx_register_param(rebx, "min_distance_from", REBX_TYPE_UINT32);
     rebx_register_param(rebx, "min_distance_orbit", REBX_TYPE_ORBIT);
+    rebx_register_param(rebx, "min_distance_interpolate", REBX_TYPE_INT);
+    rebx_register_param(rebx, "min_distance_workspace", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "energy_offset", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "energy_workspace", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "batched", REBX_TYPE_INT);
+    rebx_register_param(rebx, "modify_orbits_direct_workspace", REBX_TYPE_POINTER);
     rebx_register_param(rebx, "N_ephem", REBX_TYPE_INT);
     rebx_register_param(rebx, "N_ast", REBX_TYPE_INT);
     rebx_register_param(rebx, "geocentric", REBX_TYPE_INT);
     rebx_register_param(rebx, "outstate", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "n_out", REBX_TYPE_INT);        
+    rebx_register_param(rebx, "n_out", REBX_TYPE_INT);
+    rebx_register_param(rebx, "ephem_cache", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "ephemeris", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "n_threads", REBX_TYPE_INT);
+    rebx_register_param(rebx, "offload_device", REBX_TYPE_INT);
+    rebx_register_param(rebx, "ast_tolerance", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "ast_terms_skipped", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "ast_terms", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "float_tolerance", REBX_TYPE_DOUBLE);
+    rebx_register_param(rebx, "gravitational_harmonics_workspace", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "fused", REBX_TYPE_INT);
+    rebx_register_param(rebx, "gr_full_workspace", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "gr_workspace", REBX_TYPE_POINTER);
+    rebx_register_param(rebx, "use_sim_accelerations", REBX_TYPE_INT);
+}
+
+// FNV-1a hash of a parameter name for the interned key table
+static unsigned long rebx_hash_name(const char* name){
+    unsigned long hash = 2166136261UL;
+    for (const unsigned char* c = (const unsigned char*)name; *c != '\0'; c++){
+        hash ^= *c;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static void rebx_insert_param_key(struct rebx_extras* const rebx, const int key){
+    const unsigned long mask = (unsigned long)rebx->N_param_key_hash - 1;
+    unsigned long slot = rebx_hash_name(rebx->param_keys[key]->name) & mask;
+    while (rebx->param_key_hash[slot] != 0){
+        slot = (slot + 1) & mask;
+    }
+    rebx->param_key_hash[slot] = key + 1;
+}
+
+// Assigns the next integer key to a registered param and adds it to the key table. Returns -1 on allocation failure
+int rebx_intern_param(struct rebx_extras* const rebx, struct rebx_param* const param){
+    if (rebx->N_param_keys >= rebx->N_allocated_param_keys){
+        int N_allocated = rebx->N_allocated_param_keys ? 2*rebx->N_allocated_param_keys : 64;
+        struct rebx_param** param_keys = realloc(rebx->param_keys, N_allocated*sizeof(*param_keys));
+        if (param_keys == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for registered parameter keys.\n");
+            return -1;
+        }
+        rebx->param_keys = param_keys;
+        rebx->N_allocated_param_keys = N_allocated;
+    }
+    const int key = rebx->N_param_keys;
+    rebx->param_keys[key] = param;
+    rebx->N_param_keys++;
+    param->key = key;
+    
+    // Keep the table at most half full so probe sequences stay short
+    if (2*rebx->N_param_keys > rebx->N_param_key_hash){
+        int N_hash = rebx->N_param_key_hash ? 2*rebx->N_param_key_hash : 128;
+        int* hash = calloc(N_hash, sizeof(*hash));
+        if (hash == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for registered parameter keys.\n");
+            rebx->N_param_keys--;
+            param->key = -1;
+            return -1;
+        }
+        free(rebx->param_key_hash);
+        rebx->param_key_hash = hash;
+        rebx->N_param_key_hash = N_hash;
+        for (int i=0; i<rebx->N_param_keys; i++){
+            rebx_insert_param_key(rebx, i);
+        }
+    }
+    else{
+        rebx_insert_param_key(rebx, key);
+    }
+    return key;
 }
 
 void rebx_register_param(struct rebx_extras* const rebx, const char* name, enum rebx_param_type type){
@@ -110,8 +213,10 @@ void rebx_register_param(struct rebx_extras* const rebx, const char* name, enum
     }
     int success = rebx_add_param(rebx, &rebx->registered_params, param);
     if(!success){
-        rebx_free_param(param);
+        rebx_free_param(rebx, param);
+        return;
     }
+    rebx_intern_param(rebx, param);
     
     return;
 }
@@ -168,6 +273,25 @@ void rebx_initialize(struct reb_simulation* sim, struct rebx_extras* rebx){
     rebx->allocated_forces=NULL;
     rebx->allocated_operators=NULL;
     rebx->registered_params=NULL;
+    rebx->param_keys=NULL;
+    rebx->N_param_keys=0;
+    rebx->N_allocated_param_keys=0;
+    rebx->param_key_hash=NULL;
+    rebx->N_param_key_hash=0;
+    rebx->param_generation=0;
+    rebx->particle_lists=NULL;
+    rebx->N_particle_lists=0;
+    rebx->force_table = (struct rebx_dispatch_table){0};
+    rebx->pre_table = (struct rebx_dispatch_table){0};
+    rebx->post_table = (struct rebx_dispatch_table){0};
+    rebx->profiling = 0;
+    rebx->fused_profile = (struct rebx_profile){0};
+    rebx->copied_values = NULL;
+    rebx->var_order_warned = 0;
+    rebx->arena = rebx_create_arena();
+    if (rebx->arena == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory.\n");
+    }
     
     sim->free_particle_ap = rebx_free_particle_ap;
     sim->extras_cleanup = rebx_extras_cleanup;
@@ -182,6 +306,319 @@ void rebx_free(struct rebx_extras* rebx){
     free(rebx);
 }
 
+/**********************************************
+ Copying
+ *********************************************/
+
+/* Workspaces built lazily by effects and integrators, freed through the free_arrays chains of the force or operator
+ * holding them. Copies start without them, so they are rebuilt for the new simulation on first use. The other
+ * pointer params (J_n, C_nm, S_nm, beta_array and ephemeris) are owned by the user, only read by the effects, and
+ * shared with the copy. Struct params that effects write to (reb_orbit, i.e. min_distance_orbit) are copied into
+ * storage the copy owns (rebx_extras.copied_values), so the copy never writes to the source.
+ */
+static const char* const rebx_workspace_params[] = {"free_arrays", "free_arrays_chain", "integrator_workspace", "im_warm_start_state", "gr_workspace", "gr_full_workspace", "ephem_cache", "min_distance_workspace", "energy_workspace", "modify_orbits_direct_workspace", "radiation_forces_workspace", "gravitational_harmonics_workspace"};
+
+static int rebx_is_workspace_param(const struct rebx_param* const param){
+    if (param->type != REBX_TYPE_POINTER){
+        return 0;
+    }
+    for (size_t i=0; i<sizeof(rebx_workspace_params)/sizeof(rebx_workspace_params[0]); i++){
+        if (strcmp(param->name, rebx_workspace_params[i]) == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Forces and operators of the source in allocated order, with the copies made of them at the same index
+struct rebx_copy_map{
+    struct rebx_force** src_forces;
+    struct rebx_force** dst_forces;
+    int N_forces;
+    struct rebx_operator** src_operators;
+    struct rebx_operator** dst_operators;
+    int N_operators;
+};
+
+static struct rebx_force* rebx_copy_map_force(const struct rebx_copy_map* const map, struct rebx_force* const force){
+    for (int i=0; i<map->N_forces; i++){
+        if (map->src_forces[i] == force){
+            return map->dst_forces[i];
+        }
+    }
+    return force;
+}
+
+static struct rebx_operator* rebx_copy_map_operator(const struct rebx_copy_map* const map, struct rebx_operator* const operator){
+    for (int i=0; i<map->N_operators; i++){
+        if (map->src_operators[i] == operator){
+            return map->dst_operators[i];
+        }
+    }
+    return operator;
+}
+
+// Fills objects with the list's objects in the order they were added (lists are built by prepending)
+static void* rebx_list_objects(struct rebx_extras* const rebx, struct rebx_node* const head, int* const N){
+    *N = rebx_len(head);
+    void** objects = rebx_malloc(rebx, (*N > 0 ? *N : 1)*sizeof(*objects));
+    if (objects == NULL){
+        return NULL;
+    }
+    int i = *N;
+    for (struct rebx_node* current = head; current != NULL; current = current->next){
+        objects[--i] = current->object;
+    }
+    return objects;
+}
+
+// Reverses a list built by prepending so it ends up in the same order as the one it was copied from
+static void rebx_reverse_list(struct rebx_node** const head){
+    struct rebx_node* reversed = NULL;
+    struct rebx_node* current = *head;
+    while (current != NULL){
+        struct rebx_node* const next = current->next;
+        current->next = reversed;
+        reversed = current;
+        current = next;
+    }
+    *head = reversed;
+}
+
+// Copy of a struct param value, kept on rebx->copied_values until rebx is freed
+static void* rebx_copy_struct_value(struct rebx_extras* const rebx, const void* const src_value, const size_t size){
+    if (src_value == NULL){
+        return NULL;
+    }
+    struct rebx_node* const node = rebx_create_node(rebx);
+    if (node == NULL){
+        return NULL;
+    }
+    node->object = rebx_malloc(rebx, size);
+    if (node->object == NULL){
+        free(node);
+        return NULL;
+    }
+    memcpy(node->object, src_value, size);
+    rebx_add_node(&rebx->copied_values, node);
+    return node->object;
+}
+
+// Keys are the same in both instances, so names can be shared without looking them up
+static int rebx_copy_ap(struct rebx_extras* const rebx, struct rebx_extras* const src, struct rebx_node* const src_ap, struct rebx_node** const apptr, const struct rebx_copy_map* const map, const int skip_workspaces){
+    for (struct rebx_node* current = src_ap; current != NULL; current = current->next){
+        const struct rebx_param* const src_param = current->object;
+        if (skip_workspaces && rebx_is_workspace_param(src_param)){
+            continue;
+        }
+        struct rebx_param* const param = rebx_alloc_param(rebx);
+        if (param == NULL){
+            return 0;
+        }
+        param->type = src_param->type;
+        param->key = src_param->key;
+        param->value = NULL;
+        param->name = NULL;
+        if (param->key >= 0){
+            param->name = rebx->param_keys[param->key]->name;
+        }
+        else{
+            param->name = rebx_malloc(rebx, strlen(src_param->name) + 1);
+            if (param->name == NULL){
+                rebx_free_param(rebx, param);
+                return 0;
+            }
+            strcpy(param->name, src_param->name);
+        }
+        if (rebx_param_value_in_pool(param->type)){
+            param->value = rebx_alloc_param_value(rebx);
+            if (param->value == NULL){
+                rebx_free_param(rebx, param);
+                return 0;
+            }
+            memcpy(param->value, src_param->value, rebx_sizeof(src, param->type));
+        }
+        else if (param->type == REBX_TYPE_FORCE){
+            param->value = rebx_copy_map_force(map, src_param->value);
+        }
+        else if (param->type == REBX_TYPE_ORBIT){
+            param->value = rebx_copy_struct_value(rebx, src_param->value, sizeof(struct reb_orbit));
+            if (param->value == NULL && src_param->value != NULL){
+                rebx_free_param(rebx, param);
+                return 0;
+            }
+        }
+        else{
+            param->value = src_param->value;
+        }
+        if (!rebx_add_param(rebx, apptr, param)){
+            rebx_free_param(rebx, param);
+            return 0;
+        }
+    }
+    rebx_reverse_list(apptr);
+    return 1;
+}
+
+static int rebx_copy_steps(struct rebx_extras* const rebx, struct rebx_node* const src_steps, struct rebx_node** const steps, const struct rebx_copy_map* const map){
+    for (struct rebx_node* current = src_steps; current != NULL; current = current->next){
+        const struct rebx_step* const src_step = current->object;
+        struct rebx_step* const step = rebx_malloc(rebx, sizeof(*step));
+        if (step == NULL){
+            return 0;
+        }
+        step->operator = rebx_copy_map_operator(map, src_step->operator);
+        step->dt_fraction = src_step->dt_fraction;
+        struct rebx_node* const node = rebx_create_node(rebx);
+        if (node == NULL){
+            rebx_free_step(step);
+            return 0;
+        }
+        node->object = step;
+        rebx_add_node(steps, node);
+    }
+    rebx_reverse_list(steps);
+    return 1;
+}
+
+static int rebx_copy_forces(struct rebx_extras* const rebx, struct rebx_extras* const src, struct rebx_copy_map* const map){
+    map->src_forces = rebx_list_objects(rebx, src->allocated_forces, &map->N_forces);
+    map->dst_forces = rebx_malloc(rebx, (map->N_forces > 0 ? map->N_forces : 1)*sizeof(*map->dst_forces));
+    if (map->src_forces == NULL || map->dst_forces == NULL){
+        return 0;
+    }
+    for (int i=0; i<map->N_forces; i++){
+        const struct rebx_force* const src_force = map->src_forces[i];
+        struct rebx_force* const force = rebx_create_force(rebx, src_force->name);
+        if (force == NULL){
+            map->N_forces = i;
+            return 0;
+        }
+        force->force_type = src_force->force_type;
+        force->update_accelerations = src_force->update_accelerations;
+        map->dst_forces[i] = force;
+    }
+    return 1;
+}
+
+static int rebx_copy_operators(struct rebx_extras* const rebx, struct rebx_extras* const src, struct rebx_copy_map* const map){
+    map->src_operators = rebx_list_objects(rebx, src->allocated_operators, &map->N_operators);
+    map->dst_operators = rebx_malloc(rebx, (map->N_operators > 0 ? map->N_operators : 1)*sizeof(*map->dst_operators));
+    if (map->src_operators == NULL || map->dst_operators == NULL){
+        return 0;
+    }
+    for (int i=0; i<map->N_operators; i++){
+        const struct rebx_operator* const src_operator = map->src_operators[i];
+        struct rebx_operator* const operator = rebx_create_operator(rebx, src_operator->name);
+        if (operator == NULL){
+            map->N_operators = i;
+            return 0;
+        }
+        operator->operator_type = src_operator->operator_type;
+        operator->step_function = src_operator->step_function;
+        map->dst_operators[i] = operator;
+    }
+    return 1;
+}
+
+static int rebx_copy_contents(struct rebx_extras* const rebx, struct rebx_extras* const src, struct rebx_copy_map* const map){
+    // Register names in key order so both instances share the same keys
+    for (int key=0; key<src->N_param_keys; key++){
+        const struct rebx_param* const registered = src->param_keys[key];
+        rebx_register_param(rebx, registered->name, registered->type);
+        if (rebx->N_param_keys != key+1){
+            return 0;
+        }
+    }
+    if (!rebx_copy_forces(rebx, src, map) || !rebx_copy_operators(rebx, src, map)){
+        return 0;
+    }
+    for (int i=0; i<map->N_forces; i++){
+        if (!rebx_copy_ap(rebx, src, map->src_forces[i]->ap, &map->dst_forces[i]->ap, map, 1)){
+            return 0;
+        }
+    }
+    for (int i=0; i<map->N_operators; i++){
+        if (!rebx_copy_ap(rebx, src, map->src_operators[i]->ap, &map->dst_operators[i]->ap, map, 1)){
+            return 0;
+        }
+    }
+    struct reb_simulation* const sim = rebx->sim;
+    for (int i=0; i<sim->N; i++){
+        sim->particles[i].ap = NULL;    // may still point at the source's params if sim was copied from its simulation
+        if (!rebx_copy_ap(rebx, src, src->sim->particles[i].ap, (struct rebx_node**)&sim->particles[i].ap, map, 0)){
+            return 0;
+        }
+    }
+
+    for (struct rebx_node* current = src->additional_forces; current != NULL; current = current->next){
+        struct rebx_node* const node = rebx_create_node(rebx);
+        if (node == NULL){
+            return 0;
+        }
+        node->object = rebx_copy_map_force(map, current->object);
+        rebx_add_node(&rebx->additional_forces, node);
+    }
+    rebx_reverse_list(&rebx->additional_forces);
+    if (!rebx_copy_steps(rebx, src->pre_timestep_modifications, &rebx->pre_timestep_modifications, map) || !rebx_copy_steps(rebx, src->post_timestep_modifications, &rebx->post_timestep_modifications, map)){
+        return 0;
+    }
+    rebx->profiling = src->profiling;
+    rebx_compile_dispatch_tables(rebx);
+
+    if (rebx->additional_forces){
+        sim->additional_forces = rebx_additional_forces;
+    }
+    if (rebx->pre_timestep_modifications){
+        sim->pre_timestep_modifications = rebx_pre_timestep_modifications;
+    }
+    if (rebx->post_timestep_modifications){
+        sim->post_timestep_modifications = rebx_post_timestep_modifications;
+    }
+    return 1;
+}
+
+int rebx_init_extras_from_copy(struct rebx_extras* const rebx, struct rebx_extras* const src){
+    if (rebx->sim == NULL || src->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return 0;
+    }
+    if (rebx->sim->N != src->sim->N){
+        rebx_error(rebx, "REBOUNDx Error: Simulation passed to rebx_copy_extras must have the same number of particles as the one being copied.\n");
+        return 0;
+    }
+    if (rebx->N_param_keys != 0 || rebx->allocated_forces != NULL || rebx->allocated_operators != NULL){
+        rebx_error(rebx, "REBOUNDx Error: rebx_init_extras_from_copy needs a newly initialized rebx_extras instance.\n");
+        return 0;
+    }
+    struct rebx_copy_map map = {0};
+    const int success = rebx_copy_contents(rebx, src, &map);
+    free(map.src_forces);
+    free(map.dst_forces);
+    free(map.src_operators);
+    free(map.dst_operators);
+    return success;
+}
+
+struct rebx_extras* rebx_copy_extras(struct rebx_extras* const src, struct reb_simulation* sim){
+    if (src == NULL || sim == NULL){
+        fprintf(stderr, "REBOUNDx Error: Pointer passed to rebx_copy_extras was NULL.\n");
+        return NULL;
+    }
+    // create manually so that default registered parameters not loaded (they are copied with the rest)
+    struct rebx_extras* rebx = malloc(sizeof(*rebx));
+    if (rebx == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for rebx_copy_extras.\n");
+        return NULL;
+    }
+    rebx_initialize(sim, rebx);
+    if (!rebx_init_extras_from_copy(rebx, src)){
+        rebx_free(rebx);
+        return NULL;
+    }
+    return rebx;
+}
+
 /**********************************************
  User Interface for adding forces and operators
  *********************************************/
@@ -199,6 +636,7 @@ struct rebx_force* rebx_create_force(struct rebx_extras* const rebx, const char*
     force->sim = rebx->sim;
     force->force_type = REBX_FORCE_NONE;
     force->update_accelerations = NULL;
+    force->profile = (struct rebx_profile){0};
     force->name = NULL;
     if(name != NULL)
     {
@@ -265,6 +703,22 @@ struct rebx_force* rebx_load_force(struct rebx_extras* const rebx, const char* n
         force->update_accelerations = rebx_ephemeris_forces;
         force->force_type = REBX_FORCE_VEL;
     }
+    else if (strcmp(name, "ephemeris_forces_bary") == 0){
+        force->update_accelerations = rebx_ephemeris_forces_bary;
+        force->force_type = REBX_FORCE_VEL;
+    }
+    else if (strcmp(name, "ephemeris_forces_geo") == 0){
+        force->update_accelerations = rebx_ephemeris_forces_geo;
+        force->force_type = REBX_FORCE_VEL;
+    }
+    else if (strcmp(name, "ephemeris_forces_bary_noast") == 0){
+        force->update_accelerations = rebx_ephemeris_forces_bary_noast;
+        force->force_type = REBX_FORCE_VEL;
+    }
+    else if (strcmp(name, "ephemeris_forces_geo_noast") == 0){
+        force->update_accelerations = rebx_ephemeris_forces_geo_noast;
+        force->force_type = REBX_FORCE_VEL;
+    }
     else{
         char str[300];
         sprintf(str, "REBOUNDx error: Force '%s' not found in REBOUNDx library.\n", name);
@@ -289,11 +743,12 @@ struct rebx_operator* rebx_create_operator(struct rebx_extras* const rebx, const
     operator->sim = rebx->sim;
     operator->operator_type = REBX_OPERATOR_NONE;
     operator->step_function = NULL;
+    operator->profile = (struct rebx_profile){0};
     operator->name = NULL;
     if(name != NULL){
         operator->name = rebx_malloc(rebx, strlen(name) + 1); // +1 for \0 at end
         if (operator->name == NULL){
-            rebx_free_operator(operator);
+            rebx_free_operator(rebx, operator);
             return NULL;
         }
         else{
@@ -304,7 +759,7 @@ struct rebx_operator* rebx_create_operator(struct rebx_extras* const rebx, const
     // Add operator to allocated_operators list for later freeing
     struct rebx_node* node = rebx_create_node(rebx);
     if (node == NULL){
-        rebx_free_operator(operator);
+        rebx_free_operator(rebx, operator);
         return NULL;
     }
     node->object = operator;
@@ -358,6 +813,10 @@ struct rebx_operator* rebx_load_operator(struct rebx_extras* const rebx, const c
         operator->step_function = rebx_track_min_distance;
         operator->operator_type = REBX_OPERATOR_RECORDER;
     }
+    else if (strcmp(name, "track_energy") == 0){
+        operator->step_function = rebx_track_energy;
+        operator->operator_type = REBX_OPERATOR_RECORDER;
+    }
     else{
         char str[300];
         sprintf(str, "REBOUNDx error: Operator '%s' not found in REBOUNDx library.\n", name);
@@ -400,6 +859,7 @@ int rebx_add_force(struct rebx_extras* rebx, struct rebx_force* force){
     }
     node->object = force;
     rebx_add_node(&rebx->additional_forces, node);
+    rebx_compile_dispatch_tables(rebx);
     if (rebx->sim->additional_forces != NULL && rebx->sim->additional_forces != rebx_additional_forces){
         reb_warning(rebx->sim, "REBOUNDx Warning: additional_forces was set and is being overwritten by REBOUNDx. To incorporate both, you can add your own custom effects through REBOUNDx.  See https://github.com/dtamayo/reboundx/blob/master/ipython_examples/Custom_Effects.ipynb for a tutorial.\n");
     }
@@ -442,6 +902,7 @@ int rebx_add_operator_step(struct rebx_extras* rebx, struct rebx_operator* opera
     
     if (timing == REBX_TIMING_PRE){
         rebx_add_node(&rebx->pre_timestep_modifications, node);
+        rebx_compile_dispatch_tables(rebx);
         if (rebx->sim->pre_timestep_modifications != NULL && rebx->sim->pre_timestep_modifications != rebx_pre_timestep_modifications){
             reb_warning(rebx->sim, "REBOUNDx Warning: pre_timestep_modifications was set in the simulation and is being overwritten by REBOUNDx. To incorporate both, you can add your own custom effects through REBOUNDx.  See https://github.com/dtamayo/reboundx/blob/master/ipython_examples/Custom_Effects.ipynb for a tutorial.\n");
         }
@@ -450,6 +911,7 @@ int rebx_add_operator_step(struct rebx_extras* rebx, struct rebx_operator* opera
     }
     if (timing == REBX_TIMING_POST){
         rebx_add_node(&rebx->post_timestep_modifications, node);
+        rebx_compile_dispatch_tables(rebx);
         if (rebx->sim->post_timestep_modifications != NULL && rebx->sim->post_timestep_modifications != rebx_post_timestep_modifications){
             reb_warning(rebx->sim, "REBOUNDx Warning: post_timestep_modifications was set in the simulation and is being overwritten by REBOUNDx. To incorporate both, you can add your own custom effects through REBOUNDx.  See https://github.com/dtamayo/reboundx/blob/master/ipython_examples/Custom_Effects.ipynb for a tutorial.\n");
         }
@@ -504,6 +966,121 @@ int rebx_add_operator(struct rebx_extras* rebx, struct rebx_operator* operator){
     return 0; // didn't reach a successful outcome
 }
 
+/* Splitting schemes alternate steps of two operators A and B, starting and ending with A. The tables below give the
+ * fractions of sim->dt for each step in order (A, B, A, ..., A). Schemes built from leapfrogs are generated from their
+ * weights, with the adjacent A half steps of consecutive leapfrogs already combined.
+ */
+#define REBX_MAX_SCHEME_STEPS 32
+
+static const double rebx_yoshida4_weights[] = {1.3512071919596578, -1.7024143839193153, 1.3512071919596578};   // 1/(2-2^(1/3)), -2^(1/3)/(2-2^(1/3))
+// Yoshida (1990) solution A
+static const double rebx_yoshida6_weights[] = {0.78451361047755726, 0.23557321335935813, -1.1776799841788701, 1.3151863206839112, -1.1776799841788701, 0.23557321335935813, 0.78451361047755726};
+
+static int rebx_leapfrog_composition(const double* const weights, const int N_weights, double* const fractions){
+    int n = 0;
+    fractions[n++] = weights[0]/2.;
+    for (int i=0; i<N_weights; i++){
+        fractions[n++] = weights[i];
+        fractions[n++] = i+1 < N_weights ? (weights[i] + weights[i+1])/2. : weights[i]/2.;
+    }
+    return n;
+}
+
+// Laskar & Robutel (2001). SABAn with A the integrable part (e.g. kepler) and B the perturbation
+static int rebx_saba(const int order, double* const fractions){
+    double c[3], d[2];
+    int N_c, N_d;
+    switch (order){
+        case 1:
+            c[0] = 0.5; d[0] = 1.;
+            N_c = 1; N_d = 1;
+            break;
+        case 2:
+            c[0] = 0.5 - sqrt(3.)/6.; c[1] = sqrt(3.)/3.;
+            d[0] = 0.5;
+            N_c = 2; N_d = 1;
+            break;
+        case 3:
+            c[0] = 0.5 - sqrt(15.)/10.; c[1] = sqrt(15.)/10.;
+            d[0] = 5./18.; d[1] = 4./9.;
+            N_c = 2; N_d = 2;
+            break;
+        case 4:
+            c[0] = 0.5 - sqrt(525. + 70.*sqrt(30.))/70.;
+            c[1] = (sqrt(525. + 70.*sqrt(30.)) - sqrt(525. - 70.*sqrt(30.)))/70.;
+            c[2] = sqrt(525. - 70.*sqrt(30.))/35.;
+            d[0] = 0.25 - sqrt(30.)/72.; d[1] = 0.25 + sqrt(30.)/72.;
+            N_c = 3; N_d = 2;
+            break;
+        default:
+            return 0;
+    }
+    // A(c1) B(d1) A(c2) ... mirrored about the middle step
+    const int n = 2*(N_c + N_d) - 1;
+    for (int k=0; k<=n/2; k++){
+        const double f = k % 2 == 0 ? c[k/2] : d[k/2];
+        fractions[k] = f;
+        fractions[n-1-k] = f;
+    }
+    return n;
+}
+
+int rebx_add_splitting_scheme(struct rebx_extras* rebx, const char* scheme, struct rebx_operator* A, struct rebx_operator* B, enum rebx_timing timing){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return 0;
+    }
+    if (scheme == NULL || A == NULL || B == NULL){
+        rebx_error(rebx, "REBOUNDx error: Passed NULL pointer to rebx_add_splitting_scheme.\n");
+        return 0;
+    }
+    double fractions[REBX_MAX_SCHEME_STEPS];
+    int n = 0;
+    if (strcmp(scheme, "leapfrog") == 0){
+        const double weight = 1.;
+        n = rebx_leapfrog_composition(&weight, 1, fractions);
+    }
+    else if (strcmp(scheme, "yoshida4") == 0){
+        n = rebx_leapfrog_composition(rebx_yoshida4_weights, sizeof(rebx_yoshida4_weights)/sizeof(rebx_yoshida4_weights[0]), fractions);
+    }
+    else if (strcmp(scheme, "yoshida6") == 0){
+        n = rebx_leapfrog_composition(rebx_yoshida6_weights, sizeof(rebx_yoshida6_weights)/sizeof(rebx_yoshida6_weights[0]), fractions);
+    }
+    else if (strncmp(scheme, "saba", 4) == 0 && scheme[4] >= '1' && scheme[4] <= '4' && scheme[5] == '\0'){
+        n = rebx_saba(scheme[4] - '0', fractions);
+    }
+    if (n == 0){
+        char str[300];
+        sprintf(str, "REBOUNDx error: Splitting scheme '%.100s' not found. Options are leapfrog, yoshida4, yoshida6 and saba1 to saba4.\n", scheme);
+        rebx_error(rebx, str);
+        return 0;
+    }
+
+    // Merge adjacent steps of the same operator (A and B can be the same), dropping empty ones
+    struct rebx_operator* operators[REBX_MAX_SCHEME_STEPS];
+    int N_steps = 0;
+    for (int k=0; k<n; k++){
+        struct rebx_operator* const operator = k % 2 == 0 ? A : B;
+        if (fractions[k] == 0.){
+            continue;
+        }
+        if (N_steps > 0 && operators[N_steps-1] == operator){
+            fractions[N_steps-1] += fractions[k];
+            continue;
+        }
+        operators[N_steps] = operator;
+        fractions[N_steps] = fractions[k];
+        N_steps++;
+    }
+    // Steps are pushed onto the front of the list, so add them last to first
+    for (int k=N_steps-1; k>=0; k--){
+        if (!rebx_add_operator_step(rebx, operators[k], fractions[k], timing)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /*****************************************************************
  User interface for setting parameter values
  *****************************************************************/
@@ -533,7 +1110,7 @@ static struct rebx_param* rebx_get_or_add_param(struct rebx_extras* const rebx,
         }
         int success = rebx_add_param(rebx, apptr, param);
         if(!success){
-            rebx_free_param(param);
+            rebx_free_param(rebx, param);
             return NULL;
         }
     }
@@ -555,7 +1132,7 @@ void rebx_set_param_double(struct rebx_extras* const rebx, struct rebx_node** ap
         return;
     }
     if (param->value == NULL){ // new parameter, allocate
-        param->value = rebx_malloc(rebx, sizeof(double));
+        param->value = rebx_alloc_param_value(rebx);
     }
     // Update new or existing param value
     double* valptr = param->value;
@@ -570,7 +1147,7 @@ void rebx_set_param_int(struct rebx_extras* const rebx, struct rebx_node** apptr
         return;
     }
     if (param->value == NULL){ // new parameter, allocate
-        param->value = rebx_malloc(rebx, sizeof(int));
+        param->value = rebx_alloc_param_value(rebx);
     }
     // Update new or existing param value
     int* valptr = param->value;
@@ -585,7 +1162,7 @@ void rebx_set_param_uint32(struct rebx_extras* const rebx, struct rebx_node** ap
         return;
     }
     if (param->value == NULL){ // new parameter, allocate
-        param->value = rebx_malloc(rebx, sizeof(uint32_t));
+        param->value = rebx_alloc_param_value(rebx);
     }
     // Update new or existing param value
     uint32_t* valptr = param->value;
@@ -594,25 +1171,141 @@ void rebx_set_param_uint32(struct rebx_extras* const rebx, struct rebx_node** ap
     return;
 }
 
+/* Bulk access to a scalar param on many particles. The key is looked up once, and params that are added share the
+ * registered name, so each particle costs a walk of its (short) param list and at most two pool allocations.
+ * indices can be NULL for particles 0, 1, 2...
+ */
+static int rebx_param_array_key(struct rebx_extras* const rebx, const char* const param_name, const enum rebx_param_type type, const char* const function){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return -1;
+    }
+    const int key = rebx_get_param_key(rebx, param_name);
+    if (key < 0 || rebx->param_keys[key]->type != type){
+        char str[300];
+        snprintf(str, sizeof(str), "REBOUNDx Error: Parameter '%s' passed to %s must be registered with the matching type. See examples.\n", param_name, function);
+        rebx_error(rebx, str);
+        return -1;
+    }
+    return key;
+}
+
+static int rebx_param_array_index(struct rebx_extras* const rebx, const int* const indices, const int k, const char* const function){
+    const int i = indices ? indices[k] : k;
+    if (i < 0 || i >= rebx->sim->N){
+        char str[300];
+        snprintf(str, sizeof(str), "REBOUNDx Error: Particle index %d passed to %s is out of range.\n", i, function);
+        rebx_error(rebx, str);
+        return -1;
+    }
+    return i;
+}
+
+static void rebx_set_param_array(struct rebx_extras* const rebx, const char* const param_name, const enum rebx_param_type type, const char* const values, const size_t size, const int* const indices, const int N, const char* const function){
+    const int key = rebx_param_array_key(rebx, param_name, type, function);
+    if (key < 0){
+        return;
+    }
+    struct reb_particle* const particles = rebx->sim->particles;
+    for (int k=0; k<N; k++){
+        const int i = rebx_param_array_index(rebx, indices, k, function);
+        if (i < 0){
+            return;
+        }
+        struct rebx_param* param = rebx_get_param_struct_by_key(rebx, particles[i].ap, key);
+        if (param == NULL){
+            param = rebx_alloc_param(rebx);
+            if (param == NULL){
+                return;
+            }
+            param->name = rebx->param_keys[key]->name;
+            param->type = type;
+            param->key = key;
+            param->value = rebx_alloc_param_value(rebx);
+            if (param->value == NULL || !rebx_add_param(rebx, (struct rebx_node**)&particles[i].ap, param)){
+                rebx_free_param(rebx, param);
+                return;
+            }
+        }
+        memcpy(param->value, values + k*size, size);
+    }
+}
+
+static int rebx_get_param_array(struct rebx_extras* const rebx, const char* const param_name, const enum rebx_param_type type, char* const values, const size_t size, const int* const indices, const int N, const char* const function){
+    const int key = rebx_param_array_key(rebx, param_name, type, function);
+    if (key < 0){
+        return 0;
+    }
+    struct reb_particle* const particles = rebx->sim->particles;
+    int N_found = 0;
+    for (int k=0; k<N; k++){
+        const int i = rebx_param_array_index(rebx, indices, k, function);
+        if (i < 0){
+            return N_found;
+        }
+        const void* const value = rebx_get_param_by_key(rebx, particles[i].ap, key);
+        if (value){
+            memcpy(values + k*size, value, size);
+            N_found++;
+        }
+    }
+    return N_found;
+}
+
+void rebx_set_param_double_array(struct rebx_extras* const rebx, const char* const param_name, const double* const values, const int* const indices, const int N){
+    rebx_set_param_array(rebx, param_name, REBX_TYPE_DOUBLE, (const char*)values, sizeof(*values), indices, N, "rebx_set_param_double_array");
+}
+
+void rebx_set_param_int_array(struct rebx_extras* const rebx, const char* const param_name, const int* const values, const int* const indices, const int N){
+    rebx_set_param_array(rebx, param_name, REBX_TYPE_INT, (const char*)values, sizeof(*values), indices, N, "rebx_set_param_int_array");
+}
+
+int rebx_get_param_double_array(struct rebx_extras* const rebx, const char* const param_name, double* const values, const int* const indices, const int N){
+    return rebx_get_param_array(rebx, param_name, REBX_TYPE_DOUBLE, (char*)values, sizeof(*values), indices, N, "rebx_get_param_double_array");
+}
+
+int rebx_get_param_int_array(struct rebx_extras* const rebx, const char* const param_name, int* const values, const int* const indices, const int N){
+    return rebx_get_param_array(rebx, param_name, REBX_TYPE_INT, (char*)values, sizeof(*values), indices, N, "rebx_get_param_int_array");
+}
+
 /*******************************************************************
  User interface for getting REBOUNDx objects and parameters
  *******************************************************************/
 
-struct rebx_param* rebx_get_param_struct(struct rebx_extras* rebx, struct rebx_node* ap, const char* const param_name){
+int rebx_get_param_key(struct rebx_extras* const rebx, const char* const param_name){
+    if (rebx->N_param_key_hash == 0){
+        return -1;
+    }
+    const unsigned long mask = (unsigned long)rebx->N_param_key_hash - 1;
+    unsigned long slot = rebx_hash_name(param_name) & mask;
+    while (rebx->param_key_hash[slot] != 0){
+        const int key = rebx->param_key_hash[slot] - 1;
+        if (strcmp(rebx->param_keys[key]->name, param_name) == 0){
+            return key;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;  // name not registered
+}
+
+struct rebx_param* rebx_get_param_struct_by_key(struct rebx_extras* const rebx, struct rebx_node* ap, const int key){
+    if (key < 0){
+        return NULL;
+    }
     struct rebx_node* current = ap;
     while(current != NULL){
         struct rebx_param* param = current->object;
-        if(strcmp(param->name, param_name) == 0){
+        if(param->key == key){
             return param;
         }
         current = current->next;
     }
     
-    return NULL;   // name not found. Don't want warnings for optional parameters so don't reb_error
+    return NULL;   // key not found. Don't want warnings for optional parameters so don't reb_error
 }
 
-void* rebx_get_param(struct rebx_extras* rebx, struct rebx_node* ap, const char* const param_name){
-    struct rebx_param* param = rebx_get_param_struct(rebx, ap, param_name);
+void* rebx_get_param_by_key(struct rebx_extras* const rebx, struct rebx_node* ap, const int key){
+    struct rebx_param* param = rebx_get_param_struct_by_key(rebx, ap, key);
     if (param == NULL){
         return NULL;
     }
@@ -621,6 +1314,20 @@ void* rebx_get_param(struct rebx_extras* rebx, struct rebx_node* ap, const char*
     }
 }
 
+struct rebx_param* rebx_get_param_struct(struct rebx_extras* rebx, struct rebx_node* ap, const char* const param_name){
+    if (ap == NULL){
+        return NULL;
+    }
+    return rebx_get_param_struct_by_key(rebx, ap, rebx_get_param_key(rebx, param_name));
+}
+
+void* rebx_get_param(struct rebx_extras* rebx, struct rebx_node* ap, const char* const param_name){
+    if (ap == NULL){    // skip the key lookup for particles without params
+        return NULL;
+    }
+    return rebx_get_param_by_key(rebx, ap, rebx_get_param_key(rebx, param_name));
+}
+
 struct rebx_force* rebx_get_force(struct rebx_extras* const rebx, const char* const name){
     struct rebx_node* current = rebx->allocated_forces;
     while(current != NULL){
@@ -658,6 +1365,7 @@ int rebx_remove_force(struct rebx_extras* rebx, struct rebx_force* force){
     }
     // success only cares about removal from add_forces that affects sim
     int success = rebx_remove_node(&rebx->additional_forces, force);
+    rebx_compile_dispatch_tables(rebx);
     return success;
 }
 
@@ -697,7 +1405,7 @@ static int rebx_remove_step_node(struct rebx_node** head, struct rebx_operator*
 int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operator){
     int allocated = rebx_remove_node(&rebx->allocated_operators, operator);
     if(allocated){
-        rebx_free_operator(operator);
+        rebx_free_operator(rebx, operator);
         
     }
     
@@ -719,6 +1427,7 @@ int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operato
             success = 1;
         }
     }
+    rebx_compile_dispatch_tables(rebx);
     
     return success;
 }
@@ -737,51 +1446,256 @@ void* rebx_malloc(struct rebx_extras* const rebx, size_t memsize){
     return ptr;
 }
 
-void rebx_free_param(struct rebx_param* param){
-    if(param->name){
+#define REBX_POOL_FIRST_BLOCK 256          // objects in a pool's first block
+#define REBX_POOL_MAX_BLOCK 65536           // block size doubles up to this many objects
+
+static void rebx_init_pool(struct rebx_pool* const pool, const size_t size){
+    const size_t align = sizeof(double);
+    pool->size = (size + align - 1)/align*align;    // objects must also be able to hold a free list pointer
+    if (pool->size < sizeof(void*)){
+        pool->size = sizeof(void*);
+    }
+    pool->N_per_block = REBX_POOL_FIRST_BLOCK;
+    pool->free_list = NULL;
+    pool->cursor = NULL;
+    pool->end = NULL;
+    pool->blocks = NULL;
+}
+
+static void* rebx_pool_alloc(struct rebx_extras* const rebx, struct rebx_pool* const pool){
+    if (pool->free_list != NULL){
+        void* ptr = pool->free_list;
+        pool->free_list = *(void**)ptr;
+        return ptr;
+    }
+    if (pool->cursor == pool->end){
+        struct rebx_pool_block* block = malloc(sizeof(*block) + pool->N_per_block*pool->size);
+        if (block == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory.\n");
+            return NULL;
+        }
+        block->next = pool->blocks;
+        pool->blocks = block;
+        pool->cursor = (char*)(block + 1);
+        pool->end = pool->cursor + pool->N_per_block*pool->size;
+        if (pool->N_per_block < REBX_POOL_MAX_BLOCK){
+            pool->N_per_block *= 2;
+        }
+    }
+    void* ptr = pool->cursor;
+    pool->cursor += pool->size;
+    return ptr;
+}
+
+static void rebx_pool_free(struct rebx_pool* const pool, void* ptr){
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+}
+
+static void rebx_release_pool(struct rebx_pool* const pool){
+    struct rebx_pool_block* block = pool->blocks;
+    while (block != NULL){
+        struct rebx_pool_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    rebx_init_pool(pool, pool->size);
+}
+
+struct rebx_arena* rebx_create_arena(void){
+    struct rebx_arena* arena = malloc(sizeof(*arena));
+    if (arena == NULL){
+        return NULL;
+    }
+    rebx_init_pool(&arena->nodes, sizeof(struct rebx_node));
+    rebx_init_pool(&arena->params, sizeof(struct rebx_param));
+    rebx_init_pool(&arena->values, sizeof(double));
+    return arena;
+}
+
+void rebx_free_arena(struct rebx_arena* arena){
+    if (arena == NULL){
+        return;
+    }
+    rebx_release_pool(&arena->nodes);
+    rebx_release_pool(&arena->params);
+    rebx_release_pool(&arena->values);
+    free(arena);
+}
+
+struct rebx_param* rebx_alloc_param(struct rebx_extras* const rebx){
+    return rebx_pool_alloc(rebx, &rebx->arena->params);
+}
+
+// Values of these types are owned by the param and fit in a values pool slot
+int rebx_param_value_in_pool(const enum rebx_param_type type){
+    return (type == REBX_TYPE_DOUBLE || type == REBX_TYPE_INT || type == REBX_TYPE_UINT32);
+}
+
+void* rebx_alloc_param_value(struct rebx_extras* const rebx){
+    return rebx_pool_alloc(rebx, &rebx->arena->values);
+}
+
+// Params attached to objects point at the name stored in the registered param with the same key
+static int rebx_param_owns_name(struct rebx_extras* const rebx, const struct rebx_param* const param){
+    return (param->key < 0 || rebx->param_keys[param->key] == param);
+}
+
+void rebx_free_param(struct rebx_extras* const rebx, struct rebx_param* param){
+    if(param->name && rebx_param_owns_name(rebx, param)){
         free(param->name);
     }
     // Don't free pointers to structs
-    if(param->type == REBX_TYPE_INT || param->type == REBX_TYPE_DOUBLE){
+    if(rebx_param_value_in_pool(param->type)){
         if(param->value){
-            free(param->value);
+            rebx_pool_free(&rebx->arena->values, param->value);
         }
     }
-    free(param);
+    rebx_pool_free(&rebx->arena->params, param);
 }
 
-void rebx_free_ap(struct rebx_node** ap){
+void rebx_free_ap(struct rebx_extras* const rebx, struct rebx_node** ap){
     struct rebx_node* current = *ap;
     struct rebx_node* next;
     while (current != NULL){
         next = current->next;
-        rebx_free_param(current->object);
-        free(current);
+        rebx_free_param(rebx, current->object);
+        rebx_pool_free(&rebx->arena->nodes, current);
         current = next;
     }
+    *ap = NULL;
 }
 
 void rebx_free_particle_ap(struct reb_particle* p){
-    rebx_free_ap(&p->ap);
+    if (p->sim == NULL || p->sim->extras == NULL){ // can't reach the pools. Memory is reclaimed when the arena is freed
+        p->ap = NULL;
+        return;
+    }
+    struct rebx_extras* const rebx = p->sim->extras;
+    rebx->param_generation++;   // particle removed, so cached particle lists are stale
+    rebx_free_ap(rebx, (struct rebx_node**)&p->ap);
+}
+
+/* A force can hold workspaces of its own as well as ones set up by the integrators it is passed to,
+ * so their free functions are kept in a chain and all called when the force is freed.
+ */
+struct rebx_free_arrays_chain{
+    void (*free_arrays)(struct rebx_extras* rebx, struct rebx_force* force);
+    struct rebx_free_arrays_chain* next;
+};
+
+void rebx_add_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force, void (*free_arrays)(struct rebx_extras* rebx, struct rebx_force* force)){
+    struct rebx_free_arrays_chain* const head = rebx_get_param(rebx, force->ap, "free_arrays_chain");
+    for (struct rebx_free_arrays_chain* link = head; link != NULL; link = link->next){
+        if (link->free_arrays == free_arrays){
+            return;
+        }
+    }
+    struct rebx_free_arrays_chain* const link = rebx_malloc(rebx, sizeof(*link));
+    if (link == NULL){
+        return;
+    }
+    link->free_arrays = free_arrays;
+    link->next = head;
+    rebx_set_param_pointer(rebx, &force->ap, "free_arrays_chain", link);
 }
 
 void rebx_free_force(struct rebx_extras* rebx, struct rebx_force* force){
-    void (*free_arrays)(struct rebx_extras* rebx, struct rebx_force* force) = rebx_get_param(rebx, force->ap, "free_arrays");
+    struct rebx_free_arrays_chain* link = rebx_get_param(rebx, force->ap, "free_arrays_chain");
+    while (link != NULL){
+        struct rebx_free_arrays_chain* const next = link->next;
+        link->free_arrays(rebx, force);
+        free(link);
+        link = next;
+    }
+    void (*free_arrays)(struct rebx_extras* rebx, struct rebx_force* force) = rebx_get_param(rebx, force->ap, "free_arrays"); // set directly by custom effects
     if (free_arrays){
         free_arrays(rebx, force);
     }
     if(force->name){
         free(force->name);
     }
-    rebx_free_ap(&force->ap);
+    rebx_free_ap(rebx, &force->ap);
     free(force);
 }
 
-void rebx_free_operator(struct rebx_operator* operator){
+static void rebx_free_integrator_workspace(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_integrator_workspace* const ws = rebx_get_param(rebx, force->ap, "integrator_workspace");
+    if (ws){
+        free(ws->stage);
+        free(ws->vectors);
+    }
+    free(ws);
+}
+
+/* The integrators only change velocities, so they need full particles just for the stages the force is evaluated on,
+ * and keep everything else in compact 3N vectors. Buffers grow as needed and are reused across calls and integrators.
+ */
+struct rebx_integrator_workspace* rebx_get_integrator_workspace(struct reb_simulation* const sim, struct rebx_force* const force, const int N, const int N_vectors){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_integrator_workspace* ws = rebx_get_param(rebx, force->ap, "integrator_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for integrator workspace.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "integrator_workspace", ws);
+        rebx_add_free_arrays(rebx, force, rebx_free_integrator_workspace);
+    }
+    if (ws->N_allocated < N || ws->N_vectors < N_vectors){
+        const int N_new = N > ws->N_allocated ? N : ws->N_allocated;
+        const int N_vectors_new = N_vectors > ws->N_vectors ? N_vectors : ws->N_vectors;
+        free(ws->stage);
+        free(ws->vectors);
+        ws->stage = malloc(N_new*sizeof(*ws->stage));
+        ws->vectors = malloc((N_vectors_new > 0 ? N_vectors_new : 1)*3*N_new*sizeof(*ws->vectors));
+        if (ws->stage == NULL || ws->vectors == NULL){
+            free(ws->stage);
+            free(ws->vectors);
+            *ws = (struct rebx_integrator_workspace){0};
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for integrator workspace.\n");
+            return NULL;
+        }
+        ws->N_allocated = N_new;
+        ws->N_vectors = N_vectors_new;
+    }
+    return ws;
+}
+
+struct rebx_operator_free_arrays_chain{
+    void (*free_arrays)(struct rebx_extras* rebx, struct rebx_operator* operator);
+    struct rebx_operator_free_arrays_chain* next;
+};
+
+void rebx_add_operator_free_arrays(struct rebx_extras* const rebx, struct rebx_operator* const operator, void (*free_arrays)(struct rebx_extras* rebx, struct rebx_operator* operator)){
+    struct rebx_operator_free_arrays_chain* const head = rebx_get_param(rebx, operator->ap, "free_arrays_chain");
+    for (struct rebx_operator_free_arrays_chain* link = head; link != NULL; link = link->next){
+        if (link->free_arrays == free_arrays){
+            return;
+        }
+    }
+    struct rebx_operator_free_arrays_chain* const link = rebx_malloc(rebx, sizeof(*link));
+    if (link == NULL){
+        return;
+    }
+    link->free_arrays = free_arrays;
+    link->next = head;
+    rebx_set_param_pointer(rebx, &operator->ap, "free_arrays_chain", link);
+}
+
+void rebx_free_operator(struct rebx_extras* rebx, struct rebx_operator* operator){
+    struct rebx_operator_free_arrays_chain* link = rebx_get_param(rebx, operator->ap, "free_arrays_chain");
+    while (link != NULL){
+        struct rebx_operator_free_arrays_chain* const next = link->next;
+        link->free_arrays(rebx, operator);
+        free(link);
+        link = next;
+    }
     if(operator->name){
         free(operator->name);
     }
-    rebx_free_ap(&operator->ap);
+    rebx_free_ap(rebx, &operator->ap);
     free(operator);
 }
 
@@ -789,17 +1703,11 @@ void rebx_free_step(struct rebx_step* step){
     free(step);
 }
 
-void rebx_free_reg_param(struct rebx_param* param){
-    if(param->name){
-        free(param->name);
-    }
-    free(param);
-}
-
 void rebx_free_pointers(struct rebx_extras* rebx){
     if (rebx == NULL){
         return;
     }
+    struct reb_simulation* const sim = rebx->sim;
     rebx_detach(rebx->sim, rebx);
     struct rebx_node* current;
     struct rebx_node* next;
@@ -815,7 +1723,7 @@ void rebx_free_pointers(struct rebx_extras* rebx){
     current = rebx->allocated_operators;
     while (current != NULL){
         next = current->next;
-        rebx_free_operator(current->object);
+        rebx_free_operator(rebx, current->object);
         free(current);
         current = next;
     }
@@ -844,13 +1752,35 @@ void rebx_free_pointers(struct rebx_extras* rebx){
         current = next;
     }
     
-    current = rebx->registered_params;
+    current = rebx->copied_values;
     while (current != NULL){
         next = current->next;
-        rebx_free_reg_param(current->object);
+        free(current->object);
         free(current);
         current = next;
     }
+    rebx->copied_values = NULL;
+    rebx->var_order_warned = 0;
+    
+    // Particle params live in the arena. Releasing it below frees them in bulk, so just unlink them
+    if (sim != NULL){
+        for (int i=0; i<sim->N; i++){
+            sim->particles[i].ap = NULL;
+        }
+    }
+    
+    rebx_free_ap(rebx, &rebx->registered_params);
+    free(rebx->param_keys);
+    free(rebx->param_key_hash);
+    rebx->param_keys = NULL;
+    rebx->param_key_hash = NULL;
+    rebx->N_param_keys = 0;
+    rebx->N_allocated_param_keys = 0;
+    rebx->N_param_key_hash = 0;
+    rebx_free_particle_lists(rebx);
+    rebx_free_arena(rebx->arena);
+    rebx->arena = NULL;
+    rebx_free_dispatch_tables(rebx);
 }
 
 /**********************************************
@@ -865,52 +1795,323 @@ void rebx_reset_accelerations(struct reb_particle* const ps, const int N){
     }
 }
 
-void rebx_additional_forces(struct reb_simulation* sim){
-    struct rebx_extras* rebx = sim->extras;
-    struct rebx_node* current = rebx->additional_forces;
-    while(current != NULL){
-        /*if(sim->force_is_velocity_dependent && sim->integrator==REB_INTEGRATOR_WHFAST){
-         reb_warning(sim, "REBOUNDx: Passing a velocity-dependent force to WHFAST. Need to apply as an operator.");
-         }*/
-        struct rebx_force* force = current->object;
-        const double N = sim->N - sim->N_var;
-        force->update_accelerations(sim, force, sim->particles, N);
-        current = current->next;
+// Flattens additional_forces and the step lists (in list order) so the per-step callbacks don't chase pointers
+// or re-validate operators. Called whenever one of the lists changes.
+static int rebx_compile_steps(struct rebx_extras* const rebx, struct rebx_node* const head, struct rebx_dispatch_table* const table){
+    const int N = rebx_len(head);
+    struct rebx_step_entry* entries = NULL;
+    if (N > 0){
+        entries = realloc(table->entries, N*sizeof(*entries));
+        if (entries == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for operator dispatch table.\n");
+            free(table->entries);
+            *table = (struct rebx_dispatch_table){0};
+            return 0;
+        }
     }
+    else{
+        free(table->entries);
+    }
+    table->N_updaters = 0;
+    int i = 0;
+    for (struct rebx_node* current = head; current != NULL; current = current->next){
+        struct rebx_step* const step = current->object;
+        entries[i].step_function = step->operator->step_function;
+        entries[i].operator = step->operator;
+        entries[i].dt_fraction = step->dt_fraction;
+        if (step->operator->operator_type == REBX_OPERATOR_UPDATER){
+            table->N_updaters++;
+        }
+        i++;
+    }
+    table->entries = entries;
+    table->N = N;
+    return 1;
 }
 
-void rebx_pre_timestep_modifications(struct reb_simulation* sim){
-    struct rebx_extras* rebx = sim->extras;
-    struct rebx_node* current = rebx->pre_timestep_modifications;
-    const double dt = sim->dt;
+// Forces whose per-particle work only depends on the separation from a source particle, and can share one sweep over the particles
+static rebx_source_terms_function rebx_get_source_terms_function(void (*update_accelerations) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N)){
+    if (update_accelerations == rebx_gr_potential){
+        return rebx_gr_potential_source_terms;
+    }
+    if (update_accelerations == rebx_gravitational_harmonics){
+        return rebx_gravitational_harmonics_source_terms;
+    }
+    if (update_accelerations == rebx_tides_precession){
+        return rebx_tides_precession_source_terms;
+    }
+    if (update_accelerations == rebx_central_force){
+        return rebx_central_force_source_terms;
+    }
+    if (update_accelerations == rebx_radiation_forces){
+        return rebx_radiation_forces_source_terms;
+    }
+    return NULL;
+}
+
+// Forces with analytic first order variational equations. Others leave REBOUND's variational particles alone
+static void (*rebx_get_variations_function(void (*update_accelerations) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N))) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    if (update_accelerations == rebx_gr){
+        return rebx_gr_variations;
+    }
+    if (update_accelerations == rebx_gr_potential){
+        return rebx_gr_potential_variations;
+    }
+    if (update_accelerations == rebx_gravitational_harmonics){
+        return rebx_gravitational_harmonics_variations;
+    }
+    if (update_accelerations == rebx_tides_precession){
+        return rebx_tides_precession_variations;
+    }
+    return NULL;
+}
+
+static void rebx_set_force_entry(struct rebx_force_entry* const entry, struct rebx_force* const force){
+    entry->update_accelerations = force->update_accelerations;
+    entry->force = force;
+    entry->source_terms = rebx_get_source_terms_function(force->update_accelerations);
+    entry->update_variations = rebx_get_variations_function(force->update_accelerations);
+}
+
+// update_accelerations and step_function can be reassigned after the effect was added (e.g. from Python), so the
+// entries are checked against their force or operator on every call. This is one comparison per entry
+static void rebx_refresh_force_entries(struct rebx_force_entry* const entries, const int N_forces){
+    for (int i=0; i<N_forces; i++){
+        if (entries[i].update_accelerations != entries[i].force->update_accelerations){
+            rebx_set_force_entry(&entries[i], entries[i].force);
+        }
+    }
+}
+
+static void rebx_refresh_step_entries(struct rebx_step_entry* const entries, const int N_steps){
+    for (int i=0; i<N_steps; i++){
+        entries[i].step_function = entries[i].operator->step_function;
+    }
+}
+
+void rebx_compile_dispatch_tables(struct rebx_extras* const rebx){
+    struct rebx_dispatch_table* const table = &rebx->force_table;
+    const int N = rebx_len(rebx->additional_forces);
+    struct rebx_force_entry* entries = NULL;
+    if (N > 0){
+        entries = realloc(table->entries, N*sizeof(*entries));
+        if (entries == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for force dispatch table.\n");
+            free(table->entries);
+            *table = (struct rebx_dispatch_table){0};
+            return;
+        }
+    }
+    else{
+        free(table->entries);
+    }
+    int i = 0;
+    for (struct rebx_node* current = rebx->additional_forces; current != NULL; current = current->next){
+        rebx_set_force_entry(&entries[i], current->object);
+        i++;
+    }
+    table->entries = entries;
+    table->N = N;
     
-    while(current != NULL){
-        struct rebx_step* step = current->object;
-        struct rebx_operator* operator = step->operator;
-        if(sim->integrator==REB_INTEGRATOR_IAS15 && sim->ri_ias15.epsilon != 0 && operator->operator_type == REBX_OPERATOR_UPDATER){
-            reb_warning(sim, "REBOUNDx: Operators that affect particle trajectories with adaptive timesteps can give spurious results. Use sim.ri_ias15.epsilon=0 for fixed timestep with IAS, or use a different integrator.");
+    rebx_compile_steps(rebx, rebx->pre_timestep_modifications, &rebx->pre_table);
+    rebx_compile_steps(rebx, rebx->post_timestep_modifications, &rebx->post_table);
+}
+
+void rebx_free_dispatch_tables(struct rebx_extras* const rebx){
+    free(rebx->force_table.entries);
+    free(rebx->pre_table.entries);
+    free(rebx->post_table.entries);
+    rebx->force_table = (struct rebx_dispatch_table){0};
+    rebx->pre_table = (struct rebx_dispatch_table){0};
+    rebx->post_table = (struct rebx_dispatch_table){0};
+}
+
+/**********************************************
+ Profiling
+ *********************************************/
+
+// Monotonic nanosecond clock where available. Many effects take only microseconds per call
+static double rebx_walltime(void){
+#ifdef CLOCK_MONOTONIC
+    struct timespec tim;
+    clock_gettime(CLOCK_MONOTONIC, &tim);
+    return tim.tv_sec + (tim.tv_nsec/1e9);
+#else
+    struct timeval tim;
+    gettimeofday(&tim, NULL);
+    return tim.tv_sec + (tim.tv_usec/1e6);
+#endif
+}
+
+static inline void rebx_profile_add(struct rebx_profile* const profile, const double start, const int N){
+    profile->N_calls++;
+    profile->walltime += rebx_walltime() - start;
+    profile->N_particles += N;
+}
+
+void rebx_enable_profiling(struct rebx_extras* const rebx, const int enable){
+    rebx->profiling = enable;
+}
+
+void rebx_reset_profiles(struct rebx_extras* const rebx){
+    for (struct rebx_node* current = rebx->allocated_forces; current != NULL; current = current->next){
+        struct rebx_force* const force = current->object;
+        force->profile = (struct rebx_profile){0};
+    }
+    for (struct rebx_node* current = rebx->allocated_operators; current != NULL; current = current->next){
+        struct rebx_operator* const operator = current->object;
+        operator->profile = (struct rebx_profile){0};
+    }
+    rebx->fused_profile = (struct rebx_profile){0};
+}
+
+// Separate loop so the unprofiled path has no per-force overhead
+static void rebx_profiled_forces(struct reb_simulation* const sim, const struct rebx_force_entry* const entries, const int N_forces, const int N){
+    for (int i=0; i<N_forces; i++){
+        const double start = rebx_walltime();
+        entries[i].update_accelerations(sim, entries[i].force, sim->particles, N);
+        rebx_profile_add(&entries[i].force->profile, start, N);
+    }
+}
+
+static int rebx_force_is_fused(struct rebx_extras* const rebx, const struct rebx_force_entry* const entry, const int fused_key){
+    if (entry->source_terms == NULL){
+        return 0;
+    }
+    const int* const fused = rebx_get_param_by_key(rebx, entry->force->ap, fused_key);
+    return fused != NULL && *fused != 0;
+}
+
+static void rebx_flush_source_terms(struct rebx_extras* const rebx, struct rebx_source_term* const terms, int* const N_terms, struct reb_particle* const particles, const int N, const int profiling){
+    if (*N_terms == 0){
+        return;
+    }
+    const double start = profiling ? rebx_walltime() : 0.;
+    rebx_fused_source_forces(terms, *N_terms, particles, N);
+    if (profiling){
+        rebx_profile_add(&rebx->fused_profile, start, N);
+    }
+    *N_terms = 0;
+}
+
+static void rebx_apply_forces(struct reb_simulation* const sim, const struct rebx_force_entry* const entries, const int N_forces, const int N, const int profiling){
+    struct rebx_extras* const rebx = sim->extras;
+    
+    // Forces with "fused" set collect their per-source terms, which are then applied in one sweep per source particle
+    const int fused_key = rebx_get_param_key(rebx, "fused");
+    int N_fused = 0;
+    for (int i=0; i<N_forces; i++){
+        if (rebx_force_is_fused(rebx, &entries[i], fused_key)){
+            N_fused++;
         }
-        operator->step_function(sim, operator, dt*step->dt_fraction);
-        current = current->next;
     }
+    if (N_fused < 2){
+        if (profiling){
+            rebx_profiled_forces(sim, entries, N_forces, N);
+            return;
+        }
+        for (int i=0; i<N_forces; i++){
+            entries[i].update_accelerations(sim, entries[i].force, sim->particles, N);
+        }
+        return;
+    }
+    
+    // Only consecutive fused forces share a sweep. The pending terms are applied before any other force runs, so
+    // forces that read the accelerations (e.g. gr with use_sim_accelerations) see them in list order
+    struct rebx_source_term terms[REBX_MAX_SOURCE_TERMS];
+    int N_terms = 0;
+    for (int i=0; i<N_forces; i++){
+        const double start = profiling ? rebx_walltime() : 0.;
+        if (rebx_force_is_fused(rebx, &entries[i], fused_key)){
+            const int N_new = entries[i].source_terms(sim, entries[i].force, sim->particles, N, terms + N_terms, REBX_MAX_SOURCE_TERMS - N_terms);
+            if (N_new >= 0){
+                N_terms += N_new;
+                if (profiling){
+                    rebx_profile_add(&entries[i].force->profile, start, N);
+                }
+                continue;
+            }
+        }
+        rebx_flush_source_terms(rebx, terms, &N_terms, sim->particles, N, profiling);
+        const double start_force = profiling ? rebx_walltime() : 0.;
+        entries[i].update_accelerations(sim, entries[i].force, sim->particles, N);
+        if (profiling){
+            rebx_profile_add(&entries[i].force->profile, start_force, N);
+        }
+    }
+    rebx_flush_source_terms(rebx, terms, &N_terms, sim->particles, N, profiling);
 }
 
-void rebx_post_timestep_modifications(struct reb_simulation* sim){
-    struct rebx_extras* rebx = sim->extras;
-    struct rebx_node* current = rebx->post_timestep_modifications;
+// Runs after all the forces were applied to the real particles, with either path above
+static void rebx_variational_forces(struct reb_simulation* const sim, const struct rebx_force_entry* const entries, const int N_forces, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    for (int v=0; v<sim->var_config_N && !rebx->var_order_warned; v++){
+        if (sim->var_config[v].order != 1){
+            reb_warning(sim, "REBOUNDx Warning: REBOUNDx forces only add first order variational equations.  Second order variations are ignored.");
+            rebx->var_order_warned = 1;     // once per instance rather than on every force evaluation
+        }
+    }
+    for (int i=0; i<N_forces; i++){
+        if (entries[i].update_variations){
+            entries[i].update_variations(sim, entries[i].force, sim->particles, N);
+        }
+    }
+}
+
+void rebx_additional_forces(struct reb_simulation* sim){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_force_entry* const entries = rebx->force_table.entries;
+    const int N_forces = rebx->force_table.N;
+    const int N = sim->N - sim->N_var;
+    rebx_refresh_force_entries(entries, N_forces);
+    rebx_apply_forces(sim, entries, N_forces, N, rebx->profiling);
+    if (sim->var_config_N > 0){
+        rebx_variational_forces(sim, entries, N_forces, N);
+    }
+}
+
+void rebx_real_particle_forces(struct reb_simulation* sim){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_force_entry* const entries = rebx->force_table.entries;
+    const int N_forces = rebx->force_table.N;
+    rebx_refresh_force_entries(entries, N_forces);
+    rebx_apply_forces(sim, entries, N_forces, sim->N - sim->N_var, 0);
+}
+
+static void rebx_run_steps(struct reb_simulation* const sim, const struct rebx_dispatch_table* const table){
+    struct rebx_step_entry* const entries = table->entries;
+    const int N_steps = table->N;
     const double dt = sim->dt;
+    rebx_refresh_step_entries(entries, N_steps);
     
-    while(current != NULL){
-        struct rebx_step* step = current->object;
-        struct rebx_operator* operator = step->operator;
-        if(sim->integrator==REB_INTEGRATOR_IAS15 && sim->ri_ias15.epsilon != 0 && operator->operator_type == REBX_OPERATOR_UPDATER){
-            reb_warning(sim, "REBOUNDx: Operators that affect particle trajectories with adaptive timesteps can give spurious results. Use sim.ri_ias15.epsilon=0 for fixed timestep with IAS, or use a different integrator.");
+    // Integrator can change after operators are added, so this is checked once per call rather than per operator
+    if(table->N_updaters > 0 && sim->integrator==REB_INTEGRATOR_IAS15 && sim->ri_ias15.epsilon != 0){
+        reb_warning(sim, "REBOUNDx: Operators that affect particle trajectories with adaptive timesteps can give spurious results. Use sim.ri_ias15.epsilon=0 for fixed timestep with IAS, or use a different integrator.");
+    }
+    struct rebx_extras* const rebx = sim->extras;
+    if (rebx->profiling){
+        for (int i=0; i<N_steps; i++){
+            const double start = rebx_walltime();
+            entries[i].step_function(sim, entries[i].operator, dt*entries[i].dt_fraction);
+            rebx_profile_add(&entries[i].operator->profile, start, sim->N - sim->N_var);
         }
-        operator->step_function(sim, operator, dt*step->dt_fraction);
-        current = current->next;
+        return;
+    }
+    for (int i=0; i<N_steps; i++){
+        entries[i].step_function(sim, entries[i].operator, dt*entries[i].dt_fraction);
     }
 }
 
+void rebx_pre_timestep_modifications(struct reb_simulation* sim){
+    struct rebx_extras* rebx = sim->extras;
+    rebx_run_steps(sim, &rebx->pre_table);
+}
+
+void rebx_post_timestep_modifications(struct reb_simulation* sim){
+    struct rebx_extras* rebx = sim->extras;
+    rebx_run_steps(sim, &rebx->post_table);
+}
+
 /****************************************************************
  Internal functions for dealing with parameters
  ****************************************************************/
@@ -927,14 +2128,20 @@ struct rebx_node* rebx_create_node(struct rebx_extras* rebx){
 
 struct rebx_param* rebx_create_param(struct rebx_extras* rebx, const char* name, enum rebx_param_type type){
     // Allocate and initialize new param struct
-    struct rebx_param* param = rebx_malloc(rebx, sizeof(*param));
+    struct rebx_param* param = rebx_alloc_param(rebx);
     if (param == NULL){
         return NULL;
     }
     param->type = type;
     param->value = NULL;
+    param->key = rebx_get_param_key(rebx, name);
+    if (param->key >= 0){   // share the name stored once in the registered param
+        param->name = rebx->param_keys[param->key]->name;
+        return param;
+    }
     param->name = rebx_malloc(rebx, strlen(name) + 1); // +1 for \0 at end
     if (param->name == NULL){
+        rebx_pool_free(&rebx->arena->params, param);
         return NULL;
     }
     else{
@@ -945,24 +2152,27 @@ struct rebx_param* rebx_create_param(struct rebx_extras* rebx, const char* name,
 }
 
 int rebx_add_param(struct rebx_extras* const rebx, struct rebx_node** apptr, struct rebx_param* param){
-    struct rebx_node* node = rebx_create_node(rebx);
+    struct rebx_node* node = rebx_pool_alloc(rebx, &rebx->arena->nodes);
     if (node == NULL){
         return 0;
     }
+    node->object = NULL;
+    node->next = NULL;
     node->object = param;
     rebx_add_node(apptr, node);
+    rebx->param_generation++;
     return 1;
 }
 
 // needed from Python
 enum rebx_param_type rebx_get_type(struct rebx_extras* rebx, const char* name){
-    struct rebx_param* param = rebx_get_param_struct(rebx, rebx->registered_params, name);
+    const int key = rebx_get_param_key(rebx, name);
     
-    if (param == NULL){ // param not found
+    if (key < 0){ // param not found
         return REBX_TYPE_NONE;
     }
     
-    return param->type;
+    return rebx->param_keys[key]->type;
 }
 
 size_t rebx_sizeof(struct rebx_extras* rebx, enum rebx_param_type type){
@@ -975,6 +2185,10 @@ size_t rebx_sizeof(struct rebx_extras* rebx, enum rebx_param_type type){
         {
             return sizeof(int);
         }
+        case REBX_TYPE_UINT32:
+        {
+            return sizeof(uint32_t);
+        }
         case REBX_TYPE_FORCE:
         {
             return sizeof(struct rebx_force);
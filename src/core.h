@@ -50,6 +50,7 @@ void rebx_register_default_params(struct rebx_extras* rebx); // Registers defaul
  *********************************************/
 
 void rebx_additional_forces(struct reb_simulation* sim);                       // Calls all the forces that have been added to the simulation.
+void rebx_real_particle_forces(struct reb_simulation* sim);                   // Adds the accelerations of the added forces to the real particles only, without profiling.
 void rebx_pre_timestep_modifications(struct reb_simulation* sim);   // Calls all the pre-timestep modifications that have been added to the simulation.
 void rebx_post_timestep_modifications(struct reb_simulation* sim);  // Calls all the post-timestep modifications that have been added to the simulation.
 
@@ -72,6 +73,16 @@ void rebx_tides_precession(struct reb_simulation* const sim, struct rebx_force*
 void rebx_central_force(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
 void rebx_gravitational_harmonics(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
 void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_ephemeris_forces_bary(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_ephemeris_forces_geo(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_ephemeris_forces_bary_noast(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_ephemeris_forces_geo_noast(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+
+// First order variational accelerations of the forces above that have them (see rebx_source_variations)
+void rebx_gr_variations(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_gr_potential_variations(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_tides_precession_variations(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+void rebx_gravitational_harmonics_variations(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
 
 /****************************************
  Operator prototypes
@@ -80,6 +91,7 @@ void rebx_modify_mass(struct reb_simulation* const sim, struct rebx_operator* co
 void rebx_integrate_force(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt);
 void rebx_modify_orbits_direct(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt);
 void rebx_track_min_distance(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt);
+void rebx_track_energy(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt);
 
 /****************************************
  Integrator prototypes
@@ -88,21 +100,103 @@ void rebx_track_min_distance(struct reb_simulation* const sim, struct rebx_opera
 void rebx_integrator_euler_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
 void rebx_integrator_rk2_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
 void rebx_integrator_rk4_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
-void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
+struct rebx_im_settings{
+    double tolerance;           // relative change between iterates at which the iteration stops
+    int max_iterations;
+    int anderson_depth;         // number of previous iterates mixed in. 0 for plain fixed point iteration
+    int warm_start;             // start from the velocity change of the previous call
+};
+void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force, const struct rebx_im_settings* const settings);
+void rebx_integrator_rk45_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force, const double epsilon);
+
+/*****************************************
+ Pools for parameter storage
+ *****************************************/
+
+/*
+ * Fixed-size object pool. Objects are carved sequentially out of large blocks
+ * and recycled through a free list, so attaching params to many particles costs
+ * a handful of block allocations and teardown releases whole blocks.
+ */
+struct rebx_pool_block {
+    struct rebx_pool_block* next;
+    double align;                       // keeps objects following the header 16-byte aligned
+};
+
+struct rebx_pool {
+    size_t size;                        // bytes per object
+    int N_per_block;                    // objects in the next block allocated
+    void* free_list;                    // recycled objects, linked through their first word
+    char* cursor;                       // next unused object in the newest block
+    char* end;
+    struct rebx_pool_block* blocks;
+};
+
+struct rebx_arena {
+    struct rebx_pool nodes;             // rebx_nodes of param lists
+    struct rebx_pool params;            // rebx_params
+    struct rebx_pool values;            // values of double, int and uint32 params
+};
+
+struct rebx_arena* rebx_create_arena(void);
+void rebx_free_arena(struct rebx_arena* arena);
+struct rebx_param* rebx_alloc_param(struct rebx_extras* const rebx);
+void* rebx_alloc_param_value(struct rebx_extras* const rebx);
+int rebx_param_value_in_pool(const enum rebx_param_type type);
+
+void rebx_compile_dispatch_tables(struct rebx_extras* const rebx);
+void rebx_free_dispatch_tables(struct rebx_extras* const rebx);
 
 void* rebx_malloc(struct rebx_extras* const rebx, size_t memsize);
-void rebx_free_ap(struct rebx_node** ap);
+void rebx_free_ap(struct rebx_extras* const rebx, struct rebx_node** ap);
 void rebx_free_particle_ap(struct reb_particle* p);
 void rebx_free_force(struct rebx_extras* rebx, struct rebx_force* force);
-void rebx_free_operator(struct rebx_operator* operator);
+void rebx_add_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force, void (*free_arrays)(struct rebx_extras* rebx, struct rebx_force* force)); // Adds a workspace free function called by rebx_free_force
+
+// Buffers shared by the integrate_force integrators, kept on the force across calls
+struct rebx_integrator_workspace{
+    int N_allocated;                // number of particles the buffers hold
+    int N_vectors;                  // number of 3N double vectors in vectors
+    struct reb_particle* stage;     // particles the force is evaluated on at intermediate stages
+    double* vectors;                // N_vectors consecutive blocks of 3N doubles (x,y,z of particle i at 3i)
+};
+struct rebx_integrator_workspace* rebx_get_integrator_workspace(struct reb_simulation* const sim, struct rebx_force* const force, const int N, const int N_vectors);
+void rebx_free_operator(struct rebx_extras* rebx, struct rebx_operator* operator);
+void rebx_add_operator_free_arrays(struct rebx_extras* const rebx, struct rebx_operator* const operator, void (*free_arrays)(struct rebx_extras* rebx, struct rebx_operator* operator)); // Same for rebx_free_operator
 void rebx_free_step(struct rebx_step* step);
 void rebx_free_pointers(struct rebx_extras* rebx);
-void rebx_free_param(struct rebx_param* param);
+void rebx_free_param(struct rebx_extras* const rebx, struct rebx_param* param);
 
 enum rebx_param_type rebx_get_type(struct rebx_extras* rebx, const char* name);
+int rebx_intern_param(struct rebx_extras* const rebx, struct rebx_param* const param);
 
 struct rebx_param* rebx_create_param(struct rebx_extras* rebx, const char* name, enum rebx_param_type type);
 int rebx_add_param(struct rebx_extras* const rebx, struct rebx_node** apptr, struct rebx_param* param);
 struct rebx_node* rebx_create_node(struct rebx_extras* rebx);
 
+/*****************************************
+ Archives of snapshots (see output.c)
+*****************************************/
+
+// A particle column as it's laid out in a binary image. Pointers are into the image
+struct rebx_particle_column{
+    enum rebx_param_type type;
+    const char* name;
+    const char* indices;    // NULL if the values are for particles 0, 1, 2...
+    const char* values;
+    long N;                 // number of values
+};
+// The last full snapshot of an archive file, which new snapshots are written as diffs against
+struct rebx_archive_keyframe{
+    char* image;                            // the archive file, mapped or read into memory
+    size_t size;
+    int mapped;
+    long offset;                            // of the keyframe in the file (-1 if there isn't one)
+    long end;                               // end of the last complete snapshot, where the next one goes
+    struct rebx_particle_column* columns;   // the keyframe's particle columns, pointing into image
+    int N_columns;
+};
+int rebx_input_open_archive_keyframe(struct rebx_extras* rebx, const char* const filename, struct rebx_archive_keyframe* keyframe); // Returns 0 if the file can't be opened
+void rebx_input_close_archive_keyframe(struct rebx_archive_keyframe* keyframe);
+
 #endif
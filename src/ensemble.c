@@ -0,0 +1,137 @@
+/**
+ * @file    ensemble.c
+ * @brief   Runs copies of a simulation that differ only in a few REBOUNDx parameters
+ * @author  Dan Tamayo <tamayo.daniel@gmail.com>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2015 Dan Tamayo, Hanno Rein
+ *
+ * This file is part of reboundx.
+ *
+ * reboundx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * reboundx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "rebound.h"
+#include "reboundx.h"
+#include "core.h"
+
+/* Every member is a copy of the base simulation and its extras (see rebx_copy_extras). Params that effects write to,
+ * including reb_orbit params like min_distance_orbit, are copied into storage the member owns. Pointer params set by
+ * the user, like an ephemeris context or J_n arrays, are shared and only read. The default ephemeris context is shared
+ * too, and is loaded once under a critical section by whichever member needs it first (see rebx_ephemeris_default).
+ * Members are handed out one at a time (schedule(dynamic)), so threads that finish a short member pick up the next
+ * one rather than waiting on a fixed share. Without OpenMP they run one after the other.
+ */
+
+static int rebx_ensemble_apply_override(struct rebx_extras* const rebx, const struct rebx_ensemble_override* const override){
+    struct reb_simulation* const sim = rebx->sim;
+    struct rebx_node** apptr = NULL;
+    if (override->object == NULL){
+        if (override->index < 0 || override->index >= sim->N){
+            rebx_error(rebx, "REBOUNDx Error: Particle index in rebx_ensemble_override is out of range.\n");
+            return 0;
+        }
+        apptr = (struct rebx_node**)&sim->particles[override->index].ap;
+    }
+    else{
+        struct rebx_force* const force = rebx_get_force(rebx, override->object);
+        struct rebx_operator* const operator = force ? NULL : rebx_get_operator(rebx, override->object);
+        if (force == NULL && operator == NULL){
+            char str[300];
+            snprintf(str, sizeof(str), "REBOUNDx Error: Force or operator '%s' in rebx_ensemble_override not found.\n", override->object);
+            rebx_error(rebx, str);
+            return 0;
+        }
+        apptr = force ? &force->ap : &operator->ap;
+    }
+    switch (rebx_get_type(rebx, override->name)){
+        case REBX_TYPE_DOUBLE:
+            rebx_set_param_double(rebx, apptr, override->name, override->value);
+            return 1;
+        case REBX_TYPE_INT:
+            rebx_set_param_int(rebx, apptr, override->name, (int)override->value);
+            return 1;
+        case REBX_TYPE_UINT32:
+            rebx_set_param_uint32(rebx, apptr, override->name, (uint32_t)override->value);
+            return 1;
+        default:
+        {
+            char str[300];
+            snprintf(str, sizeof(str), "REBOUNDx Error: Parameter '%s' in rebx_ensemble_override must be registered as a double, int or uint32 param.\n", override->name);
+            rebx_error(rebx, str);
+            return 0;
+        }
+    }
+}
+
+// Copies the base simulation and extras and applies a member's overrides. Returns NULL on failure
+static struct rebx_extras* rebx_ensemble_create_member(struct rebx_extras* const rebx, const struct rebx_ensemble_override* const overrides, const int N_overrides){
+    struct reb_simulation* const sim = reb_copy_simulation(rebx->sim);
+    if (sim == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not copy the simulation for an ensemble member.\n");
+        return NULL;
+    }
+    struct rebx_extras* const member = rebx_copy_extras(rebx, sim);
+    if (member == NULL){
+        reb_free_simulation(sim);
+        return NULL;
+    }
+    for (int k=0; k<N_overrides; k++){
+        if (!rebx_ensemble_apply_override(member, &overrides[k])){
+            rebx_free(member);
+            reb_free_simulation(sim);
+            return NULL;
+        }
+    }
+    return member;
+}
+
+int rebx_run_ensemble(struct rebx_extras* const rebx, const double tmax, const int N_members, const struct rebx_ensemble_override* const overrides, const int N_overrides, void (*output)(struct reb_simulation* sim, struct rebx_extras* rebx, int member, void* data), void* data, int n_threads){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return 0;
+    }
+    if (N_members < 0 || N_overrides < 0 || (N_overrides > 0 && overrides == NULL)){
+        rebx_error(rebx, "REBOUNDx Error: Invalid members or overrides passed to rebx_run_ensemble.\n");
+        return 0;
+    }
+    if (n_threads < 1){
+        n_threads = 1;
+    }
+
+    int N_done = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads) if(n_threads > 1) reduction(+:N_done)
+    for (int m=0; m<N_members; m++){
+        struct rebx_extras* member;
+        // Copying reads the base simulation and messages go to it, so copies are made one at a time
+#pragma omp critical(rebx_ensemble_copy)
+        member = rebx_ensemble_create_member(rebx, N_overrides ? &overrides[(size_t)m*N_overrides] : NULL, N_overrides);
+        if (member == NULL){
+            continue;
+        }
+        struct reb_simulation* const sim = member->sim;
+        reb_integrate(sim, tmax);
+        if (output){
+            output(sim, member, m, data);
+        }
+        rebx_free(member);
+        reb_free_simulation(sim);
+        N_done++;
+    }
+    return N_done;
+}
@@ -38,7 +38,7 @@
  *    span of the integration, and the time step come from a file.  We probably want to 
  *    allow the user to specific barycentric or geocentric. DONE.
  * 
- * 2. Rearrange the ephem() function so that it returns all the positions in one shot.
+ * 2. Rearrange the ephem() function so that it returns all the positions in one shot.  DONE.
  * 
  * 3. Check position of the moon.  DONE.
  * 
@@ -62,12 +62,26 @@
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
+#include <string.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
+#include "core.h"
 
 #include "spk.h"
 #include "planets.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define REBX_EPHEM_X86_SIMD     // AVX2/AVX-512 point-mass kernels, selected at run time
+#endif
+
+// Built with make OFFLOAD=1 and a compiler with OpenMP 4.5 target support
+#if defined(REBX_OFFLOAD) && defined(_OPENMP) && _OPENMP >= 201511
+#include <omp.h>
+#define REBX_EPHEM_OFFLOAD      // point-mass kernel on an OpenMP target device when offload_device is set
+#endif
+
 int ebody[11] = {
         PLAN_SOL,                       // Sun (in barycentric)
         PLAN_MER,                       // Mercury center
@@ -83,6 +97,139 @@ int ebody[11] = {
 };
 
 
+/*
+ * Ephemeris context.
+ *
+ * Holds the memory-mapped planetary (DE) and asteroid (SPK) files together with
+ * the GM values of the bodies.  A context is only read after it is created, so
+ * a single one can be shared by any number of ephemeris_forces instances, in
+ * any number of threads, through the force's "ephemeris" parameter.  Forces
+ * without one fall back to a default context loaded from the working directory.
+ */
+
+#define REBX_EPHEM_PLANETS_FILE     "linux_p1550p2650.430"
+#define REBX_EPHEM_ASTEROIDS_FILE   "sb431-n16s.bsp"
+
+struct rebx_ephemeris {
+    struct _jpl_s* pl;      // planetary ephemeris
+    struct spk_s* spl;      // asteroid ephemeris, NULL if none was loaded
+    double GM[11];          // G*mass of the sun, planets and moon, in ephem() order
+    double GM_ast[16];      // G*mass of the massive asteroids
+};
+
+// The values below are G*mass.  Units are solar masses, au, days.
+static const double JPL_GM[11] =
+    {
+      0.295912208285591100E-03, // 0  sun  
+      0.491248045036476000E-10, // 1  mercury
+      0.724345233264412000E-09, // 2  venus
+      0.888769244512563400E-09, // 3  earth
+      0.109318945074237400E-10, // 4  moon
+      0.954954869555077000E-10, // 5  mars
+      0.282534584083387000E-06, // 6  jupiter
+      0.845970607324503000E-07, // 7  saturn
+      0.129202482578296000E-07, // 8  uranus
+      0.152435734788511000E-07, // 9  neptune
+      0.217844105197418000E-11, // 10 pluto
+    };
+
+// 1 Ceres, 4 Vesta, 2 Pallas, 10 Hygiea, 31 Euphrosyne, 704 Interamnia,
+// 511 Davida, 15 Eunomia, 3 Juno, 16 Psyche, 65 Cybele, 88 Thisbe, 
+// 48 Doris, 52 Europa, 451 Patientia, 87 Sylvia
+static const double JPL_GM_AST[16] =
+    {
+      1.400476556172344e-13, // ceres
+      3.854750187808810e-14, // vesta
+      3.104448198938713e-14, // pallas
+      1.235800787294125e-14, // hygiea
+      6.343280473648602e-15, // euphrosyne
+      5.256168678493662e-15, // interamnia
+      5.198126979457498e-15, // davida
+      4.678307418350905e-15, // eunomia
+      3.617538317147937e-15, // juno
+      3.411586826193812e-15, // psyche
+      3.180659282652541e-15, // cybele
+      2.577114127311047e-15, // thisbe
+      2.531091726015068e-15, // doris
+      2.476788101255867e-15, // europa
+      2.295559390637462e-15, // patientia
+      2.199295173574073e-15, // sylvia
+    };
+
+struct rebx_ephemeris* rebx_ephemeris_init(const char* const planets_file, const char* const asteroids_file){
+    return rebx_ephemeris_load(planets_file, asteroids_file, 0., 0., REBX_EPHEMERIS_LOAD_MAP);
+}
+
+struct rebx_ephemeris* rebx_ephemeris_load(const char* const planets_file, const char* const asteroids_file, const double jd_beg, const double jd_end, const enum rebx_ephemeris_load_mode mode){
+    int jpl_mode;
+    switch (mode){
+        case REBX_EPHEMERIS_LOAD_PREFAULT:
+            jpl_mode = JPL_LOAD_PREFAULT;
+            break;
+        case REBX_EPHEMERIS_LOAD_COPY:
+            jpl_mode = JPL_LOAD_COPY;
+            break;
+        default:
+            jpl_mode = JPL_LOAD_MAP;
+            break;
+    }
+
+    struct rebx_ephemeris* eph = calloc(1, sizeof(*eph));
+
+    if ((eph->pl = jpl_load(planets_file ? planets_file : REBX_EPHEM_PLANETS_FILE, jd_beg, jd_end, jpl_mode)) == NULL){
+        fprintf(stderr, "REBOUNDx Error: Could not load planetary ephemeris %s\n", planets_file ? planets_file : REBX_EPHEM_PLANETS_FILE);
+        free(eph);
+        return NULL;
+    }
+
+    if (asteroids_file && (eph->spl = spk_init(asteroids_file)) == NULL){
+        fprintf(stderr, "REBOUNDx Error: Could not load asteroid ephemeris %s\n", asteroids_file);
+        jpl_free(eph->pl);
+        free(eph);
+        return NULL;
+    }
+
+    for (int k=0; k<11; k++){
+        eph->GM[k] = JPL_GM[k];
+    }
+    for (int k=0; k<16; k++){
+        eph->GM_ast[k] = JPL_GM_AST[k];
+    }
+
+    return eph;
+}
+
+void rebx_ephemeris_free(struct rebx_ephemeris* const eph){
+    if (eph == NULL){
+        return;
+    }
+    jpl_free(eph->pl);
+    if (eph->spl){
+        spk_free(eph->spl);
+    }
+    free(eph);
+}
+
+// Context used by ephem() and by forces that were not given one.  Loaded on first use
+// and kept for the life of the process.  Forces running in parallel (ensembles,
+// integration_function_parallel) can all get here first, so the load is done in a
+// critical section and only one of them creates the context.
+static struct rebx_ephemeris* rebx_ephemeris_default(void){
+    static struct rebx_ephemeris* eph = NULL;
+    struct rebx_ephemeris* ret;
+#pragma omp critical(rebx_ephemeris_default)
+    {
+        if (eph == NULL){
+            eph = rebx_ephemeris_init(REBX_EPHEM_PLANETS_FILE, NULL);
+            if (eph){
+                eph->spl = spk_init(REBX_EPHEM_ASTEROIDS_FILE); // optional, only needed if N_ast > 0
+            }
+        }
+        ret = eph;
+    }
+    return ret;
+}
+
 // Added gravitational constant G (2020 Feb 26)
 // Added vx, vy, vz for GR stuff (2020 Feb 27)
 // Consolidated the routine, removing the if block.
@@ -92,53 +239,23 @@ void ephem(const double G, const int i, const double jde, double* const m,
 	   double* const vx, double* const vy, double* const vz,
 	   double* const ax, double* const ay, double* const az){
 
-    static int initialized = 0;
-
-    static struct _jpl_s *pl;
     struct mpos_s now;
 
-    static double M[11];
-
     if(i<0 || i>10){
       fprintf(stderr, "body out of range\n");
       exit(EXIT_FAILURE);
     }
 
-    if (initialized == 0){
-      
-      if ((pl = jpl_init()) == NULL) {
+    const struct rebx_ephemeris* const eph = rebx_ephemeris_default();
+    if (eph == NULL){
 	fprintf(stderr, "could not load DE430 file, fool!\n");
 	exit(EXIT_FAILURE);
-      }
-
-      // The values below are G*mass, so we need to divide by G.
-      // Units are solar masses, au, days.
-      const static double JPL_GM[11] =
-	{
-	  0.295912208285591100E-03, // 0  sun  
-	  0.491248045036476000E-10, // 1  mercury
-	  0.724345233264412000E-09, // 2  venus
-	  0.888769244512563400E-09, // 3  earth
-	  0.109318945074237400E-10, // 4  moon
-	  0.954954869555077000E-10, // 5  mars
-	  0.282534584083387000E-06, // 6  jupiter
-	  0.845970607324503000E-07, // 7  saturn
-	  0.129202482578296000E-07, // 8  uranus
-	  0.152435734788511000E-07, // 9  neptune
-	  0.217844105197418000E-11, // 10 pluto
-	};
-
-      for(int k=0; k<11; k++){
-	M[k] = JPL_GM[k]/G;
-      }
-      
-      initialized = 1;
-
     }
+    struct _jpl_s* const pl = eph->pl;
 
     // Get position, velocity, and mass of body i in barycentric coords. 
     
-    *m = M[i];
+    *m = eph->GM[i]/G;
 
     jpl_calc(pl, &now, jde, ebody[i], PLAN_BAR); 
 
@@ -159,85 +276,909 @@ void ephem(const double G, const int i, const double jde, double* const m,
     
 }
 
-static void ast_ephem(const double G, const int i, const double jde, double* const m, double* const x, double* const y, double* const z){
+// Same as ephem(), but for the N bodies in ids[] at once, reading the
+// ephemeris record a single time.  Results are in au, au/day and au/day^2.
+// cur keeps the caller's current record (see jpl_calc_all_cur) and may be NULL.
+// Returns 0, or -1 if jde is not covered by the ephemeris.
+static int ephem_all(const struct rebx_ephemeris* const eph, struct jpl_cur_s* const cur, const double G, const int N, const int* const ids, const double jde, double* const m, struct mpos_s* const now){
 
-    static int initialized = 0;
+    struct _jpl_s* const pl = eph->pl;
+    int codes[11] = {0};
 
-    static struct spk_s *spl;
-    struct mpos_s pos;
+    for (int k=0; k<N; k++){
+      codes[k] = ebody[ids[k]];
+      m[k] = eph->GM[ids[k]]/G;
+    }
 
-    static double M[16];    
+    if (jpl_calc_all_cur(pl, cur, now, jde, codes, N) != 0){
+      return -1;
+    }
 
-    if(i<0 || i>15){
-      fprintf(stderr, "asteroid out of range\n");
-      exit(EXIT_FAILURE);
+    for (int k=0; k<N; k++){
+      vecpos_div(now[k].u, pl->cau);
+      vecpos_div(now[k].v, pl->cau/86400.);
+      vecpos_div(now[k].w, pl->cau/(86400.*86400.));
     }
+    return 0;
+}
 
-    if (initialized == 0){
-      
-      if ((spl = spk_init("sb431-n16s.bsp")) == NULL) {
-	fprintf(stderr, "could not load sb431-n16 file, fool!\n");
-	exit(EXIT_FAILURE);
-      }
+// Heliocentric position and mass of massive asteroid i.  cur is as in ephem_all (see spk_calc_cur).
+// Returns 0, or -1 if jde is outside the segments of the asteroid ephemeris.
+static int ast_ephem(const struct rebx_ephemeris* const eph, struct spk_cur_s* const cur, const double G, const int i, const double jde, double* const m, double* const x, double* const y, double* const z){
 
-      // 1 Ceres, 4 Vesta, 2 Pallas, 10 Hygiea, 31 Euphrosyne, 704 Interamnia,
-      // 511 Davida, 15 Eunomia, 3 Juno, 16 Psyche, 65 Cybele, 88 Thisbe, 
-      // 48 Doris, 52 Europa, 451 Patientia, 87 Sylvia
-
-      // The values below are G*mass, so we need to divide by G.
-      // Units are solar masses, au, days.      
-      const static double JPL_GM[16] =
-	{
-	  1.400476556172344e-13, // ceres
-	  3.854750187808810e-14, // vesta
-	  3.104448198938713e-14, // pallas
-	  1.235800787294125e-14, // hygiea
-	  6.343280473648602e-15, // euphrosyne
-	  5.256168678493662e-15, // interamnia
-	  5.198126979457498e-15, // davida
-	  4.678307418350905e-15, // eunomia
-	  3.617538317147937e-15, // juno
-	  3.411586826193812e-15, // psyche
-	  3.180659282652541e-15, // cybele
-	  2.577114127311047e-15, // thisbe
-	  2.531091726015068e-15, // doris
-	  2.476788101255867e-15, // europa
-	  2.295559390637462e-15, // patientia
-	  2.199295173574073e-15, // sylvia
-	};
-      
-      for(int k=0; k<16; k++){
-	M[k] = JPL_GM[i]/ G;
-      }
-      
-      initialized = 1;
+    struct mpos_s pos;
 
+    *m = eph->GM_ast[i]/G;
+    if (spk_calc_cur(eph->spl, cur, i, jde, &pos) != 0){
+        return -1;
     }
-
-    *m = M[i];
-    spk_calc(spl, i, jde, &pos);          
     *x = pos.u[0];
     *y = pos.u[1];
     *z = pos.u[2];
-    
+    return 0;
 }
 
-void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+/*
+ * Ephemeris state cache.
+ *
+ * IAS15 evaluates the forces at the same Gauss-Radau substep times on every
+ * predictor-corrector iteration, so rather than re-evaluating the Chebyshev
+ * series for every body on every call we keep the barycentric states of the
+ * massive bodies for the most recent epochs.  Entries are keyed on the epoch
+ * and on the number of planets and asteroids requested, and are replaced
+ * round-robin.  Planets occupy indices 0-10 (same numbering as ephem()), the
+ * asteroids follow from index REBX_EPHEM_N_PLANETS.
+ */
+
+#define REBX_EPHEM_N_PLANETS    11
+#define REBX_EPHEM_N_AST        16
+#define REBX_EPHEM_N_BODIES     (REBX_EPHEM_N_PLANETS + REBX_EPHEM_N_AST)
+#define REBX_EPHEM_CACHE_N      16  // two IAS15 steps' worth of substep epochs
+
+struct rebx_ephem_state {
+    double t;
+    int N_ephem;
+    int N_ast;
+    double m[REBX_EPHEM_N_BODIES];
+    double x[REBX_EPHEM_N_BODIES], y[REBX_EPHEM_N_BODIES], z[REBX_EPHEM_N_BODIES];
+    double vx[REBX_EPHEM_N_BODIES], vy[REBX_EPHEM_N_BODIES], vz[REBX_EPHEM_N_BODIES];
+    double ax[REBX_EPHEM_N_BODIES], ay[REBX_EPHEM_N_BODIES], az[REBX_EPHEM_N_BODIES];
+};
+
+struct rebx_ephem_cache {
+    const struct rebx_ephemeris* eph;   // context the entries were computed from
+    double G;                           // ... and the G used to convert GM to masses
+    int N_filled;       // number of valid entries
+    int last;           // index of the most recently filled entry
+    struct rebx_ephem_state states[REBX_EPHEM_CACHE_N];
+
+    // Current DE and SPK records, so that misses in states only evaluate the series
+    struct jpl_cur_s jpl_cur;
+    struct spk_cur_s spk_cur;
+
+    // Structure-of-arrays copies of the test particle positions and accelerations
+    int N_alloc;
+    double* x;
+    double* y;
+    double* z;
+    double* ax;
+    double* ay;
+    double* az;
+
+    // Copies of the same six arrays on the offload device, kept allocated between calls
+    int device;
+    int N_device;
+    double* d_x;
+    int offload_warned;
+
+    // Values of the ast_terms_skipped and ast_terms force params, looked up once
+    double* ast_terms_skipped;
+    double* ast_terms;
+};
+
+static void rebx_ephemeris_forces_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_ephem_cache* const cache = rebx_get_param(rebx, force->ap, "ephem_cache");
+    if (cache){
+        jpl_cur_free(&cache->jpl_cur);
+        spk_cur_free(&cache->spk_cur);
+        free(cache->x);
+#ifdef REBX_EPHEM_OFFLOAD
+        if (cache->d_x){
+            omp_target_free(cache->d_x, cache->device);
+        }
+#endif
+    }
+    free(cache);
+}
+
+// Returns 0, or -1 if t is outside the coverage of the planet or asteroid ephemeris.
+static int rebx_ephem_fill_state(const struct rebx_ephemeris* const eph, struct rebx_ephem_cache* const cache, const double G, struct rebx_ephem_state* const st, const double t, const int N_ephem, const int N_ast){
+    st->t = t;
+    st->N_ephem = N_ephem;
+    st->N_ast = N_ast;
+
+    // The Sun (0) and Earth (3) are always needed for the harmonics, GR and geocentric corrections.
+    int ids[REBX_EPHEM_N_PLANETS];
+    int N_ids = 0;
+    for (int i=0; i<REBX_EPHEM_N_PLANETS; i++){
+        if (i < N_ephem || i == 0 || i == 3){
+            ids[N_ids++] = i;
+        }
+    }
+
+    double m[REBX_EPHEM_N_PLANETS];
+    struct mpos_s now[REBX_EPHEM_N_PLANETS];
+    if (ephem_all(eph, &cache->jpl_cur, G, N_ids, ids, t, m, now) != 0){
+        return -1;
+    }
+
+    for (int k=0; k<N_ids; k++){
+        const int i = ids[k];
+        st->m[i] = m[k];
+        st->x[i] = now[k].u[0];  st->y[i] = now[k].u[1];  st->z[i] = now[k].u[2];
+        st->vx[i] = now[k].v[0]; st->vy[i] = now[k].v[1]; st->vz[i] = now[k].v[2];
+        st->ax[i] = now[k].w[0]; st->ay[i] = now[k].w[1]; st->az[i] = now[k].w[2];
+    }
+
+    for (int k=0; k<N_ast; k++){
+        const int i = REBX_EPHEM_N_PLANETS + k;
+        if (ast_ephem(eph, &cache->spk_cur, G, k, t, &st->m[i], &st->x[i], &st->y[i], &st->z[i]) != 0){
+            return -1;
+        }
+
+        // Translate massive asteroids from heliocentric to barycentric.
+        st->x[i] += st->x[0];
+        st->y[i] += st->y[0];
+        st->z[i] += st->z[0];
+        st->vx[i] = 0.0; st->vy[i] = 0.0; st->vz[i] = 0.0;
+        st->ax[i] = 0.0; st->ay[i] = 0.0; st->az[i] = 0.0;
+    }
+    return 0;
+}
+
+// Returns the cached barycentric states at epoch t, evaluating the ephemerides on a miss.
+// Returns NULL, after reporting the error, if t is not covered by the ephemerides.
+static const struct rebx_ephem_state* rebx_ephem_get_state(struct reb_simulation* const sim, struct rebx_force* const force, const struct rebx_ephemeris* const eph, const double t, const int N_ephem, const int N_ast){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_ephem_cache* cache = rebx_get_param(rebx, force->ap, "ephem_cache");
+    if (cache == NULL){
+        cache = malloc(sizeof(*cache));
+        cache->N_filled = 0;
+        cache->N_alloc = 0;
+        cache->x = NULL;
+        cache->N_device = 0;
+        cache->d_x = NULL;
+        cache->offload_warned = 0;
+        cache->ast_terms_skipped = NULL;
+        cache->ast_terms = NULL;
+        memset(&cache->jpl_cur, 0, sizeof(cache->jpl_cur));
+        memset(&cache->spk_cur, 0, sizeof(cache->spk_cur));
+        rebx_set_param_pointer(rebx, &force->ap, "ephem_cache", cache);
+        rebx_add_free_arrays(rebx, force, rebx_ephemeris_forces_free_arrays);
+    }
+    if (cache->N_filled == 0 || cache->eph != eph || cache->G != sim->G){
+        cache->eph = eph;
+        cache->G = sim->G;
+        cache->N_filled = 0;
+        cache->last = REBX_EPHEM_CACHE_N-1;
+    }
+
+    // Search backwards from the most recent entry, since consecutive substeps are filled in order.
+    for (int n=0; n<cache->N_filled; n++){
+        const int k = (cache->last - n + REBX_EPHEM_CACHE_N) % REBX_EPHEM_CACHE_N;
+        const struct rebx_ephem_state* const st = &cache->states[k];
+        if (st->t == t && st->N_ephem == N_ephem && st->N_ast == N_ast){
+            return st;
+        }
+    }
+
+    cache->last = (cache->last + 1) % REBX_EPHEM_CACHE_N;
+    if (cache->N_filled < REBX_EPHEM_CACHE_N){
+        cache->N_filled++;
+    }
+    struct rebx_ephem_state* const st = &cache->states[cache->last];
+    if (rebx_ephem_fill_state(eph, cache, sim->G, st, t, N_ephem, N_ast) != 0){
+        st->t = NAN;    // never matches, so the partly filled entry is not reused
+        char str[300];
+        snprintf(str, sizeof(str), "REBOUNDx Error: Epoch %.6f is outside the coverage of the ephemerides used by ephemeris_forces.\n", t);
+        rebx_error(rebx, str);
+        return NULL;
+    }
+    return st;
+}
+
+/*
+ * Point-mass perturber kernels.
+ *
+ * The sun, planets and asteroids all contribute a plain point-mass term, so they
+ * are treated together on structure-of-arrays copies of the test particles.  The
+ * particles are processed in blocks small enough to stay in cache while every
+ * perturber is applied to them.  On x86-64 the block loop uses AVX-512 or AVX2 when
+ * the CPU supports them.  The vector kernels perform the same IEEE operations in
+ * the same order as the scalar one, so the results do not depend on the path taken.
+ */
+
+#define REBX_EPHEM_BLOCK 512    // test particles per block
+
+struct rebx_ephem_perturbers {
+    int N;
+    double ox[REBX_EPHEM_N_BODIES];     // offset minus perturber position
+    double oy[REBX_EPHEM_N_BODIES];
+    double oz[REBX_EPHEM_N_BODIES];
+    double Gm[REBX_EPHEM_N_BODIES];
+};
+
+static void rebx_ephem_point_masses_scalar(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az){
+    for (int i=0; i<pm->N; i++){
+        const double ox = pm->ox[i];
+        const double oy = pm->oy[i];
+        const double oz = pm->oz[i];
+        const double Gm = pm->Gm[i];
+        for (int j=j0; j<j1; j++){
+            const double dx = x[j] + ox;
+            const double dy = y[j] + oy;
+            const double dz = z[j] + oz;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz);
+            const double prefac = Gm/(_r*_r*_r);
+            ax[j] -= prefac*dx;
+            ay[j] -= prefac*dy;
+            az[j] -= prefac*dz;
+        }
+    }
+}
+
+#ifdef REBX_EPHEM_X86_SIMD
+__attribute__((target("avx2")))
+static void rebx_ephem_point_masses_avx2(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az){
+    const int jv = j0 + (j1-j0)/4*4;
+    for (int i=0; i<pm->N; i++){
+        const __m256d ox = _mm256_set1_pd(pm->ox[i]);
+        const __m256d oy = _mm256_set1_pd(pm->oy[i]);
+        const __m256d oz = _mm256_set1_pd(pm->oz[i]);
+        const __m256d Gm = _mm256_set1_pd(pm->Gm[i]);
+        for (int j=j0; j<jv; j+=4){
+            const __m256d dx = _mm256_add_pd(_mm256_loadu_pd(&x[j]), ox);
+            const __m256d dy = _mm256_add_pd(_mm256_loadu_pd(&y[j]), oy);
+            const __m256d dz = _mm256_add_pd(_mm256_loadu_pd(&z[j]), oz);
+            const __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+            const __m256d _r = _mm256_sqrt_pd(r2);
+            const __m256d prefac = _mm256_div_pd(Gm, _mm256_mul_pd(_mm256_mul_pd(_r, _r), _r));
+            _mm256_storeu_pd(&ax[j], _mm256_sub_pd(_mm256_loadu_pd(&ax[j]), _mm256_mul_pd(prefac, dx)));
+            _mm256_storeu_pd(&ay[j], _mm256_sub_pd(_mm256_loadu_pd(&ay[j]), _mm256_mul_pd(prefac, dy)));
+            _mm256_storeu_pd(&az[j], _mm256_sub_pd(_mm256_loadu_pd(&az[j]), _mm256_mul_pd(prefac, dz)));
+        }
+    }
+    rebx_ephem_point_masses_scalar(pm, jv, j1, x, y, z, ax, ay, az);
+}
+
+__attribute__((target("avx512f")))
+static void rebx_ephem_point_masses_avx512(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az){
+    const int jv = j0 + (j1-j0)/8*8;
+    for (int i=0; i<pm->N; i++){
+        const __m512d ox = _mm512_set1_pd(pm->ox[i]);
+        const __m512d oy = _mm512_set1_pd(pm->oy[i]);
+        const __m512d oz = _mm512_set1_pd(pm->oz[i]);
+        const __m512d Gm = _mm512_set1_pd(pm->Gm[i]);
+        for (int j=j0; j<jv; j+=8){
+            const __m512d dx = _mm512_add_pd(_mm512_loadu_pd(&x[j]), ox);
+            const __m512d dy = _mm512_add_pd(_mm512_loadu_pd(&y[j]), oy);
+            const __m512d dz = _mm512_add_pd(_mm512_loadu_pd(&z[j]), oz);
+            const __m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+            const __m512d _r = _mm512_sqrt_pd(r2);
+            const __m512d prefac = _mm512_div_pd(Gm, _mm512_mul_pd(_mm512_mul_pd(_r, _r), _r));
+            _mm512_storeu_pd(&ax[j], _mm512_sub_pd(_mm512_loadu_pd(&ax[j]), _mm512_mul_pd(prefac, dx)));
+            _mm512_storeu_pd(&ay[j], _mm512_sub_pd(_mm512_loadu_pd(&ay[j]), _mm512_mul_pd(prefac, dy)));
+            _mm512_storeu_pd(&az[j], _mm512_sub_pd(_mm512_loadu_pd(&az[j]), _mm512_mul_pd(prefac, dz)));
+        }
+    }
+    rebx_ephem_point_masses_scalar(pm, jv, j1, x, y, z, ax, ay, az);
+}
+#endif // REBX_EPHEM_X86_SIMD
+
+typedef void (*rebx_ephem_kernel)(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az);
+
+static rebx_ephem_kernel rebx_ephem_select_kernel(void){
+#ifdef REBX_EPHEM_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")){
+        return rebx_ephem_point_masses_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")){
+        return rebx_ephem_point_masses_avx2;
+    }
+#endif
+    return rebx_ephem_point_masses_scalar;
+}
+
+/*
+ * Kernels for the Sun and planets alone (REBX_EPHEM_N_PLANETS perturbers, e.g. the noast variants below).  With
+ * the perturber count known at compile time the perturber loop is unrolled inside the particle loop, so each
+ * particle's accelerations stay in registers across all the perturbers instead of being reloaded and stored once
+ * per perturber.  The terms are still subtracted one perturber at a time in the same order, so the results are
+ * identical to the kernels above.
+ */
+
+static void rebx_ephem_point_masses_planets_scalar(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az){
+    for (int j=j0; j<j1; j++){
+        double axj = ax[j];
+        double ayj = ay[j];
+        double azj = az[j];
+        for (int i=0; i<REBX_EPHEM_N_PLANETS; i++){
+            const double dx = x[j] + pm->ox[i];
+            const double dy = y[j] + pm->oy[i];
+            const double dz = z[j] + pm->oz[i];
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz);
+            const double prefac = pm->Gm[i]/(_r*_r*_r);
+            axj -= prefac*dx;
+            ayj -= prefac*dy;
+            azj -= prefac*dz;
+        }
+        ax[j] = axj;
+        ay[j] = ayj;
+        az[j] = azj;
+    }
+}
+
+#ifdef REBX_EPHEM_X86_SIMD
+__attribute__((target("avx2")))
+static void rebx_ephem_point_masses_planets_avx2(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az){
+    const int jv = j0 + (j1-j0)/4*4;
+    for (int j=j0; j<jv; j+=4){
+        const __m256d xj = _mm256_loadu_pd(&x[j]);
+        const __m256d yj = _mm256_loadu_pd(&y[j]);
+        const __m256d zj = _mm256_loadu_pd(&z[j]);
+        __m256d axj = _mm256_loadu_pd(&ax[j]);
+        __m256d ayj = _mm256_loadu_pd(&ay[j]);
+        __m256d azj = _mm256_loadu_pd(&az[j]);
+        for (int i=0; i<REBX_EPHEM_N_PLANETS; i++){
+            const __m256d dx = _mm256_add_pd(xj, _mm256_set1_pd(pm->ox[i]));
+            const __m256d dy = _mm256_add_pd(yj, _mm256_set1_pd(pm->oy[i]));
+            const __m256d dz = _mm256_add_pd(zj, _mm256_set1_pd(pm->oz[i]));
+            const __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+            const __m256d _r = _mm256_sqrt_pd(r2);
+            const __m256d prefac = _mm256_div_pd(_mm256_set1_pd(pm->Gm[i]), _mm256_mul_pd(_mm256_mul_pd(_r, _r), _r));
+            axj = _mm256_sub_pd(axj, _mm256_mul_pd(prefac, dx));
+            ayj = _mm256_sub_pd(ayj, _mm256_mul_pd(prefac, dy));
+            azj = _mm256_sub_pd(azj, _mm256_mul_pd(prefac, dz));
+        }
+        _mm256_storeu_pd(&ax[j], axj);
+        _mm256_storeu_pd(&ay[j], ayj);
+        _mm256_storeu_pd(&az[j], azj);
+    }
+    rebx_ephem_point_masses_planets_scalar(pm, jv, j1, x, y, z, ax, ay, az);
+}
+
+__attribute__((target("avx512f")))
+static void rebx_ephem_point_masses_planets_avx512(const struct rebx_ephem_perturbers* const pm, const int j0, const int j1, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z,
+        double* const restrict ax, double* const restrict ay, double* const restrict az){
+    const int jv = j0 + (j1-j0)/8*8;
+    for (int j=j0; j<jv; j+=8){
+        const __m512d xj = _mm512_loadu_pd(&x[j]);
+        const __m512d yj = _mm512_loadu_pd(&y[j]);
+        const __m512d zj = _mm512_loadu_pd(&z[j]);
+        __m512d axj = _mm512_loadu_pd(&ax[j]);
+        __m512d ayj = _mm512_loadu_pd(&ay[j]);
+        __m512d azj = _mm512_loadu_pd(&az[j]);
+        for (int i=0; i<REBX_EPHEM_N_PLANETS; i++){
+            const __m512d dx = _mm512_add_pd(xj, _mm512_set1_pd(pm->ox[i]));
+            const __m512d dy = _mm512_add_pd(yj, _mm512_set1_pd(pm->oy[i]));
+            const __m512d dz = _mm512_add_pd(zj, _mm512_set1_pd(pm->oz[i]));
+            const __m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+            const __m512d _r = _mm512_sqrt_pd(r2);
+            const __m512d prefac = _mm512_div_pd(_mm512_set1_pd(pm->Gm[i]), _mm512_mul_pd(_mm512_mul_pd(_r, _r), _r));
+            axj = _mm512_sub_pd(axj, _mm512_mul_pd(prefac, dx));
+            ayj = _mm512_sub_pd(ayj, _mm512_mul_pd(prefac, dy));
+            azj = _mm512_sub_pd(azj, _mm512_mul_pd(prefac, dz));
+        }
+        _mm512_storeu_pd(&ax[j], axj);
+        _mm512_storeu_pd(&ay[j], ayj);
+        _mm512_storeu_pd(&az[j], azj);
+    }
+    rebx_ephem_point_masses_planets_scalar(pm, jv, j1, x, y, z, ax, ay, az);
+}
+#endif // REBX_EPHEM_X86_SIMD
+
+// Kernel for pm, using the fixed count kernels when pm holds exactly the Sun and planets
+static rebx_ephem_kernel rebx_ephem_select_kernel_n(const int N_perturbers){
+    if (N_perturbers != REBX_EPHEM_N_PLANETS){
+        return rebx_ephem_select_kernel();
+    }
+#ifdef REBX_EPHEM_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")){
+        return rebx_ephem_point_masses_planets_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")){
+        return rebx_ephem_point_masses_planets_avx2;
+    }
+#endif
+    return rebx_ephem_point_masses_planets_scalar;
+}
+
+/*
+ * Single precision kernels for the mixed precision mode (float_tolerance), with float_tolerance mapped to the
+ * same bound as ast_tolerance below.  Perturbers whose largest acceleration on a block is below float_tolerance
+ * times the solar term are summed in float, 8 or 16 lanes at a time, and the float sums are then added to the
+ * double accelerations.  Absolute positions are never narrowed: the particles' offsets from the block center and
+ * the center's separations from the perturbers are found in double and only then rounded to float, so each
+ * separation is off by at most FLT_EPSILON*(|D| + R) for a center-perturber distance |D| and block radius R.
+ * Perturbers only go to the float kernels when R is below half their distance d_min to the block's bounding
+ * sphere, so (|D| + R)/d_min < 2 and the relative error of each such term is a few times FLT_EPSILON.  Each
+ * float term then adds an error of a few times FLT_EPSILON*float_tolerance of the solar term.  As with the double
+ * kernels, the paths give identical results.
+ */
+
+struct rebx_ephem_perturbers_f {
+    int N;
+    double cx, cy, cz;                  // block center; positions and offsets below are relative to it
+    float ox[REBX_EPHEM_N_BODIES];
+    float oy[REBX_EPHEM_N_BODIES];
+    float oz[REBX_EPHEM_N_BODIES];
+    float Gm[REBX_EPHEM_N_BODIES];
+};
+
+static void rebx_ephem_point_masses_scalar_f(const struct rebx_ephem_perturbers_f* const pm, const int j0, const int j1, 
+        const float* const restrict x, const float* const restrict y, const float* const restrict z,
+        float* const restrict ax, float* const restrict ay, float* const restrict az){
+    for (int i=0; i<pm->N; i++){
+        const float ox = pm->ox[i];
+        const float oy = pm->oy[i];
+        const float oz = pm->oz[i];
+        const float Gm = pm->Gm[i];
+        for (int j=j0; j<j1; j++){
+            const float dx = x[j] + ox;
+            const float dy = y[j] + oy;
+            const float dz = z[j] + oz;
+            const float _r = sqrtf(dx*dx + dy*dy + dz*dz);
+            const float prefac = Gm/(_r*_r*_r);
+            ax[j] -= prefac*dx;
+            ay[j] -= prefac*dy;
+            az[j] -= prefac*dz;
+        }
+    }
+}
+
+#ifdef REBX_EPHEM_X86_SIMD
+__attribute__((target("avx2")))
+static void rebx_ephem_point_masses_avx2_f(const struct rebx_ephem_perturbers_f* const pm, const int j0, const int j1, 
+        const float* const restrict x, const float* const restrict y, const float* const restrict z,
+        float* const restrict ax, float* const restrict ay, float* const restrict az){
+    const int jv = j0 + (j1-j0)/8*8;
+    for (int i=0; i<pm->N; i++){
+        const __m256 ox = _mm256_set1_ps(pm->ox[i]);
+        const __m256 oy = _mm256_set1_ps(pm->oy[i]);
+        const __m256 oz = _mm256_set1_ps(pm->oz[i]);
+        const __m256 Gm = _mm256_set1_ps(pm->Gm[i]);
+        for (int j=j0; j<jv; j+=8){
+            const __m256 dx = _mm256_add_ps(_mm256_loadu_ps(&x[j]), ox);
+            const __m256 dy = _mm256_add_ps(_mm256_loadu_ps(&y[j]), oy);
+            const __m256 dz = _mm256_add_ps(_mm256_loadu_ps(&z[j]), oz);
+            const __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            const __m256 _r = _mm256_sqrt_ps(r2);
+            const __m256 prefac = _mm256_div_ps(Gm, _mm256_mul_ps(_mm256_mul_ps(_r, _r), _r));
+            _mm256_storeu_ps(&ax[j], _mm256_sub_ps(_mm256_loadu_ps(&ax[j]), _mm256_mul_ps(prefac, dx)));
+            _mm256_storeu_ps(&ay[j], _mm256_sub_ps(_mm256_loadu_ps(&ay[j]), _mm256_mul_ps(prefac, dy)));
+            _mm256_storeu_ps(&az[j], _mm256_sub_ps(_mm256_loadu_ps(&az[j]), _mm256_mul_ps(prefac, dz)));
+        }
+    }
+    rebx_ephem_point_masses_scalar_f(pm, jv, j1, x, y, z, ax, ay, az);
+}
+
+__attribute__((target("avx512f")))
+static void rebx_ephem_point_masses_avx512_f(const struct rebx_ephem_perturbers_f* const pm, const int j0, const int j1, 
+        const float* const restrict x, const float* const restrict y, const float* const restrict z,
+        float* const restrict ax, float* const restrict ay, float* const restrict az){
+    const int jv = j0 + (j1-j0)/16*16;
+    for (int i=0; i<pm->N; i++){
+        const __m512 ox = _mm512_set1_ps(pm->ox[i]);
+        const __m512 oy = _mm512_set1_ps(pm->oy[i]);
+        const __m512 oz = _mm512_set1_ps(pm->oz[i]);
+        const __m512 Gm = _mm512_set1_ps(pm->Gm[i]);
+        for (int j=j0; j<jv; j+=16){
+            const __m512 dx = _mm512_add_ps(_mm512_loadu_ps(&x[j]), ox);
+            const __m512 dy = _mm512_add_ps(_mm512_loadu_ps(&y[j]), oy);
+            const __m512 dz = _mm512_add_ps(_mm512_loadu_ps(&z[j]), oz);
+            const __m512 r2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+            const __m512 _r = _mm512_sqrt_ps(r2);
+            const __m512 prefac = _mm512_div_ps(Gm, _mm512_mul_ps(_mm512_mul_ps(_r, _r), _r));
+            _mm512_storeu_ps(&ax[j], _mm512_sub_ps(_mm512_loadu_ps(&ax[j]), _mm512_mul_ps(prefac, dx)));
+            _mm512_storeu_ps(&ay[j], _mm512_sub_ps(_mm512_loadu_ps(&ay[j]), _mm512_mul_ps(prefac, dy)));
+            _mm512_storeu_ps(&az[j], _mm512_sub_ps(_mm512_loadu_ps(&az[j]), _mm512_mul_ps(prefac, dz)));
+        }
+    }
+    rebx_ephem_point_masses_scalar_f(pm, jv, j1, x, y, z, ax, ay, az);
+}
+#endif // REBX_EPHEM_X86_SIMD
+
+typedef void (*rebx_ephem_kernel_f)(const struct rebx_ephem_perturbers_f* const pm, const int j0, const int j1, 
+        const float* const restrict x, const float* const restrict y, const float* const restrict z,
+        float* const restrict ax, float* const restrict ay, float* const restrict az);
+
+static rebx_ephem_kernel_f rebx_ephem_select_kernel_f(void){
+#ifdef REBX_EPHEM_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")){
+        return rebx_ephem_point_masses_avx512_f;
+    }
+    if (__builtin_cpu_supports("avx2")){
+        return rebx_ephem_point_masses_avx2_f;
+    }
+#endif
+    return rebx_ephem_point_masses_scalar_f;
+}
+
+/*
+ * Asteroid culling.  With ast_tolerance > 0, an asteroid is left out of a block of test particles when the
+ * largest acceleration it can exert on any particle in the block, Gm/d_min^2 with d_min its distance to the
+ * block's bounding sphere, is below ast_tolerance times the smallest solar point-mass acceleration in the
+ * block.  Each skipped term is then bounded by ast_tolerance relative to the solar term for that particle.
+ * Planets are never skipped, and the kept perturbers are applied in their usual order, so nothing changes
+ * when no asteroid is skipped.  The number of skipped and total asteroid terms (per particle) accumulate in
+ * the ast_terms_skipped and ast_terms force params.  Planets and asteroids (but not the Sun) that pass the
+ * same test with float_tolerance go to the single precision kernels above.
+ * Culling runs with the host kernels, so offload_device is not used while ast_tolerance or float_tolerance is set.
+ */
+struct rebx_ephem_culling {
+    double tolerance;       // ast_tolerance, or 0 to skip nothing
+    double float_tolerance; // or 0 to keep everything in double
+    int sun;                // index of the Sun in pm, or -1
+    int N_planets;          // perturbers in pm before this index are never skipped
+    double ox, oy, oz;      // offset minus Sun position
+    double Gm_sun;
+};
+
+// Sorts the perturbers that can matter for particles j0..j1-1 into block (double) and block_f (float).
+// Returns the number of asteroids skipped.
+static int rebx_ephem_cull_block(const struct rebx_ephem_culling* const cull, const struct rebx_ephem_perturbers* const pm, const int j0, const int j1,
+        const double* const x, const double* const y, const double* const z, struct rebx_ephem_perturbers* const block, struct rebx_ephem_perturbers_f* const block_f){
+    double cx = 0., cy = 0., cz = 0.;
+    for (int j=j0; j<j1; j++){
+        cx += x[j];
+        cy += y[j];
+        cz += z[j];
+    }
+    cx /= (j1-j0);
+    cy /= (j1-j0);
+    cz /= (j1-j0);
+    double R2 = 0.;
+    for (int j=j0; j<j1; j++){
+        const double dx = x[j] - cx;
+        const double dy = y[j] - cy;
+        const double dz = z[j] - cz;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        R2 = r2 > R2 ? r2 : R2;
+    }
+    const double R = sqrt(R2);
+    const double dxs = cx + cull->ox;
+    const double dys = cy + cull->oy;
+    const double dzs = cz + cull->oz;
+    const double rs_max = sqrt(dxs*dxs + dys*dys + dzs*dzs) + R;
+    const double a_sun = cull->Gm_sun/(rs_max*rs_max);
+
+    block->N = 0;
+    block_f->N = 0;
+    block_f->cx = cx;
+    block_f->cy = cy;
+    block_f->cz = cz;
+    int N_skipped = 0;
+    for (int i=0; i<pm->N; i++){
+        if (i != cull->sun){
+            const double dx = cx + pm->ox[i];
+            const double dy = cy + pm->oy[i];
+            const double dz = cz + pm->oz[i];
+            const double d_min = sqrt(dx*dx + dy*dy + dz*dz) - R;
+            if (d_min > 0.){
+                const double a_max = pm->Gm[i]/(d_min*d_min);
+                if (i >= cull->N_planets && a_max < cull->tolerance*a_sun){
+                    N_skipped++;
+                    continue;
+                }
+                if (a_max < cull->float_tolerance*a_sun && 2.*R < d_min){
+                    block_f->ox[block_f->N] = (float)dx;    // center minus perturber, narrowed after the double sum
+                    block_f->oy[block_f->N] = (float)dy;
+                    block_f->oz[block_f->N] = (float)dz;
+                    block_f->Gm[block_f->N] = (float)pm->Gm[i];
+                    block_f->N++;
+                    continue;
+                }
+            }
+        }
+        block->ox[block->N] = pm->ox[i];
+        block->oy[block->N] = pm->oy[i];
+        block->oz[block->N] = pm->oz[i];
+        block->Gm[block->N] = pm->Gm[i];
+        block->N++;
+    }
+    return N_skipped;
+}
+
+// Adds the float_tolerance class perturbers in block_f to the double accelerations of particles j0..j1-1
+static void rebx_ephem_point_masses_f(const rebx_ephem_kernel_f kernel_f, const struct rebx_ephem_perturbers_f* const block_f, const int j0, const int j1,
+        const double* const x, const double* const y, const double* const z, double* const ax, double* const ay, double* const az){
+    float xf[REBX_EPHEM_BLOCK], yf[REBX_EPHEM_BLOCK], zf[REBX_EPHEM_BLOCK];
+    float axf[REBX_EPHEM_BLOCK], ayf[REBX_EPHEM_BLOCK], azf[REBX_EPHEM_BLOCK];
+    const int n = j1 - j0;
+    for (int j=0; j<n; j++){
+        xf[j] = (float)(x[j0+j] - block_f->cx);
+        yf[j] = (float)(y[j0+j] - block_f->cy);
+        zf[j] = (float)(z[j0+j] - block_f->cz);
+        axf[j] = 0.f;
+        ayf[j] = 0.f;
+        azf[j] = 0.f;
+    }
+    kernel_f(block_f, 0, n, xf, yf, zf, axf, ayf, azf);
+    for (int j=0; j<n; j++){
+        ax[j0+j] += axf[j];
+        ay[j0+j] += ayf[j];
+        az[j0+j] += azf[j];
+    }
+}
+
+// Adds the point-mass accelerations of all perturbers in pm to the particles, leaving out asteroids and using
+// single precision as described above if cull is not NULL.  Returns the number of asteroid terms skipped.
+// Blocks are independent, so they are shared out between n_threads threads.
+static double rebx_ephem_point_masses(struct rebx_ephem_cache* const ws, const struct rebx_ephem_perturbers* const pm, const struct rebx_ephem_culling* const cull, struct reb_particle* const particles, const int N, const int n_threads){
+    const rebx_ephem_kernel kernel = rebx_ephem_select_kernel();
+    const rebx_ephem_kernel kernel_pm = rebx_ephem_select_kernel_n(pm->N);
+    const rebx_ephem_kernel_f kernel_f = rebx_ephem_select_kernel_f();
+    double* const x = ws->x;
+    double* const y = ws->y;
+    double* const z = ws->z;
+    double* const ax = ws->ax;
+    double* const ay = ws->ay;
+    double* const az = ws->az;
+    const int N_blocks = (N + REBX_EPHEM_BLOCK - 1)/REBX_EPHEM_BLOCK;
+
+    double N_skipped = 0.;
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1) reduction(+:N_skipped)
+    for (int k=0; k<N_blocks; k++){
+        const int b = k*REBX_EPHEM_BLOCK;
+        const int e = (b + REBX_EPHEM_BLOCK < N) ? b + REBX_EPHEM_BLOCK : N;
+        for (int j=b; j<e; j++){
+            x[j] = particles[j].x;
+            y[j] = particles[j].y;
+            z[j] = particles[j].z;
+            ax[j] = particles[j].ax;
+            ay[j] = particles[j].ay;
+            az[j] = particles[j].az;
+        }
+
+        if (cull){
+            struct rebx_ephem_perturbers block;
+            struct rebx_ephem_perturbers_f block_f;
+            N_skipped += (double)rebx_ephem_cull_block(cull, pm, b, e, x, y, z, &block, &block_f)*(e-b);
+            kernel(&block, b, e, x, y, z, ax, ay, az);
+            if (block_f.N > 0){
+                rebx_ephem_point_masses_f(kernel_f, &block_f, b, e, x, y, z, ax, ay, az);
+            }
+        }
+        else{
+            kernel_pm(pm, b, e, x, y, z, ax, ay, az);
+        }
+
+        for (int j=b; j<e; j++){
+            particles[j].ax = ax[j];
+            particles[j].ay = ay[j];
+            particles[j].az = az[j];
+        }
+    }
+    return N_skipped;
+}
+
+/*
+ * Offload.  With offload_device set, the point-mass sum runs on that OpenMP target device (e.g. a GPU), one
+ * device thread per test particle applying the perturbers in the same order as the host kernels.  The device
+ * arrays stay allocated across calls and substeps.  The integrator moves the particles on the host, so each call
+ * uploads the positions and accelerations (48 bytes per particle) together with the perturber states, and
+ * downloads the accelerations.  The Earth and Sun harmonics and the solar GR term stay on the host.
+ * Returns 0 when the device cannot be used, in which case the host kernels are run instead.
+ */
+static int rebx_ephem_point_masses_device(struct reb_simulation* const sim, struct rebx_ephem_cache* const ws, const struct rebx_ephem_perturbers* const pm, struct reb_particle* const particles, const int N, const int device){
+#ifdef REBX_EPHEM_OFFLOAD
+    if (device >= omp_get_num_devices()){
+        if (!ws->offload_warned){
+            reb_warning(sim, "REBOUNDx Warning: offload_device in ephemeris_forces is not an available OpenMP device. Using the host.");
+            ws->offload_warned = 1;
+        }
+        return 0;
+    }
+    if (ws->d_x == NULL || ws->device != device || ws->N_device < N){
+        if (ws->d_x){
+            omp_target_free(ws->d_x, ws->device);
+        }
+        ws->d_x = omp_target_alloc(6*N*sizeof(double), device);
+        ws->device = device;
+        ws->N_device = ws->d_x ? N : 0;
+        if (ws->d_x == NULL){
+            reb_warning(sim, "REBOUNDx Warning: Could not allocate memory on offload_device in ephemeris_forces. Using the host.");
+            return 0;
+        }
+    }
+    for (int j=0; j<N; j++){
+        ws->x[j] = particles[j].x;
+        ws->y[j] = particles[j].y;
+        ws->z[j] = particles[j].z;
+        ws->ax[j] = particles[j].ax;
+        ws->ay[j] = particles[j].ay;
+        ws->az[j] = particles[j].az;
+    }
+    const int host = omp_get_initial_device();
+    const size_t size = N*sizeof(double);
+    double* const x = ws->d_x;
+    double* const y = x + ws->N_device;
+    double* const z = y + ws->N_device;
+    double* const ax = z + ws->N_device;
+    double* const ay = ax + ws->N_device;
+    double* const az = ay + ws->N_device;
+    omp_target_memcpy(x, ws->x, size, 0, 0, device, host);
+    omp_target_memcpy(y, ws->y, size, 0, 0, device, host);
+    omp_target_memcpy(z, ws->z, size, 0, 0, device, host);
+    omp_target_memcpy(ax, ws->ax, size, 0, 0, device, host);
+    omp_target_memcpy(ay, ws->ay, size, 0, 0, device, host);
+    omp_target_memcpy(az, ws->az, size, 0, 0, device, host);
+
+    const struct rebx_ephem_perturbers p = *pm;
+#pragma omp target teams distribute parallel for device(device) is_device_ptr(x, y, z, ax, ay, az) map(to: p)
+    for (int j=0; j<N; j++){
+        double axj = ax[j];
+        double ayj = ay[j];
+        double azj = az[j];
+        for (int i=0; i<p.N; i++){
+            const double dx = x[j] + p.ox[i];
+            const double dy = y[j] + p.oy[i];
+            const double dz = z[j] + p.oz[i];
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz);
+            const double prefac = p.Gm[i]/(_r*_r*_r);
+            axj -= prefac*dx;
+            ayj -= prefac*dy;
+            azj -= prefac*dz;
+        }
+        ax[j] = axj;
+        ay[j] = ayj;
+        az[j] = azj;
+    }
+
+    omp_target_memcpy(ws->ax, ax, size, 0, 0, host, device);
+    omp_target_memcpy(ws->ay, ay, size, 0, 0, host, device);
+    omp_target_memcpy(ws->az, az, size, 0, 0, host, device);
+    for (int j=0; j<N; j++){
+        particles[j].ax = ws->ax[j];
+        particles[j].ay = ws->ay[j];
+        particles[j].az = ws->az[j];
+    }
+    return 1;
+#else
+    if (!ws->offload_warned){
+        reb_warning(sim, "REBOUNDx Warning: offload_device is set in ephemeris_forces, but REBOUNDx was built without OpenMP offload support (make OFFLOAD=1). Using the host.");
+        ws->offload_warned = 1;
+    }
+    return 0;
+#endif
+}
+
+// The params are only added once, and their values stay in place until the force is freed, so later calls just add to them
+static void rebx_ephem_count_culled(struct rebx_extras* const rebx, struct rebx_force* const force, struct rebx_ephem_cache* const ws, const double N_skipped, const double N_terms){
+    if (ws->ast_terms_skipped == NULL || ws->ast_terms == NULL){
+        if (rebx_get_param(rebx, force->ap, "ast_terms_skipped") == NULL){
+            rebx_set_param_double(rebx, &force->ap, "ast_terms_skipped", 0.);
+        }
+        if (rebx_get_param(rebx, force->ap, "ast_terms") == NULL){
+            rebx_set_param_double(rebx, &force->ap, "ast_terms", 0.);
+        }
+        ws->ast_terms_skipped = rebx_get_param(rebx, force->ap, "ast_terms_skipped");
+        ws->ast_terms = rebx_get_param(rebx, force->ap, "ast_terms");
+        if (ws->ast_terms_skipped == NULL || ws->ast_terms == NULL){
+            return;
+        }
+    }
+    *ws->ast_terms_skipped += N_skipped;
+    *ws->ast_terms += N_terms;
+}
+
+static void rebx_ephem_alloc_soa(struct rebx_ephem_cache* const ws, const int N){
+    if (ws->N_alloc >= N){
+        return;
+    }
+    free(ws->x);
+    ws->x = malloc(6*N*sizeof(double));   // one allocation, split in six
+    ws->y = ws->x + N;
+    ws->z = ws->y + N;
+    ws->ax = ws->z + N;
+    ws->ay = ws->ax + N;
+    ws->az = ws->ay + N;
+    ws->N_alloc = N;
+}
+
+/*
+ * Variational equations.
+ *
+ * For each first order variational particle, the change in the acceleration of
+ * its real particle is the Jacobian of the forces above applied to the
+ * variation (dx, dv).  The ephemeris bodies are fixed, so only the test
+ * particle's own position and velocity enter.
+ */
+
+// Point masses: da = -Gm [dr/r^3 - 3 d (d.dr)/r^5].
+static void rebx_ephem_var_point_masses(const struct rebx_ephem_perturbers* const pm, const struct reb_particle p, const struct reb_particle dp, double* const da){
+    for (int i=0; i<pm->N; i++){
+        const double dx = p.x + pm->ox[i];
+        const double dy = p.y + pm->oy[i];
+        const double dz = p.z + pm->oz[i];
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double _r = sqrt(r2);
+        const double prefac = pm->Gm[i]/(r2*_r);
+        const double rdr = 3.*(dx*dp.x + dy*dp.y + dz*dp.z)/r2;
+        da[0] -= prefac*(dp.x - rdr*dx);
+        da[1] -= prefac*(dp.y - rdr*dy);
+        da[2] -= prefac*(dp.z - rdr*dz);
+    }
+}
+
+/*
+ * Specialized variants.
+ *
+ * The force body below is compiled once per variant with the frame and the
+ * asteroid set fixed, so the branches on them and the terms they switch off
+ * (the geocentric offsets and frame acceleration, the asteroid fetch and
+ * culling) are removed at compile time.  Every variant gives the same
+ * accelerations as ephemeris_forces with the matching parameters:
+ *
+ *  ephemeris_forces               geocentric, N_ephem and N_ast read from the force
+ *  ephemeris_forces_bary         barycentric frame, geocentric is not read
+ *  ephemeris_forces_geo           geocentric frame, geocentric is not read
+ *  ephemeris_forces_bary_noast   barycentric frame, no asteroids, N_ast is not read
+ *  ephemeris_forces_geo_noast     geocentric frame, no asteroids, N_ast is not read
+ *
+ * N_ephem is optional in the fixed variants and defaults to all 11 bodies.
+ * The point-mass sum is shared by all of them and specialized on the perturber
+ * count instead: whenever only the Sun and planets are applied (the noast
+ * variants with the default N_ephem, or N_ast = 0), it runs the fixed count
+ * kernels above.
+ */
+
+#define REBX_EPHEM_FIXED_FRAME      1   // frame set by REBX_EPHEM_GEOCENTRIC instead of the geocentric param
+#define REBX_EPHEM_GEOCENTRIC       2
+#define REBX_EPHEM_NO_AST           4   // no asteroids, N_ast is not read
+
+#if defined(__GNUC__) || defined(__clang__)
+#define REBX_EPHEM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define REBX_EPHEM_ALWAYS_INLINE inline
+#endif
+
+static REBX_EPHEM_ALWAYS_INLINE void rebx_ephemeris_forces_variant(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, const int variant){
 
     const double G = sim->G;
     const double t = sim->t;
 
-    const int* const N_ephem = rebx_get_param(sim->extras, force->ap, "N_ephem");
-    if (N_ephem == NULL){
+    const int* const N_ephem_ptr = rebx_get_param(sim->extras, force->ap, "N_ephem");
+    if (N_ephem_ptr == NULL && !(variant & REBX_EPHEM_FIXED_FRAME)){
         fprintf(stderr, "REBOUNDx Error: Need to set N_ephem for ephemeris_forces\n");
         return;
     }
+    const int N_ephem = N_ephem_ptr ? *N_ephem_ptr : REBX_EPHEM_N_PLANETS;
     
-    const int* const N_ast = rebx_get_param(sim->extras, force->ap, "N_ast");
-    if (N_ephem == NULL){
+    const int* const N_ast_ptr = (variant & REBX_EPHEM_NO_AST) ? NULL : rebx_get_param(sim->extras, force->ap, "N_ast");
+    if (N_ast_ptr == NULL && !(variant & REBX_EPHEM_NO_AST)){
         fprintf(stderr, "REBOUNDx Error: Need to set N_ast for ephemeris_forces\n");
         return;
     }
+    const int N_ast = (variant & REBX_EPHEM_NO_AST) ? 0 : *N_ast_ptr;
+
+    if (N_ephem < 0 || N_ephem > REBX_EPHEM_N_PLANETS || N_ast < 0 || N_ast > REBX_EPHEM_N_AST){
+        reb_error(sim, "REBOUNDx Error: ephemeris_forces supports N_ephem <= 11 and N_ast <= 16.\n");
+        return;
+    }
 
     double* c = rebx_get_param(sim->extras, force->ap, "c");
     if (c == NULL){
@@ -245,78 +1186,96 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
         return;
     }
 
-    int* geo = rebx_get_param(sim->extras, force->ap, "geocentric"); // Make sure there is a default set.
-    if (geo == NULL){
+    const int* const geo_ptr = (variant & REBX_EPHEM_FIXED_FRAME) ? NULL : rebx_get_param(sim->extras, force->ap, "geocentric"); // Make sure there is a default set.
+    if (geo_ptr == NULL && !(variant & REBX_EPHEM_FIXED_FRAME)){
         reb_error(sim, "REBOUNDx Error: Need to set geo flag.  See examples in documentation.\n");
         return;
     }
+    const int geo = (variant & REBX_EPHEM_FIXED_FRAME) ? ((variant & REBX_EPHEM_GEOCENTRIC) ? 1 : 0) : *geo_ptr;
+
+    const struct rebx_ephemeris* eph = rebx_get_param(sim->extras, force->ap, "ephemeris");
+    if (eph == NULL){
+        eph = rebx_ephemeris_default();
+        if (eph == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not load the default ephemeris files for ephemeris_forces.  Use rebx_ephemeris_init() to load them from elsewhere.\n");
+            return;
+        }
+    }
+    if (N_ast > 0 && eph->spl == NULL){
+        reb_error(sim, "REBOUNDx Error: N_ast > 0 but no asteroid ephemeris was loaded for ephemeris_forces.\n");
+        return;
+    }
+
+    // Test particles don't interact, so every particle loop below can be split between threads
+    // when REBOUNDx is compiled with OpenMP.  Each thread writes only to its own particles.
+    const int* const n_threads_ptr = rebx_get_param(sim->extras, force->ap, "n_threads");
+    const int n_threads = (n_threads_ptr && *n_threads_ptr > 1) ? *n_threads_ptr : 1;
 
     const double C2 = (*c)*(*c);  // This could be stored as C2.
     
-    double m, x, y, z, vx, vy, vz, ax, ay, az;
-    double xs, ys, zs, vxs, vys, vzs, axs, ays, azs;
-    double xe, ye, ze, vxe, vye, vze, axe, aye, aze;
+    double xs, ys, zs, vxs, vys, vzs;
+    double xe, ye, ze, axe, aye, aze;
     double xo, yo, zo, vxo, vyo, vzo;
     double xr, yr, zr, vxr, vyr, vzr;
 
-    // Get mass, position, velocity, and acceleration of the Earth and Sun
-    // for later use
-    ephem(G, 3, t, &m, &xe, &ye, &ze, &vxe, &vye, &vze, &axe, &aye, &aze);
-    ephem(G, 0, t, &m, &xs, &ys, &zs, &vxs, &vys, &vzs, &axs, &ays, &azs);     
+    // Barycentric states of all the massive bodies at this epoch
+    const struct rebx_ephem_state* const st = rebx_ephem_get_state(sim, force, eph, t, N_ephem, N_ast);
+    if (st == NULL){
+        return;
+    }
+
+    // Position, velocity, and acceleration of the Earth and Sun for later use
+    xe = st->x[3];   ye = st->y[3];   ze = st->z[3];
+    axe = st->ax[3]; aye = st->ay[3]; aze = st->az[3];
+    xs = st->x[0];   ys = st->y[0];   zs = st->z[0];
+    vxs = st->vx[0]; vys = st->vy[0]; vzs = st->vz[0];
 
     // The offset position is used to adjust the particle positions.
-    if(*geo == 1){
-      xo = xe;    yo = ye;    zo = ze;
-      vxo = vxe;  vyo = vye;  vzo = vze;
+    if(geo == 1){
+      xo = xe;         yo = ye;         zo = ze;
+      vxo = st->vx[3]; vyo = st->vy[3]; vzo = st->vz[3];
     }else{
       xo = 0.0;  yo = 0.0;  zo = 0.0;
       vxo = 0.0; vyo = 0.0; vzo = 0.0;      
     }
 
-    // Calculate acceleration due to sun and planets
-    // Rearrange to get all the planet positions at once
-    for (int i=0; i<*N_ephem; i++){
-
-        // Get position and mass of massive body i.
-        ephem(G, i, t, &m, &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az); 
-
-        for (int j=0; j<N; j++){
-  	  // Compute position vector of test particle j relative to massive body i.
-	  const double dx =  particles[j].x + (xo - x); 
-	  const double dy =  particles[j].y + (yo - y);
-	  const double dz =  particles[j].z + (zo - z);
-	  const double _r = sqrt(dx*dx + dy*dy + dz*dz);
-	  const double prefac = G*m/(_r*_r*_r);
-
-	  //printf("%le %le %le\n", dx, dy, dz);
-	  
-	  particles[j].ax -= prefac*dx;
-	  particles[j].ay -= prefac*dy;
-	  particles[j].az -= prefac*dz;
-
+    // Calculate acceleration due to sun, planets and massive asteroids
+    struct rebx_ephem_perturbers pm;
+    pm.N = 0;
+    for (int i=0; i<REBX_EPHEM_N_PLANETS+N_ast; i++){
+        if (i >= N_ephem && i < REBX_EPHEM_N_PLANETS){
+            continue;
         }
+        // Position vector of a test particle relative to body i is its position plus this offset.
+        pm.ox[pm.N] = xo - st->x[i];
+        pm.oy[pm.N] = yo - st->y[i];
+        pm.oz[pm.N] = zo - st->z[i];
+        pm.Gm[pm.N] = G*st->m[i];
+        pm.N++;
     }
 
-    // Calculate acceleration due to massive asteroids
-    // Rearrange to get all the asteroid positions at once
-    for (int i=0; i<*N_ast; i++){
-
-        ast_ephem(G, i, t, &m, &x, &y, &z); // Get position and mass of asteroid i.
+    struct rebx_ephem_culling cull;
+    const double* const ast_tolerance = rebx_get_param(sim->extras, force->ap, "ast_tolerance");
+    const double* const float_tolerance = rebx_get_param(sim->extras, force->ap, "float_tolerance");
+    cull.tolerance = (ast_tolerance != NULL && *ast_tolerance > 0. && N_ast > 0) ? *ast_tolerance : 0.;
+    cull.float_tolerance = (float_tolerance != NULL && *float_tolerance > 0.) ? *float_tolerance : 0.;
+    const int culling = (cull.tolerance > 0. || cull.float_tolerance > 0.) && N > 0;
+    if (culling){
+        cull.sun = N_ephem > 0 ? 0 : -1;
+        cull.N_planets = pm.N - N_ast;
+        cull.ox = xo - xs;
+        cull.oy = yo - ys;
+        cull.oz = zo - zs;
+        cull.Gm_sun = G*st->m[0];
+    }
 
-	// Translate massive asteroids from heliocentric to barycentric.
-	x += xs; y += ys; z += zs;
-	
-        for (int j=0; j<N; j++){
-  	  // Compute position vector of test particle j relative to massive body i.
-	    const double dx = particles[j].x + (xo - x);
-	    const double dy = particles[j].y + (yo - y);
-	    const double dz = particles[j].z + (zo - z); 	    	    
-            const double _r = sqrt(dx*dx + dy*dy + dz*dz);
-	    
-            const double prefac = G*m/(_r*_r*_r);
-            particles[j].ax -= prefac*dx;
-            particles[j].ay -= prefac*dy;
-            particles[j].az -= prefac*dz;
+    struct rebx_ephem_cache* const ws = rebx_get_param(sim->extras, force->ap, "ephem_cache");
+    rebx_ephem_alloc_soa(ws, N);
+    const int* const device = rebx_get_param(sim->extras, force->ap, "offload_device");
+    if (device == NULL || *device < 0 || culling || !rebx_ephem_point_masses_device(sim, ws, &pm, particles, N, *device)){
+        const double N_skipped = rebx_ephem_point_masses(ws, &pm, culling ? &cull : NULL, particles, N, n_threads);
+        if (cull.tolerance > 0.){
+            rebx_ephem_count_culled(sim->extras, force, ws, N_skipped, (double)N_ast*N);
         }
     }
 
@@ -358,75 +1317,27 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
     //xp = 0.0;
     //yp = 0.0;
     //zp = 1.0;
-    
-    double incl = acos(zp);
-    double longnode;
-    if(xp != 0.0 || yp !=0.0) {    
-      longnode = atan2(xp, -yp);
-    } else {
-      longnode = 0.0;
-    }
 
-    // Rearrange this loop for efficiency
+    // Rotation to the Earth equatorial frame, computed once for all particles
+    struct rebx_oblate_frame earth_frame;
+    rebx_oblate_frame_from_pole(&earth_frame, xp, yp, zp);
+    const double J_earth[5] = {0., 0., J2e, 0., J4e};
+
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
     for (int j=0; j<N; j++){
         const struct reb_particle p = particles[j];
-        double dx = p.x + (xo - xr);
-        double dy = p.y + (yo - yr);
-        double dz = p.z + (zo - zr);
-
-        const double r2 = dx*dx + dy*dy + dz*dz;
-        const double r = sqrt(r2);
-	
-	// Rotate to Earth equatorial frame
-	// This could be a single rotation
-
-	// Rotate around z by RA
-	double cosr = cos(-longnode);
-	double sinr = sin(-longnode);
-
-	double dxp =  dx * cosr - dy * sinr;
-	double dyp =  dx * sinr + dy * cosr;
-	double dzp =  dz;
-
-	// Rotate around x by Dec
-	double cosd = cos(-incl);
-	double sind = sin(-incl);
-	
-	dx =  dxp;
-	dy =  dyp * cosd - dzp * sind;
-	dz =  dyp * sind + dzp * cosd;
-
-	// Calculate acceleration in body frame
-	
-        const double costheta2 = dz*dz/r2;
-        const double J2e_prefac = 3.*J2e*Re_eq*Re_eq/r2/r2/r/2.;
-        const double J2e_fac = 5.*costheta2-1.;
-
-	double resx = G*Mearth*J2e_prefac*J2e_fac*dx;
-	double resy = G*Mearth*J2e_prefac*J2e_fac*dy;
-	double resz = G*Mearth*J2e_prefac*(J2e_fac-2.)*dz;	
-
-        const double J4e_prefac = 5.*J4e*Re_eq*Re_eq*Re_eq*Re_eq/r2/r2/r2/r/8.;
-        const double J4e_fac = 63.*costheta2*costheta2-42.*costheta2 + 3.;
-
-        resx += G*Mearth*J4e_prefac*J4e_fac*dx;
-        resy += G*Mearth*J4e_prefac*J4e_fac*dy;
-        resz += G*Mearth*J4e_prefac*(J4e_fac+12.-28.*costheta2)*dz;
-
-	// Rotate back to original frame
-	// Rotate around x by -Dec
-	double resxp =  resx;
-	double resyp =  resy * cosd + resz * sind;
-	double reszp = -resy * sind + resz * cosd;
-	
-	// Rotate around z by -RA
-	resx =  resxp * cosr + resyp * sinr;
-	resy = -resxp * sinr + resyp * cosr;
-	resz =  reszp;
-
-	particles[j].ax += resx;
-        particles[j].ay += resy; 
-        particles[j].az += resz;
+        const double d[3] = {p.x + (xo - xr), p.y + (yo - yr), p.z + (zo - zr)};
+        double db[3], ab[3], res[3];
+
+	// Rotate to Earth equatorial frame, calculate the J2 and J4
+	// acceleration there, and rotate back
+        rebx_oblate_frame_to_body(&earth_frame, d, db);
+        rebx_zonal_acceleration(G*Mearth, Re_eq, 4, J_earth, db[0], db[1], db[2], ab);
+        rebx_oblate_frame_from_body(&earth_frame, ab, res);
+
+	particles[j].ax += res[0];
+        particles[j].ay += res[1]; 
+        particles[j].az += res[2];
 	
     }
 
@@ -448,68 +1359,24 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
     RAs = 268.13*M_PI/180.;
     Decs = 63.87*M_PI/180.;
 
-    xp = cos(Decs)*cos(RAs);
-    yp = cos(Decs)*sin(RAs);
-    zp = sin(Decs);
-
-    incl = acos(zp);
-    if(xp != 0.0 || yp !=0.0) {    
-      longnode = atan2(xp, -yp);
-    } else {
-      longnode = 0.0;
-    }
+    struct rebx_oblate_frame sun_frame;
+    rebx_oblate_frame_from_radec(&sun_frame, RAs, Decs);
+    const double J_sun[3] = {0., 0., J2s};
     
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
     for (int j=0; j<N; j++){
         const struct reb_particle p = particles[j];
-        double dx = p.x + (xo - xr);
-        double dy = p.y + (yo - yr);
-        double dz = p.z + (zo - zr);
+        const double d[3] = {p.x + (xo - xr), p.y + (yo - yr), p.z + (zo - zr)};
+        double db[3], ab[3], res[3];
 
-        const double r2 = dx*dx + dy*dy + dz*dz;
-        const double r = sqrt(r2);
-
-	// Rotate to solar equatorial frame
+	// Rotate to solar equatorial frame and back
+        rebx_oblate_frame_to_body(&sun_frame, d, db);
+        rebx_zonal_acceleration(G*Msun, Rs_eq, 2, J_sun, db[0], db[1], db[2], ab);
+        rebx_oblate_frame_from_body(&sun_frame, ab, res);
 
-	// Rotate around z by RA
-	double cosr = cos(-longnode);
-	double sinr = sin(-longnode);
-	
-	// Rotate around z by RA
-	double dxp =  dx * cosr - dy * sinr;
-	double dyp =  dx * sinr + dy * cosr;
-	double dzp =  dz;
-
-	// Rotate around x by Dec
-	double cosd = cos(-incl);
-	double sind = sin(-incl);
-
-	dx =  dxp;
-	dy =  dyp * cosd - dzp * sind;
-	dz =  dyp * sind + dzp * cosd;
-
-	const double costheta2 = dz*dz/r2;
-        const double J2s_prefac = 3.*J2s*Rs_eq*Rs_eq/r2/r2/r/2.;
-        const double J2s_fac = 5.*costheta2-1.;
-
-	// Calculate acceleration
-	double resx = G*Msun*J2s_prefac*J2s_fac*dx;
-	double resy = G*Msun*J2s_prefac*J2s_fac*dy;
-	double resz = G*Msun*J2s_prefac*(J2s_fac-2.)*dz;
-
-	// Rotate back to original frame
-	// Rotate around x by -Dec
-	double resxp =  resx;
-	double resyp =  resy * cosd + resz * sind;
-	double reszp = -resy * sind + resz * cosd;
-	
-	// Rotate around z by -RA
-	resx =  resxp * cosr + resyp * sinr;
-	resy = -resxp * sinr + resyp * cosr;
-	resz =  reszp;
-
-        particles[j].ax += resx;
-        particles[j].ay += resy;
-        particles[j].az += resz;
+        particles[j].ax += res[0];
+        particles[j].ay += res[1];
+        particles[j].az += res[2];
 	
     }
 
@@ -523,6 +1390,8 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
 
     const double mu = G*Msun; 
     const int max_iterations = 10; // hard-coded parameter.
+    int N_unconverged = 0;
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1) reduction(+:N_unconverged)
     for (int j=0; j<N; j++){
         struct reb_particle p = particles[j];
         struct reb_vec3d vi;
@@ -561,7 +1430,7 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
         }
         const int default_max_iterations = 10;
         if(q==default_max_iterations){
-            reb_warning(sim, "REBOUNDx Warning: 10 iterations in ephemeris forces failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+            N_unconverged++;
         }
   
         const double B = (mu/ri - 1.5*vi2)*mu/(ri*ri*ri)/C2;
@@ -582,14 +1451,20 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
     }
 
 
+    // Warn outside the loop, since reb_warning is not safe to call from several threads.
+    if(N_unconverged > 0){
+        reb_warning(sim, "REBOUNDx Warning: 10 iterations in ephemeris forces failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+    }
+
     // The expressions below are in here for another purpose.
     /*
     double ae = sqrt(axe*axe + aye*aye + aze*aze);
     double rho = sqrt(G*Msun/ae);
     */
 
-    if(*geo == 1){
+    if(geo == 1){
 
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
       for (int j=0; j<N; j++){    
 
 	particles[j].ax -= axe;
@@ -600,6 +1475,67 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
 
     }
 
+    // Variational particles.  The geocentric frame acceleration does not depend
+    // on the particle, so it drops out of the variations.
+    int warn_second_order = 0;
+    for (int v=0; v<sim->var_config_N; v++){
+        const struct reb_variational_configuration vc = sim->var_config[v];
+        if (vc.order != 1){
+            warn_second_order = 1;
+            continue;
+        }
+        // A test particle variation has one particle; otherwise there is one per real particle.
+        const int j0 = vc.testparticle >= 0 ? vc.testparticle : 0;
+        const int j1 = vc.testparticle >= 0 ? vc.testparticle+1 : N;
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
+        for (int j=j0; j<j1; j++){
+            const struct reb_particle p = particles[j];
+            struct reb_particle* const dp = &particles[vc.index + j - j0];
+            const double dd[6] = {dp->x, dp->y, dp->z, dp->vx, dp->vy, dp->vz};
+            double da[3] = {0., 0., 0.};
+
+            rebx_ephem_var_point_masses(&pm, p, *dp, da);
+
+            const double de[3] = {p.x + (xo - xe), p.y + (yo - ye), p.z + (zo - ze)};
+            rebx_zonal_variation(G*Mearth, J2e, J4e, Re_eq, &earth_frame, de, dd, da);
+
+            const double ds[6] = {p.x + (xo - xs), p.y + (yo - ys), p.z + (zo - zs), p.vx + (vxo - vxs), p.vy + (vyo - vys), p.vz + (vzo - vzs)};
+            rebx_zonal_variation(G*Msun, J2s, 0., Rs_eq, &sun_frame, ds, dd, da);
+
+            // Solar GR, at the 1PN test particle order that matters for the partials
+            rebx_gr_variation(mu, C2, ds, dd, da);
+
+            dp->ax += da[0];
+            dp->ay += da[1];
+            dp->az += da[2];
+        }
+    }
+    struct rebx_extras* const rebx = sim->extras;
+    if (warn_second_order && !rebx->var_order_warned){
+        rebx->var_order_warned = 1;
+        reb_warning(sim, "REBOUNDx Warning: ephemeris_forces only supports first order variational equations.  Second order variations are ignored.");
+    }
+
+}
+
+void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    rebx_ephemeris_forces_variant(sim, force, particles, N, 0);
+}
+
+void rebx_ephemeris_forces_bary(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    rebx_ephemeris_forces_variant(sim, force, particles, N, REBX_EPHEM_FIXED_FRAME);
+}
+
+void rebx_ephemeris_forces_geo(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    rebx_ephemeris_forces_variant(sim, force, particles, N, REBX_EPHEM_FIXED_FRAME | REBX_EPHEM_GEOCENTRIC);
+}
+
+void rebx_ephemeris_forces_bary_noast(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    rebx_ephemeris_forces_variant(sim, force, particles, N, REBX_EPHEM_FIXED_FRAME | REBX_EPHEM_NO_AST);
+}
+
+void rebx_ephemeris_forces_geo_noast(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    rebx_ephemeris_forces_variant(sim, force, particles, N, REBX_EPHEM_FIXED_FRAME | REBX_EPHEM_GEOCENTRIC | REBX_EPHEM_NO_AST);
 }
 
 /**
@@ -642,13 +1578,15 @@ typedef struct {
 // Gauss Radau spacings
 static const double h[9]    = { 0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780, 0.352624717113169637373907769648, 0.547153626330555383001448554766, 0.734210177215410531523210605558, 0.885320946839095768090359771030, 0.977520613561287501891174488626, 1.0};
 
-int integration_function(double tstart, double tstep, double trange,
+void store_function(struct reb_simulation* r, int n_out, int n_particles, tstate* last, double* outtime, double* outstate);
+
+// Sets up an IAS15 simulation with ephemeris_forces and the test particles in
+// instate, with accelerations evaluated at tstart.
+static struct rebx_extras* integration_function_setup(double tstart, double tstep,
 			 int geocentric,
 			 int n_particles,
-			 double* instate,
-			 timestate *ts){
+			 double* instate){
 
-    void store_function(struct reb_simulation* r, int n_out, int n_particles, tstate* last, double* outtime, double* outstate);
     struct reb_simulation* r = reb_create_simulation();
 
     // Set up simulation constants
@@ -678,15 +1616,6 @@ int integration_function(double tstart, double tstep, double trange,
     // Here we use default units of AU/(yr/2pi)
     rebx_set_param_double(rebx, &ephem_forces->ap, "c", 173.144632674);
 
-    int fac = 5;
-    int n_out = (int)fac*8*fabs(trange/tstep);
-    
-    double* outstate = (double *) malloc(n_out*n_particles*6*sizeof(double));
-    double* outtime  = (double *) malloc(n_out*sizeof(double));    
-
-    rebx_set_param_int(rebx, &ephem_forces->ap, "n_out", 0);
-    rebx_set_param_pointer(rebx, &ephem_forces->ap, "outstate", outstate);
-
     for(int i=0; i<n_particles; i++){
 
 	struct reb_particle tp = {0};
@@ -701,182 +1630,487 @@ int integration_function(double tstart, double tstep, double trange,
 	reb_add(r, tp);
     }
 
-    int N = r->N;
-    
     r->t = tstart;    // set simulation internal time to the time of test particle initial conditions.
     r->dt = tstep;    // time step in days
 
-    outtime[0] = r->t;	
-    
-    for(int j=0; j<N; j++){
-	int offset = j*6;
-	outstate[offset+0] = r->particles[j].x;
-	outstate[offset+1] = r->particles[j].y;
-	outstate[offset+2] = r->particles[j].z;
-	outstate[offset+3] = r->particles[j].vx;
-	outstate[offset+4] = r->particles[j].vy;
-	outstate[offset+5] = r->particles[j].vz;
+    //reb_integrate(r, times[0]); // Not sure this is needed.
+    reb_update_acceleration(r); // This is needed to save the acceleration.
+
+    return rebx;
+}
+
+// Saves the state at the start of a step, which the dense output expands about.
+static void integration_function_save(struct reb_simulation* r, tstate* last){
+    for(int j=0; j<r->N; j++){
+	last[j].t = r->t;	
+	last[j].x = r->particles[j].x;
+	last[j].y = r->particles[j].y;
+	last[j].z = r->particles[j].z;
+	last[j].vx = r->particles[j].vx;
+	last[j].vy = r->particles[j].vy;
+	last[j].vz = r->particles[j].vz;
+	last[j].ax = r->particles[j].ax;
+	last[j].ay = r->particles[j].ay;
+	last[j].az = r->particles[j].az;
     }
+}
 
-    tstate last[n_particles];
+// Evaluates the IAS15 dense output of the last completed step at the fraction hn
+// of the step (0 = start, 1 = end), writing n_particles*6 values to outstate.
+// Reads the expansion point directly from last, so it needs no workspace.
+static void dense_output(struct reb_simulation* r, int n_particles, tstate* last, double hn, double* outstate){
 
-    //reb_integrate(r, times[0]); // Not sure this is needed.
-    reb_update_acceleration(r); // This is needed to save the acceleration.
- 
-    double tmax = tstart+trange;
-    int i = 1;
+    double s[9]; // Summation coefficients
+
+    // Convenience variable.  The 'br' field contains the 
+    // set of coefficients from the last completed step.
+    const struct reb_dpconst7 b  = dpcast(r->ri_ias15.br);
+
+    s[0] = r->dt_last_done * hn;
+
+    s[1] = s[0] * s[0] / 2.;
+    s[2] = s[1] * hn / 3.;
+    s[3] = s[2] * hn / 2.;
+    s[4] = 3. * s[3] * hn / 5.;
+    s[5] = 2. * s[4] * hn / 3.;
+    s[6] = 5. * s[5] * hn / 7.;
+    s[7] = 3. * s[6] * hn / 4.;
+    s[8] = 7. * s[7] * hn / 9.;
+
+    // Predict positions using b values	
+    for(int j=0;j<n_particles;j++) {  
+	const int k0 = 3*j+0;
+	const int k1 = 3*j+1;
+	const int k2 = 3*j+2;
+
+	outstate[6*j+0] = last[j].x + (s[8]*b.p6[k0] + s[7]*b.p5[k0] + s[6]*b.p4[k0] + s[5]*b.p3[k0] + s[4]*b.p2[k0] + s[3]*b.p1[k0] + s[2]*b.p0[k0] + s[1]*last[j].ax + s[0]*last[j].vx );
+	outstate[6*j+1] = last[j].y + (s[8]*b.p6[k1] + s[7]*b.p5[k1] + s[6]*b.p4[k1] + s[5]*b.p3[k1] + s[4]*b.p2[k1] + s[3]*b.p1[k1] + s[2]*b.p0[k1] + s[1]*last[j].ay + s[0]*last[j].vy );
+	outstate[6*j+2] = last[j].z + (s[8]*b.p6[k2] + s[7]*b.p5[k2] + s[6]*b.p4[k2] + s[5]*b.p3[k2] + s[4]*b.p2[k2] + s[3]*b.p1[k2] + s[2]*b.p0[k2] + s[1]*last[j].az + s[0]*last[j].vz );
+    }
+
+    s[0] = r->dt_last_done * hn;
+    s[1] =      s[0] * hn / 2.;
+    s[2] = 2. * s[1] * hn / 3.;
+    s[3] = 3. * s[2] * hn / 4.;
+    s[4] = 4. * s[3] * hn / 5.;
+    s[5] = 5. * s[4] * hn / 6.;
+    s[6] = 6. * s[5] * hn / 7.;
+    s[7] = 7. * s[6] * hn / 8.;
+
+    // Predict velocities using b values	
+    for(int j=0;j<n_particles;j++) {
+	const int k0 = 3*j+0;
+	const int k1 = 3*j+1;
+	const int k2 = 3*j+2;
+
+	outstate[6*j+3] = last[j].vx + s[7]*b.p6[k0] + s[6]*b.p5[k0] + s[5]*b.p4[k0] + s[4]*b.p3[k0] + s[3]*b.p2[k0] + s[2]*b.p1[k0] + s[1]*b.p0[k0] + s[0]*last[j].ax;
+	outstate[6*j+4] = last[j].vy + s[7]*b.p6[k1] + s[6]*b.p5[k1] + s[5]*b.p4[k1] + s[4]*b.p3[k1] + s[3]*b.p2[k1] + s[2]*b.p1[k1] + s[1]*b.p0[k1] + s[0]*last[j].ay;
+	outstate[6*j+5] = last[j].vz + s[7]*b.p6[k2] + s[6]*b.p5[k2] + s[5]*b.p4[k2] + s[4]*b.p3[k2] + s[3]*b.p2[k2] + s[2]*b.p1[k2] + s[1]*b.p0[k2] + s[0]*last[j].az;
+    }
+}
+
+// Steps the simulation set up by integration_function_setup to tstart+trange,
+// handing the dense output of every step to callback, and frees it.
+static void integration_function_run(struct rebx_extras* rebx, double trange,
+			 int n_particles,
+			 rebx_ephem_output_callback callback,
+			 void* user){
+
+    struct reb_simulation* r = rebx->sim;
+
+    // One step's worth of dense output, reused for every step.
+    double* outstate = (double *) malloc(8*n_particles*6*sizeof(double));
+    double* outtime  = (double *) malloc(8*sizeof(double));    
+
+    tstate* last = (tstate*) malloc(n_particles*sizeof(tstate));
+
+    double tmax = r->t+trange;
     const double dtsign = copysign(1.,r->dt);   // Used to determine integration direction
 
     while((r->t)*dtsign<tmax*dtsign){ 
 
-	// This could be a helper function
-	for(int j=0; j<N; j++){
-	    last[j].t = r->t;	
-	    last[j].x = r->particles[j].x;
-	    last[j].y = r->particles[j].y;
-	    last[j].z = r->particles[j].z;
-	    last[j].vx = r->particles[j].vx;
-	    last[j].vy = r->particles[j].vy;
-	    last[j].vz = r->particles[j].vz;
-	    last[j].ax = r->particles[j].ax;
-	    last[j].ay = r->particles[j].ay;
-	    last[j].az = r->particles[j].az;
-	}
+	integration_function_save(r, last);
 
 	reb_step(r);
 
-	store_function(r, 8*(i-1), n_particles, last, outtime, outstate);
+	store_function(r, 0, n_particles, last, outtime, outstate);
 	reb_update_acceleration(r); // This is needed to save the acceleration.
 
-	i++;
+	if(callback(user, outtime, outstate, 8, n_particles)){
+	    break;
+	}
 
     }
 
-    ts->t = outtime;
-    ts->state = outstate;
-    ts->n_particles = n_particles;
-    ts->n_out = (i-1)*8;
-    //*nout =  n_out;
-
+    free(last);
+    free(outtime);
+    free(outstate);
 
     rebx_free(rebx);    // this explicitly frees all the memory allocated by REBOUNDx 
     reb_free_simulation(r);
+}
+
+// Integrates the test particles in instate and hands the dense output of every
+// completed step to callback: the state at the start of the step followed by the
+// states at the 7 interior Gauss-Radau substeps, so 8 times per call.  The arrays
+// passed to the callback are reused for the next step, so memory use does not
+// depend on trange.  Integration stops early if the callback returns nonzero.
+int integration_function_stream(double tstart, double tstep, double trange,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 rebx_ephem_output_callback callback,
+			 void* user){
 
+    struct rebx_extras* rebx = integration_function_setup(tstart, tstep, geocentric, n_particles, instate);
+    integration_function_run(rebx, trange, n_particles, callback, user);
 
     return(1);
 }
 
-void store_function(struct reb_simulation* r, int n_out, int n_particles, tstate* last, double* outtime, double* outstate){
-    
-    int N = r->N;
-    int N3 = 3*N;
-    double s[9]; // Summation coefficients
+static int integration_function_check_epochs(double tstart, double tstep, int n_epochs, const double* epochs){
+    const double dtsign = copysign(1.,tstep);
+    for(int k=0; k<n_epochs; k++){
+	const double prev = k ? epochs[k-1] : tstart;
+	if(epochs[k]*dtsign < prev*dtsign){
+	    fprintf(stderr, "REBOUNDx Error: integration_function_epochs needs epochs sorted in the direction of integration, starting at or after tstart.\n");
+	    return(0);
+	}
+    }
+    return(1);
+}
 
-    outtime[n_out] = last[0].t;    
+// Integrates the test particles in instate and evaluates the dense output only at
+// the n_epochs requested times, which must be sorted in the direction of
+// integration (the sign of tstep) and not precede tstart.  Each step is only
+// expanded at the epochs that fall inside it.  outstate must hold
+// n_epochs*n_particles*6 values, (epoch, particle, x/y/z/vx/vy/vz) ordered.
+// Returns 1, or 0 if the input is invalid or memory could not be allocated.
+int integration_function_epochs(double tstart, double tstep,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 int n_epochs,
+			 const double* epochs,
+			 double* outstate){
 
-    for(int j=0; j<n_particles; j++){
-	int offset = (n_out*n_particles+j)*6;
-	outstate[offset+0] = last[j].x;
-	outstate[offset+1] = last[j].y;	
-	outstate[offset+2] = last[j].z;
-	outstate[offset+3] = last[j].vx;	
-	outstate[offset+4] = last[j].vy;
-	outstate[offset+5] = last[j].vz;	
+    const double dtsign = copysign(1.,tstep);   // Used to determine integration direction
+
+    // The epochs are placed relative to the saved state of the first particle.
+    if(n_particles <= 0){
+	fprintf(stderr, "REBOUNDx Error: integration_function_epochs needs at least one particle.\n");
+	return(0);
     }
-    
-    // Convenience variable.  The 'br' field contains the 
-    // set of coefficients from the last completed step.
-    const struct reb_dpconst7 b  = dpcast(r->ri_ias15.br);
 
-    double* x0 = malloc(sizeof(double)*N3);
-    double* v0 = malloc(sizeof(double)*N3);
-    double* a0 = malloc(sizeof(double)*N3);
+    if(!integration_function_check_epochs(tstart, tstep, n_epochs, epochs)){
+	return(0);
+    }
 
-    for(int j=0;j<N;j++) {
+    struct rebx_extras* rebx = integration_function_setup(tstart, tstep, geocentric, n_particles, instate);
+    struct reb_simulation* r = rebx->sim;
 
-	const int k0 = 3*j+0;
-	const int k1 = 3*j+1;
-	const int k2 = 3*j+2;
+    tstate* last = (tstate*) malloc(n_particles*sizeof(tstate));
+    if(last == NULL){
+	fprintf(stderr, "REBOUNDx Error: Could not allocate memory in integration_function_epochs.\n");
+	rebx_free(rebx);
+	reb_free_simulation(r);
+	return(0);
+    }
+
+    int k = 0;
+    while(k < n_epochs){ 
 
-	x0[k0] = last[j].x;
-	x0[k1] = last[j].y;
-	x0[k2] = last[j].z;	
+	integration_function_save(r, last);
 
-	v0[k0] = last[j].vx;
-	v0[k1] = last[j].vy;
-	v0[k2] = last[j].vz;	
+	reb_step(r);
 
-	a0[k0] = last[j].ax;
-	a0[k1] = last[j].ay;
-	a0[k2] = last[j].az;
+	// Epochs in (last[0].t, r->t], plus tstart itself on the first step.
+	while(k < n_epochs && epochs[k]*dtsign <= r->t*dtsign){
+	    const double hn = (epochs[k] - last[0].t)/r->dt_last_done;
+	    dense_output(r, n_particles, last, hn, &outstate[k*n_particles*6]);
+	    k++;
+	}
 
+	reb_update_acceleration(r); // This is needed to save the acceleration.
     }
 
-    // Loop over interval using Gauss-Radau spacings      
-    for(int n=1;n<8;n++) {                          
+    free(last);
+
+    rebx_free(rebx);    // this explicitly frees all the memory allocated by REBOUNDx 
+    reb_free_simulation(r);
+
+    return(1);
+}
+
+// Collects the streamed dense output into the growing arrays of a timestate.
+struct integration_function_buffer {
+    timestate* ts;
+    int n_alloc;    // rows allocated in ts->t and ts->state
+    struct reb_simulation* sim;    // for reporting a failed allocation
+    int failed;
+};
+
+static int integration_function_append(void* user, const double* t, const double* state, int n_times, int n_particles){
+    struct integration_function_buffer* buf = user;
+    timestate* ts = buf->ts;
+
+    if(ts->n_out + n_times > buf->n_alloc){
+        int n_alloc = buf->n_alloc;
+        while(n_alloc < ts->n_out + n_times){
+            n_alloc *= 2;
+        }
+        // On failure the arrays filled so far stay valid in ts, and the integration stops.
+        double* const t_new = realloc(ts->t, n_alloc*sizeof(double));
+        if(t_new == NULL){
+            reb_error(buf->sim, "REBOUNDx Error: Could not allocate memory for the output of integration_function.\n");
+            buf->failed = 1;
+            return 1;
+        }
+        ts->t = t_new;
+        double* const state_new = realloc(ts->state, n_alloc*n_particles*6*sizeof(double));
+        if(state_new == NULL){
+            reb_error(buf->sim, "REBOUNDx Error: Could not allocate memory for the output of integration_function.\n");
+            buf->failed = 1;
+            return 1;
+        }
+        ts->state = state_new;
+        buf->n_alloc = n_alloc;
+    }
+
+    memcpy(&ts->t[ts->n_out], t, n_times*sizeof(double));
+    memcpy(&ts->state[ts->n_out*n_particles*6], state, n_times*n_particles*6*sizeof(double));
+    ts->n_out += n_times;
+    return 0;
+}
+
+// Returns 1, or 0 if the output arrays could not be allocated.  ts then holds
+// the output up to the failure (or none at all), and ts->t and ts->state must
+// still be freed by the caller.
+int integration_function(double tstart, double tstep, double trange,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 timestate *ts){
+
+    // Start with room for 8 steps and double as needed, so the output
+    // no longer has to be sized from trange/tstep up front.
+    struct integration_function_buffer buf = {.ts = ts, .n_alloc = 64};
+    ts->t = malloc(buf.n_alloc*sizeof(double));
+    ts->state = malloc(buf.n_alloc*n_particles*6*sizeof(double));
+    ts->n_out = 0;
+    ts->n_particles = n_particles;
+    if(ts->t == NULL || ts->state == NULL){
+	fprintf(stderr, "REBOUNDx Error: Could not allocate memory for the output of integration_function.\n");
+	return(0);
+    }
+
+    // The first row holds the initial conditions; it is overwritten by
+    // the identical start of the first step if one is taken.
+    ts->t[0] = tstart;
+    memcpy(ts->state, instate, n_particles*6*sizeof(double));
+
+    struct rebx_extras* rebx = integration_function_setup(tstart, tstep, geocentric, n_particles, instate);
+    buf.sim = rebx->sim;
+    integration_function_run(rebx, trange, n_particles, integration_function_append, &buf);
+
+    return(buf.failed ? 0 : 1);
+}
+
+// Integrates the test particles in instate and writes their trajectories to
+// path as an SPK type 2 kernel, readable with spk_init()/spk_calc().  The span
+// from tstart over trange is split into records of len days.  Each record is
+// fitted with ncf Chebyshev coefficients per coordinate by interpolating the
+// dense output at the Chebyshev nodes of that record.  codes gives the NAIF id
+// of each particle (NULL numbers them -1, -2, ...).  The centre is the Earth
+// (399) if geocentric and the solar system barycenter (0) otherwise.
+int integration_function_spk(const char* path,
+			 double tstart, double tstep, double trange,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 const int* codes,
+			 double len,
+			 int ncf){
+
+    if(len <= 0. || ncf < 2 || ncf > 32){
+	fprintf(stderr, "REBOUNDx Error: integration_function_spk needs len > 0 and 2 <= ncf <= 32.\n");
+	return(0);
+    }
 
-	s[0] = r->dt_last_done * h[n];
-
-	s[1] = s[0] * s[0] / 2.;
-	s[2] = s[1] * h[n] / 3.;
-	s[3] = s[2] * h[n] / 2.;
-	s[4] = 3. * s[3] * h[n] / 5.;
-	s[5] = 2. * s[4] * h[n] / 3.;
-	s[6] = 5. * s[5] * h[n] / 7.;
-	s[7] = 3. * s[6] * h[n] / 4.;
-	s[8] = 7. * s[7] * h[n] / 9.;
-
-	// Predict positions at interval n using b values	
-	for(int j=0;j<N;j++) {  
-	  //int mj = j;
-	  const int k0 = 3*j+0;
-	  const int k1 = 3*j+1;
-	  const int k2 = 3*j+2;
-
-	  double xx0 = x0[k0] + (s[8]*b.p6[k0] + s[7]*b.p5[k0] + s[6]*b.p4[k0] + s[5]*b.p3[k0] + s[4]*b.p2[k0] + s[3]*b.p1[k0] + s[2]*b.p0[k0] + s[1]*a0[k0] + s[0]*v0[k0] );
-	  double xy0 = x0[k1] + (s[8]*b.p6[k1] + s[7]*b.p5[k1] + s[6]*b.p4[k1] + s[5]*b.p3[k1] + s[4]*b.p2[k1] + s[3]*b.p1[k1] + s[2]*b.p0[k1] + s[1]*a0[k1] + s[0]*v0[k1] );
-	  double xz0 = x0[k2] + (s[8]*b.p6[k2] + s[7]*b.p5[k2] + s[6]*b.p4[k2] + s[5]*b.p3[k2] + s[4]*b.p2[k2] + s[3]*b.p1[k2] + s[2]*b.p0[k2] + s[1]*a0[k2] + s[0]*v0[k2] );
-
-	  double t = r->t + r->dt_last_done * (h[n] - 1.0);
-
-	  int offset = ((n_out+n)*n_particles+j)*6;	  
-	  outtime[n_out+n] = t;
-	  outstate[offset+0] = xx0;
-	  outstate[offset+1] = xy0;	  	  
-	  outstate[offset+2] = xz0;
-	  
+    const double au_km = 149597870.7;
+    const int nrec = fabs(trange) > 0. ? (int)ceil(fabs(trange)/len) : 1;
+    const double beg = tstep > 0. ? tstart : tstart - nrec*len;
+    const int n_epochs = nrec*ncf;
+
+    // Chebyshev nodes of every record in increasing time, reversed for backward integrations.
+    double* epochs = malloc(n_epochs*sizeof(double));
+    for(int b=0; b<nrec; b++){
+	const double mid = beg + (b + 0.5)*len;
+	for(int k=0; k<ncf; k++){
+	    const int i = ncf - 1 - k;
+	    const int e = tstep > 0. ? b*ncf + k : n_epochs - 1 - (b*ncf + k);
+	    epochs[e] = mid + 0.5*len*cos(M_PI*(i + 0.5)/ncf);
 	}
+    }
+
+    double* outstate = malloc(n_epochs*n_particles*6*sizeof(double));
+    if(!integration_function_epochs(tstart, tstep, geocentric, n_particles, instate, n_epochs, epochs, outstate)){
+	free(epochs);
+	free(outstate);
+	return(0);
+    }
+
+    // Discrete Chebyshev transform of the positions at the nodes, in km.
+    double* cf = malloc((size_t)n_particles*nrec*3*ncf*sizeof(double));
+    for(int j=0; j<n_particles; j++){
+	for(int b=0; b<nrec; b++){
+	    for(int c=0; c<3; c++){
+		double* const cfr = &cf[(((size_t)j*nrec + b)*3 + c)*ncf];
+		for(int p=0; p<ncf; p++){
+		    double sum = 0.;
+		    for(int i=0; i<ncf; i++){
+			const int k = ncf - 1 - i;
+			const int e = tstep > 0. ? b*ncf + k : n_epochs - 1 - (b*ncf + k);
+			sum += outstate[((size_t)e*n_particles + j)*6 + c]*cos(M_PI*p*(i + 0.5)/ncf);
+		    }
+		    cfr[p] = (p ? 2. : 1.)*sum/ncf*au_km;
+		}
+	    }
+	}
+    }
+
+    int* tar = malloc(n_particles*sizeof(int));
+    for(int j=0; j<n_particles; j++){
+	tar[j] = codes ? codes[j] : -(j+1);
+    }
+
+    const int ret = spk_write(path, n_particles, tar, geocentric ? 399 : 0, beg, len, nrec, ncf, cf);
+    if(ret < 0){
+	fprintf(stderr, "REBOUNDx Error: integration_function_spk could not write %s.\n", path);
+    }
+
+    free(tar);
+    free(cf);
+    free(outstate);
+    free(epochs);
+
+    return(ret < 0 ? 0 : 1);
+}
+
+/*
+ * Parallel drivers.
+ *
+ * Each object gets a simulation of its own, so IAS15 controls its step size
+ * independently and a close approach of one object no longer slows down the
+ * rest.  The simulations are shared out between n_threads OpenMP threads (run
+ * one after the other without OpenMP) and all read the same default ephemeris
+ * context, which is loaded once up front.
+ */
+
+// Integrates each of the n_particles objects in instate separately.  Every
+// object takes its own steps, so there is no time grid common to all of them
+// and the output is not merged into one timestate: ts must point to an array
+// of n_particles timestates, and ts[j] receives exactly what
+// integration_function(tstart, tstep, trange, geocentric, 1, &instate[6*j], &ts[j])
+// gives.  For the states of all objects at common times, in the merged
+// (epoch, particle) layout, use integration_function_epochs_parallel.
+int integration_function_parallel(double tstart, double tstep, double trange,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 int n_threads,
+			 timestate *ts){
 
-	s[0] = r->dt_last_done * h[n];
-	s[1] =      s[0] * h[n] / 2.;
-	s[2] = 2. * s[1] * h[n] / 3.;
-	s[3] = 3. * s[2] * h[n] / 4.;
-	s[4] = 4. * s[3] * h[n] / 5.;
-	s[5] = 5. * s[4] * h[n] / 6.;
-	s[6] = 6. * s[5] * h[n] / 7.;
-	s[7] = 7. * s[6] * h[n] / 8.;
+    if(rebx_ephemeris_default() == NULL){
+	fprintf(stderr, "REBOUNDx Error: Could not load the default ephemeris files for integration_function_parallel.\n");
+	return(0);
+    }
+    if(n_threads < 1){
+	n_threads = 1;
+    }
+
+    int ret = 1;
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads) if(n_threads > 1) reduction(&&: ret)
+    for(int j=0; j<n_particles; j++){
+	ret = integration_function(tstart, tstep, trange, geocentric, 1, &instate[6*j], &ts[j]) && ret;
+    }
 
-	// Predict velocities at interval n using b values	
-	for(int j=0;j<N;j++) {
+    return(ret);
+}
 
-	  const int k0 = 3*j+0;
-	  const int k1 = 3*j+1;
-	  const int k2 = 3*j+2;
+// Integrates each of the n_particles objects in instate separately and merges
+// their states at the requested epochs into outstate, laid out as in
+// integration_function_epochs.  Returns 0 if any object failed, in which case
+// outstate is incomplete.
+int integration_function_epochs_parallel(double tstart, double tstep,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 int n_epochs,
+			 const double* epochs,
+			 int n_threads,
+			 double* outstate){
 
-	  double vx0 = v0[k0] + s[7]*b.p6[k0] + s[6]*b.p5[k0] + s[5]*b.p4[k0] + s[4]*b.p3[k0] + s[3]*b.p2[k0] + s[2]*b.p1[k0] + s[1]*b.p0[k0] + s[0]*a0[k0];
-	  double vy0 = v0[k1] + s[7]*b.p6[k1] + s[6]*b.p5[k1] + s[5]*b.p4[k1] + s[4]*b.p3[k1] + s[3]*b.p2[k1] + s[2]*b.p1[k1] + s[1]*b.p0[k1] + s[0]*a0[k1];
-	  double vz0 = v0[k2] + s[7]*b.p6[k2] + s[6]*b.p5[k2] + s[5]*b.p4[k2] + s[4]*b.p3[k2] + s[3]*b.p2[k2] + s[2]*b.p1[k2] + s[1]*b.p0[k2] + s[0]*a0[k2];
+    if(!integration_function_check_epochs(tstart, tstep, n_epochs, epochs)){
+	return(0);
+    }
+    if(rebx_ephemeris_default() == NULL){
+	fprintf(stderr, "REBOUNDx Error: Could not load the default ephemeris files for integration_function_epochs_parallel.\n");
+	return(0);
+    }
+    if(n_threads < 1){
+	n_threads = 1;
+    }
 
-	  int offset = ((n_out+n)*n_particles+j)*6;	  
-	  outstate[offset+3] = vx0;
-	  outstate[offset+4] = vy0;	  	  
-	  outstate[offset+5] = vz0;
+    int ret = 1;
+#pragma omp parallel num_threads(n_threads) if(n_threads > 1) reduction(&&: ret)
+    {
+	double* obj_state = malloc(n_epochs*6*sizeof(double));   // one object's epochs, per thread
+	if(obj_state == NULL && n_epochs > 0){
+	    fprintf(stderr, "REBOUNDx Error: Could not allocate memory in integration_function_epochs_parallel.\n");
+	    ret = 0;
+	}
 
+	// Every thread has to reach the worksharing loop, so a thread without
+	// a buffer still takes part and only skips its objects.
+#pragma omp for schedule(dynamic)
+	for(int j=0; j<n_particles; j++){
+	    if(!ret){
+		continue;
+	    }
+	    if(!integration_function_epochs(tstart, tstep, geocentric, 1, &instate[6*j], n_epochs, epochs, obj_state)){
+		ret = 0;
+		continue;
+	    }
+	    for(int k=0; k<n_epochs; k++){
+		memcpy(&outstate[(k*n_particles+j)*6], &obj_state[6*k], 6*sizeof(double));
+	    }
 	}
+
+	free(obj_state);
     }
 
-    free(x0);
-    free(v0);
-    free(a0);
+    return(ret);
+}
+
+void store_function(struct reb_simulation* r, int n_out, int n_particles, tstate* last, double* outtime, double* outstate){
+    
+    outtime[n_out] = last[0].t;    
+
+    for(int j=0; j<n_particles; j++){
+	int offset = (n_out*n_particles+j)*6;
+	outstate[offset+0] = last[j].x;
+	outstate[offset+1] = last[j].y;	
+	outstate[offset+2] = last[j].z;
+	outstate[offset+3] = last[j].vx;	
+	outstate[offset+4] = last[j].vy;
+	outstate[offset+5] = last[j].vz;	
+    }
+    
+    // Loop over interval using Gauss-Radau spacings      
+    for(int n=1;n<8;n++) {                          
+	outtime[n_out+n] = r->t + r->dt_last_done * (h[n] - 1.0);
+	dense_output(r, n_particles, last, h[n], &outstate[(n_out+n)*n_particles*6]);
+    }
 
 }
@@ -39,6 +39,7 @@
  * It ignores terms that are smaller by of order the mass ratio with the central body.
  * It gets both the mean motion and precession correct, and will be significantly faster than :ref:`gr_full`, particularly with several bodies.
  * Adding this effect to several bodies is NOT equivalent to using gr_full.
+ * With REBOUND's first order variational particles, the variations use the leading order (test particle) 1PN force about the central body, so the tangent map is accurate to the mass ratio and :math:`\mathcal{O}(GM/ac^2)` relative to the GR term.
  * 
  * **Effect Parameters**
  * 
@@ -46,6 +47,7 @@
  * Field (C type)               Required    Description
  * ============================ =========== ==================================================================
  * c (double)                   Yes         Speed of light in the units used for the simulation.
+ * use_sim_accelerations (int)  No          If nonzero, take the Newtonian accelerations from the ones REBOUND just computed rather than recomputing the O(N^2) sum. Only valid if no other force modifies accelerations before gr runs. The sum is recomputed anyway if REBOUND's gravity is not basic or compensated, has softening or skips terms (gravity_ignore_terms), or if gr is called through integrate_force.
  * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
@@ -69,14 +71,54 @@
 #include "rebound.h"
 #include "reboundx.h"
 #include "rebxtools.h"
+#include "core.h"
 
-static void rebx_calculate_gr(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations){
-    
-    struct reb_particle* const ps = malloc(N*sizeof(*ps));
-    struct reb_particle* const ps_j = malloc(N*sizeof(*ps_j));
-    memcpy(ps, particles, N*sizeof(*ps));
-    
-    // Calculate Newtonian accelerations 
+// Particle buffers kept on the force between calls, since IAS15 evaluates the force every substep
+struct rebx_gr_workspace{
+    int N_allocated;
+    struct reb_particle* ps;
+    struct reb_particle* ps_j;
+};
+
+static void rebx_gr_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_gr_workspace* const ws = rebx_get_param(rebx, force->ap, "gr_workspace");
+    if (ws){
+        free(ws->ps);
+        free(ws->ps_j);
+    }
+    free(ws);
+}
+
+static struct rebx_gr_workspace* rebx_gr_get_workspace(struct reb_simulation* const sim, struct rebx_force* const force, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_gr_workspace* ws = rebx_get_param(rebx, force->ap, "gr_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for gr workspace.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "gr_workspace", ws);
+        rebx_add_free_arrays(rebx, force, rebx_gr_free_arrays);
+    }
+    if (ws->N_allocated < N){
+        free(ws->ps);
+        free(ws->ps_j);
+        ws->ps = malloc(N*sizeof(*ws->ps));
+        ws->ps_j = malloc(N*sizeof(*ws->ps_j));
+        if (ws->ps == NULL || ws->ps_j == NULL){
+            free(ws->ps);
+            free(ws->ps_j);
+            *ws = (struct rebx_gr_workspace){0};
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for gr workspace.\n");
+            return NULL;
+        }
+        ws->N_allocated = N;
+    }
+    return ws;
+}
+
+static void rebx_gr_newtonian_accelerations(struct reb_particle* const ps, const int N, const double G){
     for(int i=0; i<N; i++){
         ps[i].ax = 0.;
         ps[i].ay = 0.;
@@ -101,6 +143,18 @@ static void rebx_calculate_gr(struct reb_simulation* const sim, struct reb_parti
             ps[j].az += prefac*pi.m*dz;
         }
     }
+}
+
+static void rebx_calculate_gr(struct reb_simulation* const sim, struct rebx_gr_workspace* const ws, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations, const int use_sim_accelerations){
+    
+    struct reb_particle* const ps = ws->ps;
+    struct reb_particle* const ps_j = ws->ps_j;
+    memcpy(ps, particles, N*sizeof(*ps));
+    
+    // Calculate Newtonian accelerations, unless the ones REBOUND just computed were passed in
+    if (!use_sim_accelerations){
+        rebx_gr_newtonian_accelerations(ps, N, G);
+    }
    
     // Transform to Jacobi coordinates
     const struct reb_particle source = ps[0];
@@ -165,9 +219,6 @@ static void rebx_calculate_gr(struct reb_simulation* const sim, struct reb_parti
         particles[i].ay += ps[i].ay;
         particles[i].az += ps[i].az;
     }
-    
-    free(ps);
-    free(ps_j);
 }
 
 void rebx_gr(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
@@ -176,15 +227,39 @@ void rebx_gr(struct reb_simulation* const sim, struct rebx_force* const force, s
         reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
         return;
     }
+    struct rebx_gr_workspace* const ws = rebx_gr_get_workspace(sim, force, N);
+    if (ws == NULL){
+        return;
+    }
     const double C2 = (*c)*(*c);
+    // The accelerations only hold the full, unsoftened Newtonian gravity of the same pairs gr sums if REBOUND computed
+    // all the terms directly and they are the particles REBOUND just updated. Otherwise recompute them
+    const int* const use_sim_acc = rebx_get_param(sim->extras, force->ap, "use_sim_accelerations");
+    const int direct_gravity = sim->gravity == REB_GRAVITY_BASIC || sim->gravity == REB_GRAVITY_COMPENSATED;
+    const int use_sim_accelerations = use_sim_acc != NULL && *use_sim_acc != 0 && direct_gravity && sim->softening == 0. && sim->gravity_ignore_terms == 0 && particles == sim->particles;
     int* max_iterations = rebx_get_param(sim->extras, force->ap, "max_iterations");
     if(max_iterations != NULL){
-        rebx_calculate_gr(sim, particles, N, C2, sim->G, *max_iterations);
+        rebx_calculate_gr(sim, ws, particles, N, C2, sim->G, *max_iterations, use_sim_accelerations);
     }
     else{
         const int default_max_iterations = 10;
-        rebx_calculate_gr(sim, particles, N, C2, sim->G, default_max_iterations);
+        rebx_calculate_gr(sim, ws, particles, N, C2, sim->G, default_max_iterations, use_sim_accelerations);
+    }
+}
+
+// Leading order test particle acceleration relative to particles[0], consistent with the order to which gr keeps the mass ratios
+static void rebx_gr_variation_relative(const void* const data, const struct reb_particle* const particles, const int i, const int source_index, const double* const d, const double* const dd, double* const da){
+    const double* const mu_C2 = data;
+    rebx_gr_variation(mu_C2[0], mu_C2[1], d, dd, da);
+}
+
+void rebx_gr_variations(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+    double* c = rebx_get_param(sim->extras, force->ap, "c");
+    if (c == NULL || N < 1){
+        return;     // rebx_gr reports the missing c
     }
+    const double mu_C2[2] = {sim->G*particles[0].m, (*c)*(*c)};
+    rebx_source_variations(sim, particles, N, 0, rebx_gr_variation_relative, mu_C2);
 }
 
 static double rebx_calculate_gr_hamiltonian(struct rebx_extras* const rebx, struct reb_simulation* const sim, const double C2){
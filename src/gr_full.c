@@ -43,6 +43,7 @@
  * Field (C type)               Required    Description
  * ============================ =========== ==================================================================
  * c (double)                   Yes         Speed of light in the units used for the simulation.
+ * n_threads (int)              No          Number of OpenMP threads sharing the pair loops (default 1). Results do not depend on it.
  * ============================ =========== ==================================================================
  * 
  * **Particle Parameters**
@@ -57,15 +58,78 @@
 #include <string.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
 
-static void rebx_calculate_gr_full(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations, const int gravity_ignore_10){
+/*
+ * Workspace kept on the force between calls, so large N neither overflows the stack nor reallocates every step.
+ * Separations are recomputed from positions where needed (x_i - x_j is exactly -(x_j - x_i)), so only the
+ * distance matrix is stored.
+ */
+struct rebx_gr_full_workspace{
+    int N_allocated;
+    double* rs;         // N*N pairwise distances
+    double* a_const;    // N*3 constant term
+    double* a_newton;   // N*3 Newtonian term
+    double* a_new;      // N*3 newly calculated term
+    double* a_old;      // N*3 previously calculated term
+    double* phi_i;      // N, (4/c^2) sum_k G m_k/r_ik
+    double* phi_j;      // N, (1/c^2) sum_l G m_l/r_lj
+};
+
+static void rebx_gr_full_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_gr_full_workspace* const ws = rebx_get_param(rebx, force->ap, "gr_full_workspace");
+    if (ws){
+        free(ws->rs);
+        free(ws->a_const);
+    }
+    free(ws);
+}
+
+static struct rebx_gr_full_workspace* rebx_gr_full_get_workspace(struct reb_simulation* const sim, struct rebx_force* const force, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_gr_full_workspace* ws = rebx_get_param(rebx, force->ap, "gr_full_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for gr_full workspace.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "gr_full_workspace", ws);
+        rebx_add_free_arrays(rebx, force, rebx_gr_full_free_arrays);
+    }
+    if (ws->N_allocated < N){
+        free(ws->rs);
+        free(ws->a_const);
+        ws->rs = malloc((size_t)N*N*sizeof(*ws->rs));
+        ws->a_const = malloc((size_t)N*14*sizeof(*ws->a_const)); // a_const, a_newton, a_new, a_old (3 each), phi_i, phi_j
+        if (ws->rs == NULL || ws->a_const == NULL){
+            free(ws->rs);
+            free(ws->a_const);
+            *ws = (struct rebx_gr_full_workspace){0};
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for gr_full workspace.\n");
+            return NULL;
+        }
+        ws->N_allocated = N;
+    }
+    ws->a_newton = ws->a_const + 3*N;
+    ws->a_new = ws->a_newton + 3*N;
+    ws->a_old = ws->a_new + 3*N;
+    ws->phi_i = ws->a_old + 3*N;
+    ws->phi_j = ws->phi_i + N;
+    return ws;
+}
+
+static void rebx_calculate_gr_full(struct reb_simulation* const sim, struct rebx_gr_full_workspace* const ws, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations, const int gravity_ignore_10, const int n_threads){
     
-    double a_const[N][3]; // array that stores the value of the constant term
-    double a_newton[N][3]; // stores the Newtonian term
-    double a_new[N][3]; // stores the newly calculated term
-    double rs[N][N];
-    double drs[N][N][3];
+    double (*const a_const)[3] = (double (*)[3])ws->a_const; // array that stores the value of the constant term
+    double (*const a_newton)[3] = (double (*)[3])ws->a_newton; // stores the Newtonian term
+    double (*const a_new)[3] = (double (*)[3])ws->a_new; // stores the newly calculated term
+    double (*const a_old)[3] = (double (*)[3])ws->a_old; // stores the previously calculated term
+    double* const rs = ws->rs;
+    double* const phi_i = ws->phi_i;
+    double* const phi_j = ws->phi_j;
 
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
     for (int i=0; i<N; i++){
         // compute the Newtonian term 
         a_newton[i][0] = particles[i].ax;
@@ -76,62 +140,68 @@ static void rebx_calculate_gr_full(struct reb_simulation* const sim, struct reb_
         a_new[i][2] = 0.;
 
         for(int j=i+1; j<N; j++){
-            if (j!=i){
-                drs[i][j][0] = particles[i].x - particles[j].x;
-                drs[i][j][1] = particles[i].y - particles[j].y;
-                drs[i][j][2] = particles[i].z - particles[j].z;
-                drs[j][i][0] = -drs[i][j][0];
-                drs[j][i][1] = -drs[i][j][1];
-                drs[j][i][2] = -drs[i][j][2];
-                rs[i][j] = sqrt(drs[i][j][0]*drs[i][j][0] + drs[i][j][1]*drs[i][j][1] + drs[i][j][2]*drs[i][j][2]);
-                rs[j][i] = rs[i][j];
-            }
+            const double dx = particles[i].x - particles[j].x;
+            const double dy = particles[i].y - particles[j].y;
+            const double dz = particles[i].z - particles[j].z;
+            rs[i*N+j] = sqrt(dx*dx + dy*dy + dz*dz);
+            rs[j*N+i] = rs[i*N+j];
         }
     }
 
     if (gravity_ignore_10){
-        const double prefact = -G/(rs[0][1]*rs[0][1]*rs[0][1]);
+        const double prefact = -G/(rs[1]*rs[1]*rs[1]);
         const double prefact0 = prefact*particles[0].m;
         const double prefact1 = prefact*particles[1].m;
-        a_newton[0][0] += prefact1*drs[0][1][0];
-        a_newton[0][1] += prefact1*drs[0][1][1];
-        a_newton[0][2] += prefact1*drs[0][1][2];
-        a_newton[1][0] -= prefact0*drs[0][1][0];
-        a_newton[1][1] -= prefact0*drs[0][1][1];
-        a_newton[1][2] -= prefact0*drs[0][1][2];
+        const double dx01 = particles[0].x - particles[1].x;
+        const double dy01 = particles[0].y - particles[1].y;
+        const double dz01 = particles[0].z - particles[1].z;
+        a_newton[0][0] += prefact1*dx01;
+        a_newton[0][1] += prefact1*dy01;
+        a_newton[0][2] += prefact1*dz01;
+        a_newton[1][0] -= prefact0*dx01;
+        a_newton[1][1] -= prefact0*dy01;
+        a_newton[1][2] -= prefact0*dz01;
     }
 
+    // The potential sums in the constant term only depend on one body, so compute them once (O(N^2) rather than O(N^3))
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
+    for (int i=0; i<N; i++){
+        double a1 = 0.;
+        for (int k = 0; k< N; k++){
+            if (k != i){
+                a1 += (4./(C2)) * G*particles[k].m/rs[i*N+k];
+            }
+        }
+        phi_i[i] = a1;
+
+        double a2 = 0.;
+        for (int l = 0; l< N; l++){
+            if (l != i){
+                a2 += (1./(C2)) * G*particles[l].m/rs[l*N+i];
+            }
+        }
+        phi_j[i] = a2;
+    }
+
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
     for (int i=0; i<N; i++){
         // then compute the constant terms:
         double a_constx = 0.;
         double a_consty = 0.;
         double a_constz = 0.;
+        const double a1 = phi_i[i];
+        double vi2 = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
+        const double a3 = -vi2/(C2);
         // 1st constant part
         for (int j = 0; j< N; j++){
             if (j != i){
-                const double dxij = drs[i][j][0];
-                const double dyij = drs[i][j][1];
-                const double dzij = drs[i][j][2];
-                const double rij2 = rs[i][j]*rs[i][j];
-                const double rij3 = rij2*rs[i][j];
+                const double dxij = particles[i].x - particles[j].x;
+                const double dyij = particles[i].y - particles[j].y;
+                const double dzij = particles[i].z - particles[j].z;
+                const double rij2 = rs[i*N+j]*rs[i*N+j];
+                const double rij3 = rij2*rs[i*N+j];
                 
-                double a1 = 0.;
-                for (int k = 0; k< N; k++){
-                    if (k != i){
-                        a1 += (4./(C2)) * G*particles[k].m/rs[i][k];
-                    }
-                }
-
-                double a2 = 0.;
-                for (int l = 0; l< N; l++){
-                    if (l != j){
-                        a2 += (1./(C2)) * G*particles[l].m/rs[l][j];
-                    }
-                }
-
-                double a3;
-                double vi2 = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
-                a3 = -vi2/(C2);
+                const double a2 = phi_j[j];
 
                 double a4;
                 double vj2 = particles[j].vx*particles[j].vx + particles[j].vy*particles[j].vy + particles[j].vz*particles[j].vz;
@@ -171,23 +241,19 @@ static void rebx_calculate_gr_full(struct reb_simulation* const sim, struct reb_
 
     // Now running the substitution again and again through the loop below
     for (int k=0; k<10; k++){ // you can set k as how many substitution you want to make
-        double a_old[N][3]; // initialize an arry that stores the information of previousu calculated accleration
-        for (int i =0; i <N; i++){
-            a_old[i][0] = a_new[i][0]; // when k = 0, a_new is the Newtownian term which calculated before
-            a_old[i][1] = a_new[i][1];
-            a_old[i][2] = a_new[i][2];
-        }
+        memcpy(a_old, a_new, N*sizeof(*a_old)); // when k = 0, a_new is zero
         // now add on the non-constant term
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
         for (int i = 0; i < N; i++){ // a_j is used to update a_i and vice versa
             double non_constx = 0.;
             double non_consty = 0.;
             double non_constz = 0.;
             for (int j = 0; j < N; j++){
                 if (j != i){
-                    const double dxij = drs[i][j][0];
-                    const double dyij = drs[i][j][1];
-                    const double dzij = drs[i][j][2];
-                    const double rij = rs[i][j];
+                    const double dxij = particles[i].x - particles[j].x;
+                    const double dyij = particles[i].y - particles[j].y;
+                    const double dzij = particles[i].z - particles[j].z;
+                    const double rij = rs[i*N+j];
                     const double rij3 = rij*rij*rij;
                     non_constx += (G*particles[j].m*dxij/rij3)*(dxij*(a_newton[j][0]+a_old[j][0])+dyij*(a_newton[j][1]+a_old[j][1])+\
                                 dzij*(a_newton[j][2]+a_old[j][2]))/(2.*C2) + (7./(2.*C2))*G*particles[j].m*(a_newton[j][0]+a_old[j][0])/rij;
@@ -236,15 +302,21 @@ void rebx_gr_full(struct reb_simulation* const sim, struct rebx_force* const gr_
         reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
         return;
     }
+    struct rebx_gr_full_workspace* const ws = rebx_gr_full_get_workspace(sim, gr_full, N);
+    if (ws == NULL){
+        return;
+    }
     const double C2 = (*c)*(*c);
     const unsigned int gravity_ignore_10 = sim->gravity_ignore_terms==1;
+    const int* const n_threads_ptr = rebx_get_param(sim->extras, gr_full->ap, "n_threads");
+    const int n_threads = (n_threads_ptr && *n_threads_ptr > 1) ? *n_threads_ptr : 1;
     int* max_iterations = rebx_get_param(sim->extras, gr_full->ap, "max_iterations");
     if(max_iterations != NULL){
-        rebx_calculate_gr_full(sim, particles, N, C2, sim->G, *max_iterations, gravity_ignore_10);
+        rebx_calculate_gr_full(sim, ws, particles, N, C2, sim->G, *max_iterations, gravity_ignore_10, n_threads);
     }
     else{
         const int default_max_iterations = 10;
-        rebx_calculate_gr_full(sim, particles, N, C2, sim->G, default_max_iterations, gravity_ignore_10);
+        rebx_calculate_gr_full(sim, ws, particles, N, C2, sim->G, default_max_iterations, gravity_ignore_10, n_threads);
     }
 }
 
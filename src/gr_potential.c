@@ -39,6 +39,7 @@
  * It gets the precession right, but gets the mean motion wrong by :math:`\mathcal{O}(GM/ac^2)`.  
  * It's the fastest option, and because it's not velocity-dependent, it automatically keeps WHFast symplectic.  
  * Nice if you have a single-star system, don't need to get GR exactly right, and want speed.
+ * First order variational particles get the exact derivative of this force.
  * 
  * **Effect Parameters**
  * 
@@ -65,6 +66,7 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
 
 static void rebx_calculate_gr_potential(struct reb_particle* const particles, const int N, const double C2, const double G){
     const struct reb_particle source = particles[0];
@@ -97,6 +99,50 @@ void rebx_gr_potential(struct reb_simulation* const sim, struct rebx_force* cons
     }
 }
 
+static void rebx_gr_potential_variation(const void* const data, const struct reb_particle* const particles, const int i, const int source_index, const double* const d, const double* const dd, double* const da){
+    const double prefac1 = *(const double*)data;
+    rebx_power_law_variation(-prefac1, 4., d, dd, da);
+}
+
+void rebx_gr_potential_variations(struct reb_simulation* const sim, struct rebx_force* const gr_potential, struct reb_particle* const particles, const int N){
+    double* c = rebx_get_param(sim->extras, gr_potential->ap, "c");
+    if (c == NULL || N < 1){
+        return;     // rebx_gr_potential reports the missing c
+    }
+    const double C2 = (*c)*(*c);
+    const double G = sim->G;
+    const double prefac1 = 6.*(G*particles[0].m)*(G*particles[0].m)/C2;
+    rebx_source_variations(sim, particles, N, 0, rebx_gr_potential_variation, &prefac1);
+}
+
+static void rebx_gr_potential_term(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair){
+    const struct reb_particle p = particles[i];
+    const double m0 = particles[0].m;
+    const double prefac = term->c[0]/(pair->r2*pair->r2);
+    
+    particles[i].ax -= prefac*pair->dx;
+    particles[i].ay -= prefac*pair->dy;
+    particles[i].az -= prefac*pair->dz;
+    particles[0].ax += p.m/m0*prefac*pair->dx;
+    particles[0].ay += p.m/m0*prefac*pair->dy;
+    particles[0].az += p.m/m0*prefac*pair->dz;
+}
+
+int rebx_gr_potential_source_terms(struct reb_simulation* const sim, struct rebx_force* const gr_potential, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max){
+    double* c = rebx_get_param(sim->extras, gr_potential->ap, "c");
+    if (c == NULL || N_max < 1 || N < 1){
+        return -1;
+    }
+    const double C2 = (*c)*(*c);
+    const double G = sim->G;
+    terms[0] = (struct rebx_source_term){0};
+    terms[0].accumulate = rebx_gr_potential_term;
+    terms[0].rebx = sim->extras;
+    terms[0].source_index = 0;
+    terms[0].c[0] = 6.*(G*particles[0].m)*(G*particles[0].m)/C2;
+    return 1;
+}
+
 static double rebx_calculate_gr_potential_potential(struct reb_simulation* const sim, const double C2){
     const struct reb_particle* const particles = sim->particles;
 	const int _N_real = sim->N - sim->N_var;
@@ -1,5 +1,5 @@
 /** * @file gravitational_harmonics.c
- * @brief   Add J2n gravitational harmonics to particles
+ * @brief   Add zonal and tesseral gravitational harmonics to particles
  * @author  Dan Tamayo <tamayo.daniel@gmail.com>
  * 
  * @section     LICENSE
@@ -34,10 +34,16 @@
  * Python Example          `J2.ipynb <https://github.com/dtamayo/reboundx/blob/master/ipython_examples/J2.ipynb>`_.
  * ======================= ===============================================
  * 
+ * First order variational particles include the variations from J2 and J4 analytically; higher degree and tesseral terms are differentiated numerically.
  *
  * **Effect Parameters**
  * 
- * None
+ * ============================ =========== ==================================================================
+ * Field (C type)               Required    Description
+ * ============================ =========== ==================================================================
+ * float_tolerance (double)     No          Closed-form J4 terms bounded below this fraction of the source's point-mass acceleration are evaluated in single precision
+ * offload_device (int)         No          OpenMP target device (e.g. a GPU) running the closed-form J2 sweep. Needs REBOUNDx built with make OFFLOAD=1
+ * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
  *
@@ -47,7 +53,34 @@
  * J2 (double)                  No          J2 coefficient
  * J4 (double)                  No          J4 coefficient
  * R_eq (double)                No         Equatorial radius of nonspherical body used for calculating Jn harmonics
+ * pole_dec (double)            No          Declination of the body's spin axis (radians). If not set, the axis is along z
+ * pole_ra (double)             No          Right ascension of the body's spin axis (radians, default 0)
+ * pole_dec_dot (double)        No          Rate of change of pole_dec per unit time, for a precessing axis (default 0)
+ * pole_ra_dot (double)         No          Rate of change of pole_ra per unit time (default 0)
+ * harmonics_degree (int)       No          Maximum degree n of the J_n, C_nm and S_nm arrays. Required for any of them to be used
+ * J_n (double*)                No          Zonal coefficients J_n indexed by degree (harmonics_degree+1 entries; 0 and 1 are ignored). Added to J2 and J4 if those are also set
+ * C_nm (double*)               No          Unnormalized tesseral coefficients C_nm stored at [n*(harmonics_degree+1)+m] (m=0 entries are ignored; use J_n)
+ * S_nm (double*)               No          Unnormalized tesseral coefficients S_nm, same layout as C_nm
+ * prime_meridian (double)      No          Angle of the body-fixed x axis from the ascending node of the equator (radians, default 0). Only used with C_nm/S_nm
+ * prime_meridian_dot (double)  No          Rotation rate of the prime meridian per unit time, e.g. the spin rate (default 0)
  * ============================ =========== ==================================================================
+ *
+ * Bodies with only J2 and/or J4 and no pole_dec use closed-form expressions. Anything else (a tilted pole, higher
+ * degrees or tesseral terms) is evaluated per source in a single pass of recursive Legendre functions
+ * (the Cunningham recursion when there are tesseral terms). The J_n, C_nm and S_nm arrays are owned by the caller,
+ * must stay allocated while the effect is used, and are not saved in REBOUNDx binaries.
+ *
+ * With float_tolerance set, the closed-form J4 pass uses the bound |a_J4| <= 15 |J4| (R_eq/r)^4 G m/r^2 to pick the
+ * particles whose J4 term is below float_tolerance times the point-mass term. Their separations from the source are
+ * taken in double, narrowed to float in blocks and evaluated 8 or 16 at a time with AVX2 or AVX-512 when the CPU has
+ * them, before the terms are added to the double accelerations. The added error is of order FLT_EPSILON*float_tolerance of
+ * the point-mass term. J2 and the general pass stay in double.
+ *
+ * With offload_device set, the closed-form J2 sweep over the particles runs on that OpenMP device, one device thread
+ * per particle, with the back-reaction on the source summed by a reduction. The particles are uploaded and downloaded
+ * on every call, since the integrator moves them on the host. The sum runs in a different order than on the host, so
+ * the source's acceleration agrees to rounding. J4, the general pass and the variations stay on the host. If the device
+ * cannot be used, the sweep runs on the host, with a warning the first time.
  * 
  */
 
@@ -57,6 +90,24 @@
 #include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
+#include "core.h"
+
+// Built with make OFFLOAD=1 and a compiler with OpenMP 4.5 target support
+#if defined(REBX_OFFLOAD) && defined(_OPENMP) && _OPENMP >= 201511
+#include <omp.h>
+#define REBX_GH_OFFLOAD         // closed-form J2 sweep on an OpenMP target device when offload_device is set
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define REBX_GH_X86_SIMD        // AVX2/AVX-512 single precision J4 kernels, selected at run time
+#endif
+
+// Sources evaluated by the general pass below rather than the closed-form J2 and J4 expressions
+static int rebx_general_source(struct rebx_extras* const rebx, const struct reb_particle* const source){
+    return rebx_get_param(rebx, source->ap, "pole_dec") != NULL || rebx_get_param(rebx, source->ap, "harmonics_degree") != NULL;
+}
 
 static void rebx_calculate_J2_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double J2, const double R_eq, const int source_index){
     const struct reb_particle source = particles[source_index];
@@ -84,21 +135,250 @@ static void rebx_calculate_J2_force(struct reb_simulation* const sim, struct reb
     }
 }
 
-static void rebx_J2(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
+// Kept on the force between calls
+struct rebx_harmonics_workspace{
+    int offload_warned;                     // the offload_device warning has been issued
+    size_t N_work_allocated;
+    double* work;                           // coefficients and scratch space of the general source being evaluated
+};
+
+static void rebx_harmonics_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_harmonics_workspace* const ws = rebx_get_param(rebx, force->ap, "gravitational_harmonics_workspace");
+    if (ws){
+        free(ws->work);
+    }
+    free(ws);
+}
+
+static struct rebx_harmonics_workspace* rebx_harmonics_get_workspace(struct reb_simulation* const sim, struct rebx_force* const force){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_harmonics_workspace* ws = rebx_get_param(rebx, force->ap, "gravitational_harmonics_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for gravitational_harmonics.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "gravitational_harmonics_workspace", ws);
+        rebx_add_free_arrays(rebx, force, rebx_harmonics_free_arrays);
+    }
+    return ws;
+}
+
+// Same sweep on an OpenMP target device. Returns 0 (after a warning the first time) when the device cannot be used
+static int rebx_calculate_J2_force_device(struct reb_simulation* const sim, struct rebx_harmonics_workspace* const ws, struct reb_particle* const particles, const int N, const double J2, const double R_eq, const int source_index, const int device){
+#ifdef REBX_GH_OFFLOAD
+    if (device >= omp_get_num_devices()){
+        if (!ws->offload_warned){
+            reb_warning(sim, "REBOUNDx Warning: offload_device in gravitational_harmonics is not an available OpenMP device. Using the host.");
+            ws->offload_warned = 1;
+        }
+        return 0;
+    }
+    const struct reb_particle source = particles[source_index];
+    const double G = sim->G;
+    double sax = 0.;
+    double say = 0.;
+    double saz = 0.;
+    // Scalars on a target construct are firstprivate under OpenMP 4.5, so the sums have to be mapped back explicitly
+#pragma omp target teams distribute parallel for device(device) map(to: source) map(tofrom: particles[0:N], sax, say, saz) reduction(+: sax, say, saz)
     for (int i=0; i<N; i++){
-        const double* const J2 = rebx_get_param(rebx, particles[i].ap, "J2");
-        if (J2 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+        if(i == source_index){
+            continue;
+        }
+        const struct reb_particle p = particles[i];
+        const double dx = p.x - source.x;
+        const double dy = p.y - source.y;
+        const double dz = p.z - source.z;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double r = sqrt(r2);
+        const double costheta2 = dz*dz/r2;
+        const double prefac = 3.*J2*R_eq*R_eq/r2/r2/r/2.;
+        const double fac = 5.*costheta2-1.;
+
+        particles[i].ax += G*source.m*prefac*fac*dx;
+        particles[i].ay += G*source.m*prefac*fac*dy;
+        particles[i].az += G*source.m*prefac*(fac-2.)*dz;
+        sax += G*p.m*prefac*fac*dx;
+        say += G*p.m*prefac*fac*dy;
+        saz += G*p.m*prefac*(fac-2.)*dz;
+    }
+    particles[source_index].ax -= sax;
+    particles[source_index].ay -= say;
+    particles[source_index].az -= saz;
+    return 1;
+#else
+    if (!ws->offload_warned){
+        reb_warning(sim, "REBOUNDx Warning: offload_device is set in gravitational_harmonics, but REBOUNDx was built without OpenMP offload support (make OFFLOAD=1). Using the host.");
+        ws->offload_warned = 1;
+    }
+    return 0;
+#endif
+}
+
+static void rebx_J2(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
+    const int J2_key = rebx_get_param_key(rebx, "J2");
+    const int R_eq_key = rebx_get_param_key(rebx, "R_eq");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, J2_key, particles, N);
+    const int* const device = rebx_get_param(rebx, gh->ap, "offload_device");
+    struct rebx_harmonics_workspace* const ws = (device != NULL && *device >= 0 && sources->N_indices > 0) ? rebx_harmonics_get_workspace(sim, gh) : NULL;
+    for (int k=0; k<sources->N_indices; k++){
+        const int i = sources->indices[k];
+        const double* const J2 = rebx_get_param_by_key(rebx, particles[i].ap, J2_key);
+        if (J2 != NULL && !rebx_general_source(rebx, &particles[i])){
+            const double* const R_eq = rebx_get_param_by_key(rebx, particles[i].ap, R_eq_key);
             if (R_eq != NULL){
+                if (ws != NULL && rebx_calculate_J2_force_device(sim, ws, particles, N, *J2, *R_eq, i, *device)){
+                    continue;
+                }
                 rebx_calculate_J2_force(sim, particles, N, *J2, *R_eq,i); 
             }
         }
     }
 }
 
-static void rebx_calculate_J4_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double J4, const double R_eq, const int source_index){
+/*
+ * Single precision J4 terms.  rebx_calculate_J4_force gathers the double separations of the particles that pass the
+ * float bound into SoA float blocks, and these kernels evaluate the terms per unit G*m of the source, written in terms
+ * of (R_eq/r)^2, 1/r^2 and the unit vector so nothing overflows a float.  The SIMD kernels use the same operations in
+ * the same order as the scalar one (a full sqrt and division, no reciprocal estimates), so every kernel returns the
+ * same terms.
+ */
+#define REBX_J4_BLOCK 256
+
+struct rebx_J4_block_f {
+    int n;
+    int index[REBX_J4_BLOCK];
+    float dx[REBX_J4_BLOCK];
+    float dy[REBX_J4_BLOCK];
+    float dz[REBX_J4_BLOCK];
+    float tx[REBX_J4_BLOCK];
+    float ty[REBX_J4_BLOCK];
+    float tz[REBX_J4_BLOCK];
+};
+
+static void rebx_J4_terms_f_scalar(const float J4f, const float R_eq2f, const int j0, const int j1, 
+        const float* const restrict dx, const float* const restrict dy, const float* const restrict dz,
+        float* const restrict tx, float* const restrict ty, float* const restrict tz){
+    for (int j=j0; j<j1; j++){
+        const float r2 = dx[j]*dx[j] + dy[j]*dy[j] + dz[j]*dz[j];
+        const float _r = 1.f/sqrtf(r2);
+        const float nz = dz[j]*_r;
+        const float costheta2 = nz*nz;
+        const float s = R_eq2f/r2;
+        const float prefac = J4f*s*s/r2;
+        const float fac = 63.f*costheta2*costheta2 - 42.f*costheta2 + 3.f;
+        const float pfr = prefac*fac*_r;
+        tx[j] = pfr*dx[j];
+        ty[j] = pfr*dy[j];
+        tz[j] = prefac*(fac + 12.f - 28.f*costheta2)*nz;
+    }
+}
+
+#ifdef REBX_GH_X86_SIMD
+__attribute__((target("avx2")))
+static void rebx_J4_terms_f_avx2(const float J4f, const float R_eq2f, const int j0, const int j1, 
+        const float* const restrict dx, const float* const restrict dy, const float* const restrict dz,
+        float* const restrict tx, float* const restrict ty, float* const restrict tz){
+    const int jv = j0 + (j1-j0)/8*8;
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 J4v = _mm256_set1_ps(J4f);
+    const __m256 R_eq2v = _mm256_set1_ps(R_eq2f);
+    for (int j=j0; j<jv; j+=8){
+        const __m256 x = _mm256_loadu_ps(&dx[j]);
+        const __m256 y = _mm256_loadu_ps(&dy[j]);
+        const __m256 z = _mm256_loadu_ps(&dz[j]);
+        const __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+        const __m256 _r = _mm256_div_ps(one, _mm256_sqrt_ps(r2));
+        const __m256 nz = _mm256_mul_ps(z, _r);
+        const __m256 c2 = _mm256_mul_ps(nz, nz);
+        const __m256 s = _mm256_div_ps(R_eq2v, r2);
+        const __m256 prefac = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(J4v, s), s), r2);
+        const __m256 fac = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(63.f), c2), c2), _mm256_mul_ps(_mm256_set1_ps(42.f), c2)), _mm256_set1_ps(3.f));
+        const __m256 pfr = _mm256_mul_ps(_mm256_mul_ps(prefac, fac), _r);
+        const __m256 facz = _mm256_sub_ps(_mm256_add_ps(fac, _mm256_set1_ps(12.f)), _mm256_mul_ps(_mm256_set1_ps(28.f), c2));
+        _mm256_storeu_ps(&tx[j], _mm256_mul_ps(pfr, x));
+        _mm256_storeu_ps(&ty[j], _mm256_mul_ps(pfr, y));
+        _mm256_storeu_ps(&tz[j], _mm256_mul_ps(_mm256_mul_ps(prefac, facz), nz));
+    }
+    rebx_J4_terms_f_scalar(J4f, R_eq2f, jv, j1, dx, dy, dz, tx, ty, tz);
+}
+
+__attribute__((target("avx512f")))
+static void rebx_J4_terms_f_avx512(const float J4f, const float R_eq2f, const int j0, const int j1, 
+        const float* const restrict dx, const float* const restrict dy, const float* const restrict dz,
+        float* const restrict tx, float* const restrict ty, float* const restrict tz){
+    const int jv = j0 + (j1-j0)/16*16;
+    const __m512 one = _mm512_set1_ps(1.f);
+    const __m512 J4v = _mm512_set1_ps(J4f);
+    const __m512 R_eq2v = _mm512_set1_ps(R_eq2f);
+    for (int j=j0; j<jv; j+=16){
+        const __m512 x = _mm512_loadu_ps(&dx[j]);
+        const __m512 y = _mm512_loadu_ps(&dy[j]);
+        const __m512 z = _mm512_loadu_ps(&dz[j]);
+        const __m512 r2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y)), _mm512_mul_ps(z, z));
+        const __m512 _r = _mm512_div_ps(one, _mm512_sqrt_ps(r2));
+        const __m512 nz = _mm512_mul_ps(z, _r);
+        const __m512 c2 = _mm512_mul_ps(nz, nz);
+        const __m512 s = _mm512_div_ps(R_eq2v, r2);
+        const __m512 prefac = _mm512_div_ps(_mm512_mul_ps(_mm512_mul_ps(J4v, s), s), r2);
+        const __m512 fac = _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(63.f), c2), c2), _mm512_mul_ps(_mm512_set1_ps(42.f), c2)), _mm512_set1_ps(3.f));
+        const __m512 pfr = _mm512_mul_ps(_mm512_mul_ps(prefac, fac), _r);
+        const __m512 facz = _mm512_sub_ps(_mm512_add_ps(fac, _mm512_set1_ps(12.f)), _mm512_mul_ps(_mm512_set1_ps(28.f), c2));
+        _mm512_storeu_ps(&tx[j], _mm512_mul_ps(pfr, x));
+        _mm512_storeu_ps(&ty[j], _mm512_mul_ps(pfr, y));
+        _mm512_storeu_ps(&tz[j], _mm512_mul_ps(_mm512_mul_ps(prefac, facz), nz));
+    }
+    rebx_J4_terms_f_scalar(J4f, R_eq2f, jv, j1, dx, dy, dz, tx, ty, tz);
+}
+#endif // REBX_GH_X86_SIMD
+
+typedef void (*rebx_J4_kernel_f)(const float J4f, const float R_eq2f, const int j0, const int j1, 
+        const float* const restrict dx, const float* const restrict dy, const float* const restrict dz,
+        float* const restrict tx, float* const restrict ty, float* const restrict tz);
+
+static rebx_J4_kernel_f rebx_J4_select_kernel_f(void){
+#ifdef REBX_GH_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")){
+        return rebx_J4_terms_f_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")){
+        return rebx_J4_terms_f_avx2;
+    }
+#endif
+    return rebx_J4_terms_f_scalar;
+}
+
+// Evaluates the gathered block and adds the terms (and their back-reaction on the source) in double
+static void rebx_J4_flush_block_f(struct rebx_J4_block_f* const blk, rebx_J4_kernel_f kernel, struct reb_particle* const particles, const int source_index, const double Gm_source, const double G, const float J4f, const float R_eq2f){
+    kernel(J4f, R_eq2f, 0, blk->n, blk->dx, blk->dy, blk->dz, blk->tx, blk->ty, blk->tz);
+    for (int j=0; j<blk->n; j++){
+        const int i = blk->index[j];
+        const double tx = blk->tx[j];
+        const double ty = blk->ty[j];
+        const double tz = blk->tz[j];
+        const double Gm = G*particles[i].m;
+        particles[i].ax += Gm_source*tx;
+        particles[i].ay += Gm_source*ty;
+        particles[i].az += Gm_source*tz;
+        particles[source_index].ax -= Gm*tx;
+        particles[source_index].ay -= Gm*ty;
+        particles[source_index].az -= Gm*tz;
+    }
+    blk->n = 0;
+}
+
+static void rebx_calculate_J4_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double J4, const double R_eq, const int source_index, const double float_tolerance){
     const struct reb_particle source = particles[source_index];
     const double G = sim->G;
+    // Beyond r^4 = float_r4 the J4 term is below float_tolerance times the point-mass term
+    const int use_float = float_tolerance > 0.;
+    const double float_r4 = use_float ? 15.*fabs(J4)*R_eq*R_eq*R_eq*R_eq/float_tolerance : 0.;
+    const float J4f = (float)(5.*J4/8.);
+    const float R_eq2f = (float)(R_eq*R_eq);
+    struct rebx_J4_block_f blk;
+    blk.n = 0;
+    const rebx_J4_kernel_f kernel = use_float ? rebx_J4_select_kernel_f() : NULL;
     for (int i=0; i<N; i++){
         if(i == source_index){
             continue;
@@ -108,6 +388,16 @@ static void rebx_calculate_J4_force(struct reb_simulation* const sim, struct reb
         const double dy = p.y - source.y;
         const double dz = p.z - source.z;
         const double r2 = dx*dx + dy*dy + dz*dz;
+        if (use_float && r2*r2 > float_r4){
+            blk.index[blk.n] = i;
+            blk.dx[blk.n] = (float)dx;
+            blk.dy[blk.n] = (float)dy;
+            blk.dz[blk.n] = (float)dz;
+            if (++blk.n == REBX_J4_BLOCK){
+                rebx_J4_flush_block_f(&blk, kernel, particles, source_index, G*source.m, G, J4f, R_eq2f);
+            }
+            continue;
+        }
         const double r = sqrt(r2);
         const double costheta2 = dz*dz/r2;
         const double prefac = 5.*J4*R_eq*R_eq*R_eq*R_eq/r2/r2/r2/r/8.;
@@ -120,23 +410,362 @@ static void rebx_calculate_J4_force(struct reb_simulation* const sim, struct reb
         particles[source_index].ay -= G*p.m*prefac*fac*dy;
         particles[source_index].az -= G*p.m*prefac*(fac+12.-28.*costheta2)*dz;
     }
+    if (blk.n > 0){
+        rebx_J4_flush_block_f(&blk, kernel, particles, source_index, G*source.m, G, J4f, R_eq2f);
+    }
 }
 
 static void rebx_J4(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
-    for (int i=0; i<N; i++){
-        const double* const J4 = rebx_get_param(rebx, particles[i].ap, "J4");
-        if (J4 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+    const int J4_key = rebx_get_param_key(rebx, "J4");
+    const int R_eq_key = rebx_get_param_key(rebx, "R_eq");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, J4_key, particles, N);
+    const double* const float_tolerance = rebx_get_param(rebx, gh->ap, "float_tolerance");
+    for (int k=0; k<sources->N_indices; k++){
+        const int i = sources->indices[k];
+        const double* const J4 = rebx_get_param_by_key(rebx, particles[i].ap, J4_key);
+        if (J4 != NULL && !rebx_general_source(rebx, &particles[i])){
+            const double* const R_eq = rebx_get_param_by_key(rebx, particles[i].ap, R_eq_key);
             if (R_eq != NULL){
-                rebx_calculate_J4_force(sim, particles, N, *J4, *R_eq,i); 
+                rebx_calculate_J4_force(sim, particles, N, *J4, *R_eq, i, float_tolerance ? *float_tolerance : 0.); 
             }
         }
     }
 }
 
+// Bodies with a tilted (pole_dec set) spin axis, higher zonal harmonics or tesseral harmonics (harmonics_degree set).
+// The rotation to the body frame is computed once per source, and all harmonics are evaluated together in a single
+// recursive pass.  Bodies with only J2 and/or J4 along z go through the separate closed-form passes above.
+struct rebx_harmonics_source {
+    int n_max;
+    double R_eq;
+    int aligned;                        // body frame is the simulation frame
+    struct rebx_oblate_frame frame;
+    double* J;                          // J[0..n_max], when there are no tesseral terms
+    double* C;                          // C_nm and S_nm at [n*(n_max+1)+m], with C_n0 = -J_n, otherwise NULL
+    double* S;
+    double* VW;                         // scratch space for rebx_harmonics_acceleration
+};
+
+// The sources are evaluated one after the other, so they share ws->work, which only grows when a source needs more
+static int rebx_harmonics_source_init(struct rebx_extras* const rebx, const struct reb_simulation* const sim, const struct reb_particle* const source, struct rebx_harmonics_workspace* const ws, struct rebx_harmonics_source* const hs){
+    const double* const R = rebx_get_param(rebx, source->ap, "R_eq");
+    const double* const J2 = rebx_get_param(rebx, source->ap, "J2");
+    const double* const J4 = rebx_get_param(rebx, source->ap, "J4");
+    const int* const degree = rebx_get_param(rebx, source->ap, "harmonics_degree");
+    const double* const J_n = degree ? rebx_get_param(rebx, source->ap, "J_n") : NULL;
+    const double* const C_nm = degree ? rebx_get_param(rebx, source->ap, "C_nm") : NULL;
+    const double* const S_nm = degree ? rebx_get_param(rebx, source->ap, "S_nm") : NULL;
+    if (R == NULL || (J2 == NULL && J4 == NULL && J_n == NULL && C_nm == NULL && S_nm == NULL)){
+        return 0;
+    }
+    const int deg = degree ? *degree : 0;
+    const int n_max = deg > 4 ? deg : 4;
+    const int tesseral = (C_nm != NULL || S_nm != NULL) && deg >= 2;
+    const int L = n_max + 1;
+    const size_t size = L + (tesseral ? 2*L*L + 2*(n_max+2)*(n_max+2) : 0);
+    if (ws->N_work_allocated < size){
+        double* const work = realloc(ws->work, size*sizeof(*work));
+        if (work == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for gravitational_harmonics.\n");
+            return 0;
+        }
+        ws->work = work;
+        ws->N_work_allocated = size;
+    }
+    double* const work = ws->work;
+    for (size_t k=0; k<size; k++){
+        work[k] = 0.;
+    }
+    *hs = (struct rebx_harmonics_source){0};
+    hs->n_max = n_max;
+    hs->R_eq = *R;
+    hs->J = work;
+    hs->J[2] = J2 ? *J2 : 0.;
+    hs->J[4] = J4 ? *J4 : 0.;
+    if (J_n != NULL){
+        for (int n=2; n<=deg; n++){
+            hs->J[n] += J_n[n];
+        }
+    }
+    if (tesseral){
+        hs->C = work + L;
+        hs->S = hs->C + L*L;
+        hs->VW = hs->S + L*L;
+        for (int n=2; n<=n_max; n++){
+            hs->C[n*L] = -hs->J[n];
+        }
+        for (int n=2; n<=deg; n++){
+            for (int m=1; m<=n; m++){
+                hs->C[n*L+m] = C_nm ? C_nm[n*(deg+1)+m] : 0.;
+                hs->S[n*L+m] = S_nm ? S_nm[n*(deg+1)+m] : 0.;
+            }
+        }
+    }
+
+    const double* const pole_dec = rebx_get_param(rebx, source->ap, "pole_dec");
+    hs->aligned = (pole_dec == NULL && !tesseral);
+    if (!hs->aligned){
+        if (pole_dec != NULL){
+            const double* const pole_ra = rebx_get_param(rebx, source->ap, "pole_ra");
+            const double* const pole_ra_dot = rebx_get_param(rebx, source->ap, "pole_ra_dot");
+            const double* const pole_dec_dot = rebx_get_param(rebx, source->ap, "pole_dec_dot");
+            const double ra = (pole_ra ? *pole_ra : 0.) + (pole_ra_dot ? *pole_ra_dot*sim->t : 0.);
+            const double dec = *pole_dec + (pole_dec_dot ? *pole_dec_dot*sim->t : 0.);
+            rebx_oblate_frame_from_radec(&hs->frame, ra, dec);
+        }
+        else{
+            rebx_oblate_frame_from_pole(&hs->frame, 0., 0., 1.);
+        }
+        if (tesseral){
+            const double* const W = rebx_get_param(rebx, source->ap, "prime_meridian");
+            const double* const W_dot = rebx_get_param(rebx, source->ap, "prime_meridian_dot");
+            rebx_oblate_frame_spin(&hs->frame, (W ? *W : 0.) + (W_dot ? *W_dot*sim->t : 0.));
+        }
+    }
+    return 1;
+}
+
+// Acceleration per unit mass of the source at separation d (simulation frame)
+static void rebx_harmonics_source_acceleration(const struct rebx_harmonics_source* const hs, const double G, const double* const d, double* const a){
+    double db[3], ab[3];
+    if (hs->aligned){
+        rebx_zonal_acceleration(G, hs->R_eq, hs->n_max, hs->J, d[0], d[1], d[2], a);
+        return;
+    }
+    rebx_oblate_frame_to_body(&hs->frame, d, db);
+    if (hs->C != NULL){
+        rebx_harmonics_acceleration(G, hs->R_eq, hs->n_max, hs->C, hs->S, db[0], db[1], db[2], hs->VW, ab);
+    }
+    else{
+        rebx_zonal_acceleration(G, hs->R_eq, hs->n_max, hs->J, db[0], db[1], db[2], ab);
+    }
+    rebx_oblate_frame_from_body(&hs->frame, ab, a);
+}
+
+static double rebx_harmonics_source_potential(const struct rebx_harmonics_source* const hs, const double G, const double* const d){
+    double db[3];
+    if (hs->aligned){
+        return rebx_zonal_potential(G, hs->R_eq, hs->n_max, hs->J, d[0], d[1], d[2]);
+    }
+    rebx_oblate_frame_to_body(&hs->frame, d, db);
+    if (hs->C != NULL){
+        return rebx_harmonics_potential(G, hs->R_eq, hs->n_max, hs->C, hs->S, db[0], db[1], db[2], hs->VW);
+    }
+    return rebx_zonal_potential(G, hs->R_eq, hs->n_max, hs->J, db[0], db[1], db[2]);
+}
+
+static void rebx_general_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const struct rebx_harmonics_source* const hs, const int source_index, double* const unused){
+    const struct reb_particle source = particles[source_index];
+    const double G = sim->G;
+    for (int i=0; i<N; i++){
+        if(i == source_index){
+            continue;
+        }
+        const struct reb_particle p = particles[i];
+        const double d[3] = {p.x - source.x, p.y - source.y, p.z - source.z};
+        double a[3];
+        rebx_harmonics_source_acceleration(hs, G, d, a);
+
+        particles[i].ax += source.m*a[0];
+        particles[i].ay += source.m*a[1];
+        particles[i].az += source.m*a[2];
+        particles[source_index].ax -= p.m*a[0];
+        particles[source_index].ay -= p.m*a[1];
+        particles[source_index].az -= p.m*a[2];
+    }
+}
+
+// Calls f for every general source, first those with pole_dec and then the remaining ones with harmonics_degree.
+// The work buffer is kept in gh's workspace, or in a temporary one if gh is NULL (the potential, which has no force)
+static void rebx_general_sources(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N, void (*f)(struct reb_simulation* const, struct reb_particle* const, const int, const struct rebx_harmonics_source* const, const int, double* const), double* const out){
+    struct rebx_harmonics_workspace temporary = {0};
+    struct rebx_harmonics_workspace* ws = NULL;
+    const int pole_dec_key = rebx_get_param_key(rebx, "pole_dec");
+    const int keys[2] = {pole_dec_key, rebx_get_param_key(rebx, "harmonics_degree")};
+    for (int l=0; l<2; l++){
+        const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, keys[l], particles, N);
+        for (int k=0; k<sources->N_indices; k++){
+            const int i = sources->indices[k];
+            if (l == 1 && rebx_get_param_by_key(rebx, particles[i].ap, pole_dec_key) != NULL){
+                continue;   // already done
+            }
+            if (ws == NULL){
+                ws = gh ? rebx_harmonics_get_workspace(sim, gh) : &temporary;
+                if (ws == NULL){
+                    return;
+                }
+            }
+            struct rebx_harmonics_source hs;
+            if (rebx_harmonics_source_init(rebx, sim, &particles[i], ws, &hs)){
+                f(sim, particles, N, &hs, i, out);
+            }
+        }
+    }
+    free(temporary.work);
+}
+
+static void rebx_J2_term(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair){
+    const struct reb_particle p = particles[i];
+    const int source_index = term->source_index;
+    const double J2 = term->c[0];
+    const double R_eq = term->c[1];
+    const double G = term->c[2];
+    const double m0 = term->c[3];
+    const double r2 = pair->r2;
+    const double r = pair->r;
+    const double costheta2 = pair->dz*pair->dz/r2;
+    const double prefac = 3.*J2*R_eq*R_eq/r2/r2/r/2.;
+    const double fac = 5.*costheta2-1.;
+
+    particles[i].ax += G*m0*prefac*fac*pair->dx;
+    particles[i].ay += G*m0*prefac*fac*pair->dy;
+    particles[i].az += G*m0*prefac*(fac-2.)*pair->dz;
+    particles[source_index].ax -= G*p.m*prefac*fac*pair->dx;
+    particles[source_index].ay -= G*p.m*prefac*fac*pair->dy;
+    particles[source_index].az -= G*p.m*prefac*(fac-2.)*pair->dz;
+}
+
+static void rebx_J4_term(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair){
+    const struct reb_particle p = particles[i];
+    const int source_index = term->source_index;
+    const double J4 = term->c[0];
+    const double R_eq = term->c[1];
+    const double G = term->c[2];
+    const double m0 = term->c[3];
+    const double r2 = pair->r2;
+    const double r = pair->r;
+    const double costheta2 = pair->dz*pair->dz/r2;
+    const double prefac = 5.*J4*R_eq*R_eq*R_eq*R_eq/r2/r2/r2/r/8.;
+    const double fac = 63.*costheta2*costheta2-42.*costheta2 + 3.;
+
+    particles[i].ax += G*m0*prefac*fac*pair->dx;
+    particles[i].ay += G*m0*prefac*fac*pair->dy;
+    particles[i].az += G*m0*prefac*(fac+12.-28.*costheta2)*pair->dz;
+    particles[source_index].ax -= G*p.m*prefac*fac*pair->dx;
+    particles[source_index].ay -= G*p.m*prefac*fac*pair->dy;
+    particles[source_index].az -= G*p.m*prefac*(fac+12.-28.*costheta2)*pair->dz;
+}
+
+static int rebx_zonal_source_terms(struct rebx_extras* const rebx, struct reb_simulation* const sim, const char* const J_name, void (*accumulate)(const struct rebx_source_term* const, struct reb_particle* const, const int, const struct rebx_source_pair* const), struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max){
+    const int J_key = rebx_get_param_key(rebx, J_name);
+    const int R_eq_key = rebx_get_param_key(rebx, "R_eq");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, J_key, particles, N);
+    int N_terms = 0;
+    for (int k=0; k<sources->N_indices; k++){
+        const int i = sources->indices[k];
+        const double* const J = rebx_get_param_by_key(rebx, particles[i].ap, J_key);
+        const double* const R_eq = rebx_get_param_by_key(rebx, particles[i].ap, R_eq_key);
+        if (R_eq == NULL || rebx_general_source(rebx, &particles[i])){
+            continue;
+        }
+        if (N_terms == N_max){
+            return -1;
+        }
+        struct rebx_source_term* const term = &terms[N_terms++];
+        *term = (struct rebx_source_term){0};
+        term->accumulate = accumulate;
+        term->rebx = rebx;
+        term->source_index = i;
+        term->needs_r = 1;
+        term->c[0] = *J;
+        term->c[1] = *R_eq;
+        term->c[2] = sim->G;
+        term->c[3] = particles[i].m;
+    }
+    return N_terms;
+}
+
+// Aligned J2 and J4 only. Tilted and higher-degree sources run through the general pass, the single precision J4
+// terms through rebx_J4 and the offloaded J2 sweep through rebx_J2, so fall back if there are any
+int rebx_gravitational_harmonics_source_terms(struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max){
+    struct rebx_extras* const rebx = sim->extras;
+    const int* const device = rebx_get_param(rebx, gh->ap, "offload_device");
+    if (rebx_get_param(rebx, gh->ap, "float_tolerance") != NULL || (device != NULL && *device >= 0)){
+        return -1;
+    }
+    if (rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "pole_dec"), particles, N)->N_indices > 0 || rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "harmonics_degree"), particles, N)->N_indices > 0){
+        return -1;
+    }
+    const int N_J2 = rebx_zonal_source_terms(rebx, sim, "J2", rebx_J2_term, particles, N, terms, N_max);
+    if (N_J2 < 0){
+        return -1;
+    }
+    const int N_J4 = rebx_zonal_source_terms(rebx, sim, "J4", rebx_J4_term, particles, N, terms + N_J2, N_max - N_J2);
+    if (N_J4 < 0){
+        return -1;
+    }
+    return N_J2 + N_J4;
+}
+
 void rebx_gravitational_harmonics(struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
     rebx_J2(sim->extras, sim, gh, particles, N);
     rebx_J4(sim->extras, sim, gh, particles, N);
+    rebx_general_sources(sim->extras, sim, gh, particles, N, rebx_general_force, NULL);
+}
+
+/* Variational equations.  The closed-form J2 and J4 sources and general sources with at most J2 and J4 use the
+ * analytic Jacobian.  For higher degrees and tesseral terms the variation is the central difference of the
+ * acceleration along the variation of the separation, with a step of 1e-5 of the separation, which is
+ * accurate to about 1e-10 relative.
+ */
+struct rebx_harmonics_variation_data{
+    double GM;
+    double J2;
+    double J4;
+    double R_eq;
+    const struct rebx_harmonics_source* hs;   // general sources only
+    int analytic;
+};
+
+static void rebx_harmonics_variation(const void* const data, const struct reb_particle* const particles, const int i, const int source_index, const double* const d, const double* const dd, double* const da){
+    const struct rebx_harmonics_variation_data* const hv = data;
+    const struct rebx_harmonics_source* const hs = hv->hs;
+    if (hv->analytic){
+        rebx_zonal_variation(hv->GM, hv->J2, hv->J4, hv->R_eq, (hs == NULL || hs->aligned) ? NULL : &hs->frame, d, dd, da);
+        return;
+    }
+    const double r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    const double dr2 = dd[0]*dd[0] + dd[1]*dd[1] + dd[2]*dd[2];
+    if (dr2 == 0.){
+        return;
+    }
+    const double eps = 1.e-5*sqrt(r2/dr2);
+    const double dp[3] = {d[0] + eps*dd[0], d[1] + eps*dd[1], d[2] + eps*dd[2]};
+    const double dm[3] = {d[0] - eps*dd[0], d[1] - eps*dd[1], d[2] - eps*dd[2]};
+    double ap[3], am[3];
+    rebx_harmonics_source_acceleration(hs, hv->GM, dp, ap);
+    rebx_harmonics_source_acceleration(hs, hv->GM, dm, am);
+    for (int k=0; k<3; k++){
+        da[k] += (ap[k] - am[k])/(2.*eps);
+    }
+}
+
+static void rebx_general_variations(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const struct rebx_harmonics_source* const hs, const int source_index, double* const unused){
+    struct rebx_harmonics_variation_data hv = {sim->G*particles[source_index].m, hs->J[2], hs->J[4], hs->R_eq, hs, hs->C == NULL && hs->n_max == 4 && hs->J[3] == 0.};
+    rebx_source_variations(sim, particles, N, source_index, rebx_harmonics_variation, &hv);
+}
+
+void rebx_gravitational_harmonics_variations(struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    const int J2_key = rebx_get_param_key(rebx, "J2");
+    const int J4_key = rebx_get_param_key(rebx, "J4");
+    const int R_eq_key = rebx_get_param_key(rebx, "R_eq");
+    const int keys[2] = {J2_key, J4_key};
+    for (int l=0; l<2; l++){
+        const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, keys[l], particles, N);
+        for (int k=0; k<sources->N_indices; k++){
+            const int i = sources->indices[k];
+            const double* const J2 = rebx_get_param_by_key(rebx, particles[i].ap, J2_key);
+            const double* const J4 = rebx_get_param_by_key(rebx, particles[i].ap, J4_key);
+            const double* const R_eq = rebx_get_param_by_key(rebx, particles[i].ap, R_eq_key);
+            if ((l == 1 && J2 != NULL) || R_eq == NULL || rebx_general_source(rebx, &particles[i])){
+                continue;   // done with J2, or not a closed-form source
+            }
+            struct rebx_harmonics_variation_data hv = {sim->G*particles[i].m, J2 ? *J2 : 0., J4 ? *J4 : 0., *R_eq, NULL, 1};
+            rebx_source_variations(sim, particles, N, i, rebx_harmonics_variation, &hv);
+        }
+    }
+    rebx_general_sources(rebx, sim, gh, particles, N, rebx_general_variations, NULL);
 }
 
 static double rebx_calculate_J2_potential(struct reb_simulation* const sim, const double J2, const double R_eq, const int source_index){
@@ -167,10 +796,14 @@ static double rebx_J2_potential(struct rebx_extras* const rebx, struct reb_simul
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
     double Htot = 0.;
-    for (int i=0; i<N_real; i++){
-        const double* const J2 = rebx_get_param(rebx, particles[i].ap, "J2");
-        if (J2 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+    const int J2_key = rebx_get_param_key(rebx, "J2");
+    const int R_eq_key = rebx_get_param_key(rebx, "R_eq");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, J2_key, particles, N_real);
+    for (int k=0; k<sources->N_indices; k++){
+        const int i = sources->indices[k];
+        const double* const J2 = rebx_get_param_by_key(rebx, particles[i].ap, J2_key);
+        if (J2 != NULL && !rebx_general_source(rebx, &particles[i])){
+            const double* const R_eq = rebx_get_param_by_key(rebx, particles[i].ap, R_eq_key);
             if (R_eq != NULL){
                 Htot += rebx_calculate_J2_potential(sim, *J2, *R_eq, i);
             }
@@ -208,10 +841,14 @@ static double rebx_J4_potential(struct rebx_extras* const rebx, struct reb_simul
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
     double Htot = 0.;
-    for (int i=0; i<N_real; i++){
-        const double* const J4 = rebx_get_param(rebx, particles[i].ap, "J4");
-        if (J4 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+    const int J4_key = rebx_get_param_key(rebx, "J4");
+    const int R_eq_key = rebx_get_param_key(rebx, "R_eq");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, J4_key, particles, N_real);
+    for (int k=0; k<sources->N_indices; k++){
+        const int i = sources->indices[k];
+        const double* const J4 = rebx_get_param_by_key(rebx, particles[i].ap, J4_key);
+        if (J4 != NULL && !rebx_general_source(rebx, &particles[i])){
+            const double* const R_eq = rebx_get_param_by_key(rebx, particles[i].ap, R_eq_key);
             if (R_eq != NULL){
                 Htot += rebx_calculate_J4_potential(sim, *J4, *R_eq, i);
             }
@@ -220,6 +857,18 @@ static double rebx_J4_potential(struct rebx_extras* const rebx, struct reb_simul
     return Htot;
 }
 
+static void rebx_general_potential(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const struct rebx_harmonics_source* const hs, const int source_index, double* const H){
+    const struct reb_particle source = particles[source_index];
+    for (int j=0; j<N; j++){
+        if (j == source_index){
+            continue;
+        }
+        const struct reb_particle p = particles[j];
+        const double d[3] = {p.x - source.x, p.y - source.y, p.z - source.z};
+        *H += p.m*source.m*rebx_harmonics_source_potential(hs, sim->G, d);
+    }
+}
+
 double rebx_gravitational_harmonics_potential(struct rebx_extras* const rebx){
     if (rebx->sim == NULL){
         rebx_error(rebx, ""); // rebx_error gives meaningful err
@@ -227,5 +876,6 @@ double rebx_gravitational_harmonics_potential(struct rebx_extras* const rebx){
     }
     double H = rebx_J2_potential(rebx, rebx->sim);
     H += rebx_J4_potential(rebx, rebx->sim);
+    rebx_general_sources(rebx, rebx->sim, NULL, rebx->sim->particles, rebx->sim->N - rebx->sim->N_var, rebx_general_potential, &H);
     return H;
 }
@@ -27,30 +27,78 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "rebound.h"
 #include "reboundx.h"
 #include "core.h"
 
-// Macro to read a single field from a binary file.
-#define CASE(typename, valueref) case REBX_BINARY_FIELD_TYPE_##typename: \
-{\
-if(!fread(valueref, field.size, 1, inf)){\
-*warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;\
-}\
-break;\
-}\
+/* Binaries are parsed in place from memory, either a buffer passed in by the user or the file mapped with mmap.
+ * Names are looked up directly in the image and values are copied straight to where they end up (the values pool
+ * for scalar types), so loading doesn't need a read call or a temporary allocation per field.
+ */
+struct rebx_input_buffer{
+    const char* data;
+    size_t size;
+    size_t pos;
+};
+
+// Returns a pointer to the next size bytes of the image and moves past them, or NULL if there aren't enough left
+static const char* rebx_input_take(struct rebx_input_buffer* const in, const long size){
+    if (size < 0 || (size_t)size > in->size - in->pos){
+        return NULL;
+    }
+    const char* const ptr = in->data + in->pos;
+    in->pos += size;
+    return ptr;
+}
+
+static int rebx_input_read(struct rebx_input_buffer* const in, void* const dst, const long size){
+    const char* const src = rebx_input_take(in, size);
+    if (src == NULL){
+        return 0;
+    }
+    memcpy(dst, src, size);
+    return 1;
+}
+
+static int rebx_input_read_field(struct rebx_input_buffer* const in, struct rebx_binary_field* const field){
+    return rebx_input_read(in, field, sizeof(*field));
+}
+
+// Skipping past the end of the image leaves it at the end, so the next read reports it as corrupt
+static void rebx_input_skip(struct rebx_input_buffer* const in, const long field_size){
+    if (rebx_input_take(in, field_size) == NULL){
+        in->pos = in->size;
+    }
+}
+
+// Position just past an object of field_size starting at the current position, so a partially read object can be skipped
+static size_t rebx_input_end_of(const struct rebx_input_buffer* const in, const long field_size){
+    if (field_size < 0 || (size_t)field_size > in->size - in->pos){
+        return in->size;
+    }
+    return in->pos + field_size;
+}
 
-#define CASE_MALLOC(typename, valueref) case REBX_BINARY_FIELD_TYPE_##typename: \
+// Strings are saved with their terminating zero. Returns NULL if it's missing
+static const char* rebx_input_take_string(struct rebx_input_buffer* const in, const long size){
+    const char* const str = rebx_input_take(in, size);
+    if (str == NULL || size == 0 || str[size-1] != '\0'){
+        return NULL;
+    }
+    return str;
+}
+
+// Macro to read a single field from a binary image.
+#define CASE(typename, valueref) case REBX_BINARY_FIELD_TYPE_##typename: \
 {\
-valueref = malloc(field.size);\
-if(valueref == NULL){\
-*warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;\
-}\
-else{\
-if(!fread(valueref, field.size, 1, inf)){\
+if(field.size > (long)sizeof(*(valueref)) || !rebx_input_read(in, valueref, field.size)){\
 *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;\
-free(valueref);\
-}\
+rebx_input_skip(in, field.size);\
 }\
 break;\
 }\
@@ -59,96 +107,191 @@ void rebx_input_skip_binary_field(FILE* inf, long field_size){
     fseek(inf, field_size, SEEK_CUR);
 }
 
-static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, FILE* inf, enum rebx_input_binary_messages* warnings);
+static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings);
+
+// A param as it's laid out in the image. name and value point into it
+struct rebx_param_record{
+    enum rebx_param_type type;
+    const char* name;
+    const char* value;
+    long value_size;
+};
+
+static int rebx_read_param(struct rebx_input_buffer* in, struct rebx_param_record* const record, enum rebx_input_binary_messages* warnings){
+    record->type = REBX_TYPE_NONE;
+    record->name = NULL;
+    record->value = NULL;
+    record->value_size = 0;
 
-static struct rebx_param* rebx_read_param(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
-    
-    struct rebx_param* param = malloc(sizeof(*param));
-    if (param == NULL){
-        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
-        return NULL;
-    }
-    param->value = NULL;
-    param->name = NULL;
-    param->type = REBX_TYPE_NONE;
-    
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){ // means we didn't reach an END field. Corrupt
+        if (!rebx_input_read_field(in, &field)){ // means we didn't reach an END field. Corrupt
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
         switch (field.type){
-            CASE(PARAM_TYPE,                  &param->type);
-            CASE_MALLOC(NAME,                 param->name);
-            CASE_MALLOC(PARAM_VALUE,          param->value);
+            CASE(PARAM_TYPE,                  &record->type);
+            case REBX_BINARY_FIELD_TYPE_NAME:
+            {
+                record->name = rebx_input_take_string(in, field.size);
+                if (record->name == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARAM_VALUE:
+            {
+                record->value = rebx_input_take(in, field.size);
+                record->value_size = field.size;
+                if (record->value == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                }
+                break;
+            }
             case REBX_BINARY_FIELD_TYPE_END:
                 reading_fields=0;
                 break;
             default: // Might have added new fields, saved with new version and loaded with old version
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
     }
     // Check type and name after param has been loaded. Check value later (registered params should have value=NULL)
-    if (param->type == REBX_TYPE_NONE || param->name == NULL){
+    if (record->type == REBX_TYPE_NONE || record->name == NULL){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-        rebx_free_param(param);
-        return NULL;
+        return 0;
     }
-    return param;
+    return 1;
 }
 
-static int rebx_load_param(struct rebx_extras* rebx, struct rebx_node** ap, FILE* inf, enum rebx_input_binary_messages* warnings){
-    struct rebx_param* param = rebx_read_param(rebx, inf, warnings);
-    
-    if(param == NULL){
+static int rebx_load_param(struct rebx_extras* rebx, struct rebx_node** ap, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
+    struct rebx_param_record record;
+    if(!rebx_read_param(in, &record, warnings)){
         return 0;
     }
-    
-    if(param->value == NULL){
+
+    if(record.value == NULL || record.value_size == 0){
         *warnings |= REBX_INPUT_BINARY_WARNING_PARAM_VALUE_NULL;
-        rebx_free_param(param);
         return 0;
     }
-    
+
+    struct rebx_param* param = rebx_alloc_param(rebx);
+    if (param == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+        return 0;
+    }
+    param->type = record.type;
+    param->value = NULL;
+    param->name = NULL;
+    param->key = -1;
+
     if(param->type == REBX_TYPE_FORCE){
-        struct rebx_force* force = rebx_get_force(rebx, param->value);
+        // Saved as the force's name. Forces are loaded before any params can point to them
+        struct rebx_force* force = NULL;
+        if (record.value[record.value_size-1] == '\0'){
+            force = rebx_get_force(rebx, record.value);
+        }
         if (force == NULL){
             *warnings |= REBX_INPUT_BINARY_WARNING_FORCE_PARAM_NOT_LOADED;
-            rebx_free_param(param);
+            rebx_free_param(rebx, param);
             return 0;
         }
         param->value = force;
     }
+    else if(rebx_param_value_in_pool(param->type)){
+        // Scalar values are owned by the values pool, so copy them straight there
+        if (record.value_size > (long)sizeof(double)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            rebx_free_param(rebx, param);
+            return 0;
+        }
+        param->value = rebx_alloc_param_value(rebx);
+        if (param->value == NULL){
+            *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+            rebx_free_param(rebx, param);
+            return 0;
+        }
+        memcpy(param->value, record.value, record.value_size);
+    }
+    else{
+        param->value = malloc(record.value_size);
+        if (param->value == NULL){
+            *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+            rebx_free_param(rebx, param);
+            return 0;
+        }
+        memcpy(param->value, record.value, record.value_size);
+    }
+
+    // Keyed lookups need the interned key. Register names saved without a matching registered param
+    int key = rebx_get_param_key(rebx, record.name);
+    if (key < 0){
+        rebx_register_param(rebx, record.name, param->type);
+        key = rebx_get_param_key(rebx, record.name);
+    }
+    if (key >= 0){  // share the registered name
+        param->name = rebx->param_keys[key]->name;
+        param->key = key;
+    }
+    else{
+        param->name = malloc(strlen(record.name) + 1);
+        if (param->name == NULL){
+            *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+            rebx_free_param(rebx, param);
+            return 0;
+        }
+        strcpy(param->name, record.name);
+    }
     int success = rebx_add_param(rebx, ap, param);
     if(!success){
         return 0;
     }
     return 1;
-    
+
 }
 
-static int rebx_load_registered_param(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
-    struct rebx_param* param = rebx_read_param(rebx, inf, warnings);
-    
-    if(param == NULL){
+static int rebx_load_registered_param(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
+    struct rebx_param_record record;
+    if(!rebx_read_param(in, &record, warnings)){
         return 0;
     }
-    
+
+    // Default params were already registered in rebx_attach
+    if (rebx_get_param_key(rebx, record.name) >= 0){
+        return 1;
+    }
+
+    struct rebx_param* param = rebx_alloc_param(rebx);
+    if (param == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+        return 0;
+    }
+    param->type = record.type;
+    param->value = NULL;
+    param->key = -1;
+    param->name = malloc(strlen(record.name) + 1);
+    if (param->name == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+        rebx_free_param(rebx, param);
+        return 0;
+    }
+    strcpy(param->name, record.name);
     int success = rebx_add_param(rebx, &rebx->registered_params, param);
     if(!success){
         return 0;
     }
+    rebx_intern_param(rebx, param);
     return 1;
 }
 
-static char* rebx_load_name(FILE* inf, enum rebx_input_binary_messages* warnings){
+// Returns a pointer to the name in the image
+static const char* rebx_load_name(struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
-    if (!fread(&field, sizeof(field), 1, inf)){
+    if (!rebx_input_read_field(in, &field)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return NULL;
     }
@@ -156,28 +299,21 @@ static char* rebx_load_name(FILE* inf, enum rebx_input_binary_messages* warnings
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return NULL;
     }
-    char* name = malloc(field.size);
+    const char* const name = rebx_input_take_string(in, field.size);
     if (name == NULL){
-        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
-        return NULL;
-    }
-    if (!fread(name, field.size, 1, inf)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-        free(name);
-        return NULL;
     }
     return name;
 }
 
-static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_force_field(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     
     // Name of force always comes first so that we can load it
-    char* name = rebx_load_name(inf, warnings);
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_force* force = rebx_load_force(rebx, name);
-    free(name);
     if(force == NULL){
         *warnings |= REBX_INPUT_BINARY_WARNING_FORCE_NOT_LOADED;
         return 0;
@@ -186,14 +322,14 @@ static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             return 0;
         }
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM_LIST:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &force->ap, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &force->ap, in, warnings)){
                     return 0;
                 }
                 break;
@@ -206,7 +342,7 @@ static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
@@ -216,14 +352,13 @@ static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_
 }
 
 // Force is already loaded in allocated_forces. Need to get from that list and add to sim
-static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_additional_force_field(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     
-    char* name = rebx_load_name(inf, warnings);
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_force* force = rebx_get_force(rebx, name);
-    free(name);
     if(force == NULL){
         return 0;
     }
@@ -232,7 +367,7 @@ static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf,
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             return 0;
         }
@@ -245,7 +380,7 @@ static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf,
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
@@ -255,14 +390,13 @@ static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf,
     return success;
 }
 
-static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_operator_field(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     // Name of force always comes first so that we can load it
-    char* name = rebx_load_name(inf, warnings);
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_operator* operator = rebx_load_operator(rebx, name);
-    free(name);
     if(operator == NULL){
         *warnings |= REBX_INPUT_BINARY_WARNING_OPERATOR_NOT_LOADED;
         return 0;
@@ -271,14 +405,14 @@ static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum re
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM_LIST:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &operator->ap, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &operator->ap, in, warnings)){
                     return 0;
                 }
                 break;
@@ -291,7 +425,7 @@ static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum re
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
@@ -300,13 +434,12 @@ static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum re
     return 1;
 }
 
-static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings, struct rebx_node** ap){
-    char* name = rebx_load_name(inf, warnings);
+static int rebx_load_step_field(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings, struct rebx_node** ap){
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_operator* operator = rebx_get_operator(rebx, name);
-    free(name);
     if(operator == NULL){
         *warnings |= REBX_INPUT_BINARY_WARNING_OPERATOR_NOT_LOADED;
         return 0;
@@ -316,7 +449,7 @@ static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_i
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
@@ -347,10 +480,10 @@ static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_i
     return success;
 }
 
-static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_particle(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     struct reb_particle* p = NULL;
     struct rebx_binary_field field;
-    if (!fread(&field, sizeof(field), 1, inf)){
+    if (!rebx_input_read_field(in, &field)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return 0;
     }
@@ -360,7 +493,11 @@ static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
         return 0;
     }
     int index;
-    if(!fread(&index, field.size, 1, inf)){
+    if(field.size != (long)sizeof(index) || !rebx_input_read(in, &index, field.size)){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return 0;
+    }
+    if(index < 0 || index >= rebx->sim->N){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return 0;
     }
@@ -369,14 +506,14 @@ static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
     
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             return 0;
         }
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM_LIST:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &p->ap, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &p->ap, in, warnings)){
                     return 0;
                 }
                 break;
@@ -389,22 +526,174 @@ static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_skip(in, field.size);
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+// Reads a column in place. Without indices, the values are for particles 0, 1, 2... in order
+static int rebx_read_particle_column(struct rebx_extras* rebx, struct rebx_input_buffer* in, struct rebx_particle_column* const column, enum rebx_input_binary_messages* warnings){
+    column->type = REBX_TYPE_NONE;
+    column->name = NULL;
+    column->indices = NULL;
+    column->values = NULL;
+    column->N = 0;
+    long indices_size = 0;
+    long values_size = 0;
+    
+    struct rebx_binary_field field;
+    int reading_fields = 1;
+    while (reading_fields){
+        if (!rebx_input_read_field(in, &field)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            return 0;
+        }
+        switch (field.type){
+            CASE(PARAM_TYPE,                  &column->type);
+            case REBX_BINARY_FIELD_TYPE_NAME:
+            {
+                column->name = rebx_input_take_string(in, field.size);
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_COLUMN_INDICES:
+            {
+                column->indices = rebx_input_take(in, field.size);
+                indices_size = field.size;
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_COLUMN_VALUES:
+            {
+                column->values = rebx_input_take(in, field.size);
+                values_size = field.size;
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_END:
+            {
+                reading_fields=0;
+                break;
+            }
+            default:
+            {
+                *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
     }
+    
+    if (!rebx_param_value_in_pool(column->type) || column->name == NULL || column->values == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return 0;
+    }
+    const long size = rebx_sizeof(rebx, column->type);
+    column->N = values_size/size;
+    if (values_size % size != 0 || (column->indices != NULL && indices_size != column->N*(long)sizeof(int))){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return 0;
+    }
+    return 1;
+}
+
+// With overwrite (snapshot diffs), particles that already have the param get their value replaced
+static int rebx_load_particle_column(struct rebx_extras* rebx, struct rebx_input_buffer* in, const int overwrite, enum rebx_input_binary_messages* warnings){
+    struct reb_simulation* const sim = rebx->sim;
+    struct rebx_particle_column column;
+    if (!rebx_read_particle_column(rebx, in, &column, warnings)){
+        return 0;
+    }
+    if (column.indices == NULL && column.N > sim->N){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return 0;
+    }
+    
+    int key = rebx_get_param_key(rebx, column.name);
+    if (key < 0){
+        rebx_register_param(rebx, column.name, column.type);
+        key = rebx_get_param_key(rebx, column.name);
+        if (key < 0){
+            *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+            return 0;
+        }
+    }
+    
+    const long size = rebx_sizeof(rebx, column.type);
+    for (long j=0; j<column.N; j++){
+        int index = j;
+        if (column.indices != NULL){
+            memcpy(&index, column.indices + j*sizeof(int), sizeof(int));  // image isn't aligned
+        }
+        if (index < 0 || index >= sim->N){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            return 0;
+        }
+        struct rebx_node** const ap = (struct rebx_node**)&sim->particles[index].ap;
+        if (overwrite){
+            struct rebx_param* existing = NULL;
+            for (struct rebx_node* current = *ap; current != NULL; current = current->next){
+                struct rebx_param* const param = current->object;
+                if (param->key == key){
+                    existing = param;
+                    break;
+                }
+            }
+            if (existing != NULL && existing->type == column.type){
+                memcpy(existing->value, column.values + j*size, size);
+                continue;
+            }
+        }
+        struct rebx_param* param = rebx_alloc_param(rebx);
+        if (param == NULL){
+            *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+            return 0;
+        }
+        param->type = column.type;
+        param->name = rebx->param_keys[key]->name;
+        param->key = key;
+        param->value = rebx_alloc_param_value(rebx);
+        if (param->value == NULL || !rebx_add_param(rebx, ap, param)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+            rebx_free_param(rebx, param);
+            return 0;
+        }
+        memcpy(param->value, column.values + j*size, size);
+    }
     return 1;
 }
 
-static int rebx_load_rebx(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_particle_columns(struct rebx_extras* rebx, struct rebx_input_buffer* in, const int overwrite, enum rebx_input_binary_messages* warnings){
+    struct rebx_binary_field field;
+    while (1){
+        if (!rebx_input_read_field(in, &field)){
+            return 0;
+        }
+        if (field.type == REBX_BINARY_FIELD_TYPE_END){
+            return 1;
+        }
+        if (field.type != REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMN){
+            *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+            rebx_input_skip(in, field.size);
+            continue;
+        }
+        const size_t end = rebx_input_end_of(in, field.size);
+        if (!rebx_load_particle_column(rebx, in, overwrite, warnings)){
+            *warnings |= REBX_INPUT_BINARY_WARNING_PARTICLE_PARAMS_NOT_LOADED;
+            in->pos = end;
+        }
+    }
+}
+
+static int rebx_load_rebx(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
+        const size_t end = rebx_input_end_of(in, field.size);
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_END:
             {
@@ -413,56 +702,56 @@ static int rebx_load_rebx(struct rebx_extras* rebx, FILE* inf, enum rebx_input_b
             }
             case REBX_BINARY_FIELD_TYPE_REGISTERED_PARAMETERS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM, &rebx->registered_params, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM, &rebx->registered_params, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ALLOCATED_FORCES:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_FORCE, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_FORCE, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ALLOCATED_OPERATORS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_OPERATOR, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_OPERATOR, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCES:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PRE_TIMESTEP_MODIFICATIONS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->pre_timestep_modifications, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->pre_timestep_modifications, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_POST_TIMESTEP_MODIFICATIONS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->post_timestep_modifications, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->post_timestep_modifications, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
@@ -470,9 +759,9 @@ static int rebx_load_rebx(struct rebx_extras* rebx, FILE* inf, enum rebx_input_b
     return 1;
 }
 
-static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_snapshot(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
-    if (!fread(&field, sizeof(field), 1, inf)){
+    if (!rebx_input_read_field(in, &field)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return 0;
     }
@@ -483,27 +772,41 @@ static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
 
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
+        const size_t end = rebx_input_end_of(in, field.size);
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_REBX_STRUCTURE:
             {
-                if (!rebx_load_rebx(rebx, inf, warnings)){
+                if (!rebx_load_rebx(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_REBX_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PARTICLES:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARTICLE, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARTICLE, NULL, in, warnings)){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                    in->pos = end;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMNS:
+            {
+                if (!rebx_load_particle_columns(rebx, in, 0, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
+            case REBX_BINARY_FIELD_TYPE_SNAPSHOT_TIME: // only used to index archives
+            {
+                rebx_input_skip(in, field.size);
+                break;
+            }
             case REBX_BINARY_FIELD_TYPE_END:
             {
                 reading_fields=0;
@@ -512,7 +815,7 @@ static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_LIST_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_skip(in, field.size);
                 break;
             }
         }
@@ -522,13 +825,14 @@ static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
 }
 
 // Only fails (returns 0) if binary is in wrong format
-static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             return 0;
         }
+        const size_t end = rebx_input_end_of(in, field.size);
         
         // Check whether we've reached end before checking for expected type
         if (field.type == REBX_BINARY_FIELD_TYPE_END){
@@ -543,57 +847,57 @@ static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM:
             {
-                if(!rebx_load_param(rebx, ap, inf, warnings)){
+                if(!rebx_load_param(rebx, ap, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_PARAM_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM:
             {
-                if(!rebx_load_registered_param(rebx, inf, warnings)){
+                if(!rebx_load_registered_param(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_REGISTERED_PARAM_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_FORCE:
             {
-                if (!rebx_load_force_field(rebx, inf, warnings)){
+                if (!rebx_load_force_field(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_FORCE_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE:
             {
-                if (!rebx_load_additional_force_field(rebx, inf, warnings)){
+                if (!rebx_load_additional_force_field(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_ADDITIONAL_FORCE_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_OPERATOR:
             {
-                if (!rebx_load_operator_field(rebx, inf, warnings)){
+                if (!rebx_load_operator_field(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_OPERATOR_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_STEP:
             {
-                if (!rebx_load_step_field(rebx, inf, warnings, ap)){
+                if (!rebx_load_step_field(rebx, in, warnings, ap)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_STEP_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PARTICLE:
             {
-                if (!rebx_load_particle(rebx, inf, warnings)){
+                if (!rebx_load_particle(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_PARTICLE_PARAMS_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    in->pos = end;
                 }
                 break;
             }
@@ -607,52 +911,344 @@ static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type
     return 1;
 }
 
-static void rebx_input_read_header(FILE* inf, enum rebx_input_binary_messages* warnings){
-    long objects = 0;
+static void rebx_input_read_header(struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
     // Input header.
     const char str[] = "REBOUNDx Binary File. Version: ";
     const char zero = '\0';
-    char readbuf[65], curvbuf[65];
+    char readbuf[65] = {0}, curvbuf[65];
     sprintf(curvbuf,"%s%s",str,rebx_version_str);
     memcpy(curvbuf+strlen(curvbuf)+1,rebx_githash_str,sizeof(char)*(62-strlen(curvbuf)));
     curvbuf[63] = zero;
-    
-    objects += fread(readbuf,sizeof(*str),64,inf);
+
+    if (!rebx_input_read(in, readbuf, 64)){
+        rebx_input_skip(in, in->size);
+    }
     // Note: following compares version, but ignores githash.
     if(strcmp(readbuf,curvbuf)!=0){
         *warnings |= REBX_INPUT_BINARY_WARNING_VERSION;
     }
 }
 
-void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const filename, enum rebx_input_binary_messages* warnings){
+void rebx_init_extras_from_buffer(struct rebx_extras* rebx, const char* const buf, const size_t size, enum rebx_input_binary_messages* warnings){
     if (rebx->sim == NULL){
         rebx_error(rebx, ""); // rebx_error gives meaningful err
         return;
     }
-    FILE* inf = fopen(filename,"rb");
-    if (!inf){
+    struct rebx_input_buffer in = {.data = buf, .size = buf ? size : 0, .pos = 0};
+    rebx_input_read_header(&in, warnings);
+    rebx_load_snapshot(rebx, &in, warnings);
+}
+
+// Maps the whole file, or reads it into memory if it can't be mapped (e.g. empty files or pipes). Returns NULL if it can't be opened
+static char* rebx_input_open_image(const char* const filename, size_t* const size, int* const mapped, enum rebx_input_binary_messages* warnings){
+    const int fd = open(filename, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) < 0){
+        if (fd >= 0){
+            close(fd);
+        }
         *warnings |= REBX_INPUT_BINARY_ERROR_NOFILE;
+        return NULL;
+    }
+    *size = sb.st_size;
+    void* map = *size > 0 ? mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map != MAP_FAILED){
+        close(fd);
+        *mapped = 1;
+        return map;
+    }
+    *mapped = 0;
+    char* buf = malloc(*size > 0 ? *size : 1);
+    if (buf == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+        close(fd);
+        return NULL;
+    }
+    size_t done = 0;
+    while (done < *size){
+        const ssize_t n = read(fd, buf + done, *size - done);
+        if (n <= 0){
+            break;
+        }
+        done += n;
+    }
+    *size = done;
+    close(fd);
+    return buf;
+}
+
+static void rebx_input_close_image(char* const buf, const size_t size, const int mapped){
+    if (mapped){
+        munmap(buf, size);
+    }
+    else{
+        free(buf);
+    }
+}
+
+void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const filename, enum rebx_input_binary_messages* warnings){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
         return;
     }
-    
-    rebx_input_read_header(inf, warnings);
-    rebx_load_snapshot(rebx, inf, warnings);
-    
-    fclose(inf);
-    return;
+    size_t size = 0;
+    int mapped = 0;
+    char* const buf = rebx_input_open_image(filename, &size, &mapped, warnings);
+    if (buf == NULL){
+        return;
+    }
+    rebx_init_extras_from_buffer(rebx, buf, size, warnings);
+    rebx_input_close_image(buf, size, mapped);
 }
 
-struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, const char* const filename){
-    if (sim == NULL){
-        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_binary was NULL.\n");
-        return NULL;
+/************************************************************
+ Archives: a full snapshot (keyframe) followed by snapshot diffs
+*************************************************************/
+
+// Loads the particle columns of the keyframe at offset
+static void rebx_load_keyframe_columns(struct rebx_extras* rebx, const struct rebx_input_buffer* archive, const long offset, enum rebx_input_binary_messages* warnings){
+    struct rebx_input_buffer in = {.data = archive->data, .size = archive->size, .pos = 0};
+    struct rebx_binary_field field;
+    if (offset < 0 || (size_t)offset >= in.size){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return;
+    }
+    in.pos = offset;
+    if (!rebx_input_read_field(&in, &field) || field.type != REBX_BINARY_FIELD_TYPE_SNAPSHOT){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return;
+    }
+    while (rebx_input_read_field(&in, &field) && field.type != REBX_BINARY_FIELD_TYPE_END){
+        if (field.type == REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMNS){
+            const size_t end = rebx_input_end_of(&in, field.size);
+            if (!rebx_load_particle_columns(rebx, &in, 0, warnings)){
+                *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                in.pos = end;
+            }
+        }
+        else{
+            rebx_input_skip(&in, field.size);
+        }
+    }
+}
+
+/* A diff holds the full rebx structure and the params of particles that don't go in columns, which are small, but only
+ * the particle column entries that changed since its keyframe. Those are applied on top of the keyframe's columns.
+ */
+static int rebx_load_snapshot_diff(struct rebx_extras* rebx, struct rebx_input_buffer* in, enum rebx_input_binary_messages* warnings){
+    struct rebx_binary_field field;
+    if (!rebx_input_read_field(in, &field) || field.type != REBX_BINARY_FIELD_TYPE_SNAPSHOT_DIFF){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return 0;
+    }
+    const size_t diff_offset = in->pos - sizeof(field);
+    long keyframe = -1;
+    int keyframe_loaded = 0;
+    int reading_fields = 1;
+    while (reading_fields){
+        if (!rebx_input_read_field(in, &field)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            break;
+        }
+        const size_t end = rebx_input_end_of(in, field.size);
+        switch (field.type){
+            CASE(KEYFRAME_OFFSET,       &keyframe);
+            case REBX_BINARY_FIELD_TYPE_REBX_STRUCTURE:
+            {
+                if (!rebx_load_rebx(rebx, in, warnings)){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_REBX_NOT_LOADED;
+                    in->pos = end;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARTICLES:
+            {
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARTICLE, NULL, in, warnings)){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                    in->pos = end;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMNS:
+            {
+                if (!keyframe_loaded && keyframe >= 0 && (size_t)keyframe < diff_offset){
+                    rebx_load_keyframe_columns(rebx, in, keyframe, warnings);
+                    keyframe_loaded = 1;
+                }
+                if (!rebx_load_particle_columns(rebx, in, 1, warnings)){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                    in->pos = end;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_SNAPSHOT_TIME:
+            {
+                rebx_input_skip(in, field.size);
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_END:
+            {
+                reading_fields=0;
+                break;
+            }
+            default:
+            {
+                *warnings |= REBX_INPUT_BINARY_WARNING_LIST_UNKNOWN;
+                rebx_input_skip(in, field.size);
+                break;
+            }
+        }
+    }
+    if (!keyframe_loaded){
+        if (keyframe < 0 || (size_t)keyframe >= diff_offset){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            return 0;
+        }
+        rebx_load_keyframe_columns(rebx, in, keyframe, warnings);
+    }
+    return 1;
+}
+
+int rebx_archive_index(const char* const buf, const size_t size, double* times, long* offsets, const int N_max){
+    struct rebx_input_buffer in = {.data = buf, .size = buf ? size : 0, .pos = 64}; // skip header
+    if (in.pos > in.size){
+        return 0;
+    }
+    int N = 0;
+    struct rebx_binary_field field;
+    while (1){
+        const size_t offset = in.pos;
+        if (!rebx_input_read_field(&in, &field)){
+            break;
+        }
+        if (field.type != REBX_BINARY_FIELD_TYPE_SNAPSHOT && field.type != REBX_BINARY_FIELD_TYPE_SNAPSHOT_DIFF){
+            break;
+        }
+        if (field.size < 0 || (size_t)field.size > in.size - in.pos){ // truncated, e.g. a write was interrupted
+            break;
+        }
+        const size_t end = in.pos + field.size;
+        // Snapshots written with rebx_output_binary don't have a time
+        double t = NAN;
+        struct rebx_binary_field time_field;
+        if (rebx_input_read_field(&in, &time_field) && time_field.type == REBX_BINARY_FIELD_TYPE_SNAPSHOT_TIME && time_field.size == sizeof(t)){
+            rebx_input_read(&in, &t, sizeof(t));
+        }
+        if (N < N_max){
+            if (times){
+                times[N] = t;
+            }
+            if (offsets){
+                offsets[N] = offset;
+            }
+        }
+        N++;
+        in.pos = end;
+    }
+    return N;
+}
+
+void rebx_init_extras_from_archive(struct rebx_extras* rebx, const char* const buf, const size_t size, const long offset, enum rebx_input_binary_messages* warnings){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return;
+    }
+    struct rebx_input_buffer in = {.data = buf, .size = buf ? size : 0, .pos = 0};
+    rebx_input_read_header(&in, warnings);
+    struct rebx_binary_field field;
+    if (offset < 64 || (size_t)offset >= in.size){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return;
+    }
+    in.pos = offset;
+    if (!rebx_input_read_field(&in, &field)){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return;
+    }
+    in.pos = offset;
+    if (field.type == REBX_BINARY_FIELD_TYPE_SNAPSHOT_DIFF){
+        rebx_load_snapshot_diff(rebx, &in, warnings);
+    }
+    else{
+        rebx_load_snapshot(rebx, &in, warnings);
     }
+}
+
+int rebx_input_open_archive_keyframe(struct rebx_extras* rebx, const char* const filename, struct rebx_archive_keyframe* keyframe){
+    *keyframe = (struct rebx_archive_keyframe){.offset = -1, .end = 64};
     enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
-    // create manually so that default registered parameters not loaded
-    struct rebx_extras* rebx = malloc(sizeof(*rebx));
-    rebx_initialize(sim, rebx);
-    rebx_init_extras_from_binary(rebx, filename, &warnings);
+    keyframe->image = rebx_input_open_image(filename, &keyframe->size, &keyframe->mapped, &warnings);
+    if (keyframe->image == NULL){
+        return 0;
+    }
+    const char* const buf = keyframe->image;
+    const size_t size = keyframe->size;
+    const int N = rebx_archive_index(buf, size, NULL, NULL, 0);
+    if (N == 0){
+        return 1;
+    }
+    long* const offsets = malloc(N*sizeof(*offsets));
+    if (offsets == NULL){
+        return 1;
+    }
+    rebx_archive_index(buf, size, NULL, offsets, N);
+    struct rebx_input_buffer in = {.data = buf, .size = size, .pos = offsets[N-1]};
+    struct rebx_binary_field field;
+    if (rebx_input_read_field(&in, &field)){
+        keyframe->end = in.pos + field.size;   // checked to be complete in rebx_archive_index
+    }
+    for (int i=N-1; i>=0 && keyframe->offset < 0; i--){
+        in.pos = offsets[i];
+        if (rebx_input_read_field(&in, &field) && field.type == REBX_BINARY_FIELD_TYPE_SNAPSHOT){
+            keyframe->offset = offsets[i];
+        }
+    }
+    free(offsets);
+    if (keyframe->offset < 0){
+        return 1;
+    }
     
+    // Find the columns. in is now just past the keyframe's SNAPSHOT field
+    int N_allocated = 0;
+    int valid = 1;
+    while (valid && rebx_input_read_field(&in, &field) && field.type != REBX_BINARY_FIELD_TYPE_END){
+        if (field.type != REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMNS){
+            rebx_input_skip(&in, field.size);
+            continue;
+        }
+        while (valid && rebx_input_read_field(&in, &field) && field.type == REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMN){
+            if (keyframe->N_columns == N_allocated){
+                N_allocated = N_allocated ? 2*N_allocated : 16;
+                struct rebx_particle_column* const columns = realloc(keyframe->columns, N_allocated*sizeof(*columns));
+                if (columns == NULL){
+                    valid = 0;
+                    break;
+                }
+                keyframe->columns = columns;
+            }
+            if (!rebx_read_particle_column(rebx, &in, &keyframe->columns[keyframe->N_columns], &warnings)){
+                valid = 0;
+                break;
+            }
+            keyframe->N_columns++;
+        }
+        break;
+    }
+    if (!valid){ // can't diff against it, so the next snapshot is written in full
+        keyframe->offset = -1;
+    }
+    return 1;
+}
+
+void rebx_input_close_archive_keyframe(struct rebx_archive_keyframe* keyframe){
+    if (keyframe->image != NULL){
+        rebx_input_close_image(keyframe->image, keyframe->size, keyframe->mapped);
+    }
+    free(keyframe->columns);
+    *keyframe = (struct rebx_archive_keyframe){.offset = -1};
+}
+
+static void rebx_input_report(struct reb_simulation* sim, enum rebx_input_binary_messages warnings){
     if (warnings & REBX_INPUT_BINARY_ERROR_NOFILE){
         reb_error(sim,"REBOUNDx: Cannot open binary file. Check filename.");
     }
@@ -701,6 +1297,65 @@ struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, c
     if (warnings & REBX_INPUT_BINARY_WARNING_FORCE_PARAM_NOT_LOADED){
         reb_warning(sim,"REBOUNDx: A force parameter failed to load from the list of REBOUNDx implemented forces. Custom forces can't be saved to a REBOUNDx binary, and function points must be reset when a simulation is reloaded.");
     }
+}
+
+struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, const char* const filename){
+    if (sim == NULL){
+        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_binary was NULL.\n");
+        return NULL;
+    }
+    enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
+    // create manually so that default registered parameters not loaded
+    struct rebx_extras* rebx = malloc(sizeof(*rebx));
+    rebx_initialize(sim, rebx);
+    rebx_init_extras_from_binary(rebx, filename, &warnings);
+    rebx_input_report(sim, warnings);
+    return rebx;
+}
+
+struct rebx_extras* rebx_create_extras_from_buffer(struct reb_simulation* sim, const char* const buf, const size_t size){
+    if (sim == NULL){
+        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_buffer was NULL.\n");
+        return NULL;
+    }
+    enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
+    // create manually so that default registered parameters not loaded
+    struct rebx_extras* rebx = malloc(sizeof(*rebx));
+    rebx_initialize(sim, rebx);
+    rebx_init_extras_from_buffer(rebx, buf, size, &warnings);
+    rebx_input_report(sim, warnings);
+    return rebx;
+}
+
+struct rebx_extras* rebx_create_extras_from_archive(struct reb_simulation* sim, const char* const filename, int snapshot){
+    if (sim == NULL){
+        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_archive was NULL.\n");
+        return NULL;
+    }
+    enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
+    // create manually so that default registered parameters not loaded
+    struct rebx_extras* rebx = malloc(sizeof(*rebx));
+    rebx_initialize(sim, rebx);
+    size_t size = 0;
+    int mapped = 0;
+    char* const buf = rebx_input_open_image(filename, &size, &mapped, &warnings);
+    if (buf != NULL){
+        const int N = rebx_archive_index(buf, size, NULL, NULL, 0);
+        long* const offsets = N > 0 ? malloc(N*sizeof(*offsets)) : NULL;
+        if (snapshot < 0){
+            snapshot += N;
+        }
+        if (offsets == NULL || snapshot < 0 || snapshot >= N){
+            reb_error(sim, "REBOUNDx: Snapshot passed to rebx_create_extras_from_archive is not in the archive.");
+        }
+        else{
+            rebx_archive_index(buf, size, NULL, offsets, N);
+            rebx_init_extras_from_archive(rebx, buf, size, offsets[snapshot], &warnings);
+        }
+        free(offsets);
+        rebx_input_close_image(buf, size, mapped);
+    }
+    rebx_input_report(sim, warnings);
     return rebx;
 }
 
@@ -711,7 +1366,9 @@ FILE* rebx_input_inspect_binary(const char* const filename, enum rebx_input_bina
         return NULL;
     }
     
-    rebx_input_read_header(inf, warnings);
+    char header[64] = {0};
+    struct rebx_input_buffer in = {.data = header, .size = fread(header, 1, sizeof(header), inf), .pos = 0};
+    rebx_input_read_header(&in, warnings);
     return inf;
 }
 
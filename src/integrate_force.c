@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
 #include "core.h"
@@ -48,7 +49,24 @@ void rebx_integrate_force(struct reb_simulation* const sim, struct rebx_operator
     switch(integrator){
         case REBX_INTEGRATOR_IMPLICIT_MIDPOINT:
         {
-            rebx_integrator_implicit_midpoint_integrate(sim, dt, force);
+            struct rebx_im_settings settings = {.tolerance = DBL_EPSILON, .max_iterations = 10, .anderson_depth = 0, .warm_start = 0};
+            const double* const tolerance = rebx_get_param(rebx, operator->ap, "im_tolerance");
+            const int* const max_iterations = rebx_get_param(rebx, operator->ap, "im_max_iterations");
+            const int* const anderson_depth = rebx_get_param(rebx, operator->ap, "im_anderson_depth");
+            const int* const warm_start = rebx_get_param(rebx, operator->ap, "im_warm_start");
+            if (tolerance != NULL){
+                settings.tolerance = *tolerance;
+            }
+            if (max_iterations != NULL){
+                settings.max_iterations = *max_iterations;
+            }
+            if (anderson_depth != NULL){
+                settings.anderson_depth = *anderson_depth;
+            }
+            if (warm_start != NULL){
+                settings.warm_start = *warm_start;
+            }
+            rebx_integrator_implicit_midpoint_integrate(sim, dt, force, &settings);
             break;
         }
         case REBX_INTEGRATOR_RK2:
@@ -61,6 +79,12 @@ void rebx_integrate_force(struct reb_simulation* const sim, struct rebx_operator
             rebx_integrator_rk4_integrate(sim, dt, force);
             break;
         }
+        case REBX_INTEGRATOR_RK45:
+        {
+            const double* const epsilon = rebx_get_param(rebx, operator->ap, "epsilon");
+            rebx_integrator_rk45_integrate(sim, dt, force, epsilon ? *epsilon : 1.e-9);
+            break;
+        }
         case REBX_INTEGRATOR_EULER:
         {
             rebx_integrator_euler_integrate(sim, dt, force);
@@ -21,104 +21,239 @@
  * You should have received a copy of the GNU General Public License
  * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
  *
+ * The end of step velocities v solve v = g(v) = v0 + dt*a((v0 + v)/2), which is iterated on until successive
+ * iterates agree to a relative tolerance (im_tolerance, default DBL_EPSILON) or im_max_iterations (default 10) is hit.
+ * By default this is a plain fixed point iteration. Setting im_anderson_depth to m > 0 mixes in the last m iterates
+ * (Anderson acceleration), which converges in far fewer force evaluations for strong dissipative forces. Setting
+ * im_warm_start starts the iteration from the velocity change of the previous call (scaled by the ratio of timesteps)
+ * rather than from zero.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <float.h>
+#include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
 
-static void avg_particles(struct reb_particle* const ps_avg, struct reb_particle* const ps1, struct reb_particle* const ps2, int N){
-    for(int i=0; i<N; i++){
-        ps_avg[i].x = 0.5*(ps1[i].x + ps2[i].x);
-        ps_avg[i].y = 0.5*(ps1[i].y + ps2[i].y);
-        ps_avg[i].z = 0.5*(ps1[i].z + ps2[i].z);
-        ps_avg[i].vx = 0.5*(ps1[i].vx + ps2[i].vx);
-        ps_avg[i].vy = 0.5*(ps1[i].vy + ps2[i].vy);
-        ps_avg[i].vz = 0.5*(ps1[i].vz + ps2[i].vz);
-        ps_avg[i].ax = 0.;
-        ps_avg[i].ay = 0.;
-        ps_avg[i].az = 0.;
-        ps_avg[i].m = 0.5*(ps1[i].m + ps2[i].m);
+#define REBX_IM_MAX_ANDERSON_DEPTH 10
+
+// Velocity change over the last call, used as the first guess by im_warm_start
+struct rebx_im_warm_start{
+    int N;
+    double dt;
+    double* dv;
+};
+
+static void rebx_im_free_warm_start(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_im_warm_start* const warm = rebx_get_param(rebx, force->ap, "im_warm_start_state");
+    if (warm){
+        free(warm->dv);
     }
+    free(warm);
 }
 
-static int compare(struct reb_particle* ps1, struct reb_particle* ps2, int N){
-    double tot2 = 0.;
-    double deltatot2 = 0.;
-    for(int i=0; i<N; i++){
-        const double dvx = ps1[i].vx - ps2[i].vx;
-        const double dvy = ps1[i].vy - ps2[i].vy;
-        const double dvz = ps1[i].vz - ps2[i].vz;
-        deltatot2 += dvx*dvx + dvy*dvy + dvz*dvz;
-        tot2 += ps1[i].vx*ps1[i].vx + ps1[i].vy*ps1[i].vy + ps1[i].vz*ps1[i].vz;
-    }
-    if (deltatot2/tot2 < DBL_EPSILON*DBL_EPSILON){
-        return 1;
+static struct rebx_im_warm_start* rebx_im_get_warm_start(struct reb_simulation* const sim, struct rebx_force* const force, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_im_warm_start* warm = rebx_get_param(rebx, force->ap, "im_warm_start_state");
+    if (warm == NULL){
+        warm = calloc(1, sizeof(*warm));
+        if (warm == NULL){
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "im_warm_start_state", warm);
+        rebx_add_free_arrays(rebx, force, rebx_im_free_warm_start);
     }
-    else{
-        return 0;
+    if (warm->N != N){
+        free(warm->dv);
+        warm->dv = malloc(3*N*sizeof(*warm->dv));
+        warm->N = warm->dv ? N : 0;
+        warm->dt = 0.;      // nothing stored yet for these particles
     }
+    return warm->dv ? warm : NULL;
 }
 
-void rebx_im_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
-    struct reb_particle* const ps_final = rebx_get_param(rebx, force->ap, "ps_final");
-    free(ps_final);
-    struct reb_particle* const ps_prev = rebx_get_param(rebx, force->ap, "ps_prev");
-    free(ps_prev);
-    struct reb_particle* const ps_avg = rebx_get_param(rebx, force->ap, "ps_avg");
-    free(ps_avg);
+static double rebx_im_dot(const double* const a, const double* const b, const int n){
+    double sum = 0.;
+    for (int l=0; l<n; l++){
+        sum += a[l]*b[l];
+    }
+    return sum;
 }
 
-static struct reb_particle* setup(struct rebx_extras* rebx, struct rebx_force* force, const int N){
-    rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_im_free_arrays);
-    struct reb_particle* const ps_final = malloc(N*sizeof(*ps_final));
-    rebx_set_param_pointer(rebx, &force->ap, "im_ps_final", ps_final);
-    struct reb_particle* const ps_prev = malloc(N*sizeof(*ps_prev));
-    rebx_set_param_pointer(rebx, &force->ap, "im_ps_prev", ps_prev);
-    struct reb_particle* const ps_avg = malloc(N*sizeof(*ps_avg));
-    rebx_set_param_pointer(rebx, &force->ap, "im_ps_avg", ps_avg);
-    
-    return ps_final;
+// Solves the m x m system A gamma = b in place by Gaussian elimination with partial pivoting. Returns 0 if singular.
+static int rebx_im_solve(double A[REBX_IM_MAX_ANDERSON_DEPTH][REBX_IM_MAX_ANDERSON_DEPTH], double* const b, const int m){
+    for (int c=0; c<m; c++){
+        int pivot = c;
+        for (int r=c+1; r<m; r++){
+            if (fabs(A[r][c]) > fabs(A[pivot][c])){
+                pivot = r;
+            }
+        }
+        if (A[pivot][c] == 0.){
+            return 0;
+        }
+        for (int k=0; k<m; k++){
+            const double tmp = A[c][k];
+            A[c][k] = A[pivot][k];
+            A[pivot][k] = tmp;
+        }
+        const double tmp = b[c];
+        b[c] = b[pivot];
+        b[pivot] = tmp;
+        for (int r=c+1; r<m; r++){
+            const double factor = A[r][c]/A[c][c];
+            for (int k=c; k<m; k++){
+                A[r][k] -= factor*A[c][k];
+            }
+            b[r] -= factor*b[c];
+        }
+    }
+    for (int c=m-1; c>=0; c--){
+        for (int k=c+1; k<m; k++){
+            b[c] -= A[c][k]*b[k];
+        }
+        b[c] /= A[c][c];
+    }
+    return 1;
 }
 
-void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force){
-    struct rebx_extras* rebx = sim->extras;
+void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force, const struct rebx_im_settings* const settings){
     const int N = sim->N - sim->N_var;
-    struct reb_particle* ps_final = rebx_get_param(rebx, force->ap, "im_ps_final");
-    if (ps_final == NULL){
-        ps_final = setup(rebx, force, N);
+    const int n = 3*N;
+    int depth = settings->anderson_depth;
+    depth = depth < 0 ? 0 : (depth > REBX_IM_MAX_ANDERSON_DEPTH ? REBX_IM_MAX_ANDERSON_DEPTH : depth);
+    // x, g, and for Anderson the previous x and g and the last depth differences of f = g - x and of g
+    struct rebx_integrator_workspace* const ws = rebx_get_integrator_workspace(sim, force, N, depth ? 4 + 2*depth : 2);
+    if (ws == NULL){
+        return;
     }
-    // These should not fail since we check above and setup if not there
-    struct reb_particle* const ps_prev = rebx_get_param(rebx, force->ap, "im_ps_prev");
-    struct reb_particle* const ps_avg = rebx_get_param(rebx, force->ap, "im_ps_avg");
+    // Positions and masses don't change, so only the velocities of the midpoint (ps_avg) are updated between force evaluations
     struct reb_particle* const ps_orig = sim->particles;
-    memcpy(ps_final, sim->particles, N*sizeof(*ps_final));
-    memcpy(ps_avg, sim->particles, N*sizeof(*ps_orig));
-    int n, converged;
-    for(n=0;n<10;n++){
-        memcpy(ps_prev, ps_final, N*sizeof(*ps_prev));
+    struct reb_particle* const ps_avg = ws->stage;
+    double* x = ws->vectors;            // current guess for the end of step velocities
+    double* g = ws->vectors + n;        // g(x)
+    double* const x_prev = ws->vectors + 2*n;
+    double* const g_prev = ws->vectors + 3*n;
+    double* const dF = ws->vectors + 4*n;
+    double* const dG = ws->vectors + (4 + depth)*n;
+    int N_history = 0;                  // differences stored in dF, dG, used as a ring buffer
+    int next = 0;
+
+    memcpy(ps_avg, ps_orig, N*sizeof(*ps_avg));
+    struct rebx_im_warm_start* const warm = settings->warm_start ? rebx_im_get_warm_start(sim, force, N) : NULL;
+    const int warm_started = warm != NULL && warm->dt != 0.;
+    for(int i=0; i<N; i++){
+        x[3*i] = ps_orig[i].vx;
+        x[3*i+1] = ps_orig[i].vy;
+        x[3*i+2] = ps_orig[i].vz;
+    }
+    if (warm_started){
+        const double scale = dt/warm->dt;
+        for(int l=0; l<n; l++){
+            x[l] += scale*warm->dv[l];
+        }
+        for(int i=0; i<N; i++){
+            ps_avg[i].vx = 0.5*(ps_orig[i].vx + x[3*i]);
+            ps_avg[i].vy = 0.5*(ps_orig[i].vy + x[3*i+1]);
+            ps_avg[i].vz = 0.5*(ps_orig[i].vz + x[3*i+2]);
+        }
+    }
+
+    const double tolerance2 = settings->tolerance*settings->tolerance;
+    const int max_iterations = settings->max_iterations > 0 ? settings->max_iterations : 1;
+    int iter;
+    for(iter=0; iter<max_iterations; iter++){
         force->update_accelerations(sim, force, ps_avg, N);
+        double tot2 = 0.;
+        double deltatot2 = 0.;
         for(int i=0; i<N; i++){
-            ps_final[i].vx = ps_orig[i].vx + dt*ps_avg[i].ax;
-            ps_final[i].vy = ps_orig[i].vy + dt*ps_avg[i].ay;
-            ps_final[i].vz = ps_orig[i].vz + dt*ps_avg[i].az;
+            g[3*i] = ps_orig[i].vx + dt*ps_avg[i].ax;
+            g[3*i+1] = ps_orig[i].vy + dt*ps_avg[i].ay;
+            g[3*i+2] = ps_orig[i].vz + dt*ps_avg[i].az;
+            const double dvx = g[3*i] - x[3*i];
+            const double dvy = g[3*i+1] - x[3*i+1];
+            const double dvz = g[3*i+2] - x[3*i+2];
+            deltatot2 += dvx*dvx + dvy*dvy + dvz*dvz;
+            tot2 += g[3*i]*g[3*i] + g[3*i+1]*g[3*i+1] + g[3*i+2]*g[3*i+2];
         }
-        converged = compare(ps_final, ps_prev, N);
-        if (converged){
+        if (deltatot2/tot2 < tolerance2){
             break;
         }
-        avg_particles(ps_avg, ps_orig, ps_final, N);
+        if (depth == 0){
+            double* const tmp = x;      // plain fixed point iteration, x = g
+            x = g;
+            g = tmp;
+        }
+        else{
+            if (iter > 0){
+                double* const dFk = dF + next*n;
+                double* const dGk = dG + next*n;
+                for(int l=0; l<n; l++){
+                    dFk[l] = (g[l] - x[l]) - (g_prev[l] - x_prev[l]);
+                    dGk[l] = g[l] - g_prev[l];
+                }
+                next = (next + 1) % depth;
+                N_history = N_history < depth ? N_history + 1 : depth;
+            }
+            memcpy(x_prev, x, n*sizeof(*x));
+            memcpy(g_prev, g, n*sizeof(*g));
+            // x = g - dG gamma, with gamma minimizing |f - dF gamma|
+            double A[REBX_IM_MAX_ANDERSON_DEPTH][REBX_IM_MAX_ANDERSON_DEPTH];
+            double gamma[REBX_IM_MAX_ANDERSON_DEPTH];
+            for (int j=0; j<N_history; j++){
+                double fj = 0.;
+                for(int l=0; l<n; l++){
+                    fj += dF[j*n + l]*(g[l] - x[l]);
+                }
+                gamma[j] = fj;
+                for (int k=0; k<=j; k++){
+                    A[j][k] = A[k][j] = rebx_im_dot(dF + j*n, dF + k*n, n);
+                }
+            }
+            const int solved = N_history > 0 && rebx_im_solve(A, gamma, N_history);
+            memcpy(x, g, n*sizeof(*x));
+            if (solved){
+                for (int j=0; j<N_history; j++){
+                    for(int l=0; l<n; l++){
+                        x[l] -= gamma[j]*dG[j*n + l];
+                    }
+                }
+            }
+            else{
+                N_history = 0;          // degenerate history, restart from a plain step
+                next = 0;
+            }
+        }
+        for(int i=0; i<N; i++){
+            ps_avg[i].vx = 0.5*(ps_orig[i].vx + x[3*i]);
+            ps_avg[i].vy = 0.5*(ps_orig[i].vy + x[3*i+1]);
+            ps_avg[i].vz = 0.5*(ps_orig[i].vz + x[3*i+2]);
+            ps_avg[i].ax = 0.;
+            ps_avg[i].ay = 0.;
+            ps_avg[i].az = 0.;
+        }
     }
-    const int default_max_iterations = 10;
-    if(n==default_max_iterations){
-        reb_warning(sim, "REBOUNDx: 10 iterations in integrator_implicit_midpoint.c failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+    if(iter==max_iterations){
+        char str[300];
+        sprintf(str, "REBOUNDx: %d iterations in integrator_implicit_midpoint.c failed to converge. This is typically because the perturbation is too strong for the current implementation.", max_iterations);
+        reb_warning(sim, str);
+    }
+    // g holds the last evaluation, which is the result of the plain iteration when it stops
+    double* const v_final = (depth == 0 && iter == max_iterations) ? x : g;
+    if (warm != NULL){
+        warm->dt = dt;
+        for(int i=0; i<N; i++){
+            warm->dv[3*i] = v_final[3*i] - ps_orig[i].vx;
+            warm->dv[3*i+1] = v_final[3*i+1] - ps_orig[i].vy;
+            warm->dv[3*i+2] = v_final[3*i+2] - ps_orig[i].vz;
+        }
     }
     for(int i=0; i<N; i++){
-        sim->particles[i].vx = ps_final[i].vx;
-        sim->particles[i].vy = ps_final[i].vy;
-        sim->particles[i].vz = ps_final[i].vz;
+        sim->particles[i].vx = v_final[3*i];
+        sim->particles[i].vy = v_final[3*i+1];
+        sim->particles[i].vz = v_final[3*i+2];
     }
 }
@@ -30,29 +30,22 @@
 #include "reboundx.h"
 #include "core.h"
 
-void rebx_rk2_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
-    struct reb_particle* const k2 = rebx_get_param(rebx, force->ap, "rk2_k2");
-    free(k2);
-}
-
 void rebx_integrator_rk2_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force){
-    struct rebx_extras* rebx = sim->extras;
     const int N = sim->N - sim->N_var;
-    struct reb_particle* k2 = rebx_get_param(rebx, force->ap, "rk2_k2");
-    if (k2 == NULL){
-        k2 = malloc(N*sizeof(*k2));
-        rebx_set_param_pointer(rebx, &force->ap, "rk2_k2", k2);
-        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_rk2_free_arrays);
-        
+    struct rebx_integrator_workspace* const ws = rebx_get_integrator_workspace(sim, force, N, 0);
+    if (ws == NULL){
+        return;
     }
-    memcpy(k2, sim->particles, N*sizeof(*k2));
+    struct reb_particle* const ps = sim->particles;
+    struct reb_particle* const k2 = ws->stage;
+    memcpy(k2, ps, N*sizeof(*k2));
 
-    force->update_accelerations(sim, force, sim->particles, N);
+    force->update_accelerations(sim, force, ps, N);
     const double a21 = 2.*dt/3.;
     for(int i=0; i<N; i++){
-        k2[i].vx = sim->particles[i].vx + a21*sim->particles[i].ax;
-        k2[i].vy = sim->particles[i].vy + a21*sim->particles[i].ay;
-        k2[i].vz = sim->particles[i].vz + a21*sim->particles[i].az;
+        k2[i].vx = ps[i].vx + a21*ps[i].ax;
+        k2[i].vy = ps[i].vy + a21*ps[i].ay;
+        k2[i].vz = ps[i].vz + a21*ps[i].az;
     }
 
     force->update_accelerations(sim, force, k2, N);
@@ -60,8 +53,8 @@ void rebx_integrator_rk2_integrate(struct reb_simulation* const sim, const doubl
     const double b1 = dt/4.;
     const double b2 = 3.*dt/4.;
     for(int i=0; i<N; i++){
-        sim->particles[i].vx += b1*sim->particles[i].ax + b2*k2[i].ax;
-        sim->particles[i].vy += b1*sim->particles[i].ay + b2*k2[i].ay;
-        sim->particles[i].vz += b1*sim->particles[i].az + b2*k2[i].az;
+        ps[i].vx += b1*ps[i].ax + b2*k2[i].ax;
+        ps[i].vy += b1*ps[i].ay + b2*k2[i].ay;
+        ps[i].vz += b1*ps[i].az + b2*k2[i].az;
     }
 }
@@ -30,62 +30,54 @@
 #include "reboundx.h"
 #include "core.h"
 
-void rebx_rk4_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
-    struct reb_particle* const k2 = rebx_get_param(rebx, force->ap, "rk4_k2");
-    free(k2);
-    struct reb_particle* const k3 = rebx_get_param(rebx, force->ap, "rk4_k3");
-    free(k3);
-}
-
 void rebx_integrator_rk4_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force){
-    struct rebx_extras* rebx = sim->extras;
     const int N = sim->N - sim->N_var;
     rebx_reset_accelerations(sim->particles, N);
-    struct reb_particle* k2 = rebx_get_param(rebx, force->ap, "rk4_k2");
-    if (k2 == NULL){
-        k2 = malloc(N*sizeof(*k2));
-        struct reb_particle* k3 = malloc(N*sizeof(*k3));
-        rebx_set_param_pointer(rebx, &force->ap, "rk4_k2", k2);
-        rebx_set_param_pointer(rebx, &force->ap, "rk4_k3", k3);
-        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_rk4_free_arrays);
-        
+    struct rebx_integrator_workspace* const ws = rebx_get_integrator_workspace(sim, force, N, 1);
+    if (ws == NULL){
+        return;
     }
-    struct reb_particle* k3 = rebx_get_param(rebx, force->ap, "rk4_k3");
-    memcpy(k2, sim->particles, N*sizeof(*k2));
-    memcpy(k3, sim->particles, N*sizeof(*k3));
+    struct reb_particle* const ps = sim->particles;
+    struct reb_particle* const stage = ws->stage;
+    double* const a23 = ws->vectors;    // k2, then k2+k3
+    memcpy(stage, ps, N*sizeof(*stage));
     
     const double dt2 = dt/2.;
-    force->update_accelerations(sim, force, sim->particles, N);  // k1 = sim.particles.a
+    force->update_accelerations(sim, force, ps, N);  // k1 = sim.particles.a
     
     for(int i=0; i<N; i++){
-        k2[i].vx = sim->particles[i].vx + dt2*sim->particles[i].ax;
-        k2[i].vy = sim->particles[i].vy + dt2*sim->particles[i].ay;
-        k2[i].vz = sim->particles[i].vz + dt2*sim->particles[i].az;
+        stage[i].vx = ps[i].vx + dt2*ps[i].ax;
+        stage[i].vy = ps[i].vy + dt2*ps[i].ay;
+        stage[i].vz = ps[i].vz + dt2*ps[i].az;
     }
-    force->update_accelerations(sim, force, k2, N);
+    force->update_accelerations(sim, force, stage, N);
     
     for(int i=0; i<N; i++){
-        k3[i].vx = sim->particles[i].vx + dt2*k2[i].ax;
-        k3[i].vy = sim->particles[i].vy + dt2*k2[i].ay;
-        k3[i].vz = sim->particles[i].vz + dt2*k2[i].az;
+        a23[3*i] = stage[i].ax;
+        a23[3*i+1] = stage[i].ay;
+        a23[3*i+2] = stage[i].az;
+        stage[i].vx = ps[i].vx + dt2*stage[i].ax;
+        stage[i].vy = ps[i].vy + dt2*stage[i].ay;
+        stage[i].vz = ps[i].vz + dt2*stage[i].az;
     }
-    force->update_accelerations(sim, force, k3, N);
+    rebx_reset_accelerations(stage, N);
+    force->update_accelerations(sim, force, stage, N);
     
-    for(int i=0; i<N; i++){     // store k2+k3 in k3 and reuse k2 for k4 to avoid a memcpy
-        k2[i].vx = sim->particles[i].vx + dt*k3[i].ax;
-        k2[i].vy = sim->particles[i].vy + dt*k3[i].ay;
-        k2[i].vz = sim->particles[i].vz + dt*k3[i].az;
-        k3[i].ax += k2[i].ax;
-        k3[i].ay += k2[i].ay;
-        k3[i].az += k2[i].az;
+    for(int i=0; i<N; i++){
+        stage[i].vx = ps[i].vx + dt*stage[i].ax;
+        stage[i].vy = ps[i].vy + dt*stage[i].ay;
+        stage[i].vz = ps[i].vz + dt*stage[i].az;
+        a23[3*i] = stage[i].ax + a23[3*i];
+        a23[3*i+1] = stage[i].ay + a23[3*i+1];
+        a23[3*i+2] = stage[i].az + a23[3*i+2];
     }
-    rebx_reset_accelerations(k2, N);
-    force->update_accelerations(sim, force, k2, N);
+    rebx_reset_accelerations(stage, N);
+    force->update_accelerations(sim, force, stage, N);     // k4
     
     const double dt6 = dt/6.;
     for(int i=0; i<N; i++){
-        sim->particles[i].vx += dt6*(sim->particles[i].ax + k2[i].ax + 2.*k3[i].ax);
-        sim->particles[i].vy += dt6*(sim->particles[i].ay + k2[i].ay + 2.*k3[i].ay);
-        sim->particles[i].vz += dt6*(sim->particles[i].az + k2[i].az + 2.*k3[i].az);
+        ps[i].vx += dt6*(ps[i].ax + stage[i].ax + 2.*a23[3*i]);
+        ps[i].vy += dt6*(ps[i].ay + stage[i].ay + 2.*a23[3*i+1]);
+        ps[i].vz += dt6*(ps[i].az + stage[i].az + 2.*a23[3*i+2]);
     }
 }
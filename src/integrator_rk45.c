@@ -0,0 +1,217 @@
+/**
+ * @file    integrator_rk45.c
+ * @brief   Adaptive embedded Runge Kutta method (Dormand-Prince 5(4))
+ * @author  Dan Tamayo <tamayo.daniel@gmail.com>, Hanno Rein
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Dan Tamayo, Hanno Rein
+ *
+ * This file is part of reboundx.
+ *
+ * reboundx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * reboundx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Like the fixed step integrators, this advances the velocities across the operator step with the positions held fixed.
+ * The step is split into substeps whose size is set by the difference between the embedded 5th and 4th order solutions,
+ * measured relative to each particle's speed, so that it stays below epsilon. The speed is floored at the velocity change
+ * the largest stage acceleration gives over the whole operator step, so particles at or near rest are measured against
+ * the change the force makes rather than a vanishing speed. The last accepted substep is kept on the
+ * force and used as the first guess for the next operator step, and the last stage of an accepted substep is reused
+ * as the first stage of the next one (FSAL). The guess is stored in the force's rk45_dt_last parameter, so it is saved
+ * in binaries and restarted simulations reproduce uninterrupted ones. If epsilon is not met within REBX_RK45_MAX_SUBSTEPS
+ * substeps, a warning is issued and the rest of the operator step is completed with fixed substeps.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "rebound.h"
+#include "reboundx.h"
+#include "core.h"
+
+#define REBX_RK45_SAFETY 0.9
+#define REBX_RK45_MIN_FACTOR 0.2
+#define REBX_RK45_MAX_FACTOR 5.
+#define REBX_RK45_MAX_SUBSTEPS 100000
+
+// Dormand & Prince (1980) coefficients. The 5th order weights are the last row of a, and e are 5th minus 4th order weights.
+static const double rebx_rk45_a[7][6] = {
+    {0.},
+    {1./5.},
+    {3./40., 9./40.},
+    {44./45., -56./15., 32./9.},
+    {19372./6561., -25360./2187., 64448./6561., -212./729.},
+    {9017./3168., -355./33., 46732./5247., 49./176., -5103./18656.},
+    {35./384., 0., 500./1113., 125./192., -2187./6784., 11./84.},
+};
+static const double rebx_rk45_e[7] = {71./57600., 0., -71./16695., 71./1920., -17253./339200., 22./525., -1./40.};
+
+struct rebx_rk45_buffers{
+    struct reb_particle* stage;     // particles with the velocities of the current stage
+    double* k[7];                   // stage accelerations
+    double* v0;                     // velocities at the start of the substep
+};
+
+// Accelerations of the stage particles with velocities v0 + h*sum_j a[s][j]*k[j], stored in k[s]
+static void rebx_rk45_stage(struct reb_simulation* const sim, struct rebx_force* const force, struct rebx_rk45_buffers* const ws, const int N, const int s, const double h){
+    struct reb_particle* const stage = ws->stage;
+    for (int l=0; l<3*N; l++){
+        double dv = 0.;
+        for (int j=0; j<s; j++){
+            dv += rebx_rk45_a[s][j]*ws->k[j][l];
+        }
+        ws->k[s][l] = ws->v0[l] + h*dv;   // stage velocity for now
+    }
+    for (int i=0; i<N; i++){
+        stage[i].vx = ws->k[s][3*i];
+        stage[i].vy = ws->k[s][3*i+1];
+        stage[i].vz = ws->k[s][3*i+2];
+    }
+    rebx_reset_accelerations(stage, N);
+    force->update_accelerations(sim, force, stage, N);
+    for (int i=0; i<N; i++){
+        ws->k[s][3*i] = stage[i].ax;
+        ws->k[s][3*i+1] = stage[i].ay;
+        ws->k[s][3*i+2] = stage[i].az;
+    }
+}
+
+void rebx_integrator_rk45_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force, const double epsilon){
+    const int N = sim->N - sim->N_var;
+    struct rebx_integrator_workspace* const workspace = rebx_get_integrator_workspace(sim, force, N, 8);
+    if (workspace == NULL || dt == 0.){
+        return;
+    }
+    struct rebx_rk45_buffers buffers = {.stage = workspace->stage, .v0 = workspace->vectors + 3*N*7};
+    for (int s=0; s<7; s++){
+        buffers.k[s] = workspace->vectors + 3*N*s;
+    }
+    struct rebx_rk45_buffers* const ws = &buffers;
+    struct rebx_extras* const rebx = sim->extras;
+    double* const dt_last = rebx_get_param(rebx, force->ap, "rk45_dt_last");
+    struct reb_particle* const particles = sim->particles;
+    memcpy(ws->stage, particles, N*sizeof(*ws->stage));
+    for (int i=0; i<N; i++){
+        ws->v0[3*i] = particles[i].vx;
+        ws->v0[3*i+1] = particles[i].vy;
+        ws->v0[3*i+2] = particles[i].vz;
+    }
+
+    double h = (dt_last != NULL && *dt_last != 0. && fabs(*dt_last) < fabs(dt)) ? copysign(*dt_last, dt) : dt;
+    double h_next = 0.;
+    double t = 0.;                  // time done within the operator step
+    rebx_rk45_stage(sim, force, ws, N, 0, h);
+    int N_substeps = 0;
+    int fixed = 0;                  // set once the substep limit is reached, see below
+    while (fabs(t) < fabs(dt)){
+        const int last = fabs(t + h) >= fabs(dt);
+        const int truncated = last && fabs(t + h) > fabs(dt);
+        if (last){
+            h = dt - t;
+        }
+        for (int s=1; s<7; s++){
+            rebx_rk45_stage(sim, force, ws, N, s, h);
+        }
+
+        // New velocities (5th order, same as the last stage) and the error estimate relative to each particle's speed
+        double err = 0.;
+        double vmax2 = 0.;
+        for (int i=0; i<N; i++){
+            const double* const v0 = &ws->v0[3*i];
+            const double v02 = v0[0]*v0[0] + v0[1]*v0[1] + v0[2]*v0[2];
+            vmax2 = v02 > vmax2 ? v02 : vmax2;
+        }
+        double amax2 = 0.;          // largest squared stage acceleration, for the absolute floor of the scale
+        for (int s=0; s<7; s++){
+            for (int i=0; i<N; i++){
+                const double* const k = &ws->k[s][3*i];
+                const double a2 = k[0]*k[0] + k[1]*k[1] + k[2]*k[2];
+                amax2 = a2 > amax2 ? a2 : amax2;
+            }
+        }
+        const double floor2 = dt*dt*amax2;  // nonzero whenever e2 is, since the error is a sum of stage accelerations
+        for (int i=0; i<N; i++){
+            double e2 = 0.;
+            double v2 = 0.;
+            for (int c=0; c<3; c++){
+                const int l = 3*i+c;
+                double dv = 0.;
+                for (int s=0; s<6; s++){
+                    dv += rebx_rk45_a[6][s]*ws->k[s][l];
+                }
+                double ev = 0.;
+                for (int s=0; s<7; s++){
+                    ev += rebx_rk45_e[s]*ws->k[s][l];
+                }
+                const double v = ws->v0[l] + h*dv;
+                v2 += v*v > ws->v0[l]*ws->v0[l] ? v*v : ws->v0[l]*ws->v0[l];
+                e2 += h*ev*h*ev;
+            }
+            double scale2 = v2 > 0. ? v2 : vmax2;
+            scale2 = scale2 > floor2 ? scale2 : floor2;
+            if (e2 > 0.){
+                const double ratio = sqrt(e2/scale2)/epsilon;
+                err = ratio > err ? ratio : err;
+            }
+        }
+
+        N_substeps++;
+        const int give_up = !fixed && N_substeps >= REBX_RK45_MAX_SUBSTEPS;
+        const int accepted = err <= 1. || fixed || give_up;
+        if (accepted){
+            for (int l=0; l<3*N; l++){
+                double dv = 0.;
+                for (int s=0; s<6; s++){
+                    dv += rebx_rk45_a[6][s]*ws->k[s][l];
+                }
+                ws->v0[l] += h*dv;
+            }
+            t = last ? dt : t + h;
+            memcpy(ws->k[0], ws->k[6], 3*N*sizeof(*ws->k[0]));   // FSAL: last stage is the first of the next substep
+        }
+        // Past the substep limit there is no error control, but the rest of the operator step is still covered in substeps
+        // of the last accepted size, with at most REBX_RK45_MAX_SUBSTEPS more of them, so the operator always advances by dt
+        if (give_up){
+            fixed = 1;
+            if (fabs(h) < fabs(dt - t)/REBX_RK45_MAX_SUBSTEPS){
+                h = (dt - t)/REBX_RK45_MAX_SUBSTEPS;
+            }
+            if (fabs(t) < fabs(dt)){
+                char str[300];
+                snprintf(str, sizeof(str), "REBOUNDx: rk45 reached the maximum number of substeps without meeting epsilon. The remaining %g of the operator step is integrated with fixed substeps of %g.", dt - t, h);
+                reb_warning(sim, str);
+            }
+        }
+        if (fixed){
+            continue;
+        }
+        const double factor = err > 0. ? REBX_RK45_SAFETY*pow(err, -0.2) : REBX_RK45_MAX_FACTOR;
+        h *= factor < REBX_RK45_MIN_FACTOR ? REBX_RK45_MIN_FACTOR : (factor > REBX_RK45_MAX_FACTOR ? REBX_RK45_MAX_FACTOR : factor);
+        if (accepted && !truncated){
+            h_next = h;         // a final substep cut short to land on dt shouldn't shrink the first guess of the next call
+        }
+    }
+    if (h_next != 0. && dt_last != NULL){
+        *dt_last = h_next;
+    }
+    else if (h_next != 0.){
+        rebx_set_param_double(rebx, &force->ap, "rk45_dt_last", h_next);
+    }
+
+    for (int i=0; i<N; i++){
+        particles[i].vx = ws->v0[3*i];
+        particles[i].vy = ws->v0[3*i+1];
+        particles[i].vz = ws->v0[3*i+2];
+    }
+}
@@ -37,10 +37,24 @@
  * 
  * This adds exponential mass growth/loss to individual particles every timestep.
  * Set particles' ``tau_mass`` parameter to a negative value for mass loss, positive for mass growth.
+ * By default masses are advanced to first order in the timestep, m += m*dt/tau_mass. Set ``exact_mass_update`` to use
+ * the exact exponential m *= exp(dt/tau_mass), which stays accurate for timesteps that are not small compared to tau_mass.
+ *
+ * By default the simulation is moved to its center of mass frame after every step, which also removes any COM drift from
+ * other (e.g. non-conservative) effects. Setting ``incremental_com`` instead recentres fully only the first time the
+ * operator runs. After that, the center of mass shift caused by a step's mass changes is computed from the particles
+ * with ``tau_mass`` alone, with the total mass kept up to date from the same changes, and removed from all particles.
+ * A full recentring is done again if particles are added or removed, or with variational particles. COM drift from
+ * other effects, or masses changed outside this operator, are then no longer corrected every step.
  * 
  * **Effect Parameters**
  * 
- * *None*
+ * ============================ =========== =======================================================
+ * Name (C type)                Required    Description
+ * ============================ =========== =======================================================
+ * exact_mass_update (int)      No          If nonzero, use the exact exponential mass update (default 0)
+ * incremental_com (int)        No          If nonzero, only remove the COM shift caused by the mass changes after the first step (default 0)
+ * ============================ =========== =======================================================
  * 
  * **Particle Parameters**
  * 
@@ -59,16 +73,70 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
 
 void rebx_modify_mass(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
+    struct rebx_extras* const rebx = sim->extras;
+    struct reb_particle* const ps = sim->particles;
     const int _N_real = sim->N - sim->N_var;
-	for(int i=0; i<_N_real; i++){
-		struct reb_particle* const p = &sim->particles[i];
-        const double* const tau_mass = rebx_get_param(sim->extras, p->ap, "tau_mass");
-        if (tau_mass != NULL){
-		    p->m += p->m*dt/(*tau_mass);
+    const int tau_key = rebx_get_param_key(rebx, "tau_mass");
+    const struct rebx_particle_list* const changing = rebx_get_particle_list(rebx, tau_key, ps, _N_real);
+    const int* const exact = rebx_get_param(rebx, operator->ap, "exact_mass_update");
+    const int exponential = exact != NULL && *exact != 0;
+
+    // Mass-weighted position and velocity of the mass changes
+    double dm = 0., dmx = 0., dmy = 0., dmz = 0., dmvx = 0., dmvy = 0., dmvz = 0.;
+    for (int k=0; k<changing->N_indices; k++){
+        struct reb_particle* const p = &ps[changing->indices[k]];
+        const double* const tau_mass = rebx_get_param_by_key(rebx, p->ap, tau_key);
+        const double m = exponential ? p->m*exp(dt/(*tau_mass)) : p->m + p->m*dt/(*tau_mass);
+        const double delta = m - p->m;
+        p->m = m;
+        dm += delta;
+        dmx += delta*p->x;
+        dmy += delta*p->y;
+        dmz += delta*p->z;
+        dmvx += delta*p->vx;
+        dmvy += delta*p->vy;
+        dmvz += delta*p->vz;
+    }
+
+    const int* const incremental = rebx_get_param(rebx, operator->ap, "incremental_com");
+    const int* const recentered_N = rebx_get_param(rebx, operator->ap, "recentered_N");
+    double* const M = rebx_get_param(rebx, operator->ap, "recentered_mass");
+    if (incremental == NULL || *incremental == 0){
+        reb_move_to_com(sim);
+        return;
+    }
+    if (recentered_N == NULL || *recentered_N != _N_real || M == NULL || sim->N_var > 0){
+        reb_move_to_com(sim);
+        double M_tot = 0.;
+        for (int i=0; i<_N_real; i++){
+            M_tot += ps[i].m;
         }
-	}
-    reb_move_to_com(sim);
+        rebx_set_param_int(rebx, &operator->ap, "recentered_N", _N_real);
+        rebx_set_param_double(rebx, &operator->ap, "recentered_mass", M_tot);
+        return;
+    }
+    if (changing->N_indices == 0){
+        return;
+    }
+    
+    // The last recentring left the COM at rest at the origin, so the new COM is just the changes' share
+    *M += dm;
+    if (*M <= 0.){
+        return;
+    }
+    // Every particle still has to be shifted: the integrators and outputs work with the particles' own coordinates,
+    // so the new frame can't be deferred to an offset. Only the sums are limited to the changing particles.
+    const double x = dmx/(*M), y = dmy/(*M), z = dmz/(*M);
+    const double vx = dmvx/(*M), vy = dmvy/(*M), vz = dmvz/(*M);
+    for (int i=0; i<_N_real; i++){
+        ps[i].x -= x;
+        ps[i].y -= y;
+        ps[i].z -= z;
+        ps[i].vx -= vx;
+        ps[i].vy -= vy;
+        ps[i].vz -= vz;
+    }
 }
-
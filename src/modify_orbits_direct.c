@@ -53,8 +53,15 @@
  *                                          eccentricity evolution at constant angular momentum.
  * coordinates (enum)           No          Type of elements to use for modification (Jacobi, barycentric or particle).
  *                                          See the examples for usage.
+ * batched (int)                No          If nonzero, convert all particles to and from orbital elements in vectorized
+ *                                          batches (default 0). See below.
  * ============================ =========== ==================================================================
  *
+ * By default particles are modified one at a time, each seeing the back reactions of the ones before it. With `batched`
+ * set, every particle's elements are instead taken relative to its primary at the start of the step, and the back
+ * reactions are applied together at the end.  The two differ by terms of order the particle-to-primary mass ratio times
+ * the change in the elements over one step, and batching is much faster for large swarms of particles. Particles whose conversion fails either way are left unchanged.
+ *
  * **Particle Parameters**
  *
  * One can pick and choose which particles have which parameters set.  
@@ -77,6 +84,8 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
+#include "core.h"
 
 static struct reb_particle rebx_calculate_modify_orbits_direct(struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* primary, const double dt){
     struct rebx_extras* const rebx = sim->extras;
@@ -120,12 +129,246 @@ static struct reb_particle rebx_calculate_modify_orbits_direct(struct reb_simula
     return reb_tools_orbit_to_particle(sim->G, *primary, p->m, o.a, o.e, o.inc, o.Omega, o.omega, o.f);
 }
 
+// Per-lane arrays for the batched path, kept on the operator between steps
+struct rebx_mod_direct_workspace{
+    int N_allocated;
+    double* memory;
+    int* index;
+    int* err;
+    double* m;
+    double* m_primary;
+    double* massratio;
+    struct reb_particle* primary;
+    struct rebx_state_batch states;
+    struct rebx_orbit_batch orbits;
+};
+
+static void rebx_mod_direct_free_arrays(struct rebx_extras* rebx, struct rebx_operator* operator){
+    struct rebx_mod_direct_workspace* const ws = rebx_get_param(rebx, operator->ap, "modify_orbits_direct_workspace");
+    if (ws){
+        free(ws->memory);
+        free(ws->index);
+        free(ws->err);
+        free(ws->primary);
+    }
+    free(ws);
+}
+
+static struct rebx_mod_direct_workspace* rebx_mod_direct_get_workspace(struct reb_simulation* const sim, struct rebx_operator* const operator, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_mod_direct_workspace* ws = rebx_get_param(rebx, operator->ap, "modify_orbits_direct_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for modify_orbits_direct workspace.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &operator->ap, "modify_orbits_direct_workspace", ws);
+        rebx_add_operator_free_arrays(rebx, operator, rebx_mod_direct_free_arrays);
+    }
+    if (ws->N_allocated < N){
+        free(ws->memory);
+        free(ws->index);
+        free(ws->err);
+        free(ws->primary);
+        ws->memory = malloc(15*N*sizeof(*ws->memory));
+        ws->index = malloc(N*sizeof(*ws->index));
+        ws->err = malloc(2*N*sizeof(*ws->err));
+        ws->primary = malloc(N*sizeof(*ws->primary));
+        if (ws->memory == NULL || ws->index == NULL || ws->err == NULL || ws->primary == NULL){
+            free(ws->memory);
+            free(ws->index);
+            free(ws->err);
+            free(ws->primary);
+            *ws = (struct rebx_mod_direct_workspace){0};
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for modify_orbits_direct workspace.\n");
+            return NULL;
+        }
+        double* const mem = ws->memory;
+        ws->m = mem;
+        ws->m_primary = mem + N;
+        ws->massratio = mem + 2*N;
+        ws->states = (struct rebx_state_batch){mem + 3*N, mem + 4*N, mem + 5*N, mem + 6*N, mem + 7*N, mem + 8*N};
+        ws->orbits = (struct rebx_orbit_batch){mem + 9*N, mem + 10*N, mem + 11*N, mem + 12*N, mem + 13*N, mem + 14*N};
+        ws->N_allocated = N;
+    }
+    return ws;
+}
+
+static void rebx_mod_direct_shift(struct reb_particle* const p, const double* const d){
+    p->x -= d[0];
+    p->y -= d[1];
+    p->z -= d[2];
+    p->vx -= d[3];
+    p->vy -= d[4];
+    p->vz -= d[5];
+}
+
+static void rebx_modify_orbits_direct_batched(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const double dt){
+    struct rebx_extras* const rebx = sim->extras;
+    struct reb_particle* const particles = sim->particles;
+    const int N_real = sim->N - sim->N_var;
+    struct rebx_mod_direct_workspace* const ws = rebx_mod_direct_get_workspace(sim, operator, N_real);
+    if (ws == NULL){
+        return;
+    }
+
+    // Primaries from the state at the start of the step, in the same order and with the same mass ratios as rebxtools_com_ptm
+    struct reb_particle com = reb_get_com(sim);
+    int refindex = -1;
+    if (coordinates == REBX_COORDINATES_JACOBI){
+        refindex = 0;
+    }
+    else if (coordinates == REBX_COORDINATES_PARTICLE){
+        const struct rebx_particle_list* const references = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "primary"), particles, N_real);
+        if (references->N_indices == 0){
+            if (N_real > 0){
+                reb_error(sim, "Coordinates set to REBX_COORDINATES_PARTICLE, but primary param was not found in any particle.  Need to set parameter.\n");
+            }
+            return;
+        }
+        refindex = references->indices[0];
+        com = particles[refindex];
+    }
+    else if (coordinates != REBX_COORDINATES_BARYCENTRIC){
+        reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
+        return;
+    }
+    int n = 0;
+    for (int i=N_real-1; i>=0; i--){
+        if (i == refindex){
+            continue;
+        }
+        const struct reb_particle p = particles[i];
+        if (coordinates == REBX_COORDINATES_JACOBI){
+            com = reb_get_com_without_particle(com, p);
+        }
+        ws->index[n] = i;
+        ws->primary[n] = com;
+        ws->m[n] = p.m;
+        ws->m_primary[n] = com.m;
+        ws->massratio[n] = coordinates == REBX_COORDINATES_BARYCENTRIC ? p.m/com.m : p.m/(com.m + p.m);
+        ws->states.x[n] = p.x - com.x;
+        ws->states.y[n] = p.y - com.y;
+        ws->states.z[n] = p.z - com.z;
+        ws->states.vx[n] = p.vx - com.vx;
+        ws->states.vy[n] = p.vy - com.vy;
+        ws->states.vz[n] = p.vz - com.vz;
+        n++;
+    }
+
+    rebx_particles_to_orbits(sim->G, n, ws->m, ws->m_primary, &ws->states, &ws->orbits, ws->err);
+
+    const int tau_a_key = rebx_get_param_key(rebx, "tau_a");
+    const int tau_e_key = rebx_get_param_key(rebx, "tau_e");
+    const int tau_inc_key = rebx_get_param_key(rebx, "tau_inc");
+    const int tau_omega_key = rebx_get_param_key(rebx, "tau_omega");
+    const int tau_Omega_key = rebx_get_param_key(rebx, "tau_Omega");
+    const double* const p_param = rebx_get_param(rebx, operator->ap, "p");
+    struct rebx_orbit_batch* const o = &ws->orbits;
+    for (int k=0; k<n; k++){
+        if (ws->err[k]){        // mass of primary was 0 or p = primary.  Leave the particle unchanged.
+            continue;
+        }
+        const struct reb_particle* const p = &particles[ws->index[k]];
+        const double* const tau_a = rebx_get_param_by_key(rebx, p->ap, tau_a_key);
+        const double* const tau_e = rebx_get_param_by_key(rebx, p->ap, tau_e_key);
+        const double* const tau_inc = rebx_get_param_by_key(rebx, p->ap, tau_inc_key);
+        const double* const tau_omega = rebx_get_param_by_key(rebx, p->ap, tau_omega_key);
+        const double* const tau_Omega = rebx_get_param_by_key(rebx, p->ap, tau_Omega_key);
+        const double a0 = o->a[k];
+        const double e0 = o->e[k];
+        const double inc0 = o->inc[k];
+        if(tau_a != NULL){
+            o->a[k] += a0*dt/(*tau_a);
+        }
+        if(tau_e != NULL){
+            o->e[k] += e0*dt/(*tau_e);
+            if(p_param != NULL){
+                o->a[k] += 2.*a0*e0*e0*(*p_param)*dt/(*tau_e); // Coupling term between e and a
+            }
+        }
+        if(tau_inc != NULL){
+            o->inc[k] += inc0*dt/(*tau_inc);
+        }
+        if(tau_omega != NULL){
+            o->omega[k] += 2.*M_PI*dt/(*tau_omega);
+        }
+        if(tau_Omega != NULL){
+            o->Omega[k] += 2.*M_PI*dt/(*tau_Omega);
+        }
+    }
+
+    int* const err_back = ws->err + N_real;
+    rebx_orbits_to_particles(sim->G, n, ws->m, ws->m_primary, &ws->orbits, &ws->states, err_back);
+
+    // Move the particles to their new states, keeping the changes (zero for lanes where either conversion failed) in states
+    struct rebx_state_batch* const d = &ws->states;
+    for (int k=0; k<n; k++){
+        struct reb_particle* const p = &particles[ws->index[k]];
+        const struct reb_particle* const primary = &ws->primary[k];
+        if (ws->err[k] || err_back[k]){
+            d->x[k] = d->y[k] = d->z[k] = d->vx[k] = d->vy[k] = d->vz[k] = 0.;
+            continue;
+        }
+        const double x = primary->x + d->x[k];
+        const double y = primary->y + d->y[k];
+        const double z = primary->z + d->z[k];
+        const double vx = primary->vx + d->vx[k];
+        const double vy = primary->vy + d->vy[k];
+        const double vz = primary->vz + d->vz[k];
+        d->x[k] = x - p->x;
+        d->y[k] = y - p->y;
+        d->z[k] = z - p->z;
+        d->vx[k] = vx - p->vx;
+        d->vy[k] = vy - p->vy;
+        d->vz[k] = vz - p->vz;
+        p->x = x;
+        p->y = y;
+        p->z = z;
+        p->vx = vx;
+        p->vy = vy;
+        p->vz = vz;
+    }
+
+    // Back reactions massratio*diff. Barycentric ones go to every particle, Jacobi ones to the particle itself and all
+    // those inside it (lanes run outwards in, so a running total works), and heliocentric ones to the particle and the primary.
+    double total[6] = {0};
+    for (int k=0; k<n; k++){
+        const double r = ws->massratio[k];
+        const double diff[6] = {r*d->x[k], r*d->y[k], r*d->z[k], r*d->vx[k], r*d->vy[k], r*d->vz[k]};
+        for (int l=0; l<6; l++){
+            total[l] += diff[l];
+        }
+        struct reb_particle* const p = &particles[ws->index[k]];
+        if (coordinates == REBX_COORDINATES_JACOBI){
+            rebx_mod_direct_shift(p, total);
+        }
+        else if (coordinates == REBX_COORDINATES_PARTICLE){
+            rebx_mod_direct_shift(p, diff);
+        }
+    }
+    if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+        for (int j=0; j<N_real; j++){
+            rebx_mod_direct_shift(&particles[j], total);
+        }
+    }
+    else if (refindex >= 0){
+        rebx_mod_direct_shift(&particles[refindex], total);
+    }
+}
+
 void rebx_modify_orbits_direct(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
     const int* const ptr = rebx_get_param(sim->extras, operator->ap, "coordinates");
    	enum REBX_COORDINATES coordinates = REBX_COORDINATES_JACOBI;
 	if (ptr != NULL){
 		coordinates = *ptr;
 	}
+    const int* const batched = rebx_get_param(sim->extras, operator->ap, "batched");
+    if (batched != NULL && *batched){
+        rebx_modify_orbits_direct_batched(sim, operator, coordinates, dt);
+        return;
+    }
     const int back_reactions_inclusive = 1;
     const char* reference_name = "primary";
     rebxtools_com_ptm(sim, operator, coordinates, back_reactions_inclusive, reference_name, rebx_calculate_modify_orbits_direct, dt);
@@ -24,7 +24,10 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <unistd.h>
 #include "reboundx.h"
 #include "core.h"
 
@@ -32,7 +35,7 @@
  
  It is a nested series of rebx_binary_field structs, with a binary_field_type enum that tells you how to handle what comes next, and a size so that you can skip this object if you don't recognize it (perhaps it's an older version of REBOUNDx reading a newer binary).
  
- At the outermost level you read in REBX_BINARY_FIELD_SNAPSHOT objects. Currently each binary only has one, but this allows us to later make it possible to append more snapshots if needed.
+ At the outermost level you read in REBX_BINARY_FIELD_SNAPSHOT objects. Binaries written with rebx_output_binary have one, and archives (see below) append more.
  
  Each snapshot currently holds the rebx structure and a list of particles, for which we store all  the params attached to them. So each of them would have a rebx_binary_field identifying them and telling you how large they are in case you need to skip it.
  
@@ -44,7 +47,7 @@
     REBX {type=REBX_STRUCT, size=skip_to_particles}
         ...
     END (REBX)
-    PARTICLES {type=PARTICLES, size=skip_to_END(SNAPSHOT)}
+    PARTICLES {type=PARTICLES, size=skip_to_PARTICLE_COLUMNS}
         PARTICLE {type=PARTICLE, size=skip_to_next_particle}
             PARTICLE_INDEX {type=PARTICLE_INDEX, size=size_to_read}
             INT
@@ -73,14 +76,88 @@
         ...
         END (PARTICLE)
     END (PARTICLES)
+    PARTICLE_COLUMNS {type=PARTICLE_COLUMNS, size=skip_to_END(SNAPSHOT)}
+        PARTICLE_COLUMN {type=PARTICLE_COLUMN, size=skip_to_next_column}
+            PARAM_TYPE {type=PARAM_TYPE, size=size_to_read}
+            ENUM
+            NAME {type=NAME, size=size_to_read}
+            STRING
+            COLUMN_INDICES {type=COLUMN_INDICES, size=size_to_read}
+            INT ARRAY
+            COLUMN_VALUES {type=COLUMN_VALUES, size=size_to_read}
+            VALUE ARRAY
+        END (PARTICLE_COLUMN)
+        ...
+    END (PARTICLE_COLUMNS)
  END (SNAPSHOT)
  
- // not implemented yet
+ Particle params of scalar types (double, int, uint32) are stored in PARTICLE_COLUMNS rather than under each PARTICLE, so each name is stored once per snapshot, with one column per param holding the indices of the particles that have it and their values. COLUMN_INDICES is left out when every particle has the param, in which case the values are for particles 0, 1, 2... Only particles with params of other types get a PARTICLE entry, and only for those params. Binaries written before the columns were added only have PARTICLES, and still load.
+ 
+ Archives written with rebx_output_archive_snapshot append further snapshots, aligned with a REBOUND simulationarchive through their time:
+ 
  SNAPSHOT {type=SNAPSHOT, size=skip_to_next_snapshot}
- ...
+    SNAPSHOT_TIME {type=SNAPSHOT_TIME, size=size_to_read}
+    DOUBLE
+    ...
  END (SNAPSHOT)
+ SNAPSHOT_DIFF {type=SNAPSHOT_DIFF, size=skip_to_next_snapshot}
+    SNAPSHOT_TIME {type=SNAPSHOT_TIME, size=size_to_read}
+    DOUBLE
+    KEYFRAME_OFFSET {type=KEYFRAME_OFFSET, size=size_to_read}
+    LONG
+    REBX {type=REBX_STRUCT, size=skip_to_particles}
+    ...
+    PARTICLES ...
+    PARTICLE_COLUMNS ...
+ END (SNAPSHOT_DIFF)
+ ...
+ 
+ A SNAPSHOT_DIFF holds the (small) rebx structure and PARTICLES in full, but only the column entries that are new or changed since the full SNAPSHOT (keyframe) at KEYFRAME_OFFSET from the start of the file. Loading one therefore reads the keyframe's columns and applies one diff. A new keyframe is written whenever a column entry of the last one has been removed since.
+ 
+ The whole image is built in memory, where object sizes can be filled in once the object is complete, and then written out with a single fwrite (or handed back by rebx_output_binary_to_buffer).
 */
 
+/************************************************************
+In-memory image of the binary
+*************************************************************/
+
+struct rebx_output_buffer{
+    char* data;
+    size_t size;
+    size_t allocated;
+    int failed;         // set if an allocation failed. Further writes are ignored
+};
+
+static void rebx_buffer_write(struct rebx_output_buffer* const buf, const void* const data, const size_t size){
+    if (buf->failed || size == 0){
+        return;
+    }
+    if (buf->size + size > buf->allocated){
+        size_t allocated = buf->allocated ? buf->allocated : 4096;
+        while (allocated < buf->size + size){
+            allocated *= 2;
+        }
+        char* const data_new = realloc(buf->data, allocated);
+        if (data_new == NULL){
+            buf->failed = 1;
+            return;
+        }
+        buf->data = data_new;
+        buf->allocated = allocated;
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+// Field structs have padding between type and size, which is zeroed so the same state always gives the same bytes
+static void rebx_buffer_write_field(struct rebx_output_buffer* const buf, const enum rebx_binary_field_type type, const long size){
+    struct rebx_binary_field field;
+    memset(&field, 0, sizeof(field));
+    field.type = type;
+    field.size = size;
+    rebx_buffer_write(buf, &field, sizeof(field));
+}
+
 /************************************************************
 Macros to remove repetition in writing fields.
 *************************************************************/
@@ -88,27 +165,24 @@ Macros to remove repetition in writing fields.
 // Write a data field of binary_field_type typename with size typesize
 // valueptr is a pointer to the memory to write
 #define REBX_WRITE_DATA_FIELD(typename, valueptr, typesize) {\
-struct rebx_binary_field field = {.type = REBX_BINARY_FIELD_TYPE_##typename, .size=typesize};\
-fwrite(&field, sizeof(field), 1, of);\
-fwrite(valueptr,typesize,1,of);\
+rebx_buffer_write_field(of, REBX_BINARY_FIELD_TYPE_##typename, typesize);\
+rebx_buffer_write(of, valueptr, typesize);\
 }
 
-/*  For the arbitrary objects, we write a preliminary field struct without a size (since we don't know it yet), and cache the file position to measure how large the object is later.*/
+/*  For the arbitrary objects, we write a preliminary field struct without a size (since we don't know it yet), and keep its offset in the buffer to measure how large the object is later.*/
 #define REBX_START_OBJECT_FIELD(name, typename)\
-long pos_start_header_##name = ftell(of);\
-struct rebx_binary_field header_##name = {.type = REBX_BINARY_FIELD_TYPE_##typename, .size=0};\
-fwrite(&header_##name, sizeof(header_##name), 1, of);\
-long pos_start_##name = ftell(of);\
+const size_t pos_start_header_##name = of->size;\
+rebx_buffer_write_field(of, REBX_BINARY_FIELD_TYPE_##typename, 0);\
+const size_t pos_start_##name = of->size;\
 
-/*  After we write all the data we need for the particular object, we calculate how long this segment is, and update the field struct with this size so we have option of skipping the whole object when reading.*/
+/*  After we write all the data we need for the particular object, we calculate how long this segment is, and update the field struct in the buffer with this size so we have option of skipping the whole object when reading.*/
 
 #define REBX_END_OBJECT_FIELD(name) {\
 REBX_WRITE_DATA_FIELD(END,        NULL,             0);\
-long pos_end_##name = ftell(of);\
-header_##name.size = pos_end_##name - pos_start_##name;\
-fseek(of, pos_start_header_##name, SEEK_SET);\
-fwrite(&header_##name, sizeof(header_##name), 1, of);\
-fseek(of, 0, SEEK_END);\
+if (!of->failed){\
+const long size_##name = of->size - pos_start_##name;\
+memcpy(of->data + pos_start_header_##name + offsetof(struct rebx_binary_field, size), &size_##name, sizeof(size_##name));\
+}\
 }
 
 /*  Write a list of listtype (e.g., ALLOCATED_FORCES) with nodes of type nodetype (e.g. ALLOCATED_FORCE), to the passed linkedlist (e.g. rebx->allocated_forces)*/
@@ -119,9 +193,9 @@ rebx_write_list(rebx, REBX_BINARY_FIELD_TYPE_##nodetype, linkedlist, of);\
 REBX_END_OBJECT_FIELD(list);\
 }
 
-static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, FILE* of);
+static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, struct rebx_output_buffer* of);
 
-static void rebx_write_force_param(struct rebx_extras* rebx, struct rebx_param* param, FILE* of){
+static void rebx_write_force_param(struct rebx_extras* rebx, struct rebx_param* param, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(force_param, PARAM);
     REBX_WRITE_DATA_FIELD(PARAM_TYPE, &param->type,     sizeof(param->type));
     REBX_WRITE_DATA_FIELD(NAME,       param->name,      strlen(param->name) + 1);
@@ -130,7 +204,7 @@ static void rebx_write_force_param(struct rebx_extras* rebx, struct rebx_param*
     REBX_END_OBJECT_FIELD(force_param);
 }
 
-static void rebx_write_param(struct rebx_extras* rebx, struct rebx_param* param, FILE* of){
+static void rebx_write_param(struct rebx_extras* rebx, struct rebx_param* param, struct rebx_output_buffer* of){
     if (param->type == REBX_TYPE_POINTER){ // Don't write pointers because we won't know how to load them when we read binary. Need to add type to store in binaries.
         return;
     }
@@ -146,14 +220,14 @@ static void rebx_write_param(struct rebx_extras* rebx, struct rebx_param* param,
     REBX_END_OBJECT_FIELD(param);
 }
 
-static void rebx_write_registered_param(struct rebx_extras* rebx, struct rebx_param* param, FILE* of){
+static void rebx_write_registered_param(struct rebx_extras* rebx, struct rebx_param* param, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(registered_param, REGISTERED_PARAM);
     REBX_WRITE_DATA_FIELD(PARAM_TYPE, &param->type,     sizeof(param->type));
     REBX_WRITE_DATA_FIELD(NAME,       param->name,      strlen(param->name) + 1);
     REBX_END_OBJECT_FIELD(registered_param);
 }
 
-static void rebx_write_force(struct rebx_extras* rebx, struct rebx_force* force, FILE* of){
+static void rebx_write_force(struct rebx_extras* rebx, struct rebx_force* force, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(force, FORCE);
     // must write name first so that force can be loaded on read
     REBX_WRITE_DATA_FIELD(NAME, force->name, strlen(force->name) + 1);
@@ -162,20 +236,20 @@ static void rebx_write_force(struct rebx_extras* rebx, struct rebx_force* force,
 }
 
 // Same as force, but only holds the name for later loading, rather than the whole parameter list
-static void rebx_write_additional_force(struct rebx_extras* rebx, struct rebx_force* force, FILE* of){
+static void rebx_write_additional_force(struct rebx_extras* rebx, struct rebx_force* force, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(additional_force, ADDITIONAL_FORCE);
     REBX_WRITE_DATA_FIELD(NAME, force->name, strlen(force->name) + 1);
     REBX_END_OBJECT_FIELD(additional_force);
 }
 
-static void rebx_write_operator(struct rebx_extras* rebx, struct rebx_operator* operator, FILE* of){
+static void rebx_write_operator(struct rebx_extras* rebx, struct rebx_operator* operator, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(operator, OPERATOR);
     REBX_WRITE_DATA_FIELD(NAME, operator->name, strlen(operator->name) + 1);
     REBX_WRITE_LIST_FIELD(PARAM_LIST, PARAM, operator->ap);
     REBX_END_OBJECT_FIELD(operator);
 }
 
-static void rebx_write_step(struct rebx_extras* rebx, struct rebx_step* step, FILE* of){
+static void rebx_write_step(struct rebx_extras* rebx, struct rebx_step* step, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(step, STEP);
     // Need operator name to load it from source when reading it back in
     REBX_WRITE_DATA_FIELD(NAME, step->operator->name,   strlen(step->operator->name) + 1);
@@ -183,14 +257,41 @@ static void rebx_write_step(struct rebx_extras* rebx, struct rebx_step* step, FI
     REBX_END_OBJECT_FIELD(step);
 }
 
-static void rebx_write_particle(struct rebx_extras* rebx, struct reb_particle* particle, int index, FILE* of){
+// Whether a particle param is written to PARTICLE_COLUMNS rather than to the particle's own PARAM_LIST
+static int rebx_is_column_param(struct rebx_extras* rebx, const struct rebx_param* param){
+    return rebx_param_value_in_pool(param->type) && param->key >= 0 && param->key < rebx->N_param_keys && rebx->param_keys[param->key]->type == param->type;
+}
+
+// Writes the particle's params that don't go in a column. Written back to front like rebx_write_list
+static void rebx_write_particle(struct rebx_extras* rebx, struct reb_particle* particle, int index, struct rebx_output_buffer* of){
+    struct rebx_node* nodes_stack[64];
+    const int N = rebx_len(particle->ap);
+    struct rebx_node** const nodes = N > 64 ? malloc(N*sizeof(*nodes)) : nodes_stack;
+    if (nodes == NULL){
+        of->failed = 1;
+        return;
+    }
+    int n = 0;
+    for (struct rebx_node* current = particle->ap; current != NULL; current = current->next){
+        nodes[n++] = current;
+    }
     REBX_START_OBJECT_FIELD(particle, PARTICLE);
     REBX_WRITE_DATA_FIELD(PARTICLE_INDEX,    &index, sizeof(index));
-    REBX_WRITE_LIST_FIELD(PARAM_LIST, PARAM, particle->ap);
+    REBX_START_OBJECT_FIELD(list, PARAM_LIST);
+    for (int i=N-1; i>=0; i--){
+        struct rebx_param* const param = nodes[i]->object;
+        if (!rebx_is_column_param(rebx, param)){
+            rebx_write_param(rebx, param, of);
+        }
+    }
+    REBX_END_OBJECT_FIELD(list);
     REBX_END_OBJECT_FIELD(particle);
+    if (nodes != nodes_stack){
+        free(nodes);
+    }
 }
 
-static void rebx_write_rebx(struct rebx_extras* rebx, FILE* of){
+static void rebx_write_rebx(struct rebx_extras* rebx, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(rebx_structure, REBX_STRUCTURE);
     REBX_WRITE_LIST_FIELD(REGISTERED_PARAMETERS, REGISTERED_PARAM, rebx->registered_params);
     REBX_WRITE_LIST_FIELD(ALLOCATED_FORCES, FORCE, rebx->allocated_forces);
@@ -201,25 +302,236 @@ static void rebx_write_rebx(struct rebx_extras* rebx, FILE* of){
     REBX_END_OBJECT_FIELD(rebx_structure);
 }
 
-// Write a particle field for each particle with a list of its parameters
-static void rebx_write_particles(struct rebx_extras* rebx, FILE* of){
-    struct reb_simulation* sim = rebx->sim; // checked sim valid in output_binray
+static void rebx_write_particle_column(struct rebx_extras* rebx, const struct rebx_param* registered, const int N, const int* indices, const char* values, struct rebx_output_buffer* of){
+    const int N_particles = rebx->sim->N;
+    REBX_START_OBJECT_FIELD(column, PARTICLE_COLUMN);
+    REBX_WRITE_DATA_FIELD(PARAM_TYPE, &registered->type,    sizeof(registered->type));
+    REBX_WRITE_DATA_FIELD(NAME,       registered->name,     strlen(registered->name) + 1);
+    if (N < N_particles){  // every particle has it otherwise, in index order
+        REBX_WRITE_DATA_FIELD(COLUMN_INDICES,   indices,    N*sizeof(*indices));
+    }
+    REBX_WRITE_DATA_FIELD(COLUMN_VALUES,    values,     N*rebx_sizeof(rebx, registered->type));
+    REBX_END_OBJECT_FIELD(column);
+}
+
+// Scalar particle params laid out by column. The entries of the param with key k are [offsets[k], offsets[k]+filled[k])
+struct rebx_column_layout{
+    int* offsets;
+    int* filled;
+    int* indices;
+    char* values;       // each entry takes sizeof(double), with a column's values packed at its own type's size
+    int N_list;         // number of particles with params that don't go in columns
+};
+
+static void rebx_free_column_layout(struct rebx_column_layout* const layout){
+    free(layout->offsets);
+    free(layout->filled);
+    free(layout->indices);
+    free(layout->values);
+}
+
+static int rebx_layout_particle_columns(struct rebx_extras* rebx, struct rebx_column_layout* const layout){
+    struct reb_simulation* sim = rebx->sim;
+    const int N_keys = rebx->N_param_keys;
+    *layout = (struct rebx_column_layout){0};
     
+    // Count the particles with each param, so the columns can be laid out back to back in one index and one value array
+    layout->offsets = calloc(N_keys + 1, sizeof(*layout->offsets));
+    layout->filled = calloc(N_keys + 1, sizeof(*layout->filled));
+    if (layout->offsets == NULL || layout->filled == NULL){
+        rebx_free_column_layout(layout);
+        return 0;
+    }
+    int* const offsets = layout->offsets;
+    for (int i=0; i<sim->N; i++){
+        int in_list = 0;
+        for (struct rebx_node* current = sim->particles[i].ap; current != NULL; current = current->next){
+            const struct rebx_param* const param = current->object;
+            if (rebx_is_column_param(rebx, param)){
+                offsets[param->key + 1]++;
+            }
+            else{
+                in_list = 1;
+            }
+        }
+        layout->N_list += in_list;
+    }
+    for (int k=0; k<N_keys; k++){
+        offsets[k+1] += offsets[k];
+    }
+    const int N_values = offsets[N_keys];
+    if (N_values == 0){
+        return 1;
+    }
+    
+    layout->indices = malloc(N_values*sizeof(*layout->indices));
+    layout->values = malloc(N_values*sizeof(double));
+    if (layout->indices == NULL || layout->values == NULL){
+        rebx_free_column_layout(layout);
+        return 0;
+    }
+    for (int i=0; i<sim->N; i++){
+        for (struct rebx_node* current = sim->particles[i].ap; current != NULL; current = current->next){
+            const struct rebx_param* const param = current->object;
+            if (rebx_is_column_param(rebx, param)){
+                const int k = param->key;
+                const size_t size = rebx_sizeof(rebx, param->type);
+                layout->indices[offsets[k] + layout->filled[k]] = i;
+                memcpy(layout->values + offsets[k]*sizeof(double) + layout->filled[k]*size, param->value, size);
+                layout->filled[k]++;
+            }
+        }
+    }
+    return 1;
+}
+
+// A particle field for each particle with params that don't go in columns
+static void rebx_write_particle_list(struct rebx_extras* rebx, const struct rebx_column_layout* const layout, struct rebx_output_buffer* of){
+    struct reb_simulation* sim = rebx->sim;
+    if (layout->N_list == 0){
+        return;
+    }
     REBX_START_OBJECT_FIELD(particle_list, PARTICLES);
     for (int i=0; i<sim->N; i++){
-        rebx_write_particle(rebx, &sim->particles[i], i, of);
+        for (struct rebx_node* current = sim->particles[i].ap; current != NULL; current = current->next){
+            if (!rebx_is_column_param(rebx, current->object)){
+                rebx_write_particle(rebx, &sim->particles[i], i, of);
+                break;
+            }
+        }
     }
     REBX_END_OBJECT_FIELD(particle_list);
 }
 
-static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, FILE* of){
-    
-    int N = rebx_len(list);
-    while (N > 0){
-        struct rebx_node* current = list;
-        for(int i=0;i<N-1;i++){
-            current=current->next;
+static void rebx_write_particle_columns(struct rebx_extras* rebx, const struct rebx_column_layout* const layout, struct rebx_output_buffer* of){
+    const int N_keys = rebx->N_param_keys;
+    if (layout->offsets[N_keys] == 0){
+        return;
+    }
+    REBX_START_OBJECT_FIELD(column_list, PARTICLE_COLUMNS);
+    for (int k=0; k<N_keys; k++){
+        if (layout->filled[k] > 0){
+            rebx_write_particle_column(rebx, rebx->param_keys[k], layout->filled[k], layout->indices + layout->offsets[k], layout->values + layout->offsets[k]*sizeof(double), of);
         }
+    }
+    REBX_END_OBJECT_FIELD(column_list);
+}
+
+// Write the scalar particle params by column, and a particle field for each particle with params of other types
+static void rebx_write_particles(struct rebx_extras* rebx, struct rebx_output_buffer* of){
+    struct rebx_column_layout layout;
+    if (!rebx_layout_particle_columns(rebx, &layout)){
+        of->failed = 1;
+        return;
+    }
+    rebx_write_particle_list(rebx, &layout, of);
+    rebx_write_particle_columns(rebx, &layout, of);
+    rebx_free_column_layout(&layout);
+}
+
+/* Writes only the column entries that are new or have changed since the keyframe. Returns 0 if a column entry of the
+ * keyframe has since been removed, in which case a diff can't describe the current state.
+ */
+static int rebx_write_particle_column_diffs(struct rebx_extras* rebx, const struct rebx_column_layout* const layout, const struct rebx_archive_keyframe* const keyframe, struct rebx_output_buffer* of){
+    struct reb_simulation* sim = rebx->sim;
+    const int N = sim->N;
+    int* const position = malloc((N > 0 ? N : 1)*sizeof(*position));  // of each particle in the keyframe column
+    int* const indices = malloc((N > 0 ? N : 1)*sizeof(*indices));
+    char* const values = malloc((N > 0 ? N : 1)*sizeof(double));
+    char* const matched = calloc(keyframe->N_columns + 1, 1);
+    int representable = 1;
+    if (position == NULL || indices == NULL || values == NULL || matched == NULL){
+        of->failed = 1;
+    }
+    else{
+        REBX_START_OBJECT_FIELD(column_list, PARTICLE_COLUMNS);
+        for (int k=0; k<rebx->N_param_keys && representable; k++){
+            const int N_entries = layout->filled[k];
+            if (N_entries == 0){
+                continue;
+            }
+            const struct rebx_param* const registered = rebx->param_keys[k];
+            const size_t size = rebx_sizeof(rebx, registered->type);
+            const struct rebx_particle_column* column = NULL;
+            for (int c=0; c<keyframe->N_columns; c++){
+                if (strcmp(keyframe->columns[c].name, registered->name) == 0){
+                    column = &keyframe->columns[c];
+                    matched[c] = 1;
+                    break;
+                }
+            }
+            if (column != NULL && column->type != registered->type){
+                representable = 0;
+                break;
+            }
+            for (int i=0; i<N; i++){
+                position[i] = -1;
+            }
+            if (column != NULL){
+                for (long j=0; j<column->N; j++){
+                    int index = j;
+                    if (column->indices != NULL){
+                        memcpy(&index, column->indices + j*sizeof(int), sizeof(int));
+                    }
+                    if (index >= 0 && index < N){
+                        position[index] = j;
+                    }
+                }
+            }
+            const int* const entry_indices = layout->indices + layout->offsets[k];
+            const char* const entry_values = layout->values + layout->offsets[k]*sizeof(double);
+            long N_kept = 0;
+            int N_changed = 0;
+            for (int e=0; e<N_entries; e++){
+                const int i = entry_indices[e];
+                const char* const value = entry_values + e*size;
+                if (position[i] >= 0){
+                    N_kept++;
+                    if (memcmp(column->values + position[i]*size, value, size) == 0){
+                        continue;
+                    }
+                }
+                indices[N_changed] = i;
+                memcpy(values + N_changed*size, value, size);
+                N_changed++;
+            }
+            if (column != NULL && N_kept < column->N){
+                representable = 0;
+                break;
+            }
+            if (N_changed > 0){
+                rebx_write_particle_column(rebx, registered, N_changed, indices, values, of);
+            }
+        }
+        for (int c=0; c<keyframe->N_columns; c++){
+            if (!matched[c]){
+                representable = 0;
+            }
+        }
+        REBX_END_OBJECT_FIELD(column_list);
+    }
+    free(position);
+    free(indices);
+    free(values);
+    free(matched);
+    return representable;
+}
+
+static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, struct rebx_output_buffer* of){
+    // Lists are built by pushing onto the front, so write them back to front so they're rebuilt in the same order on read
+    struct rebx_node* nodes_stack[64];
+    const int N = rebx_len(list);
+    struct rebx_node** const nodes = N > 64 ? malloc(N*sizeof(*nodes)) : nodes_stack;
+    if (nodes == NULL){
+        of->failed = 1;
+        return;
+    }
+    int n = 0;
+    for (struct rebx_node* current = list; current != NULL; current = current->next){
+        nodes[n++] = current;
+    }
+    for (int i=N-1; i>=0; i--){
+        struct rebx_node* const current = nodes[i];
         switch(list_type){
             case REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM:
             {
@@ -252,37 +564,152 @@ static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_typ
                 break;
             }
         }
-        N--;
+    }
+    if (nodes != nodes_stack){
+        free(nodes);
     }
 }
 
-// Could be extended to include time or steps_done to make an archive
-static void rebx_write_snapshot(struct rebx_extras* rebx, FILE* of){
+// Snapshots in archives also hold the simulation time, so they can be matched up with the simulationarchive
+static void rebx_write_snapshot(struct rebx_extras* rebx, const int with_time, struct rebx_output_buffer* of){
     REBX_START_OBJECT_FIELD(snapshot, SNAPSHOT);
+    if (with_time){
+        REBX_WRITE_DATA_FIELD(SNAPSHOT_TIME,    &rebx->sim->t,      sizeof(rebx->sim->t));
+    }
     rebx_write_rebx(rebx, of);
     rebx_write_particles(rebx, of);
     REBX_END_OBJECT_FIELD(snapshot);
 }
 
+// Returns 0 if the state can't be written as a diff against the keyframe, in which case nothing is left in of
+static int rebx_write_snapshot_diff(struct rebx_extras* rebx, const struct rebx_archive_keyframe* const keyframe, struct rebx_output_buffer* of){
+    struct rebx_column_layout layout;
+    if (!rebx_layout_particle_columns(rebx, &layout)){
+        of->failed = 1;
+        return 1;
+    }
+    const size_t start = of->size;
+    REBX_START_OBJECT_FIELD(snapshot_diff, SNAPSHOT_DIFF);
+    REBX_WRITE_DATA_FIELD(SNAPSHOT_TIME,    &rebx->sim->t,      sizeof(rebx->sim->t));
+    REBX_WRITE_DATA_FIELD(KEYFRAME_OFFSET,  &keyframe->offset,  sizeof(keyframe->offset));
+    rebx_write_rebx(rebx, of);
+    rebx_write_particle_list(rebx, &layout, of);
+    const int representable = rebx_write_particle_column_diffs(rebx, &layout, keyframe, of);
+    REBX_END_OBJECT_FIELD(snapshot_diff);
+    rebx_free_column_layout(&layout);
+    if (!representable){
+        of->size = start;
+    }
+    return representable;
+}
+
+static void rebx_write_header(struct rebx_output_buffer* const buf){
+    const char str[] = "REBOUNDx Binary File. Version: ";
+    char zero = '\0';
+    size_t lenheader = strlen(str)+strlen(rebx_version_str);
+    rebx_buffer_write(buf, str, strlen(str));
+    rebx_buffer_write(buf, rebx_version_str, strlen(rebx_version_str));
+    rebx_buffer_write(buf, &zero, 1);
+    rebx_buffer_write(buf, rebx_githash_str, 62-lenheader);
+    rebx_buffer_write(buf, &zero, 1);
+}
+
+// Builds the header and snapshot in buf. Returns 0 on failure, with buf freed
+static int rebx_output_binary_image(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
+    rebx_write_header(buf);
+    rebx_write_snapshot(rebx, 0, buf);
+    if (buf->failed){
+        free(buf->data);
+        *buf = (struct rebx_output_buffer){0};
+        rebx_error(rebx, "REBOUNDx error: Could not allocate memory for binary output.");
+        return 0;
+    }
+    return 1;
+}
+
+void rebx_output_binary_to_buffer(struct rebx_extras* rebx, char** bufp, size_t* sizep){
+    *bufp = NULL;
+    *sizep = 0;
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return;
+    }
+    struct rebx_output_buffer buf = {0};
+    if (rebx_output_binary_image(rebx, &buf)){
+        *bufp = buf.data;
+        *sizep = buf.size;
+    }
+}
+
 void rebx_output_binary(struct rebx_extras* rebx, char* filename){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return;
+    }
+    struct rebx_output_buffer buf = {0};
+    if (!rebx_output_binary_image(rebx, &buf)){
+        return;
+    }
     FILE* of = fopen(filename,"wb");
     if (of==NULL){
         rebx_error(rebx, "REBOUNDx error: Can not open file passed to rebx_output_binary.");
+        free(buf.data);
+        return;
     }
+    if (fwrite(buf.data, 1, buf.size, of) != buf.size){
+        rebx_error(rebx, "REBOUNDx error: Could not write the full binary in rebx_output_binary.");
+    }
+    fclose(of);
+    free(buf.data);
+}
+
+void rebx_output_archive_snapshot(struct rebx_extras* rebx, const char* const filename){
     if (rebx->sim == NULL){
         rebx_error(rebx, ""); // rebx_error gives meaningful err
         return;
     }
-    // Write header.
-    const char str[] = "REBOUNDx Binary File. Version: ";
-    char zero = '\0';
-    size_t lenheader = strlen(str)+strlen(rebx_version_str);
-    fwrite(str,sizeof(char),strlen(str),of);
-    fwrite(rebx_version_str,sizeof(char), strlen(rebx_version_str),of);
-    fwrite(&zero,sizeof(char),1,of);
-    fwrite(rebx_githash_str,sizeof(char),62-lenheader,of);
-    fwrite(&zero,sizeof(char),1,of);
-
-    rebx_write_snapshot(rebx, of);
+    struct rebx_archive_keyframe keyframe;
+    const int exists = rebx_input_open_archive_keyframe(rebx, filename, &keyframe) && keyframe.size > 0;
+    const char str[] = "REBOUNDx Binary File.";
+    if (exists && (keyframe.size < 64 || strncmp(keyframe.image, str, strlen(str)) != 0)){
+        rebx_input_close_archive_keyframe(&keyframe);
+        rebx_error(rebx, "REBOUNDx error: File passed to rebx_output_archive_snapshot exists but is not a REBOUNDx binary. Not overwriting it.");
+        return;
+    }
+    
+    // New snapshots are diffs against the last full one, unless a particle param was removed since
+    struct rebx_output_buffer buf = {0};
+    if (!exists){
+        rebx_write_header(&buf);
+    }
+    if (!exists || keyframe.offset < 0 || !rebx_write_snapshot_diff(rebx, &keyframe, &buf)){
+        rebx_write_snapshot(rebx, 1, &buf);
+    }
+    const long end = exists ? keyframe.end : 0;
+    rebx_input_close_archive_keyframe(&keyframe);
+    if (buf.failed){
+        free(buf.data);
+        rebx_error(rebx, "REBOUNDx error: Could not allocate memory for binary output.");
+        return;
+    }
+    
+    // Append after the last complete snapshot, which also writes over what's left of an interrupted one
+    FILE* of = fopen(filename, exists ? "r+b" : "wb");
+    if (of == NULL || fseek(of, end, SEEK_SET) != 0){
+        rebx_error(rebx, "REBOUNDx error: Can not open file passed to rebx_output_archive_snapshot.");
+        if (of != NULL){
+            fclose(of);
+        }
+        free(buf.data);
+        return;
+    }
+    if (fwrite(buf.data, 1, buf.size, of) != buf.size){
+        rebx_error(rebx, "REBOUNDx error: Could not write the full snapshot in rebx_output_archive_snapshot.");
+    }
+    // A new snapshot shorter than the interrupted one it replaced would leave the old bytes after it
+    else if (exists && (fflush(of) != 0 || ftruncate(fileno(of), end + (off_t)buf.size) != 0)){
+        rebx_error(rebx, "REBOUNDx error: Could not truncate the file after the snapshot in rebx_output_archive_snapshot.");
+    }
     fclose(of);
+    free(buf.data);
 }
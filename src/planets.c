@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -47,6 +50,12 @@ void jpl_work(double *P, int ncm, int ncf, int niv, double t0, double t1, double
 
         b = (int)t;
 
+        // the end of the record (t0 = 1) is the end of its last interval
+        if (b >= niv) {
+                b = niv - 1;
+                t0 = 1.0;
+        }
+
         // set up Chebyshev polynomials and derivatives
         T[0] = 1.0; T[1] = t0;
         S[0] = 0.0; S[1] = 1.0;
@@ -76,32 +85,19 @@ void jpl_work(double *P, int ncm, int ncf, int niv, double t0, double t1, double
 /*
  *  jpl_init
  *
- *  Initialise everything needed ... probaly not be compatible with a non-430 file.
+ *  Initialise everything needed for a binary DE4xx file (tested with DE430).
  *
  */
 
-struct _jpl_s * jpl_init(void)
+// read the header record, which starts after the title and the first 400 constant names
+static int _hdr(int fd, struct _jpl_s *jpl)
 {
-        struct _jpl_s *jpl;
-        struct stat sb;
-        char buf[256];
         ssize_t ret;
         off_t off;
-        int fd, p;
-
-//      snprintf(buf, sizeof(buf), "/home/blah/wherever/linux_p1550p2650.430");
-        snprintf(buf, sizeof(buf), "linux_p1550p2650.430");
-
-        if ((fd = open(buf, O_RDONLY)) < 0)
-                return NULL;
-
-        jpl = malloc(sizeof(struct _jpl_s));
-        memset(jpl, 0, sizeof(struct _jpl_s));
+        int p;
 
-        if (fstat(fd, &sb) < 0)
-                goto err;
         if (lseek(fd, 0x0A5C, SEEK_SET) < 0)
-                goto err;
+                return -1;
 
         // read header
         ret  = read(fd, &jpl->beg, sizeof(double));
@@ -129,34 +125,150 @@ struct _jpl_s * jpl_init(void)
         ret += read(fd, &jpl->ncf[12], sizeof(int32_t));
         ret += read(fd, &jpl->niv[12], sizeof(int32_t));
 
-        // skip the remaining constants
-        off = 6 * (jpl->num - 400);
+        // files with more than 400 constants store the remaining names
+        // here, followed by the mantle and TT-TDB pointers; older files
+        // (eg: DE405) have neither
+        if (jpl->num > 400) {
+                off = 6 * (jpl->num - 400);
 
-        if (lseek(fd, off, SEEK_CUR) < 0)
-                goto err;
+                if (lseek(fd, off, SEEK_CUR) < 0)
+                        return -1;
 
-        // finishing reading
-        for (p = 13; p < 15; p++) {
-                ret += read(fd, &jpl->off[p], sizeof(int32_t));
-                ret += read(fd, &jpl->ncf[p], sizeof(int32_t));
-                ret += read(fd, &jpl->niv[p], sizeof(int32_t));
+                // finishing reading
+                for (p = 13; p < 15; p++) {
+                        ret += read(fd, &jpl->off[p], sizeof(int32_t));
+                        ret += read(fd, &jpl->ncf[p], sizeof(int32_t));
+                        ret += read(fd, &jpl->niv[p], sizeof(int32_t));
+                }
         }
 
+        if (jpl->inc <= 0.0 || jpl->end <= jpl->beg)
+                return -1;
+
+        // jpl_work() handles at most 24 coefficients
+        for (p = 0; p < _NUM_JPL; p++)
+                if (jpl->ncf[p] < 0 || jpl->ncf[p] > 24)
+                        return -1;
+
         // adjust for correct indexing (ie: zero based)
         for (p = 0; p < _NUM_JPL; p++)
                 jpl->off[p] -= 1;
 
-        // save file size, and determine 'kernel size'
-        jpl->len = sb.st_size;
+        // determine 'kernel size'
         jpl->rec = sizeof(double) * 2;
 
         for (p = 0; p < _NUM_JPL; p++)
                 jpl->rec += sizeof(double) * jpl->ncf[p] * jpl->niv[p] * jpl->ncm[p];
 
+        return 0;
+}
+
+// anonymous memory for the copied records, huge pages if we can get them;
+// the length is rounded up to whole (huge) pages
+static void * _mem(size_t *len)
+{
+        void *map = MAP_FAILED;
+        size_t big = (*len + (1 << 21) - 1) & ~(size_t)((1 << 21) - 1);
+
+#ifdef MAP_HUGETLB
+        map = mmap(NULL, big, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (map == MAP_FAILED) {
+                map = mmap(NULL, big, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+                if (map != MAP_FAILED && madvise(map, big, MADV_HUGEPAGE) < 0)
+                        { ; } // transparent huge pages are only a hint
+#endif
+        }
+
+        *len = big;
+
+        return (map == MAP_FAILED) ? NULL : map;
+}
+
+/*
+ *  jpl_load
+ *
+ *  Load a DE file, making the records covering [beg, end] (julian days) readily
+ *  available; beg >= end means the whole file.
+ *
+ *      JPL_LOAD_MAP      - memory map, records are paged in on first touch
+ *      JPL_LOAD_PREFAULT - memory map, and fault in the pages of the window now
+ *      JPL_LOAD_COPY     - copy the window into private (huge page backed)
+ *                          memory; times outside it are then not available
+ *
+ */
+struct _jpl_s * jpl_load(const char *path, double beg, double end, int mode)
+{
+        struct _jpl_s *jpl;
+        struct stat sb;
+        volatile char tch;
+        size_t nrec, b0, b1, o0, o1, pg, n;
+        int fd;
+
+        if ((fd = open(path, O_RDONLY)) < 0)
+                return NULL;
+
+        jpl = malloc(sizeof(struct _jpl_s));
+        memset(jpl, 0, sizeof(struct _jpl_s));
+
+        if (fstat(fd, &sb) < 0)
+                goto err;
+        if (_hdr(fd, jpl) < 0)
+                goto err;
+
+        // records in the file, after the two header records
+        if ((size_t)sb.st_size < 3 * jpl->rec)
+                goto err;
+
+        nrec = sb.st_size / jpl->rec - 2;
+        b0 = 0;
+        b1 = nrec - 1;
+
+        // records covering the window, plus one for its very end
+        if (beg < end) {
+                if (beg > jpl->beg)
+                        b0 = (size_t)((beg - jpl->beg) / jpl->inc);
+                if (end < jpl->end)
+                        b1 = (size_t)((end - jpl->beg) / jpl->inc) + 1;
+                if (b1 > nrec - 1)
+                        b1 = nrec - 1;
+                if (b0 > b1)
+                        goto err;
+        }
+
+        if (mode == JPL_LOAD_COPY) {
+                // the two header records, then the window
+                jpl->len = (b1 - b0 + 3) * jpl->rec;
+                jpl->map = _mem(&jpl->len);
+
+                if (jpl->map == NULL)
+                        goto err;
+
+                if (pread(fd, jpl->map, 2 * jpl->rec, 0) != (ssize_t)(2 * jpl->rec)
+                  || pread(fd, jpl->map + 2 * jpl->rec, (b1 - b0 + 1) * jpl->rec, (b0 + 2) * jpl->rec) != (ssize_t)((b1 - b0 + 1) * jpl->rec)) {
+                        munmap(jpl->map, jpl->len);
+                        goto err;
+                }
+
+                // the coverage shrinks to the copied records
+                jpl->nrec = b1 - b0 + 1;
+                jpl->beg += b0 * jpl->inc;
+                if (jpl->beg + (b1 - b0 + 1) * jpl->inc < jpl->end)
+                        jpl->end = jpl->beg + (b1 - b0 + 1) * jpl->inc;
+
+                close(fd);
+                return jpl;
+        }
+
+        // save file size
+        jpl->len = sb.st_size;
+        jpl->nrec = nrec;
+
         // memory map the file, which makes us thread-safe with kernel caching
         jpl->map = mmap(NULL, jpl->len, PROT_READ, MAP_SHARED, fd, 0);
 
-        if (jpl->map == NULL)
+        if (jpl->map == MAP_FAILED)
                 goto err;
 
         // this file descriptor is no longer needed since we are memory mapped
@@ -165,6 +277,20 @@ struct _jpl_s * jpl_init(void)
         if (madvise(jpl->map, jpl->len, MADV_RANDOM) < 0)
                 { ; } // perror ...
 
+        if (mode == JPL_LOAD_PREFAULT) {
+                pg = sysconf(_SC_PAGESIZE);
+                o0 = (b0 + 2) * jpl->rec / pg * pg;
+                o1 = (b1 + 3) * jpl->rec;
+
+                // read ahead, then touch every page so the faults happen now
+                if (madvise(jpl->map + o0, o1 - o0, MADV_WILLNEED) < 0)
+                        { ; } // perror ...
+
+                for (n = o0; n < o1; n += pg)
+                        tch = ((const char *)jpl->map)[n];
+                (void)tch;
+        }
+
         return jpl;
 
 err:    close(fd);
@@ -173,6 +299,9 @@ err:    close(fd);
         return NULL;
 }
 
+struct _jpl_s * jpl_init(const char *path)
+        { return jpl_load(path, 0.0, 0.0, JPL_LOAD_MAP); }
+
 /*
  *  jpl_free
  *
@@ -261,6 +390,21 @@ static void _lun(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
 static void (* _help[_NUM_TEST])(struct _jpl_s *, double *, double, struct mpos_s *)
     = { _bar, _sun, _ear, _emb, _lun, _mer, _ven, _mar, _jup, _sat, _ura, _nep, _plu};
 
+// record number and 'offset' into the record for a covered jde; the very end of
+// the coverage is the end of the last record, not the start of one past it
+static size_t _blk(const struct _jpl_s *pl, double jde, double *t)
+{
+        size_t blk = (size_t)((jde - pl->beg) / pl->inc);
+
+        if (blk >= pl->nrec) {
+                blk = pl->nrec - 1;
+                *t = (jde - pl->beg - blk * pl->inc) / pl->inc;
+        } else
+                *t = fmod(jde - pl->beg, pl->inc) / pl->inc;
+
+        return blk;
+}
+
 int jpl_calc(struct _jpl_s *pl, struct mpos_s *now, double jde, int n, int m)
 {
         struct mpos_s pos;
@@ -277,8 +421,7 @@ int jpl_calc(struct _jpl_s *pl, struct mpos_s *now, double jde, int n, int m)
                 return -1;
 
         // compute record number and 'offset' into record
-        blk = (u_int32_t)((jde - pl->beg) / pl->inc);
-        t = fmod(jde - pl->beg, pl->inc) / pl->inc;
+        blk = _blk(pl, jde, &t);
         z = pl->map + (blk + 2) * pl->rec;
 
         // the magick of function pointers
@@ -294,3 +437,262 @@ int jpl_calc(struct _jpl_s *pl, struct mpos_s *now, double jde, int n, int m)
         now->jde = jde;
         return 0;
 }
+
+/*
+ *  jpl_calc_all
+ *
+ *  Caculate the barycentric position+velocity+acceleration of several bodies
+ *  (PLAN_* codes in n[]) at once.  Each Chebyshev component in the record is
+ *  summed at most once, and the polynomials are shared between components
+ *  that use the same number of intervals.
+ *
+ */
+
+#define _JPL_MAX_CF     24              // largest number of coefficients supported
+
+struct _cheb_s {
+        int niv;                        // number of intervals (0 if unused)
+        int ncf;                        // number of polynomials set up
+        int b;                          // interval index
+        double c;                       // derivative scaling
+        double T[_JPL_MAX_CF], S[_JPL_MAX_CF], U[_JPL_MAX_CF];
+};
+
+// which components are needed for each of the PLAN_* codes
+static const int _need[_NUM_TEST][2] = {
+        {-1, -1},                       // PLAN_BAR
+        {JPL_SUN, -1},                  // PLAN_SOL
+        {JPL_EMB, JPL_LUN},             // PLAN_EAR
+        {JPL_EMB, -1},                  // PLAN_EMB
+        {JPL_EMB, JPL_LUN},             // PLAN_LUN
+        {JPL_MER, -1},
+        {JPL_VEN, -1},
+        {JPL_MAR, -1},
+        {JPL_JUP, -1},
+        {JPL_SAT, -1},
+        {JPL_URA, -1},
+        {JPL_NEP, -1},
+        {JPL_PLU, -1},
+};
+
+static void _cheb(struct _cheb_s *ch, int niv, int ncf, double t0, double t1)
+{
+        double t;
+        int p, beg;
+
+        if (ch->niv != niv) {
+                // adjust to correct interval
+                t = t0 * (double)niv;
+                ch->niv = niv;
+                ch->b = (int)t;
+                ch->c = (double)(niv * 2) / t1 / 86400.0;
+                ch->ncf = 0;
+                t = 2.0 * fmod(t, 1.0) - 1.0;
+                if (ch->b >= niv) {
+                        ch->b = niv - 1;
+                        t = 1.0;
+                }
+                ch->T[0] = 1.0; ch->T[1] = t;
+                ch->S[0] = 0.0; ch->S[1] = 1.0;
+                ch->U[0] = 0.0; ch->U[1] = 0.0; ch->U[2] = 4.0;
+                ch->ncf = 2;
+        }
+
+        if (ncf <= ch->ncf)
+                return;
+
+        // extend the polynomials and derivatives up to ncf terms
+        t = ch->T[1];
+        for (p = ch->ncf; p < ncf; p++) {
+                ch->T[p] = 2.0 * t * ch->T[p-1] - ch->T[p-2];
+                ch->S[p] = 2.0 * t * ch->S[p-1] + 2.0 * ch->T[p-1] - ch->S[p-2];
+        }
+        beg = (ch->ncf > 3) ? ch->ncf : 3;
+        for (p = beg; p < ncf; p++) {
+                ch->U[p] = 2.0 * t * ch->U[p-1] + 4.0 * ch->S[p-1] - ch->U[p-2];
+        }
+
+        ch->ncf = ncf;
+}
+
+static void _sum(const double *P, int ncm, int ncf, const struct _cheb_s *ch, struct mpos_s *pos)
+{
+        const double c = ch->c;
+        int p, m, n;
+
+        for (m = 0; m < ncm; m++) {
+                pos->u[m] = pos->v[m] = pos->w[m] = 0.0;
+                n = ncf * (m + ch->b * ncm);
+
+                for (p = 0; p < ncf; p++) {
+                        pos->u[m] += ch->T[p] * P[n+p];
+                        pos->v[m] += ch->S[p] * P[n+p] * c;
+                        pos->w[m] += ch->U[p] * P[n+p] * c * c;
+                }
+        }
+}
+
+static int _calc_all(struct _jpl_s *pl, const double *z, double t, struct mpos_s *now, double jde, const int *n, int num)
+{
+        struct _cheb_s ch[_NUM_JPL];
+        struct mpos_s cmp[_NUM_JPL];
+        int done[_NUM_JPL];
+        double f;
+        int i, k, q, c, s;
+
+        for (k = 0; k < _NUM_JPL; k++) {
+                done[k] = 0;
+                ch[k].niv = 0;
+        }
+
+        // sum each component needed once, sharing polynomials between equal interval counts
+        for (i = 0; i < num; i++) {
+                if (n[i] < 0 || n[i] >= _NUM_TEST)
+                        return -1;
+
+                for (q = 0; q < 2; q++) {
+                        c = _need[n[i]][q];
+                        if (c < 0 || done[c])
+                                continue;
+
+                        if (pl->ncf[c] > _JPL_MAX_CF)
+                                return -1;
+
+                        for (s = 0; s < _NUM_JPL; s++)
+                                if (ch[s].niv == 0 || ch[s].niv == pl->niv[c])
+                                        break;
+
+                        _cheb(&ch[s], pl->niv[c], pl->ncf[c], t, pl->inc);
+                        _sum(&z[pl->off[c]], pl->ncm[c], pl->ncf[c], &ch[s], &cmp[c]);
+                        done[c] = 1;
+                }
+        }
+
+        for (i = 0; i < num; i++) {
+                switch (n[i]) {
+                case PLAN_BAR:
+                        vecpos_nul(now[i].u);
+                        vecpos_nul(now[i].v);
+                        vecpos_nul(now[i].w);
+                        break;
+
+                case PLAN_EAR:
+                case PLAN_LUN:
+                        f = (n[i] == PLAN_EAR) ? -1.0 / (1.0 + pl->cem) : pl->cem / (1.0 + pl->cem);
+
+                        vecpos_set(now[i].u, cmp[JPL_EMB].u);
+                        vecpos_off(now[i].u, cmp[JPL_LUN].u, f);
+
+                        vecpos_set(now[i].v, cmp[JPL_EMB].v);
+                        vecpos_off(now[i].v, cmp[JPL_LUN].v, f);
+
+                        vecpos_set(now[i].w, cmp[JPL_EMB].w);
+                        vecpos_off(now[i].w, cmp[JPL_LUN].w, f);
+                        break;
+
+                default:
+                        c = _need[n[i]][0];
+                        vecpos_set(now[i].u, cmp[c].u);
+                        vecpos_set(now[i].v, cmp[c].v);
+                        vecpos_set(now[i].w, cmp[c].w);
+                        break;
+                }
+
+                now[i].jde = jde;
+        }
+
+        return 0;
+}
+
+int jpl_calc_all(struct _jpl_s *pl, struct mpos_s *now, double jde, const int *n, int num)
+{
+        size_t blk;
+        double t;
+
+        if (pl == NULL || now == NULL || n == NULL)
+                return -1;
+
+        // check if covered by this file
+        if (jde < pl->beg || jde > pl->end || pl->map == NULL)
+                return -1;
+
+        // compute record number and 'offset' into record
+        blk = _blk(pl, jde, &t);
+
+        return _calc_all(pl, pl->map + (blk + 2) * pl->rec, t, now, jde, n, num);
+}
+
+/*
+ *  jpl_calc_all_cur
+ *
+ *  Same as jpl_calc_all(), for a caller that moves through time in order.  The
+ *  record in use is copied into cur, so the record number and the mapping are
+ *  only looked at again once jde leaves it, and the next record in the
+ *  direction of travel is then requested from the kernel ahead of time.  Times
+ *  within _JPL_EDGE of a record boundary go through the usual lookup, so the
+ *  results are identical to jpl_calc_all().
+ *
+ */
+
+#define _JPL_EDGE       1.0e-6          // days, well above the rounding of (jde - beg) / inc
+
+int jpl_calc_all_cur(struct _jpl_s *pl, struct jpl_cur_s *cur, struct mpos_s *now, double jde, const int *n, int num)
+{
+        size_t blk, pg, o0, o1;
+        double lo, t;
+        int dir;
+
+        if (cur == NULL)
+                return jpl_calc_all(pl, now, jde, n, num);
+        if (pl == NULL || now == NULL || n == NULL)
+                return -1;
+
+        if (cur->jpl == pl && cur->rec != NULL && jde > cur->lo && jde < cur->hi && jde <= pl->end) {
+                cur->last = jde;
+                return _calc_all(pl, cur->rec, fmod(jde - pl->beg, pl->inc) / pl->inc, now, jde, n, num);
+        }
+
+        // check if covered by this file
+        if (jde < pl->beg || jde > pl->end || pl->map == NULL)
+                return -1;
+
+        blk = _blk(pl, jde, &t);
+        dir = (cur->jpl == pl && cur->rec != NULL && jde < cur->last) ? -1 : 1;
+
+        if (cur->jpl != pl) {
+                free(cur->rec);
+                cur->rec = NULL;
+                if (posix_memalign((void **)&cur->rec, 64, pl->rec) != 0)
+                        cur->rec = NULL;
+                cur->jpl = pl;
+        }
+        if (cur->rec == NULL)
+                return jpl_calc_all(pl, now, jde, n, num);
+
+        memcpy(cur->rec, pl->map + (blk + 2) * pl->rec, pl->rec);
+        cur->blk = blk;
+        lo = pl->beg + (double)blk * pl->inc;
+        cur->lo = lo + _JPL_EDGE;
+        cur->hi = lo + pl->inc - _JPL_EDGE;
+        cur->last = jde;
+
+        // if the next record is there, page it in now
+        if ((dir > 0 && blk + 1 < pl->nrec) || (dir < 0 && blk > 0)) {
+                pg = sysconf(_SC_PAGESIZE);
+                o0 = (blk + 2 + dir) * pl->rec / pg * pg;
+                o1 = (blk + 3 + dir) * pl->rec;
+                if (o1 <= pl->len && madvise(pl->map + o0, o1 - o0, MADV_WILLNEED) < 0)
+                        { ; } // only a hint
+        }
+
+        return _calc_all(pl, cur->rec, t, now, jde, n, num);
+}
+
+void jpl_cur_free(struct jpl_cur_s *cur)
+{
+        if (cur == NULL)
+                return;
+
+        free(cur->rec);
+        memset(cur, 0, sizeof(struct jpl_cur_s));
+}
@@ -1,7 +1,21 @@
-struct _jpl_s * jpl_init(void);
+struct _jpl_s;
+struct jpl_cur_s;
+
+struct _jpl_s * jpl_init(const char *path);
+struct _jpl_s * jpl_load(const char *path, double beg, double end, int mode);
 int jpl_free(struct _jpl_s *jpl);
 void jpl_work(double *P, int ncm, int ncf, int niv, double t0, double t1, double *u, double *v, double *w);
 int jpl_calc(struct _jpl_s *jpl, struct mpos_s *now, double jde, int n, int m);
+int jpl_calc_all(struct _jpl_s *jpl, struct mpos_s *now, double jde, const int *n, int num);
+int jpl_calc_all_cur(struct _jpl_s *jpl, struct jpl_cur_s *cur, struct mpos_s *now, double jde, const int *n, int num);
+void jpl_cur_free(struct jpl_cur_s *cur);
+
+// how jpl_load() makes the records available
+enum {
+        JPL_LOAD_MAP,                   // memory map, paged in on first touch
+        JPL_LOAD_PREFAULT,              // memory map, prefault the time window
+        JPL_LOAD_COPY,                  // copy the time window to (huge page) memory
+};
 
 // these are the body codes for the user to specify
 enum {
@@ -58,9 +72,20 @@ struct _jpl_s {
         int32_t ncm[_NUM_JPL];          // number of components / dimension
 ///
         size_t len, rec;                // file and record sizes
+        size_t nrec;                    // records available after the two header records
         void *map;                      // memory mapped location
 };
 
+// the record one caller is working in, for jpl_calc_all_cur(); zero before first use.
+// Each thread needs its own, the ephemeris itself stays read-only.
+struct jpl_cur_s {
+        const struct _jpl_s *jpl;       // ephemeris the copy was taken from
+        double lo, hi;                  // times that certainly fall in the record
+        double last;                    // time of the previous call
+        size_t blk;                     // record number
+        double *rec;                    // aligned copy of the record
+};
+
 // From Weryk's code
 /////// private interface :
 
@@ -46,8 +46,20 @@
  * Field (C type)               Required    Description
  * ============================ =========== ==================================================================
  * c (double)                   Yes         Speed of light in the units used for the simulation.
+ * beta_array (double*)         No          Betas indexed by position in the particles array (0 for particles that feel no radiation). If set, the particles' beta parameters are ignored
+ * beta_array_length (int)      No          Number of entries in beta_array. Required with beta_array, and must be at least the number of particles
+ * n_threads (int)              No          Number of OpenMP threads sharing the beta_array sweep (default 1). Results do not depend on it.
+ * offload_device (int)         No          OpenMP target device (e.g. a GPU) running the beta_array sweep. Needs REBOUNDx built with make OFFLOAD=1
  * ============================ =========== ==================================================================
  *
+ * For large numbers of dust grains, beta_array avoids a parameter lookup per particle and evaluates all sources in a
+ * single sweep over the particles. On the host, the particles are copied in blocks into contiguous position, velocity
+ * and acceleration arrays, and each source is applied to a block in a flat loop the compiler can vectorize. The array is owned by the caller (e.g. a NumPy array passed with ctypes), must stay
+ * allocated while the effect is used, and must be kept in step with the particles array if particles are added or removed.
+ * Each particle's acceleration only depends on its own state and the sources', so the sweep can run on an offload device.
+ * The particles are uploaded and downloaded on every call, since the integrator moves them on the host. If the device
+ * cannot be used, the sweep runs on the host, with a warning the first time.
+ *
  * **Particle Parameters**
  *
  * If no particles have radiation_source set, effect will assume the particle at index 0 in the particles array is the source.
@@ -65,17 +77,26 @@
 #include <math.h>
 #include <stdlib.h>
 #include "reboundx.h"
+#include "rebxtools.h"
+#include "core.h"
+
+// Built with make OFFLOAD=1 and a compiler with OpenMP 4.5 target support
+#if defined(REBX_OFFLOAD) && defined(_OPENMP) && _OPENMP >= 201511
+#include <omp.h>
+#define REBX_RAD_OFFLOAD        // beta_array sweep on an OpenMP target device when offload_device is set
+#endif
 
 static void rebx_calculate_radiation_forces(struct rebx_extras* const rebx, struct reb_simulation* const sim, const double c, const int source_index, struct reb_particle* const particles, const int N){
     const struct reb_particle source = particles[source_index];
     const double mu = sim->G*source.m;
+    const int beta_key = rebx_get_param_key(rebx, "beta");
+    const struct rebx_particle_list* const dust = rebx_get_particle_list(rebx, beta_key, particles, N); // only particles with beta set feel radiation forces
 
-    for (int i=0;i<N;i++){
-        
+    for (int k=0;k<dust->N_indices;k++){
+        const int i = dust->indices[k];
         if(i == source_index) continue;
         
-        const double* beta = rebx_get_param(rebx, particles[i].ap, "beta");
-        if(beta == NULL) continue; // only particles with beta set feel radiation forces
+        const double* beta = rebx_get_param_by_key(rebx, particles[i].ap, beta_key);
         
         const struct reb_particle p = particles[i];
         const double dx = p.x - source.x; 
@@ -97,25 +118,311 @@ static void rebx_calculate_radiation_forces(struct rebx_extras* const rebx, stru
 	}
 }
 
+struct rebx_radiation_source {
+    int index;
+    double mu;
+    double x, y, z;
+    double vx, vy, vz;
+};
+
+#ifdef REBX_RAD_OFFLOAD
+#pragma omp declare target
+#endif
+// Adds the radiation forces from every source on particles[i] in the device sweep
+static void rebx_radiation_forces_particle(const double c, const double beta, const struct rebx_radiation_source* const sources, const int N_sources, struct reb_particle* const particles, const int i){
+    const struct reb_particle p = particles[i];
+    double ax = 0.;
+    double ay = 0.;
+    double az = 0.;
+    for (int k=0; k<N_sources; k++){
+        const struct rebx_radiation_source* const source = &sources[k];
+        if (source->index == i){
+            continue;
+        }
+        const double dx = p.x - source->x; 
+        const double dy = p.y - source->y;
+        const double dz = p.z - source->z;
+        const double dr = sqrt(dx*dx + dy*dy + dz*dz); // distance to star
+
+        const double dvx = p.vx - source->vx;
+        const double dvy = p.vy - source->vy;
+        const double dvz = p.vz - source->vz;
+        const double rdot = (dx*dvx + dy*dvy + dz*dvz)/dr; // radial velocity
+        const double a_rad = beta*source->mu/(dr*dr);
+
+        // Equation (5) of Burns, Lamy & Soter (1979)
+
+        ax += a_rad*((1.-rdot/c)*dx/dr - dvx/c);
+        ay += a_rad*((1.-rdot/c)*dy/dr - dvy/c);
+        az += a_rad*((1.-rdot/c)*dz/dr - dvz/c);
+    }
+    particles[i].ax += ax;
+    particles[i].ay += ay;
+    particles[i].az += az;
+}
+#ifdef REBX_RAD_OFFLOAD
+#pragma omp end declare target
+#endif
+
+// Buffers for the beta_array sweep kept on the force between calls
+struct rebx_radiation_workspace{
+    int N_sources_allocated;
+    struct rebx_radiation_source* sources;
+    int N_allocated;
+    double* soa;                            // x, y, z, vx, vy, vz, ax, ay, az of every particle, N_allocated doubles each
+    int offload_warned;                     // the offload_device warning has been issued
+};
+
+static void rebx_radiation_forces_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
+    struct rebx_radiation_workspace* const ws = rebx_get_param(rebx, force->ap, "radiation_forces_workspace");
+    if (ws){
+        free(ws->sources);
+        free(ws->soa);
+    }
+    free(ws);
+}
+
+/*
+ * Host sweep.  Blocks of particles are copied into the SoA arrays, each source is applied to the block in a flat loop
+ * over contiguous arrays that the compiler vectorizes, and the block's accelerations are added back. Particles with
+ * beta = 0 go through the loop too and add exact zeros, rather than being branched around. Vectorizing the sqrt needs
+ * -fno-math-errno, which the Makefile and setup.py pass.  Each particle sums the sources in the same order and with the same operations as
+ * rebx_radiation_forces_particle.  Blocks are independent, so they are shared among the n_threads.
+ */
+#define REBX_RAD_BLOCK 256
+
+static void rebx_radiation_sweep(const double c, const struct rebx_radiation_source* const source, const double* const restrict beta, 
+        const double* const restrict x, const double* const restrict y, const double* const restrict z, 
+        const double* const restrict vx, const double* const restrict vy, const double* const restrict vz, 
+        double* const restrict ax, double* const restrict ay, double* const restrict az, const int i0, const int i1){
+    const double mu = source->mu;
+    const double sx = source->x;
+    const double sy = source->y;
+    const double sz = source->z;
+    const double svx = source->vx;
+    const double svy = source->vy;
+    const double svz = source->vz;
+#pragma omp simd
+    for (int i=i0; i<i1; i++){
+        const double dx = x[i] - sx; 
+        const double dy = y[i] - sy;
+        const double dz = z[i] - sz;
+        const double dr = sqrt(dx*dx + dy*dy + dz*dz + (beta[i] == 0.)); // distance to star (offset for beta = 0 so their zero terms stay finite)
+
+        const double dvx = vx[i] - svx;
+        const double dvy = vy[i] - svy;
+        const double dvz = vz[i] - svz;
+        const double rdot = (dx*dvx + dy*dvy + dz*dvz)/dr; // radial velocity
+        const double a_rad = beta[i]*mu/(dr*dr);
+
+        // Equation (5) of Burns, Lamy & Soter (1979)
+
+        ax[i] += a_rad*((1.-rdot/c)*dx/dr - dvx/c);
+        ay[i] += a_rad*((1.-rdot/c)*dy/dr - dvy/c);
+        az[i] += a_rad*((1.-rdot/c)*dz/dr - dvz/c);
+    }
+}
+
+static void rebx_calculate_radiation_forces_array(struct rebx_radiation_workspace* const ws, const double c, const double* const beta, const int N_sources, struct reb_particle* const particles, const int N, const int n_threads){
+    const struct rebx_radiation_source* const sources = ws->sources;
+    double* const x = ws->soa;
+    double* const y = x + ws->N_allocated;
+    double* const z = y + ws->N_allocated;
+    double* const vx = z + ws->N_allocated;
+    double* const vy = vx + ws->N_allocated;
+    double* const vz = vy + ws->N_allocated;
+    double* const ax = vz + ws->N_allocated;
+    double* const ay = ax + ws->N_allocated;
+    double* const az = ay + ws->N_allocated;
+#pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
+    for (int b=0; b<N; b+=REBX_RAD_BLOCK){
+        const int e = b + REBX_RAD_BLOCK < N ? b + REBX_RAD_BLOCK : N;
+        for (int i=b; i<e; i++){
+            x[i] = particles[i].x;
+            y[i] = particles[i].y;
+            z[i] = particles[i].z;
+            vx[i] = particles[i].vx;
+            vy[i] = particles[i].vy;
+            vz[i] = particles[i].vz;
+            ax[i] = 0.;
+            ay[i] = 0.;
+            az[i] = 0.;
+        }
+        for (int k=0; k<N_sources; k++){
+            // A source does not act on itself, so the block is split around it
+            const int index = sources[k].index;
+            const int i_split = index < b ? b : (index > e ? e : index);
+            rebx_radiation_sweep(c, &sources[k], beta, x, y, z, vx, vy, vz, ax, ay, az, b, i_split);
+            rebx_radiation_sweep(c, &sources[k], beta, x, y, z, vx, vy, vz, ax, ay, az, (index >= b && index < e) ? index + 1 : i_split, e);
+        }
+        for (int i=b; i<e; i++){
+            particles[i].ax += ax[i];
+            particles[i].ay += ay[i];
+            particles[i].az += az[i];
+        }
+    }
+}
+
+static struct rebx_radiation_workspace* rebx_radiation_get_workspace(struct reb_simulation* const sim, struct rebx_force* const force, const int N_sources, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_radiation_workspace* ws = rebx_get_param(rebx, force->ap, "radiation_forces_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for radiation_forces.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "radiation_forces_workspace", ws);
+        rebx_add_free_arrays(rebx, force, rebx_radiation_forces_free_arrays);
+    }
+    if (ws->N_sources_allocated < N_sources){
+        struct rebx_radiation_source* const sources = realloc(ws->sources, N_sources*sizeof(*sources));
+        if (sources == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for radiation_forces.\n");
+            return NULL;
+        }
+        ws->sources = sources;
+        ws->N_sources_allocated = N_sources;
+    }
+    if (ws->N_allocated < N){
+        free(ws->soa);
+        ws->soa = malloc(9*N*sizeof(*ws->soa));
+        ws->N_allocated = ws->soa ? N : 0;
+        if (ws->soa == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for radiation_forces.\n");
+            return NULL;
+        }
+    }
+    return ws;
+}
+
+// Same sweep on an OpenMP target device. Returns 0 (after a warning the first time) when the device cannot be used
+static int rebx_calculate_radiation_forces_device(struct reb_simulation* const sim, struct rebx_radiation_workspace* const ws, const double c, const double* const beta, const int N_sources, struct reb_particle* const particles, const int N, const int device){
+#ifdef REBX_RAD_OFFLOAD
+    if (device >= omp_get_num_devices()){
+        if (!ws->offload_warned){
+            reb_warning(sim, "REBOUNDx Warning: offload_device in radiation_forces is not an available OpenMP device. Using the host.");
+            ws->offload_warned = 1;
+        }
+        return 0;
+    }
+    const struct rebx_radiation_source* const sources = ws->sources;
+#pragma omp target teams distribute parallel for device(device) map(to: beta[0:N], sources[0:N_sources]) map(tofrom: particles[0:N])
+    for (int i=0; i<N; i++){
+        if (beta[i] != 0.){
+            rebx_radiation_forces_particle(c, beta[i], sources, N_sources, particles, i);
+        }
+    }
+    return 1;
+#else
+    if (!ws->offload_warned){
+        reb_warning(sim, "REBOUNDx Warning: offload_device is set in radiation_forces, but REBOUNDx was built without OpenMP offload support (make OFFLOAD=1). Using the host.");
+        ws->offload_warned = 1;
+    }
+    return 0;
+#endif
+}
+
+static void rebx_radiation_forces_array(struct reb_simulation* const sim, struct rebx_force* const radiation_forces, const double c, const double* const beta, const struct rebx_particle_list* const source_list, struct reb_particle* const particles, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    const int* const length = rebx_get_param(rebx, radiation_forces->ap, "beta_array_length");
+    if (length == NULL || *length < N){
+        reb_error(sim, "REBOUNDx Error: radiation_forces beta_array_length must be set and at least the number of particles.\n");
+        return;
+    }
+    const int N_sources = source_list->N_indices ? source_list->N_indices : 1;  // default source to index 0 if "radiation_source" not found on any particle
+    struct rebx_radiation_workspace* const ws = rebx_radiation_get_workspace(sim, radiation_forces, N_sources, N);
+    if (ws == NULL){
+        return;
+    }
+    struct rebx_radiation_source* const sources = ws->sources;
+    for (int k=0; k<N_sources; k++){
+        const int index = source_list->N_indices ? source_list->indices[k] : 0;
+        const struct reb_particle source = particles[index];
+        sources[k] = (struct rebx_radiation_source){index, sim->G*source.m, source.x, source.y, source.z, source.vx, source.vy, source.vz};
+    }
+    const int* const device = rebx_get_param(rebx, radiation_forces->ap, "offload_device");
+    if (device != NULL && *device >= 0 && rebx_calculate_radiation_forces_device(sim, ws, c, beta, N_sources, particles, N, *device)){
+        return;
+    }
+    const int* const n_threads_ptr = rebx_get_param(rebx, radiation_forces->ap, "n_threads");
+    const int n_threads = (n_threads_ptr && *n_threads_ptr > 1) ? *n_threads_ptr : 1;
+    rebx_calculate_radiation_forces_array(ws, c, beta, N_sources, particles, N, n_threads);
+}
+
 void rebx_radiation_forces(struct reb_simulation* const sim, struct rebx_force* const radiation_forces, struct reb_particle* const particles, const int N){
     struct rebx_extras* const rebx = sim->extras;
     double* c = rebx_get_param(rebx, radiation_forces->ap, "c");
     if (c == NULL){
         reb_error(sim, "Need to set speed of light in radiation_forces effect.  See examples in documentation.\n");
+        return;
     }
     
-    int source_found=0;
-    for (int i=0; i<N; i++){
-        if (rebx_get_param(rebx, particles[i].ap, "radiation_source") != NULL){
-            source_found = 1;
-            rebx_calculate_radiation_forces(rebx, sim, *c, i, particles, N);
-        }
+
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "radiation_source"), particles, N);
+    const double* const beta = rebx_get_param(rebx, radiation_forces->ap, "beta_array");
+    if (beta != NULL){
+        rebx_radiation_forces_array(sim, radiation_forces, *c, beta, sources, particles, N);
+        return;
     }
-    if (!source_found){
+    for (int k=0; k<sources->N_indices; k++){
+        rebx_calculate_radiation_forces(rebx, sim, *c, sources->indices[k], particles, N);
+    }
+    if (sources->N_indices == 0){
         rebx_calculate_radiation_forces(rebx, sim, *c, 0, particles, N);    // default source to index 0 if "radiation_source" not found on any particle
     }
 }
 
+static void rebx_radiation_forces_term(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair){
+    const double* beta = rebx_get_param_by_key(term->rebx, particles[i].ap, term->key[0]);
+    if(beta == NULL){ // only particles with beta set feel radiation forces
+        return;
+    }
+    const struct reb_particle source = particles[term->source_index];
+    const struct reb_particle p = particles[i];
+    const double mu = term->c[0];
+    const double c = term->c[1];
+    const double dx = pair->dx;
+    const double dy = pair->dy;
+    const double dz = pair->dz;
+    const double dr = pair->r; // distance to star
+    
+    const double dvx = p.vx - source.vx;
+    const double dvy = p.vy - source.vy;
+    const double dvz = p.vz - source.vz;
+    const double rdot = (dx*dvx + dy*dvy + dz*dvz)/dr; // radial velocity
+    const double a_rad = *beta*mu/(dr*dr);
+
+    // Equation (5) of Burns, Lamy & Soter (1979)
+
+    particles[i].ax += a_rad*((1.-rdot/c)*dx/dr - dvx/c);
+    particles[i].ay += a_rad*((1.-rdot/c)*dy/dr - dvy/c);
+    particles[i].az += a_rad*((1.-rdot/c)*dz/dr - dvz/c);
+}
+
+int rebx_radiation_forces_source_terms(struct reb_simulation* const sim, struct rebx_force* const radiation_forces, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max){
+    struct rebx_extras* const rebx = sim->extras;
+    double* c = rebx_get_param(rebx, radiation_forces->ap, "c");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "radiation_source"), particles, N);
+    const int N_sources = sources->N_indices ? sources->N_indices : 1;  // default source to index 0 if "radiation_source" not found on any particle
+    if (c == NULL || N_sources > N_max || N < 1 || rebx_get_param(rebx, radiation_forces->ap, "beta_array") != NULL){    // the beta_array sweep already handles all sources at once
+        return -1;
+    }
+    for (int k=0; k<N_sources; k++){
+        const int source_index = sources->N_indices ? sources->indices[k] : 0;
+        struct rebx_source_term* const term = &terms[k];
+        *term = (struct rebx_source_term){0};
+        term->accumulate = rebx_radiation_forces_term;
+        term->rebx = rebx;
+        term->source_index = source_index;
+        term->needs_r = 1;
+        term->key[0] = rebx_get_param_key(rebx, "beta");
+        term->c[0] = sim->G*particles[source_index].m;
+        term->c[1] = *c;
+    }
+    return N_sources;
+}
+
 double rebx_rad_calc_beta(const double G, const double c, const double source_mass, const double source_luminosity, const double radius, const double density, const double Q_pr){
     return 3.*source_luminosity*Q_pr/(16.*M_PI*G*source_mass*c*density*radius);   
 }
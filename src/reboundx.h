@@ -124,6 +124,13 @@ enum rebx_binary_field_type{
     REBX_BINARY_FIELD_TYPE_PARTICLES=24,
     REBX_BINARY_FIELD_TYPE_FORCE=25,
     REBX_BINARY_FIELD_TYPE_SNAPSHOT=26,
+    REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMNS=27,
+    REBX_BINARY_FIELD_TYPE_PARTICLE_COLUMN=28,
+    REBX_BINARY_FIELD_TYPE_COLUMN_INDICES=29,
+    REBX_BINARY_FIELD_TYPE_COLUMN_VALUES=30,
+    REBX_BINARY_FIELD_TYPE_SNAPSHOT_DIFF=31,
+    REBX_BINARY_FIELD_TYPE_SNAPSHOT_TIME=32,
+    REBX_BINARY_FIELD_TYPE_KEYFRAME_OFFSET=33,
 };
 
 /**
@@ -160,6 +167,7 @@ enum rebx_integrator {
     REBX_INTEGRATOR_RK4 = 1,
     REBX_INTEGRATOR_EULER = 2,
     REBX_INTEGRATOR_RK2 = 3,
+    REBX_INTEGRATOR_RK45 = 4,
 };
 
 /****************************************
@@ -183,6 +191,16 @@ struct rebx_param{
     char* name;                 ///< For searching linked lists and informative errors
     enum rebx_param_type type;  ///< Needed to cast value
     void* value;                ///< Pointer to parameter value
+    int key;                    ///< Interned index of name in rebx_extras.param_keys (-1 if name not registered)
+};
+
+/**
+ * @brief Call counters for a force or operator, accumulated while rebx_extras.profiling is set.
+ */
+struct rebx_profile{
+    unsigned long N_calls;          ///< Number of times the force or operator was called
+    double walltime;                ///< Cumulative wall time spent in the calls (seconds)
+    unsigned long N_particles;      ///< Cumulative number of particles passed to the calls
 };
 
 /**
@@ -195,6 +213,7 @@ struct rebx_force{
     // See comments in params.py in __init__
     enum rebx_force_type force_type;    ///< Force type for internal logic
     void (*update_accelerations) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N); ///< Function pointer to add additional accelerations
+    struct rebx_profile profile;        ///< Counters filled in when profiling is enabled
 };
 
 /**
@@ -207,6 +226,7 @@ struct rebx_operator{
     // See comments in params.py in __init__
     enum rebx_operator_type operator_type;  ///< Operator type for internal logic
     void (*step_function) (struct reb_simulation* sim, struct rebx_operator* operator, const double dt);       ///< Function pointer to execute step
+    struct rebx_profile profile;        ///< Counters filled in when profiling is enabled. Summed over all steps using the operator
 };
 
 /**
@@ -218,6 +238,36 @@ struct rebx_step{
     double dt_fraction;                 ///< Fraction of sim.dt to use each time it's called
 };
 
+/**
+ * @brief Entry of the flat table rebx_additional_forces runs through, compiled from the additional_forces list.
+ */
+struct rebx_source_term;
+struct rebx_force_entry{
+    void (*update_accelerations) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
+    struct rebx_force* force;
+    int (*source_terms) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);    ///< Non-NULL if the force can join the fused source sweep (see the "fused" force parameter)
+    void (*update_variations) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);  ///< Non-NULL if the force adds accelerations to first order variational particles
+};
+
+/**
+ * @brief Entry of the flat tables the timestep modifications run through, compiled from the step lists.
+ */
+struct rebx_step_entry{
+    void (*step_function) (struct reb_simulation* sim, struct rebx_operator* operator, const double dt);
+    struct rebx_operator* operator;
+    double dt_fraction;
+};
+
+/**
+ * @brief Flat dispatch table.  Rebuilt whenever forces or operator steps are added or removed, and entries whose
+ * update_accelerations or step_function was reassigned are refreshed before they are called.
+ */
+struct rebx_dispatch_table{
+    void* entries;                  ///< rebx_force_entry or rebx_step_entry array, in list order
+    int N;                          ///< Number of entries
+    int N_updaters;                 ///< Number of REBX_OPERATOR_UPDATER steps (step tables only)
+};
+
 /**
  * @brief Structure used as building block to save and load binary files.
  */
@@ -240,6 +290,26 @@ struct rebx_extras {
     struct rebx_node* registered_params;            ///< Linked list of rebx_params with all the parameter names registered with their type (for type safety)
     struct rebx_node* allocated_forces;             ///< For memory management
     struct rebx_node* allocated_operators;          ///< For memory management
+
+    struct rebx_param** param_keys;                 ///< Registered params indexed by their interned integer key
+    int N_param_keys;                               ///< Number of registered keys
+    int N_allocated_param_keys;                     ///< Allocated length of param_keys
+    int* param_key_hash;                            ///< Open-addressing table mapping hashed names to key+1 (0 = empty)
+    int N_param_key_hash;                           ///< Length of param_key_hash (power of 2)
+
+    unsigned long param_generation;                 ///< Incremented whenever a param is added to an object or a particle is removed
+    struct rebx_particle_list** particle_lists;     ///< Cached indices of particles carrying each param, indexed by key (see rebxtools.h)
+    int N_particle_lists;                           ///< Length of particle_lists
+    struct rebx_arena* arena;                       ///< Pools holding the nodes, params and scalar values of all param lists
+
+    struct rebx_dispatch_table force_table;         ///< Compiled additional_forces
+    struct rebx_dispatch_table pre_table;           ///< Compiled pre_timestep_modifications
+    struct rebx_dispatch_table post_table;          ///< Compiled post_timestep_modifications
+
+    int profiling;                                  ///< If nonzero, record call counts and wall time in each force and operator profile
+    struct rebx_profile fused_profile;              ///< Counters for the shared sweep of forces with "fused" set (collecting each force's terms is counted in its own profile)
+    struct rebx_node* copied_values;                ///< Struct param values (e.g. reb_orbit) copied by rebx_copy_extras, owned and freed by this instance
+    int var_order_warned;                           ///< Set once the warning that second order variations are ignored has been issued
 };
 
 /****************************************
@@ -276,9 +346,72 @@ void rebx_extras_cleanup(struct reb_simulation* sim);
  */
 void rebx_free(struct rebx_extras* rebx);
 
+/**
+ * @brief Deep copies all registered parameters, forces, operators, steps and particle parameters of a REBOUNDx instance in memory, and attaches the copy to sim.
+ * @details sim would typically be a copy of src's simulation (e.g. from reb_copy_simulation) and must have the same number of particles.
+ * Any param lists its particles point to are replaced. Force params are remapped to the copied forces. Workspaces that effects and
+ * integrators build lazily are not copied, and get rebuilt for sim on first use. Other pointer and struct params set by the user
+ * (e.g. J_n arrays, an ephemeris, or a reb_orbit for min_distance_orbit) are shared with src.
+ * @param src Pointer to the rebx_extras instance to copy.
+ * @param sim Pointer to the simulation to attach the copy to.
+ * @return Pointer to the new rebx_extras instance, or NULL if the copy failed.
+ */
+struct rebx_extras* rebx_copy_extras(struct rebx_extras* const src, struct reb_simulation* sim);
+
+/**
+ * @brief Same as rebx_copy_extras(), but copies into an extras instance that was just initialized on its simulation (e.g. from Python).
+ * @param rebx Pointer to the rebx_extras instance to copy into.
+ * @param src Pointer to the rebx_extras instance to copy.
+ * @return 1 on success, 0 on failure.
+ */
+int rebx_init_extras_from_copy(struct rebx_extras* const rebx, struct rebx_extras* const src);
+
+/**
+ * @brief A parameter value to set on one member of an ensemble (see rebx_run_ensemble()).
+ */
+struct rebx_ensemble_override{
+    const char* object;         ///< Name of the force or operator holding the param, or NULL for a particle param
+    int index;                  ///< Index of the particle when object is NULL
+    const char* name;           ///< Name of the param. Must be registered as a double, int or uint32 param
+    double value;               ///< Value to set (truncated for int and uint32 params)
+};
+
+/**
+ * @brief Integrates copies of rebx's simulation to tmax that differ only in some parameters, e.g. for parameter sweeps.
+ * @details Each member is a copy of the simulation (reb_copy_simulation) and its effects (rebx_copy_extras()) with the member's
+ * overrides applied, and is freed after output is called on it. Params that effects write to, like min_distance_orbit, are copied into
+ * each member. Pointer params set by the user, like an ephemeris context, are shared by all members and only read. Members are shared out between n_threads OpenMP threads, each taking the next member when it finishes one
+ * (they run one after the other without OpenMP). ephemeris_forces without an "ephemeris" param use the default context, which is loaded
+ * once by whichever member first needs it and then shared.
+ * @param rebx Pointer to the rebx_extras instance attached to the base simulation. Not changed.
+ * @param tmax Time to integrate every member to.
+ * @param N_members Number of members.
+ * @param overrides N_members*N_overrides overrides, with those of member m at overrides[m*N_overrides].
+ * @param N_overrides Number of overrides per member.
+ * @param output Called from the thread that ran a member once it reaches tmax, with the member's index and data. Can be NULL.
+ * @param data Passed through to output, e.g. an array to write each member's results into.
+ * @param n_threads Number of threads.
+ * @return Number of members that were run.
+ */
+int rebx_run_ensemble(struct rebx_extras* const rebx, const double tmax, const int N_members, const struct rebx_ensemble_override* const overrides, const int N_overrides, void (*output)(struct reb_simulation* sim, struct rebx_extras* rebx, int member, void* data), void* data, int n_threads);
+
 int rebx_remove_force(struct rebx_extras* rebx, struct rebx_force* force);
 int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operator);
 
+/**
+ * @brief Turns recording of per-force and per-operator profiles on or off.
+ * @details While enabled, every call made through rebx_additional_forces and the pre/post timestep modifications adds to the profile of its force or operator (call count, wall time and particles passed). When disabled the dispatch loops are unchanged.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param enable 1 to record, 0 to stop recording. Existing counts are kept.
+ */
+void rebx_enable_profiling(struct rebx_extras* const rebx, const int enable);
+
+/**
+ * @brief Zeroes the profiles of all forces and operators created with this rebx_extras instance.
+ * @param rebx Pointer to the rebx_extras instance
+ */
+void rebx_reset_profiles(struct rebx_extras* const rebx);
+
 /**
  * @brief Save a binary file with all the effects in the simulation, as well as all particle and effect parameters.
  * @param rebx Pointer to the rebx_extras instance
@@ -286,6 +419,14 @@ int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operato
  */
 void rebx_output_binary(struct rebx_extras* rebx, char* filename);
 
+/**
+ * @brief Same as rebx_output_binary(), but writes the binary into memory rather than to a file.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param bufp Set to a newly allocated buffer holding the binary (NULL on failure). Caller must free it.
+ * @param sizep Set to the size of the buffer in bytes.
+ */
+void rebx_output_binary_to_buffer(struct rebx_extras* rebx, char** bufp, size_t* sizep);
+
 /**
  * @brief Reads a REBOUNDx binary file, loads all effects and parameters.
  * @param sim Pointer to the simulation to which the effects and parameters should be added.
@@ -300,6 +441,62 @@ struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, c
  * @param warnings Pointer to an array of warnings to be populated during loading. 
  */
 void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const filename, enum rebx_input_binary_messages* warnings);
+
+/**
+ * @brief Same as rebx_create_extras_from_binary(), but loads a binary held in memory, e.g. one written by rebx_output_binary_to_buffer().
+ * @param sim Pointer to the simulation to which the effects and parameters should be added.
+ * @param buf Buffer holding the binary. Only read during the call, so it can be freed afterwards.
+ * @param size Size of the buffer in bytes.
+ */
+struct rebx_extras* rebx_create_extras_from_buffer(struct reb_simulation* sim, const char* const buf, const size_t size);
+
+/**
+ * @brief Similar to rebx_create_extras_from_buffer(), but takes an extras instance (must be attached to a simulation) and allows for manual message handling.
+ * @param rebx Pointer to a rebx_extras instance to be updated.
+ * @param buf Buffer holding the binary.
+ * @param size Size of the buffer in bytes.
+ * @param warnings Pointer to an array of warnings to be populated during loading.
+ */
+void rebx_init_extras_from_buffer(struct rebx_extras* rebx, const char* const buf, const size_t size, enum rebx_input_binary_messages* warnings);
+
+/**
+ * @brief Appends a snapshot of all effects and parameters to an archive, creating it if it doesn't exist.
+ * @details Meant to be called alongside reb_simulationarchive_snapshot. Snapshots after the first only store the particle
+ * parameters that changed since the last full one, and record the simulation time so they can be matched up with the
+ * simulationarchive. The first snapshot of an archive can also be loaded with rebx_create_extras_from_binary().
+ * @param rebx Pointer to the rebx_extras instance
+ * @param filename Filename of the archive.
+ */
+void rebx_output_archive_snapshot(struct rebx_extras* rebx, const char* const filename);
+
+/**
+ * @brief Loads a snapshot from an archive written with rebx_output_archive_snapshot() (or a binary from rebx_output_binary()).
+ * @param sim Pointer to the simulation to which the effects and parameters should be added.
+ * @param filename Filename of the archive.
+ * @param snapshot Index of the snapshot. Negative values count back from the last one.
+ */
+struct rebx_extras* rebx_create_extras_from_archive(struct reb_simulation* sim, const char* const filename, int snapshot);
+
+/**
+ * @brief Indexes the snapshots of an archive held in memory without parsing them.
+ * @param buf Buffer holding the archive.
+ * @param size Size of the buffer in bytes.
+ * @param times Filled with the simulation time of each snapshot (NAN for binaries from rebx_output_binary()). Can be NULL.
+ * @param offsets Filled with the offset of each snapshot in buf, to pass to rebx_init_extras_from_archive(). Can be NULL.
+ * @param N_max Length of times and offsets.
+ * @return Number of snapshots in the archive (can be larger than N_max).
+ */
+int rebx_archive_index(const char* const buf, const size_t size, double* times, long* offsets, const int N_max);
+
+/**
+ * @brief Loads the snapshot at offset (see rebx_archive_index()) of an archive held in memory into an extras instance (must be attached to a simulation).
+ * @param rebx Pointer to a rebx_extras instance to be updated.
+ * @param buf Buffer holding the archive.
+ * @param size Size of the buffer in bytes.
+ * @param offset Offset of the snapshot in buf.
+ * @param warnings Pointer to an array of warnings to be populated during loading.
+ */
+void rebx_init_extras_from_archive(struct rebx_extras* rebx, const char* const buf, const size_t size, const long offset, enum rebx_input_binary_messages* warnings);
 /** @} */
 /** @} */
 
@@ -325,6 +522,17 @@ void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const fi
 //struct rebx_effect* rebx_add(struct rebx_extras* rebx, const char* name);
 int rebx_add_operator(struct rebx_extras* rebx, struct rebx_operator* operator);
 int rebx_add_operator_step(struct rebx_extras* rebx, struct rebx_operator* operator, const double dt_fraction, enum rebx_timing timing);
+/**
+ * @brief Adds the steps of a splitting scheme alternating between two operators, starting and ending with A.
+ * @details Adjacent steps of the same operator are merged, so e.g. yoshida4 costs 4 A steps and 3 B steps.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param scheme leapfrog, yoshida4, yoshida6 (compositions of A(1/2)B(1)A(1/2)), or saba1 to saba4 (Laskar & Robutel 2001, with A the integrable part).
+ * @param A Operator for the outer steps, e.g. kepler or drift.
+ * @param B Operator for the inner steps, e.g. interaction or kick.
+ * @param timing Whether the steps are done before or after the REBOUND timestep.
+ * @return 1 on success, 0 on failure (e.g. unknown scheme). Steps added before a failure are not removed.
+ */
+int rebx_add_splitting_scheme(struct rebx_extras* rebx, const char* scheme, struct rebx_operator* A, struct rebx_operator* B, enum rebx_timing timing);
 int rebx_add_force(struct rebx_extras* rebx, struct rebx_force* force);
 struct rebx_operator* rebx_load_operator(struct rebx_extras* const rebx, const char* name);
 struct rebx_force* rebx_load_force(struct rebx_extras* const rebx, const char* name);
@@ -405,6 +613,53 @@ void rebx_set_param_double(struct rebx_extras* const rebx, struct rebx_node** ap
 void rebx_set_param_int(struct rebx_extras* const rebx, struct rebx_node** apptr, const char* const param_name, int val);
 void rebx_set_param_uint32(struct rebx_extras* const rebx, struct rebx_node** apptr, const char* const param_name, uint32_t val);
 void rebx_register_param(struct rebx_extras* const rebx, const char* name, enum rebx_param_type type);
+
+/**
+ * @brief Sets a double param on many particles at once, adding it to particles that don't have it yet.
+ * @details Much faster than calling rebx_set_param_double for each particle (e.g. from Python), since the name is looked up only once.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param param_name Name of the parameter. Must be registered as a double param.
+ * @param values Array of N values.
+ * @param indices Array of the N particle indices to set values[k] on, or NULL for particles 0 to N-1.
+ * @param N Number of values.
+ */
+void rebx_set_param_double_array(struct rebx_extras* const rebx, const char* const param_name, const double* const values, const int* const indices, const int N);
+/**
+ * @brief Same as rebx_set_param_double_array for int params.
+ */
+void rebx_set_param_int_array(struct rebx_extras* const rebx, const char* const param_name, const int* const values, const int* const indices, const int N);
+/**
+ * @brief Gathers a double param from many particles at once.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param param_name Name of the parameter. Must be registered as a double param.
+ * @param values Array of N values to fill. Entries of particles without the param are left unchanged.
+ * @param indices Array of the N particle indices to read values[k] from, or NULL for particles 0 to N-1.
+ * @param N Number of values.
+ * @return Number of particles that had the param.
+ */
+int rebx_get_param_double_array(struct rebx_extras* const rebx, const char* const param_name, double* const values, const int* const indices, const int N);
+/**
+ * @brief Same as rebx_get_param_double_array for int params.
+ */
+int rebx_get_param_int_array(struct rebx_extras* const rebx, const char* const param_name, int* const values, const int* const indices, const int N);
+
+/**
+ * @brief Gets the interned integer key of a registered parameter name.
+ * @details Look the key up once (e.g. outside a loop over particles) and pass it to rebx_get_param_by_key, which compares integers rather than strings.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param param_name Name of the registered parameter
+ * @return Key of the parameter, -1 if the name has not been registered.
+ */
+int rebx_get_param_key(struct rebx_extras* const rebx, const char* const param_name);
+
+/**
+ * @brief Gets a parameter from a particle or effect by its interned key (see rebx_get_param_key).
+ * @param ap Pointer from which to get the param
+ * @param key Key returned by rebx_get_param_key
+ * @return A void pointer to the parameter. NULL if not found (or key is -1).
+ */
+void* rebx_get_param_by_key(struct rebx_extras* const rebx, struct rebx_node* ap, const int key);
+struct rebx_param* rebx_get_param_struct_by_key(struct rebx_extras* const rebx, struct rebx_node* ap, const int key);
 /** @} */
 /** @} */
 
@@ -588,7 +843,144 @@ void rebx_input_skip_binary_field(FILE* inf, long field_size);
 /** @} */
 
 void rebx_error(struct rebx_extras* rebx, const char* const msg);
-#endif
+
+/****************************************
+ Ephemeris Functions
+ *****************************************/
+/**
+ * \name Ephemeris Functions
+ * @{
+ */
+/**
+ * @defgroup EphemerisFunctions
+ * @details Functions for loading the JPL ephemerides used by ephemeris_forces
+ * @{
+ */
+
+/**
+ * @brief Loaded planetary and asteroid ephemerides.  Opaque; see rebx_ephemeris_init.
+ */
+struct rebx_ephemeris;
+
+/**
+ * @brief Loads (memory maps) JPL ephemeris files into a context for ephemeris_forces.
+ * @details The context is only read once created, so a single one can be shared by any number of
+ * ephemeris_forces instances and threads by setting it as the force's "ephemeris" pointer parameter.
+ * Forces without one use a default context loaded from the working directory on first use (once, also when forces run in parallel threads).
+ * The caller owns the context and must keep it alive until all forces using it are freed.
+ * @param planets_file Path to the binary JPL DE file (NULL for linux_p1550p2650.430).
+ * @param asteroids_file Path to the SPK kernel with the massive asteroids (e.g. sb431-n16s.bsp), or NULL to load none.
+ * @return Pointer to the new context, or NULL if a file could not be loaded.
+ */
+struct rebx_ephemeris* rebx_ephemeris_init(const char* const planets_file, const char* const asteroids_file);
+
+/**
+ * @brief How rebx_ephemeris_load makes the planetary ephemeris records available.
+ */
+enum rebx_ephemeris_load_mode {
+    REBX_EPHEMERIS_LOAD_MAP,        ///< Memory map the file; records are read from disk on first use (default).
+    REBX_EPHEMERIS_LOAD_PREFAULT,   ///< Memory map the file and fault in the records of the time window up front.
+    REBX_EPHEMERIS_LOAD_COPY,       ///< Copy the records of the time window into (huge page backed) memory. Times outside the window are unavailable.
+};
+
+/**
+ * @brief Loads ephemeris files like rebx_ephemeris_init, preparing the records for a time window.
+ * @details Short jobs that touch a small part of a large DE file can avoid paying page-fault latency during
+ * the integration by prefaulting or copying only the records they need.  The planetary file can be any binary
+ * DE4xx file in the DE430 layout (e.g. DE430, DE440).
+ * @param planets_file Path to the binary JPL DE file (NULL for linux_p1550p2650.430).
+ * @param asteroids_file Path to the SPK kernel with the massive asteroids, or NULL to load none.
+ * @param jd_beg Start of the time window (JD TDB).
+ * @param jd_end End of the time window (JD TDB). If jd_end <= jd_beg the whole file is used.
+ * @param mode See rebx_ephemeris_load_mode.
+ * @return Pointer to the new context, or NULL if a file could not be loaded.
+ */
+struct rebx_ephemeris* rebx_ephemeris_load(const char* const planets_file, const char* const asteroids_file, const double jd_beg, const double jd_end, const enum rebx_ephemeris_load_mode mode);
+
+/**
+ * @brief Frees a context created with rebx_ephemeris_init or rebx_ephemeris_load.
+ * @param eph Pointer to the context to free.
+ */
+void rebx_ephemeris_free(struct rebx_ephemeris* const eph);
+
+/**
+ * @brief Receives the dense output of integration_function_stream.
+ * @param user The pointer passed to integration_function_stream.
+ * @param t Array of n_times output times.
+ * @param state Array of n_times*n_particles*6 positions and velocities, (time, particle, x/y/z/vx/vy/vz) ordered.
+ * @param n_times Number of output times (8 per IAS15 step).
+ * @param n_particles Number of test particles.
+ * @return Nonzero to stop the integration. The arrays are reused after the callback returns.
+ */
+typedef int (*rebx_ephem_output_callback)(void* user, const double* t, const double* state, int n_times, int n_particles);
+
+/**
+ * @brief Integrates test particles with ephemeris_forces, streaming the dense output step by step.
+ * @details Memory use is independent of trange: the output of each IAS15 step (its start and the
+ * 7 interior Gauss-Radau substeps) is passed to callback and then discarded.
+ * @param tstart Initial time (TDB days).
+ * @param tstep Initial time step (days); its sign sets the integration direction.
+ * @param trange Length of the integration (days).
+ * @param geocentric 1 if instate is geocentric, 0 if barycentric.
+ * @param n_particles Number of test particles.
+ * @param instate Array of n_particles*6 initial positions and velocities.
+ * @param callback Function called after every completed step.
+ * @param user Pointer passed through to callback.
+ * @return 1.
+ */
+int integration_function_stream(double tstart, double tstep, double trange, int geocentric, int n_particles, double* instate, rebx_ephem_output_callback callback, void* user);
+
+/**
+ * @brief Integrates test particles with ephemeris_forces and returns their states only at requested epochs.
+ * @details The IAS15 dense output of each step is evaluated only at the epochs falling inside it, so cost
+ * and memory scale with n_epochs rather than with the number of steps.
+ * @param tstart Initial time (TDB days).
+ * @param tstep Initial time step (days); its sign sets the integration direction.
+ * @param geocentric 1 if instate is geocentric, 0 if barycentric.
+ * @param n_particles Number of test particles.
+ * @param instate Array of n_particles*6 initial positions and velocities.
+ * @param n_epochs Number of output epochs.
+ * @param epochs Output epochs (TDB days), sorted in the direction of integration and not before tstart.
+ * @param outstate Caller-allocated array of n_epochs*n_particles*6 doubles, (epoch, particle, x/y/z/vx/vy/vz) ordered.
+ * @return 1 on success, 0 if epochs are not sorted.
+ */
+int integration_function_epochs(double tstart, double tstep, int geocentric, int n_particles, double* instate, int n_epochs, const double* epochs, double* outstate);
+
+/**
+ * @brief Parallel version of integration_function_epochs, integrating each test particle in its own simulation.
+ * @details Every object gets independent IAS15 step control.  Simulations are distributed between
+ * n_threads OpenMP threads (serially if REBOUNDx is built without OpenMP) and share one ephemeris context.
+ * @param tstart Initial time (TDB days).
+ * @param tstep Initial time step (days); its sign sets the integration direction.
+ * @param geocentric 1 if instate is geocentric, 0 if barycentric.
+ * @param n_particles Number of test particles.
+ * @param instate Array of n_particles*6 initial positions and velocities.
+ * @param n_epochs Number of output epochs.
+ * @param epochs Output epochs (TDB days), sorted in the direction of integration and not before tstart.
+ * @param n_threads Number of threads to use.
+ * @param outstate Caller-allocated array of n_epochs*n_particles*6 doubles, (epoch, particle, x/y/z/vx/vy/vz) ordered.
+ * @return 1 on success, 0 if epochs are not sorted or the ephemeris could not be loaded.
+ */
+int integration_function_epochs_parallel(double tstart, double tstep, int geocentric, int n_particles, double* instate, int n_epochs, const double* epochs, int n_threads, double* outstate);
+
+/**
+ * @brief Integrates test particles with ephemeris_forces and writes their trajectories as an SPK type 2 kernel.
+ * @details The span is split into records of len days, each fitted with ncf Chebyshev coefficients per
+ * coordinate at its Chebyshev nodes.  The file can be read back with any SPK reader, including the one
+ * used by ephemeris_forces for the asteroids.
+ * @param path Output file name.
+ * @param tstart Initial time (TDB days).
+ * @param tstep Initial time step (days); its sign sets the integration direction.
+ * @param trange Length of the integration (days).
+ * @param geocentric 1 if instate is geocentric (the kernel is Earth centred), 0 if barycentric.
+ * @param n_particles Number of test particles.
+ * @param instate Array of n_particles*6 initial positions and velocities.
+ * @param codes NAIF ids to store the particles under, or NULL for -1, -2, ...
+ * @param len Record length (days).
+ * @param ncf Chebyshev coefficients per coordinate and record (2 to 32).
+ * @return 1 on success, 0 on failure.
+ */
+int integration_function_spk(const char* path, double tstart, double tstep, double trange, int geocentric, int n_particles, double* instate, const int* codes, double len, int ncf);
 
 // Added gravitational constant G for the GR stuff (2020 Feb 26)
 // Added vx, vy, vz (2020 Feb 27)
@@ -613,3 +1005,6 @@ void ephem(const double G, const int i, const double t, double* const m,
 	   double* const vx, double* const vy, double* const vz,
 	   double* const ax, double* const ay, double* const az);
 
+/** @} */
+/** @} */
+#endif
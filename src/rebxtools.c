@@ -34,6 +34,115 @@ void rebx_calculate_jacobi_masses(const struct reb_particle* const ps, double* c
     m_j[0] = eta;
 }
 
+const struct rebx_particle_list* rebx_get_particle_list(struct rebx_extras* const rebx, const int key, const struct reb_particle* const particles, const int N){
+    static const struct rebx_particle_list empty = {0};
+    if (key < 0){   // unregistered name, so no particle can carry it
+        return &empty;
+    }
+    if (key >= rebx->N_particle_lists){
+        const int N_lists = rebx->N_param_keys > key ? rebx->N_param_keys : key + 1;
+        struct rebx_particle_list** lists = realloc(rebx->particle_lists, N_lists*sizeof(*lists));
+        if (lists == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for particle lists.\n");
+            return &empty;
+        }
+        for (int k=rebx->N_particle_lists; k<N_lists; k++){
+            lists[k] = NULL;
+        }
+        rebx->particle_lists = lists;
+        rebx->N_particle_lists = N_lists;
+    }
+    struct rebx_particle_list* list = rebx->particle_lists[key];
+    if (list == NULL){
+        list = calloc(1, sizeof(*list));
+        if (list == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for particle lists.\n");
+            return &empty;
+        }
+        list->generation = rebx->param_generation - 1;   // force a build
+        rebx->particle_lists[key] = list;
+    }
+    if (list->generation == rebx->param_generation && list->N == N && list->particles == particles){
+        return list;
+    }
+    
+    list->N_indices = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_struct_by_key(rebx, particles[i].ap, key) == NULL){
+            continue;
+        }
+        if (list->N_indices == list->N_allocated){
+            const int N_allocated = list->N_allocated ? 2*list->N_allocated : 16;
+            int* indices = realloc(list->indices, N_allocated*sizeof(*indices));
+            if (indices == NULL){
+                rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for particle lists.\n");
+                list->N_indices = 0;
+                list->generation = rebx->param_generation - 1;
+                return list;
+            }
+            list->indices = indices;
+            list->N_allocated = N_allocated;
+        }
+        list->indices[list->N_indices++] = i;
+    }
+    list->generation = rebx->param_generation;
+    list->N = N;
+    list->particles = particles;
+    return list;
+}
+
+void rebx_free_particle_lists(struct rebx_extras* const rebx){
+    for (int k=0; k<rebx->N_particle_lists; k++){
+        if (rebx->particle_lists[k]){
+            free(rebx->particle_lists[k]->indices);
+            free(rebx->particle_lists[k]);
+        }
+    }
+    free(rebx->particle_lists);
+    rebx->particle_lists = NULL;
+    rebx->N_particle_lists = 0;
+}
+
+// Terms are swept source by source, in the order their sources first appear
+void rebx_fused_source_forces(struct rebx_source_term* const terms, const int N_terms, struct reb_particle* const particles, const int N){
+    int done[REBX_MAX_SOURCE_TERMS] = {0};
+    int group[REBX_MAX_SOURCE_TERMS];
+    for (int t=0; t<N_terms; t++){
+        if (done[t]){
+            continue;
+        }
+        const int source_index = terms[t].source_index;
+        int N_group = 0;
+        int needs_r = 0;
+        for (int u=t; u<N_terms; u++){
+            if (!done[u] && terms[u].source_index == source_index){
+                group[N_group++] = u;
+                needs_r |= terms[u].needs_r;
+                done[u] = 1;
+            }
+        }
+        
+        const double sx = particles[source_index].x;
+        const double sy = particles[source_index].y;
+        const double sz = particles[source_index].z;
+        for (int i=0; i<N; i++){
+            if (i == source_index){
+                continue;
+            }
+            struct rebx_source_pair pair;
+            pair.dx = particles[i].x - sx;
+            pair.dy = particles[i].y - sy;
+            pair.dz = particles[i].z - sz;
+            pair.r2 = pair.dx*pair.dx + pair.dy*pair.dy + pair.dz*pair.dz;
+            pair.r = needs_r ? sqrt(pair.r2) : 0.;
+            for (int g=0; g<N_group; g++){
+                const struct rebx_source_term* const term = &terms[group[g]];
+                term->accumulate(term, particles, i, &pair);
+            }
+        }
+    }
+}
+
 double rebx_Edot(struct reb_particle* const ps, const int N){
     double Edot = 0.;
     for(int i=0; i<N; i++){
@@ -42,6 +151,425 @@ double rebx_Edot(struct reb_particle* const ps, const int N){
     return Edot;
 }
 
+/* Oblate bodies.  The rotation matrix taking vectors to the body equatorial frame is
+ * computed once per source and force evaluation, so the per-particle work is three
+ * matrix-vector products and one pass over the zonal terms, with no trigonometry.
+ */
+
+void rebx_oblate_frame_from_pole(struct rebx_oblate_frame* const frame, const double xp, const double yp, const double zp){
+    // Rotate around z by -longnode, then around x by -incl, bringing the pole onto the z axis.
+    const double incl = acos(zp);
+    const double longnode = (xp != 0. || yp != 0.) ? atan2(xp, -yp) : 0.;
+    const double cosr = cos(-longnode);
+    const double sinr = sin(-longnode);
+    const double cosd = cos(-incl);
+    const double sind = sin(-incl);
+
+    frame->R[0][0] = cosr;      frame->R[0][1] = -sinr;     frame->R[0][2] = 0.;
+    frame->R[1][0] = sinr*cosd; frame->R[1][1] = cosr*cosd; frame->R[1][2] = -sind;
+    frame->R[2][0] = sinr*sind; frame->R[2][1] = cosr*sind; frame->R[2][2] = cosd;
+}
+
+void rebx_oblate_frame_from_radec(struct rebx_oblate_frame* const frame, const double ra, const double dec){
+    rebx_oblate_frame_from_pole(frame, cos(dec)*cos(ra), cos(dec)*sin(ra), sin(dec));
+}
+
+void rebx_oblate_frame_spin(struct rebx_oblate_frame* const frame, const double angle){
+    const double c = cos(angle);
+    const double s = sin(angle);
+    for (int k=0; k<3; k++){
+        const double R0 = frame->R[0][k];
+        const double R1 = frame->R[1][k];
+        frame->R[0][k] = c*R0 + s*R1;
+        frame->R[1][k] = -s*R0 + c*R1;
+    }
+}
+
+void rebx_zonal_acceleration(const double GM, const double R_eq, const int n_max, const double* const J, const double x, const double y, const double z, double* const a){
+    const double r2 = x*x + y*y + z*z;
+    const double r = sqrt(r2);
+    const double u = z/r;
+    const double q = R_eq/r;
+
+    // Legendre polynomials P_n(u) and derivatives by recurrence
+    double P0 = 1.;
+    double P1 = u;
+    double dP1 = 1.;
+    double qn = q;
+    double sr = 0.;     // radial part
+    double sz = 0.;     // along the pole
+    for (int n=2; n<=n_max; n++){
+        const double P = ((2*n-1)*u*P1 - (n-1)*P0)/n;
+        const double dP = n*P1 + u*dP1;
+        qn *= q;
+        if (J[n] != 0.){
+            sr += J[n]*qn*((n+1)*P + u*dP);
+            sz += J[n]*qn*dP;
+        }
+        P0 = P1;
+        P1 = P;
+        dP1 = dP;
+    }
+
+    const double fac = GM/r2;
+    a[0] = fac*sr*x/r;
+    a[1] = fac*sr*y/r;
+    a[2] = fac*(sr*z/r - sz);
+}
+
+double rebx_zonal_potential(const double GM, const double R_eq, const int n_max, const double* const J, const double x, const double y, const double z){
+    const double r = sqrt(x*x + y*y + z*z);
+    const double u = z/r;
+    const double q = R_eq/r;
+
+    double P0 = 1.;
+    double P1 = u;
+    double qn = q;
+    double s = 0.;
+    for (int n=2; n<=n_max; n++){
+        const double P = ((2*n-1)*u*P1 - (n-1)*P0)/n;
+        qn *= q;
+        s += J[n]*qn*P;
+        P0 = P1;
+        P1 = P;
+    }
+    return GM/r*s;
+}
+
+/* V_nm + i W_nm = (R_eq/r)^(n+1) P_nm(z/r) exp(i m lambda) (Montenbruck & Gill 2000, Sec. 3.2), filled for n, m <= n_max+1
+ * so the acceleration terms of degree n_max can reach n+1 and m+1.
+ */
+static void rebx_harmonics_VW(const double R_eq, const int n_max, const double x, const double y, const double z, double* const V, double* const W){
+    const int L = n_max + 2;
+    const double r2 = x*x + y*y + z*z;
+    const double rho = R_eq*R_eq/r2;
+    const double x0 = R_eq*x/r2;
+    const double y0 = R_eq*y/r2;
+    const double z0 = R_eq*z/r2;
+
+    V[0] = R_eq/sqrt(r2);
+    W[0] = 0.;
+    V[L] = z0*V[0];
+    W[L] = 0.;
+    for (int n=2; n<L; n++){
+        V[n*L] = ((2*n-1)*z0*V[(n-1)*L] - (n-1)*rho*V[(n-2)*L])/n;
+        W[n*L] = 0.;
+    }
+    for (int m=1; m<L; m++){
+        const int mm = m*L + m;
+        const int prev = (m-1)*L + m-1;
+        V[mm] = (2*m-1)*(x0*V[prev] - y0*W[prev]);
+        W[mm] = (2*m-1)*(x0*W[prev] + y0*V[prev]);
+        if (m+1 < L){
+            V[mm+L] = (2*m+1)*z0*V[mm];
+            W[mm+L] = (2*m+1)*z0*W[mm];
+        }
+        for (int n=m+2; n<L; n++){
+            const int nm = n*L + m;
+            V[nm] = ((2*n-1)*z0*V[nm-L] - (n+m-1)*rho*V[nm-2*L])/(n-m);
+            W[nm] = ((2*n-1)*z0*W[nm-L] - (n+m-1)*rho*W[nm-2*L])/(n-m);
+        }
+    }
+}
+
+void rebx_harmonics_acceleration(const double GM, const double R_eq, const int n_max, const double* const C, const double* const S, const double x, const double y, const double z, double* const VW, double* const a){
+    const int L = n_max + 2;
+    double* const V = VW;
+    double* const W = VW + L*L;
+    rebx_harmonics_VW(R_eq, n_max, x, y, z, V, W);
+
+    double ax = 0.;
+    double ay = 0.;
+    double az = 0.;
+    for (int n=2; n<=n_max; n++){
+        const double* const Cn = C + n*(n_max+1);
+        const double* const Sn = S + n*(n_max+1);
+        const double* const V1 = V + (n+1)*L;   // degree n+1
+        const double* const W1 = W + (n+1)*L;
+        if (Cn[0] != 0.){
+            ax -= Cn[0]*V1[1];
+            ay -= Cn[0]*W1[1];
+            az -= (n+1)*Cn[0]*V1[0];
+        }
+        for (int m=1; m<=n; m++){
+            if (Cn[m] == 0. && Sn[m] == 0.){
+                continue;
+            }
+            const double fac = (double)(n-m+1)*(n-m+2);
+            ax += 0.5*(-Cn[m]*V1[m+1] - Sn[m]*W1[m+1] + fac*(Cn[m]*V1[m-1] + Sn[m]*W1[m-1]));
+            ay += 0.5*(-Cn[m]*W1[m+1] + Sn[m]*V1[m+1] + fac*(-Cn[m]*W1[m-1] + Sn[m]*V1[m-1]));
+            az += (n-m+1)*(-Cn[m]*V1[m] - Sn[m]*W1[m]);
+        }
+    }
+
+    const double fac = GM/(R_eq*R_eq);
+    a[0] = fac*ax;
+    a[1] = fac*ay;
+    a[2] = fac*az;
+}
+
+double rebx_harmonics_potential(const double GM, const double R_eq, const int n_max, const double* const C, const double* const S, const double x, const double y, const double z, double* const VW){
+    const int L = n_max + 2;
+    double* const V = VW;
+    double* const W = VW + L*L;
+    rebx_harmonics_VW(R_eq, n_max, x, y, z, V, W);
+
+    double U = 0.;
+    for (int n=2; n<=n_max; n++){
+        for (int m=0; m<=n; m++){
+            U += C[n*(n_max+1)+m]*V[n*L+m] + S[n*(n_max+1)+m]*W[n*L+m];
+        }
+    }
+    return -GM/R_eq*U;
+}
+
+/* Variational equations.  The Jacobians below are those of the accelerations the corresponding
+ * forces apply, evaluated at the real particles and applied to the variations.
+ */
+
+struct reb_particle* rebx_variational_particle(struct reb_simulation* const sim, const struct reb_variational_configuration* const vc, const int j){
+    if (vc->testparticle >= 0){
+        return j == vc->testparticle ? &sim->particles[vc->index] : NULL;
+    }
+    return &sim->particles[vc->index + j];
+}
+
+void rebx_source_variations(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const int source_index, rebx_variation_function f, const void* const data){
+    const struct reb_particle source = particles[source_index];
+    for (int v=0; v<sim->var_config_N; v++){
+        const struct reb_variational_configuration* const vc = &sim->var_config[v];
+        if (vc->order != 1){
+            continue;
+        }
+        struct reb_particle* const ds = rebx_variational_particle(sim, vc, source_index);
+        for (int i=0; i<N; i++){
+            if (i == source_index){
+                continue;
+            }
+            struct reb_particle* const dp = rebx_variational_particle(sim, vc, i);
+            if (dp == NULL && ds == NULL){
+                continue;
+            }
+            const struct reb_particle p = particles[i];
+            const double d[6] = {p.x - source.x, p.y - source.y, p.z - source.z, p.vx - source.vx, p.vy - source.vy, p.vz - source.vz};
+            double dd[6] = {0., 0., 0., 0., 0., 0.};
+            if (dp){
+                dd[0] = dp->x;  dd[1] = dp->y;  dd[2] = dp->z;
+                dd[3] = dp->vx; dd[4] = dp->vy; dd[5] = dp->vz;
+            }
+            if (ds){
+                dd[0] -= ds->x;  dd[1] -= ds->y;  dd[2] -= ds->z;
+                dd[3] -= ds->vx; dd[4] -= ds->vy; dd[5] -= ds->vz;
+            }
+            double da[3] = {0., 0., 0.};
+            f(data, particles, i, source_index, d, dd, da);
+            if (dp){
+                dp->ax += da[0];
+                dp->ay += da[1];
+                dp->az += da[2];
+            }
+            if (ds && source.m > 0.){
+                const double mratio = p.m/source.m;
+                ds->ax -= mratio*da[0];
+                ds->ay -= mratio*da[1];
+                ds->az -= mratio*da[2];
+            }
+        }
+    }
+}
+
+// da = K/r^n [dd - n (d.dd)/r^2 d]
+void rebx_power_law_variation(const double K, const double n, const double* const d, const double* const dd, double* const da){
+    const double r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    const double prefac = K/pow(r2, 0.5*n);
+    const double rdr = n*(d[0]*dd[0] + d[1]*dd[1] + d[2]*dd[2])/r2;
+    da[0] += prefac*(dd[0] - rdr*d[0]);
+    da[1] += prefac*(dd[1] - rdr*d[1]);
+    da[2] += prefac*(dd[2] - rdr*d[2]);
+}
+
+void rebx_zonal_variation(const double GM, const double J2, const double J4, const double R_eq, const struct rebx_oblate_frame* const frame, const double* const d, const double* const dd, double* const da){
+    double db[3], ddb[3];
+
+    // Rotate the offset and its variation to the body equatorial frame
+    if (frame){
+        rebx_oblate_frame_to_body(frame, d, db);
+        rebx_oblate_frame_to_body(frame, dd, ddb);
+    }
+    else{
+        for (int k=0; k<3; k++){
+            db[k] = d[k];
+            ddb[k] = dd[k];
+        }
+    }
+    const double x = db[0], y = db[1], z = db[2];
+    const double ddx = ddb[0], ddy = ddb[1], ddz = ddb[2];
+
+    const double r2 = x*x + y*y + z*z;
+    const double _r = sqrt(r2);
+    const double rdr = (x*ddx + y*ddy + z*ddz)/r2;     // d(r)/r
+    const double c2 = z*z/r2;
+    const double dc2 = 2.*(z*ddz/r2 - c2*rdr);
+
+    // J2: a = P f (x, y, z) - 2 P (0, 0, z), P = 3 J2 R^2 GM/(2 r^5), f = 5 c2 - 1
+    const double P = GM*3.*J2*R_eq*R_eq/r2/r2/_r/2.;
+    const double f = 5.*c2 - 1.;
+    const double dP = -5.*P*rdr;
+    const double df = 5.*dc2;
+    double res[3];
+    res[0] = (dP*f + P*df)*x + P*f*ddx;
+    res[1] = (dP*f + P*df)*y + P*f*ddy;
+    res[2] = (dP*(f-2.) + P*df)*z + P*(f-2.)*ddz;
+
+    // J4: a = Q g (x, y, z) + Q (12 - 28 c2) (0, 0, z), Q = 5 J4 R^4 GM/(8 r^7), g = 63 c2^2 - 42 c2 + 3
+    if (J4 != 0.){
+        const double Q = GM*5.*J4*R_eq*R_eq*R_eq*R_eq/r2/r2/r2/_r/8.;
+        const double g = 63.*c2*c2 - 42.*c2 + 3.;
+        const double dQ = -7.*Q*rdr;
+        const double dg = (126.*c2 - 42.)*dc2;
+        const double gz = g + 12. - 28.*c2;
+        res[0] += (dQ*g + Q*dg)*x + Q*g*ddx;
+        res[1] += (dQ*g + Q*dg)*y + Q*g*ddy;
+        res[2] += (dQ*gz + Q*(dg - 28.*dc2))*z + Q*gz*ddz;
+    }
+
+    // Rotate back to original frame
+    double dab[3];
+    if (frame){
+        rebx_oblate_frame_from_body(frame, res, dab);
+    }
+    else{
+        for (int k=0; k<3; k++){
+            dab[k] = res[k];
+        }
+    }
+    da[0] += dab[0];
+    da[1] += dab[1];
+    da[2] += dab[2];
+}
+
+void rebx_gr_variation(const double mu, const double C2, const double* const d, const double* const dd, double* const da){
+    const double x = d[0], y = d[1], z = d[2];
+    const double vx = d[3], vy = d[4], vz = d[5];
+    const double r2 = x*x + y*y + z*z;
+    const double _r = sqrt(r2);
+    const double v2 = vx*vx + vy*vy + vz*vz;
+    const double rv = x*vx + y*vy + z*vz;
+    const double rdr = x*dd[0] + y*dd[1] + z*dd[2];
+    const double vdv = vx*dd[3] + vy*dd[4] + vz*dd[5];
+    const double drv = dd[0]*vx + dd[1]*vy + dd[2]*vz + x*dd[3] + y*dd[4] + z*dd[5];
+
+    const double k = mu/(C2*r2*_r);
+    const double A = 4.*mu/_r - v2;
+    const double dk = -3.*k*rdr/r2;
+    const double dA = -4.*mu*rdr/(r2*_r) - 2.*vdv;
+
+    da[0] += dk*(A*x + 4.*rv*vx) + k*(dA*x + A*dd[0] + 4.*(drv*vx + rv*dd[3]));
+    da[1] += dk*(A*y + 4.*rv*vy) + k*(dA*y + A*dd[1] + 4.*(drv*vy + rv*dd[4]));
+    da[2] += dk*(A*z + 4.*rv*vz) + k*(dA*z + A*dd[2] + 4.*(drv*vz + rv*dd[5]));
+}
+
+#define REBX_ORBIT_TINY 1.e-308     // as in REBOUND's conversions
+#define REBX_ORBIT_MIN_INC 1.e-8    // below this inclination (or above pi minus it), angles are found from longitudes
+
+// Branch-free acos2 from REBOUND: acos(num/denom), negated if disambiguator < 0, and 0 or pi outside [-1, 1] (0 for 0/0)
+static inline double rebx_acos2(const double num, const double denom, const double disambiguator){
+    const double cosine = num/denom;
+    const int inside = cosine > -1. && cosine < 1.;
+    const double val = acos(inside ? cosine : (cosine <= -1. ? -1. : 1.));
+    return (inside && disambiguator < 0.) ? -val : val;
+}
+
+void rebx_particles_to_orbits(const double G, const int n, const double* const m, const double* const m_primary, const struct rebx_state_batch* const states, struct rebx_orbit_batch* const orbits, int* const err){
+#pragma omp simd
+    for (int k=0; k<n; k++){
+        const double mu = G*(m[k] + m_primary[k]);
+        const double dx = states->x[k];
+        const double dy = states->y[k];
+        const double dz = states->z[k];
+        const double dvx = states->vx[k];
+        const double dvy = states->vy[k];
+        const double dvz = states->vz[k];
+        const double d = sqrt(dx*dx + dy*dy + dz*dz);
+        const double vsquared = dvx*dvx + dvy*dvy + dvz*dvz;
+        const double vcircsquared = mu/d;
+        const double a = -mu/(vsquared - 2.*vcircsquared);
+
+        const double hx = dy*dvz - dz*dvy;
+        const double hy = dz*dvx - dx*dvz;
+        const double hz = dx*dvy - dy*dvx;
+        const double h = sqrt(hx*hx + hy*hy + hz*hz);
+
+        const double vdiffsquared = vsquared - vcircsquared;
+        const double rvr = dx*dvx + dy*dvy + dz*dvz;
+        const double muinv = 1./mu;
+        const double ex = muinv*(vdiffsquared*dx - rvr*dvx);
+        const double ey = muinv*(vdiffsquared*dy - rvr*dvy);
+        const double ez = muinv*(vdiffsquared*dz - rvr*dvz);
+        const double e = sqrt(ex*ex + ey*ey + ez*ez);
+
+        const double inc = rebx_acos2(hz, h, 1.);
+        const double nx = -hy;              // along the ascending node, zhat cross h
+        const double ny = hx;
+        const double nn = sqrt(nx*nx + ny*ny);
+        const double Omega = rebx_acos2(nx, nn, ny);
+
+        // Nearly planar orbits use the longitudes, which stay well defined, and the others the angles from the node
+        const int planar = inc < REBX_ORBIT_MIN_INC || inc > M_PI - REBX_ORBIT_MIN_INC;
+        const int prograde = inc < M_PI/2.;
+        const double pomega = rebx_acos2(ex, e, ey);
+        const double theta = rebx_acos2(dx, d, dy);
+        const double wpf = rebx_acos2(nx*dx + ny*dy, nn*d, dz);
+        const double omega_node = rebx_acos2(nx*ex + ny*ey, nn*e, ez);
+        const double omega = planar ? (prograde ? pomega - Omega : Omega - pomega) : omega_node;
+        const double f = planar ? (prograde ? theta - pomega : pomega - theta) : wpf - omega_node;
+
+        const int code = m_primary[k] <= REBX_ORBIT_TINY ? 1 : (d <= REBX_ORBIT_TINY ? 2 : 0);
+        err[k] = code;
+        orbits->a[k] = code ? NAN : a;
+        orbits->e[k] = code ? NAN : e;
+        orbits->inc[k] = code ? NAN : inc;
+        orbits->Omega[k] = code ? NAN : Omega;
+        orbits->omega[k] = code ? NAN : omega;
+        orbits->f[k] = code ? NAN : f;
+    }
+}
+
+void rebx_orbits_to_particles(const double G, const int n, const double* const m, const double* const m_primary, const struct rebx_orbit_batch* const orbits, struct rebx_state_batch* const states, int* const err){
+#pragma omp simd
+    for (int k=0; k<n; k++){
+        const double a = orbits->a[k];
+        const double e = orbits->e[k];
+        const double cO = cos(orbits->Omega[k]);
+        const double sO = sin(orbits->Omega[k]);
+        const double co = cos(orbits->omega[k]);
+        const double so = sin(orbits->omega[k]);
+        const double cf = cos(orbits->f[k]);
+        const double sf = sin(orbits->f[k]);
+        const double ci = cos(orbits->inc[k]);
+        const double si = sin(orbits->inc[k]);
+
+        int code = 0;
+        code = e*cf < -1. ? 5 : code;                   // unbound orbit with f beyond the asymptotes
+        code = e < 1. && a < 0. ? 4 : code;             // unbound orbit must have e > 1
+        code = e > 1. && a > 0. ? 3 : code;             // bound orbit must have e < 1
+        code = e < 0. ? 2 : code;
+        code = e == 1. ? 1 : code;                      // radial orbit
+        err[k] = code;
+
+        const double r = a*(1.-e*e)/(1. + e*cf);
+        const double v0 = sqrt(G*(m[k] + m_primary[k])/a/(1.-e*e));   // works for elliptical and hyperbolic orbits
+
+        // Murray & Dermott Eq 2.122, and Eq. 2.36 rotated by the matrices of Sec. 2.8 for the velocities
+        states->x[k] = code ? NAN : r*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
+        states->y[k] = code ? NAN : r*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
+        states->z[k] = code ? NAN : r*(so*cf+co*sf)*si;
+        states->vx[k] = code ? NAN : v0*((e+cf)*(-ci*co*sO - cO*so) - sf*(co*cO - ci*so*sO));
+        states->vy[k] = code ? NAN : v0*((e+cf)*(ci*co*cO - sO*so) - sf*(co*sO + ci*so*cO));
+        states->vz[k] = code ? NAN : v0*((e+cf)*co*si - sf*si*so);
+    }
+}
+
 void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_vec3d (*calculate_force) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source), struct reb_particle* const particles, const int N){
     struct rebx_extras* const rebx = sim->extras;
     struct reb_particle com = reb_get_com(sim); // Start with full com for jacobi and barycentric coordinates.
@@ -51,23 +579,21 @@ void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const f
         refindex = 0;                           // There is no jacobi coordinate for the 0th particle, so set refindex to skip it in loop below.
     }
     else if(coordinates == REBX_COORDINATES_PARTICLE){
-        for (int i=0; i < N; i++){
-			struct reb_particle* p = &particles[i];
-            const int* const reference = rebx_get_param(rebx, p->ap, reference_name);
-            if (reference){
-                com = particles[i];
-                refindex = i;
-                break;
-            }
-            if (i == N-1){
-                char str[200];
-                sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
-                reb_error(sim, str);
-            }
+        const struct rebx_particle_list* const references = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, reference_name), particles, N);
+        if (references->N_indices > 0){
+            refindex = references->indices[0];
+            com = particles[refindex];
+        }
+        else if (N > 0){
+            char str[200];
+            sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
+            reb_error(sim, str);
         }
     }
 
     
+    const int direct = N <= REBX_BACK_REACTIONS_DIRECT_N;
+    struct reb_vec3d total = {0};   // back reactions summed so far, when not applied directly
     for(int i=N-1; i>=0; i--){ // Run through backwards so each iteration does not depend on previous ones in Jacobi coordinates.
         if (i==refindex){
             continue;
@@ -86,6 +612,12 @@ void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const f
         switch(coordinates){
             case REBX_COORDINATES_BARYCENTRIC:
                 massratio = p->m/com.m;
+                if (!direct){
+                    total.x += massratio*a.x;
+                    total.y += massratio*a.y;
+                    total.z += massratio*a.z;
+                    break;
+                }
                 for(int j=0; j < N; j++){
                     particles[j].ax -= massratio*a.x;
                     particles[j].ay -= massratio*a.y;
@@ -99,6 +631,23 @@ void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const f
                 else{
                     massratio = p->m/com.m;
                 }
+                if (!direct){
+                    // Particle i receives the reactions of all particles outside it (and its own if inclusive)
+                    if (back_reactions_inclusive){
+                        total.x += massratio*a.x;
+                        total.y += massratio*a.y;
+                        total.z += massratio*a.z;
+                    }
+                    p->ax -= total.x;
+                    p->ay -= total.y;
+                    p->az -= total.z;
+                    if (!back_reactions_inclusive){
+                        total.x += massratio*a.x;
+                        total.y += massratio*a.y;
+                        total.z += massratio*a.z;
+                    }
+                    break;
+                }
                 for(int j=0; j < i + back_reactions_inclusive; j++){    // stop at j=i if inclusive, at i-1 if not
                     particles[j].ax -= massratio*a.x;
                     particles[j].ay -= massratio*a.y;
@@ -123,6 +672,20 @@ void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const f
                 reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
         }
     }
+    if (!direct){
+        if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+            for(int j=0; j < N; j++){
+                particles[j].ax -= total.x;
+                particles[j].ay -= total.y;
+                particles[j].az -= total.z;
+            }
+        }
+        else if (coordinates == REBX_COORDINATES_JACOBI && N > 0){
+            particles[0].ax -= total.x;   // the 0th particle is inside every Jacobi coordinate
+            particles[0].ay -= total.y;
+            particles[0].az -= total.z;
+        }
+    }
 }
 
 static inline void rebx_subtract_posvel(struct reb_particle* p, struct reb_particle* diff, const double massratio){
@@ -144,28 +707,32 @@ void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* c
         refindex = 0;                           // There is no jacobi coordinate for the 0th particle, so should skip index 0
     }
     else if(coordinates == REBX_COORDINATES_PARTICLE){
-        for (int i=0; i < N_real; i++){
-            struct reb_particle* p = &sim->particles[i];
-            const int* const reference = rebx_get_param(rebx, p->ap, reference_name);
-            if (reference){
-                com = sim->particles[i];
-                refindex = i;
-                break;
-            }
-            if (i == N_real-1){                 
-                char str[200];
-                sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
-                reb_error(sim, str);
-            }
+        const struct rebx_particle_list* const references = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, reference_name), sim->particles, N_real);
+        if (references->N_indices > 0){
+            refindex = references->indices[0];
+            com = sim->particles[refindex];
+        }
+        else if (N_real > 0){
+            char str[200];
+            sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
+            reb_error(sim, str);
         }
     }
 
     
+    /* Above REBX_BACK_REACTIONS_DIRECT_N particles the back reactions are summed in total and only applied to a particle
+     * when it is reached (Jacobi), or to all particles at the end (barycentric). Each step still sees the same shifted state.
+     */
+    const int direct = N_real <= REBX_BACK_REACTIONS_DIRECT_N;
+    struct reb_particle total = {0};
     for(int i=N_real-1; i>=0; i--){ // Run through backwards so each iteration does not depend on previous ones in Jacobi coordinates.
         if (i==refindex){
             continue;
         }
         struct reb_particle* p = &sim->particles[i];
+        if (!direct && (coordinates == REBX_COORDINATES_JACOBI || coordinates == REBX_COORDINATES_BARYCENTRIC)){
+            rebx_subtract_posvel(p, &total, 1.);  // reactions of the particles already stepped
+        }
         if (coordinates == REBX_COORDINATES_JACOBI){
             com = reb_get_com_without_particle(com, *p);
         }
@@ -183,6 +750,11 @@ void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* c
         switch(coordinates){
             case REBX_COORDINATES_BARYCENTRIC:
                 massratio = p->m/com.m;
+                if (!direct){
+                    rebx_subtract_posvel(p, &total, -1.);     // back out the shift, since the full total is applied to everyone at the end
+                    rebx_subtract_posvel(&total, &diff, -massratio);
+                    break;
+                }
                 for(int j=0; j < N_real; j++){
                     rebx_subtract_posvel(&sim->particles[j], &diff, massratio);
                 }
@@ -194,6 +766,13 @@ void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* c
                 else{
                     massratio = p->m/com.m;
                 }
+                if (!direct){
+                    if (back_reactions_inclusive){
+                        rebx_subtract_posvel(p, &diff, massratio);
+                    }
+                    rebx_subtract_posvel(&total, &diff, -massratio);
+                    break;
+                }
                 for(int j=0; j < i + back_reactions_inclusive; j++){    // stop at j=i if inclusive, at i-1 if not
                     rebx_subtract_posvel(&sim->particles[j], &diff, massratio);
                 }
@@ -212,6 +791,16 @@ void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* c
                 reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
         }
     }
+    if (!direct){
+        if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+            for(int j=0; j < N_real; j++){
+                rebx_subtract_posvel(&sim->particles[j], &total, 1.);
+            }
+        }
+        else if (coordinates == REBX_COORDINATES_JACOBI && N_real > 0){
+            rebx_subtract_posvel(&sim->particles[0], &total, 1.);
+        }
+    }
 }
 
 /*static const struct reb_orbit reb_orbit_nan = {.d = NAN, .v = NAN, .h = NAN, .P = NAN, .n = NAN, .a = NAN, .e = NAN, .inc = NAN, .Omega = NAN, .omega = NAN, .pomega = NAN, .f = NAN, .M = NAN, .l = NAN};
@@ -32,8 +32,69 @@ struct reb_orbit;
 struct reb_vec3d;
 struct rebx_force;
 struct rebx_operator;
+struct rebx_extras;
 enum REBX_COORDINATES;
 
+/**
+ * Cached indices (ascending, all < N) of the particles carrying a given registered parameter.
+ * Rebuilt lazily whenever a parameter is added to any object, a particle is removed, or N / the particle array changes.
+ */
+struct rebx_particle_list {
+    unsigned long generation;                   // rebx->param_generation when the list was built
+    const struct reb_particle* particles;       // particle array the list was built for
+    int N;                                      // number of particles scanned
+    int N_indices;                              // number of participating particles
+    int N_allocated;
+    int* indices;
+};
+
+// Returned pointer stays valid until rebx_free_particle_lists; contents may be rebuilt by the next call with the same key.
+const struct rebx_particle_list* rebx_get_particle_list(struct rebx_extras* const rebx, const int key, const struct reb_particle* const particles, const int N);
+
+void rebx_free_particle_lists(struct rebx_extras* const rebx);
+
+/**
+ * Fused evaluation of forces measured relative to a source particle (enabled by setting the "fused" int param on each force).
+ * Each fusable effect turns its configuration into one term per source; terms sharing a source are evaluated in a
+ * single sweep that computes the separation (and its norm if any term needs it) once per particle. Only forces that are
+ * consecutive in the force list share a sweep, so every other force still runs in list order.
+ */
+struct rebx_source_pair {
+    double dx, dy, dz;                          // particle minus source
+    double r2;
+    double r;                                   // sqrt(r2), only set if a term in the sweep has needs_r
+};
+
+struct rebx_source_term {
+    // Adds the term's accelerations for particle i (and its back-reaction on the source) directly to particles
+    void (*accumulate)(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair);
+    struct rebx_extras* rebx;
+    int source_index;
+    int needs_r;
+    int key[2];                                 // per-particle params read by the term
+    double c[4];                                // constants precomputed once per source
+};
+
+#define REBX_MAX_SOURCE_TERMS 64
+
+// Writes an effect's terms for the current state. Returns the number written, or -1 if the force must be run on its own.
+typedef int (*rebx_source_terms_function)(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);
+
+void rebx_fused_source_forces(struct rebx_source_term* const terms, const int N_terms, struct reb_particle* const particles, const int N);
+
+int rebx_gr_potential_source_terms(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);
+int rebx_gravitational_harmonics_source_terms(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);
+int rebx_tides_precession_source_terms(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);
+int rebx_central_force_source_terms(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);
+int rebx_radiation_forces_source_terms(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max);
+
+/*
+ * Up to this many particles, rebx_com_force and rebxtools_com_ptm apply each back reaction to the particles it acts on
+ * as it is computed, which reproduces earlier versions bit for bit. Above it the back reactions are accumulated into
+ * running totals, so the bookkeeping is O(N) rather than O(N^2) and results agree to floating point summation order.
+ */
+#define REBX_BACK_REACTIONS_DIRECT_N 64
+
 void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_vec3d (*calculate_force) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source), struct reb_particle* const particles, const int N);
 
 void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle (*calculate_step) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt), const double dt);
@@ -41,6 +102,106 @@ void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* c
 double rebx_Edot(struct reb_particle* const ps, const int N);
 
 void rebx_calculate_jacobi_masses(const struct reb_particle* const ps, double* const m_j, const int N);
+
+/**
+ * Orientation of an oblate body: R rotates vectors from the simulation frame to the body equatorial frame (pole along z).
+ */
+struct rebx_oblate_frame {
+    double R[3][3];
+};
+
+void rebx_oblate_frame_from_pole(struct rebx_oblate_frame* const frame, const double xp, const double yp, const double zp);   // unit pole vector
+
+void rebx_oblate_frame_from_radec(struct rebx_oblate_frame* const frame, const double ra, const double dec);   // pole RA and Dec in radians
+
+static inline void rebx_oblate_frame_to_body(const struct rebx_oblate_frame* const frame, const double* const v, double* const vb){
+    vb[0] = frame->R[0][0]*v[0] + frame->R[0][1]*v[1] + frame->R[0][2]*v[2];
+    vb[1] = frame->R[1][0]*v[0] + frame->R[1][1]*v[1] + frame->R[1][2]*v[2];
+    vb[2] = frame->R[2][0]*v[0] + frame->R[2][1]*v[1] + frame->R[2][2]*v[2];
+}
+
+static inline void rebx_oblate_frame_from_body(const struct rebx_oblate_frame* const frame, const double* const vb, double* const v){
+    v[0] = frame->R[0][0]*vb[0] + frame->R[1][0]*vb[1] + frame->R[2][0]*vb[2];
+    v[1] = frame->R[0][1]*vb[0] + frame->R[1][1]*vb[1] + frame->R[2][1]*vb[2];
+    v[2] = frame->R[0][2]*vb[0] + frame->R[1][2]*vb[1] + frame->R[2][2]*vb[2];
+}
+
+// Rotates the body frame by angle (radians) about its pole, e.g. to the body-fixed frame given the prime meridian angle.
+void rebx_oblate_frame_spin(struct rebx_oblate_frame* const frame, const double angle);
+
+// Acceleration a (body frame) at (x,y,z) from the zonal harmonics J[2..n_max] of a body with G*mass GM and radius R_eq, in one pass.
+void rebx_zonal_acceleration(const double GM, const double R_eq, const int n_max, const double* const J, const double x, const double y, const double z, double* const a);
+
+// Matching potential per unit mass, GM/r sum J_n (R_eq/r)^n P_n(z/r) (a = -grad of this).
+double rebx_zonal_potential(const double GM, const double R_eq, const int n_max, const double* const J, const double x, const double y, const double z);
+
+/**
+ * Full spherical harmonics through degree n_max, with unnormalized coefficients C_nm, S_nm stored at [n*(n_max+1)+m]
+ * (C_n0 = -J_n; degrees 0 and 1 are ignored). Evaluated in one pass of the Cunningham recursion in Cartesian coordinates,
+ * so there is no trigonometry. VW is scratch space for 2*(n_max+2)*(n_max+2) doubles.
+ */
+void rebx_harmonics_acceleration(const double GM, const double R_eq, const int n_max, const double* const C, const double* const S, const double x, const double y, const double z, double* const VW, double* const a);
+
+// Matching potential per unit mass (same sign convention as rebx_zonal_potential).
+double rebx_harmonics_potential(const double GM, const double R_eq, const int n_max, const double* const C, const double* const S, const double x, const double y, const double z, double* const VW);
+
+/**
+ * First order variational equations. Variations of the accelerations are added to REBOUND's variational particles,
+ * linearizing each force about the real particle the variational particle belongs to. Forces that act between a source
+ * and the other particles compute the variation da of a particle's acceleration from the variation of its separation
+ * from the source; rebx_source_variations then adds da to the particle's variation and the back reaction to the source's.
+ * Variations of the masses are not included.
+ */
+struct reb_variational_configuration;
+
+// Variational particle of real particle j in configuration vc, or NULL if j is not varied in it (test particle variations)
+struct reb_particle* rebx_variational_particle(struct reb_simulation* const sim, const struct reb_variational_configuration* const vc, const int j);
+
+// d is particle i minus the source (position, velocity) and dd its variation; writes the variation of i's acceleration to da
+typedef void (*rebx_variation_function)(const void* const data, const struct reb_particle* const particles, const int i, const int source_index, const double* const d, const double* const dd, double* const da);
+
+// Applies f to every particle other than source_index, in every first order configuration. Higher orders are skipped.
+void rebx_source_variations(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const int source_index, rebx_variation_function f, const void* const data);
+
+// Variation of a = K d/r^n
+void rebx_power_law_variation(const double K, const double n, const double* const d, const double* const dd, double* const da);
+
+// Variation of the J2 and J4 acceleration of a body with G*mass GM at offset d, added to da. frame == NULL means the pole is along z.
+void rebx_zonal_variation(const double GM, const double J2, const double J4, const double R_eq, const struct rebx_oblate_frame* const frame, const double* const d, const double* const dd, double* const da);
+
+// Variation of the 1PN test particle acceleration a = mu/(c^2 r^3) [(4 mu/r - v^2) r + 4 (r.v) v] around a body with G*mass mu, added to da
+void rebx_gr_variation(const double mu, const double C2, const double* const d, const double* const dd, double* const da);
+
+/**
+ * Structure-of-arrays batches for orbital element conversions. Lane k of a state holds a particle's position and
+ * velocity relative to its primary; lane k of an orbit holds the corresponding elements (angles in radians).
+ */
+struct rebx_state_batch {
+    double* x;
+    double* y;
+    double* z;
+    double* vx;
+    double* vy;
+    double* vz;
+};
+
+struct rebx_orbit_batch {
+    double* a;
+    double* e;
+    double* inc;
+    double* Omega;
+    double* omega;
+    double* f;
+};
+
+/**
+ * Batched counterparts of REBOUND's reb_tools_particle_to_orbit_err and reb_tools_orbit_to_particle_err for n lanes, with
+ * particle masses m and primary masses m_primary. The loops are branch-free so the compiler can vectorize them. Each lane
+ * gets the same error code as the scalar function (0 on success), and lanes with errors are set to NaN.
+ */
+void rebx_particles_to_orbits(const double G, const int n, const double* const m, const double* const m_primary, const struct rebx_state_batch* const states, struct rebx_orbit_batch* const orbits, int* const err);
+
+void rebx_orbits_to_particles(const double G, const int n, const double* const m, const double* const m_primary, const struct rebx_orbit_batch* const orbits, struct rebx_state_batch* const states, int* const err);
 /*
 struct reb_orbit rebxtools_particle_to_orbit_err(double G, struct reb_particle* p, struct reb_particle* primary, int* err);
 
@@ -37,17 +37,14 @@ struct sum_s {
  */
 int spk_free(struct spk_s *pl)
 {
-	int m;
-
 	if (pl == NULL)
 		return -1;
 
-	for (m = 0; m < pl->num; m++) {
-		free(pl->one[m]);
-		free(pl->two[m]);
-	}
+	if (pl->map != NULL)
+		munmap(pl->map, pl->len);
 
-	munmap(pl->map, pl->len);
+	free(pl->targets);
+	free(pl->index);
 	memset(pl, 0, sizeof(struct spk_s));
 	free(pl);
 	return 0;
@@ -63,15 +60,6 @@ int spk_free(struct spk_s *pl)
 static double inline _jul(double eph)
 	{ return 2451545.0 + eph / 86400.0; }
 
-// check for any non-7bit ascii characters
-static int _com(const char *buf)
-{
-	for (int n = 0; n < 1024; n++)
-		{ if (buf[n] < 0) return 0; }
-
-	return 1;
-}
-
 // display output strings to console
 static void _sho(const char *buf)
 {
@@ -88,19 +76,21 @@ struct spk_s * spk_init(const char *path)
 	struct stat sb;
 	char buf[1024];
 	struct sum_s *sum;
+	struct spk_seg *seg;
+	struct spk_target *tar;
 	double *val;
-	int fd, nd, ni, nc;
-	int m, n, c, b, B;
+	int fd, nd, ni, nc, fw;
+	int m, n, b, B;
+	int nt, ns;			// allocated targets and segments
 	off_t off;
-	int num;
 
 	if ((fd = open(path, O_RDONLY)) < 0)
 		return NULL;
 
-	pl = malloc(sizeof(struct spk_s));
-	memset(pl, 0, sizeof(struct spk_s));
+	pl = calloc(1, sizeof(struct spk_s));
 	val = (double *)buf;
 	sum = (struct sum_s *)buf;
+	nt = ns = 0;
 
 	if (fstat(fd, &sb) < 0)
 		goto err;
@@ -127,24 +117,26 @@ struct spk_s * spk_init(const char *path)
 	}
 
 	// could check the other headers, but we really don't care
-	// so find the first summary record (after potential comments)
-	off = lseek(fd, 1024, SEEK_SET);
-	read(fd, buf, 1024);
+	// so go to the first summary record (FWARD, after potential comments)
+	lseek(fd, 76, SEEK_SET);
+	read(fd, &fw, sizeof(int));
 
-	while (_com(buf) > 0) {
-	//	_sho(buf);
-		off = lseek(fd, 0, SEEK_CUR);
-		read(fd, buf, 1024);
+	if (fw < 2) {
+		errno = EILSEQ;
+		goto err;
 	}
 
+	off = lseek(fd, (fw - 1) * 1024, SEEK_SET);
+	read(fd, buf, 1024);
+
 	// we are at the first summary block, validate
 	if (val[1] != 0.0) {
 		errno = EILSEQ;
 		goto err;
 	}
 
-	// okay, let's go
-	m = 0;
+	// okay, let's go; the index and target list grow as needed
+	m = -1;
 next:	n = (int)val[0] - 1;
 	B = (int)val[2];
 
@@ -156,20 +148,30 @@ next:	n = (int)val[0] - 1;
 //				sum->ref, sum->ver, sum->one, sum->two);
 
 		// pick out new target!
-		if (sum->tar != pl->tar[m]) {
+		if (m < 0 || sum->tar != pl->targets[m].code) {
+			if (pl->num == nt) {
+				nt = nt ? 2 * nt : 32;
+				pl->targets = realloc(pl->targets, nt * sizeof(struct spk_target));
+			}
 			m = pl->num++;
-			pl->tar[m] = sum->tar;
-			pl->cen[m] = sum->cen;
-			pl->beg[m] = _jul(sum->beg);
-			pl->res[m] = _jul(sum->end) - pl->beg[m];
-			pl->one[m] = calloc(32768, sizeof(int));
-			pl->two[m] = calloc(32768, sizeof(int));
+			tar = &pl->targets[m];
+			tar->code = sum->tar;
+			tar->cen = sum->cen;
+			tar->beg = _jul(sum->beg);
+			tar->res = _jul(sum->end) - tar->beg;
+			tar->one = pl->nseg;
+			tar->ind = 0;
 		}
 
 		// add index
-		c = pl->ind[m]++;
-		pl->one[m][c] = sum->one;
-		pl->two[m][c] = sum->two;
+		if (pl->nseg == ns) {
+			ns = ns ? 2 * ns : 1024;
+			pl->index = realloc(pl->index, ns * sizeof(struct spk_seg));
+		}
+		seg = &pl->index[pl->nseg++];
+		pl->targets[m].ind++;
+		seg->one = sum->one;
+		seg->num = sum->two;		// directory address, decoded below
 	}
 
 	if (n >= 0) {
@@ -179,12 +181,41 @@ next:	n = (int)val[0] - 1;
 		goto next;
 	}
 
+	// trim to size
+	pl->targets = realloc(pl->targets, (pl->num ? pl->num : 1) * sizeof(struct spk_target));
+	pl->index = realloc(pl->index, (pl->nseg ? pl->nseg : 1) * sizeof(struct spk_seg));
+
 	// memory map : kernel caching and thread safe
 	pl->len = sb.st_size;
 	pl->map = mmap(NULL, pl->len, PROT_READ, MAP_SHARED, fd, 0);
 
-	if (pl->map == NULL)
+	if (pl->map == MAP_FAILED) {
+		pl->map = NULL;
 		goto err;
+	}
+
+	// decode the directory at the end of each segment: INIT, INTLEN, RSIZE, N
+	for (b = 0; b < pl->nseg; b++) {
+		seg = &pl->index[b];
+
+		if (seg->num < 4 || sizeof(double) * (size_t)seg->num > pl->len) {
+			errno = EILSEQ;
+			goto err;
+		}
+
+		val = pl->map + sizeof(double) * (seg->num - 1);
+
+		seg->jde = _jul(val[-3]);
+		seg->len = val[-2] / 86400.0;
+		seg->rsz = (int)val[-1];
+		seg->num = (int)val[0];
+
+		// number of coefficients per coordinate must fit in spk_calc()
+		if ((seg->rsz - 2) / 3 > 32 || seg->rsz < 5) {
+			errno = EILSEQ;
+			goto err;
+		}
+	}
 
 	if (close(fd) < 0)
 		{ ; }
@@ -194,6 +225,11 @@ next:	n = (int)val[0] - 1;
 	return pl;
 
 err:	perror(path);
+	close(fd);
+	if (pl->map != NULL)
+		munmap(pl->map, pl->len);
+	free(pl->targets);
+	free(pl->index);
 	free(pl);
 	return NULL;
 }
@@ -213,7 +249,7 @@ int spk_find(struct spk_s *pl, int tar)
 		return -1;
 
 	for (n = 0; n < pl->num; n++)
-		if (pl->tar[n] == tar)
+		if (pl->targets[n].code == tar)
 			{ return n; }
 
 	return -1;
@@ -227,36 +263,15 @@ int spk_find(struct spk_s *pl, int tar)
  *
  */
 
-int spk_calc(struct spk_s *pl, int m, double jde, struct mpos_s *pos)
+// sum the Chebyshev series of one record with P coefficients per coordinate
+static void _sum(const double *val, int P, double jde, struct mpos_s *pos)
 {
-	struct sum_s *sum;
-	int n, b, p, P, R;
 	double T[32], S[32];
-	double *val;
-
-	if (pl == NULL || pos == NULL)
-		return -1;
-	if (m < 0 || m >= pl->num)
-		return -1;
-
-	pos->jde = jde;
+	int n, b, p;
 
 	for (n = 0; n < 3; n++)
 		pos->u[n] = pos->v[n] = 0.0;
 
-	// find location of 'directory' describing the data records
-	n = (int)((jde - pl->beg[m]) / pl->res[m]);
-	val = pl->map + sizeof(double) * (pl->two[m][n] - 1);
-
-	// record size and number of coefficients per coordinate
-	R = (int)val[-1];
-	P = (R - 2) / 3; // must be < 32 !!
-
-	// pick out the precise record
-	b = (int)((jde - _jul(val[-3])) / (val[-2] / 86400.0));
-	val = pl->map + sizeof(double) * (pl->one[m][n] - 1)
-			+ sizeof(double) * b * R;
-
 	// scale to interpolation units
 	jde -= _jul(val[0]);
 	jde /= val[1] / 86400.0;
@@ -284,7 +299,294 @@ int spk_calc(struct spk_s *pl, int m, double jde, struct mpos_s *pos)
 		pos->v[n] /= 149597870.7 / 86400.0;
 		pos->v[n] /= val[1];
 	}
+}
+
+// find the record holding jde for target m; returns NULL if not covered
+static const double * _look(struct spk_s *pl, int m, double jde, int *P, int *R, double *lo, double *hi)
+{
+	struct spk_target *tar;
+	struct spk_seg *seg;
+	int n, b;
+
+	// find the segment describing the data records
+	tar = &pl->targets[m];
+	n = (int)((jde - tar->beg) / tar->res);
+
+	if (jde < tar->beg || n >= tar->ind)
+		return NULL;
+
+	seg = &pl->index[tar->one + n];
+
+	// record size and number of coefficients per coordinate
+	*R = seg->rsz;
+	*P = (*R - 2) / 3; // must be < 32 !!
+
+	// pick out the precise record
+	b = (int)((jde - seg->jde) / seg->len);
+
+	if (b < 0 || b >= seg->num)
+		return NULL;
+
+	if (lo != NULL) {
+		// the epochs both lookups above certainly place in this record
+		*lo = fmax(tar->beg + n * tar->res, seg->jde + b * seg->len);
+		*hi = fmin(tar->beg + (n + 1) * tar->res, seg->jde + (b + 1) * seg->len);
+	}
+
+	return pl->map + sizeof(double) * (seg->one - 1)
+			+ sizeof(double) * b * seg->rsz;
+}
+
+int spk_calc(struct spk_s *pl, int m, double jde, struct mpos_s *pos)
+{
+	const double *val;
+	int n, P, R;
+
+	if (pl == NULL || pos == NULL)
+		return -1;
+	if (m < 0 || m >= pl->num)
+		return -1;
+
+	pos->jde = jde;
+
+	if ((val = _look(pl, m, jde, &P, &R, NULL, NULL)) == NULL) {
+		for (n = 0; n < 3; n++)
+			pos->u[n] = pos->v[n] = 0.0;
+		return -1;
+	}
+
+	_sum(val, P, jde, pos);
 
 	return 0;
 }
 
+
+/*
+ *  spk_calc_cur
+ *
+ *  Same as spk_calc(), for a caller that moves through time in order.  Each
+ *  target's current record is copied into cur, so the segment and record are
+ *  only looked up again once jde leaves it, and the next record in the
+ *  direction of travel is then requested from the kernel ahead of time.  Epochs
+ *  within _EDGE of a record boundary go through the usual lookup, so the
+ *  results are identical to spk_calc().
+ *
+ */
+
+#define _EDGE	1.0e-6		// days, well above the rounding of the record lookup
+
+int spk_calc_cur(struct spk_s *pl, struct spk_cur_s *cur, int m, double jde, struct mpos_s *pos)
+{
+	struct spk_rec_s *rec;
+	const double *val;
+	double lo, hi;
+	size_t pg, o0, o1, sz;
+	int P, R;
+
+	if (cur == NULL)
+		return spk_calc(pl, m, jde, pos);
+	if (pl == NULL || pos == NULL)
+		return -1;
+	if (m < 0 || m >= pl->num)
+		return -1;
+
+	if (cur->spl != pl || cur->num != pl->num) {
+		free(cur->rec);
+		cur->rec = NULL;
+		if (posix_memalign((void **)&cur->rec, 64, sizeof(struct spk_rec_s) * pl->num) != 0)
+			cur->rec = NULL;
+		else
+			memset(cur->rec, 0, sizeof(struct spk_rec_s) * pl->num);
+		cur->spl = pl;
+		cur->num = pl->num;
+		cur->last = jde;
+		cur->dir = 1;
+	}
+	if (cur->rec == NULL)
+		return spk_calc(pl, m, jde, pos);
+
+	// all targets are usually asked for at one epoch, so only a new epoch sets the direction
+	if (jde != cur->last)
+		cur->dir = (jde < cur->last) ? -1 : 1;
+	cur->last = jde;
+	rec = &cur->rec[m];
+	pos->jde = jde;
+
+	if (rec->P > 0 && jde > rec->lo && jde < rec->hi) {
+		_sum(rec->val, rec->P, jde, pos);
+		return 0;
+	}
+
+	if ((val = _look(pl, m, jde, &P, &R, &lo, &hi)) == NULL)
+		return spk_calc(pl, m, jde, pos);
+
+	memcpy(rec->val, val, sizeof(double) * (2 + 3 * P));
+	rec->P = P;
+	rec->lo = lo + _EDGE;
+	rec->hi = hi - _EDGE;
+
+	// records of a segment are contiguous, so page in the neighbour now
+	sz = sizeof(double) * R;
+	o0 = (size_t)((const char *)val - (const char *)pl->map);
+	if (cur->dir > 0)
+		o0 += sz;
+	else if (o0 >= sz)
+		o0 -= sz;
+	o1 = o0 + sz;
+	pg = sysconf(_SC_PAGESIZE);
+	o0 = o0 / pg * pg;
+	if (o1 <= pl->len && madvise(pl->map + o0, o1 - o0, MADV_WILLNEED) < 0)
+		{ ; } // only a hint
+
+	_sum(rec->val, rec->P, jde, pos);
+
+	return 0;
+}
+
+void spk_cur_free(struct spk_cur_s *cur)
+{
+	if (cur == NULL)
+		return;
+
+	free(cur->rec);
+	memset(cur, 0, sizeof(struct spk_cur_s));
+}
+
+
+/*
+ *  spk_write
+ *
+ *  Write a type 2 (Chebyshev position) kernel with one segment per target.
+ *  All targets share the centre and the record grid: nrec records of len days
+ *  starting at beg, each with ncf coefficients per coordinate in [km].  The
+ *  coefficients cf are ordered [target][record][coordinate][coefficient].
+ *
+ */
+
+// convert julian day number to SPK epoch (since J2000.0)
+static double inline _eph(double jde)
+	{ return (jde - 2451545.0) * 86400.0; }
+
+// write one 1024 byte record, zero padded
+static int _rec(FILE *fp, const void *buf, size_t len)
+{
+	char rec[1024];
+
+	memset(rec, 0, sizeof(rec));
+	memcpy(rec, buf, len < sizeof(rec) ? len : sizeof(rec));
+	return fwrite(rec, sizeof(rec), 1, fp) == 1 ? 0 : -1;
+}
+
+#define _SPK_SUM_PER_REC	25	// (128 - 3) / 5 summaries fit one record
+
+int spk_write(const char *path, int num, const int *tar, int cen,
+		double beg, double len, int nrec, int ncf, const double *cf)
+{
+	FILE *fp;
+	char buf[1024];
+	struct sum_s sum;
+	char nam[16];
+	double *val, dir[4], rec[2];
+	int S, R, B, one, s, m, n, b;
+
+	if (path == NULL || tar == NULL || cf == NULL)
+		return -1;
+	if (num < 1 || nrec < 1 || ncf < 1 || ncf > 32 || len <= 0.0)
+		return -1;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		return -1;
+
+	// summary and name record pairs come first, then the data
+	S = (num + _SPK_SUM_PER_REC - 1) / _SPK_SUM_PER_REC;
+	R = 2 + 3 * ncf;
+	one = (1 + 2 * S) * 128 + 1;
+
+	// file record
+	memset(buf, 0, sizeof(buf));
+	memcpy(&buf[0], "DAF/SPK ", 8);
+	*(int *)&buf[8] = 2;				// ND
+	*(int *)&buf[12] = 6;				// NI
+	memset(&buf[16], ' ', 60);			// internal file name
+	memcpy(&buf[16], "REBOUNDx ephemeris_forces", 25);
+	*(int *)&buf[76] = 2;				// FWARD
+	*(int *)&buf[80] = 2 * S;			// BWARD
+	*(int *)&buf[84] = one + num * (nrec * R + 4);	// FREE
+	memcpy(&buf[88], "LTL-IEEE", 8);
+	memcpy(&buf[699], "FTPSTR:\r:\n:\r\n:\r\x00:\x81:\x10\xce:ENDFTP", 28);
+
+	if (_rec(fp, buf, sizeof(buf)) < 0)
+		goto err;
+
+	// summary records, each followed by its name record
+	val = (double *)buf;
+
+	for (s = 0; s < S; s++) {
+		memset(buf, 0, sizeof(buf));
+		val[0] = (s + 1 < S) ? 2 * s + 4 : 0;	// NEXT
+		val[1] = (s > 0) ? 2 * s : 0;		// PREV
+		val[2] = 0;				// NSUM
+
+		for (m = s * _SPK_SUM_PER_REC; m < num && m < (s + 1) * _SPK_SUM_PER_REC; m++) {
+			sum.beg = _eph(beg);
+			sum.end = _eph(beg + nrec * len);
+			sum.tar = tar[m];
+			sum.cen = cen;
+			sum.ref = 1;
+			sum.ver = 2;
+			sum.one = one + m * (nrec * R + 4);
+			sum.two = sum.one + nrec * R + 4 - 1;
+			memcpy(&buf[24 + (int)val[2] * sizeof(struct sum_s)], &sum, sizeof(sum));
+			val[2]++;
+		}
+
+		if (_rec(fp, buf, sizeof(buf)) < 0)
+			goto err;
+
+		// segment names are the target codes, blank padded
+		B = (int)val[2];
+		memset(buf, ' ', sizeof(buf));
+		for (n = 0; n < B; n++) {
+			b = snprintf(nam, sizeof(nam), "%d", tar[s * _SPK_SUM_PER_REC + n]);
+			memcpy(&buf[n * 40], nam, b);
+		}
+
+		if (_rec(fp, buf, sizeof(buf)) < 0)
+			goto err;
+	}
+
+	// data : records of MID, RADIUS and the coefficients, then the directory
+	for (m = 0; m < num; m++) {
+		for (b = 0; b < nrec; b++) {
+			rec[0] = _eph(beg + (b + 0.5) * len);
+			rec[1] = 0.5 * len * 86400.0;
+
+			if (fwrite(rec, sizeof(double), 2, fp) != 2)
+				goto err;
+			if (fwrite(&cf[((size_t)m * nrec + b) * 3 * ncf], sizeof(double), 3 * ncf, fp) != (size_t)(3 * ncf))
+				goto err;
+		}
+
+		// INIT, INTLEN, RSIZE, N
+		dir[0] = _eph(beg);
+		dir[1] = len * 86400.0;
+		dir[2] = R;
+		dir[3] = nrec;
+
+		if (fwrite(dir, sizeof(double), 4, fp) != 4)
+			goto err;
+	}
+
+	// pad the last record
+	n = (int)(ftell(fp) % 1024);
+	if (n > 0) {
+		memset(buf, 0, sizeof(buf));
+		if (fwrite(buf, 1024 - n, 1, fp) != 1)
+			goto err;
+	}
+
+	return fclose(fp) == 0 ? 0 : -1;
+
+err:	fclose(fp);
+	return -1;
+}
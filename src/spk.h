@@ -8,8 +8,6 @@
 #ifndef _SPK_H
 #define _SPK_H
 
-#define _SPK_MAX	32	// maximum body count
-
 enum {
 	SPK_NAIF_SSB		= 0,
 	SPK_NAIF_MER		= 1,
@@ -51,26 +49,60 @@ struct mpos_s {
 	double jde;
 };
 
-struct spk_s {
+// one type 2 segment, with its directory decoded at load time
+struct spk_seg {
+	int one;			// initial array address
+	int rsz;			// record size (doubles)
+	int num;			// number of records
+	double jde;			// epoch of first record
+	double len;			// record interval [days]
+};
 
-	int tar[_SPK_MAX];		// target code
-	int cen[_SPK_MAX];		// centre target
-	double beg[_SPK_MAX];		// begin epoch
-	double res[_SPK_MAX];		// epoch step
-	int *one[_SPK_MAX];		// record index
-	int *two[_SPK_MAX];		// ... ditto
-	int ind[_SPK_MAX];		// length of index
+struct spk_target {
+	int code;			// target code
+	int cen;			// centre target
+	double beg;			// begin epoch
+	double res;			// epoch step
+	int one;			// first segment in the index
+	int ind;			// number of segments
+};
+
+struct spk_s {
+	struct spk_target *targets;	// targets, in file order
+	struct spk_seg *index;		// segments of all targets, contiguous per target
 
 	int num;			// number of targets
+	int nseg;			// number of segments
 	void *map;			// memory map
 	size_t len;			// map length
 };
 
 
+// the record one caller is working in for each target, for spk_calc_cur(); zero before first use.
+// Each thread needs its own, the kernel itself stays read-only.
+struct spk_rec_s {
+	double lo, hi;			// epochs that certainly fall in the record
+	int P;				// number of coefficients per coordinate, 0 if none is held
+	double val[2 + 3 * 32];		// copy of the record: midpoint, radius, coefficients
+};
+
+struct spk_cur_s {
+	const struct spk_s *spl;	// kernel the copies were taken from
+	int num;			// number of targets
+	double last;			// epoch of the previous call
+	int dir;			// direction of travel, +1 or -1
+	struct spk_rec_s *rec;		// one per target, aligned
+};
+
+
 int spk_free(struct spk_s *pl);
 struct spk_s * spk_init(const char *path);
 int spk_find(struct spk_s *pl, int m);
 int spk_calc(struct spk_s *pl, int tar, double jde, struct mpos_s *pos);
+int spk_calc_cur(struct spk_s *pl, struct spk_cur_s *cur, int tar, double jde, struct mpos_s *pos);
+void spk_cur_free(struct spk_cur_s *cur);
+int spk_write(const char *path, int num, const int *tar, int cen,
+		double beg, double len, int nrec, int ncf, const double *cf);
 
 #endif // _SPK_H
 
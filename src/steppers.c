@@ -64,23 +64,72 @@
 #include "rebound.h"
 #include "reboundx.h"
 
-// will do IAS with gravity + any additional_forces
+// will do IAS with gravity + any additional_forces.
+// By default every call resets IAS15 and ramps up from a timestep of 1e-4*dt. Setting the operator's ias15_warm_start
+// to 1 instead starts from the last accepted internal timestep (kept in ias15_dt_last, so it is saved in binaries),
+// and setting it to 2 also keeps the IAS15 predictor state between calls. That state lives in the simulation, so
+// 2 falls back to 1 when REBOUND itself is integrating with IAS15.
+
+static void rebx_ias15_clear_compensation(struct reb_simulation* const sim){
+    struct reb_simulation_integrator_ias15* const ri = &sim->ri_ias15;
+    // Other operators moved the particles since the last call, so the compensated summation residuals no longer apply
+    for (int k=0; k<ri->allocatedN; k++){
+        if (ri->csx){
+            ri->csx[k] = 0.;
+        }
+        if (ri->csv){
+            ri->csv[k] = 0.;
+        }
+    }
+}
 
 void rebx_ias15_step(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
+    struct rebx_extras* const rebx = sim->extras;
     const double old_t = sim->t;
     const double t_needed = old_t + dt;
     const double old_dt = sim->dt;
+    const int* const warm_start_param = rebx_get_param(rebx, operator->ap, "ias15_warm_start");
+    int warm_start = warm_start_param ? *warm_start_param : 0;
+    if (warm_start > 1 && sim->integrator == REB_INTEGRATOR_IAS15){
+        warm_start = 1;
+    }
+    double* const dt_last = rebx_get_param(rebx, operator->ap, "ias15_dt_last");
     sim->gravity_ignore_terms = 0;
-    reb_integrator_ias15_reset(sim);
+    if (warm_start > 1 && dt_last != NULL && sim->ri_ias15.allocatedN == 3*sim->N){
+        rebx_ias15_clear_compensation(sim);
+    }
+    else{
+        reb_integrator_ias15_reset(sim);
+    }
     
-    sim->dt = 0.0001*dt; // start with a small timestep.
+    if (warm_start && dt_last != NULL && *dt_last > 0.){
+        sim->dt = *dt_last < dt ? *dt_last : dt;
+    }
+    else{
+        sim->dt = 0.0001*dt; // start with a small timestep.
+    }
     
+    double dt_next = 0.;
     while(sim->t < t_needed && fabs(sim->dt/old_dt)>1e-14 ){
         reb_update_acceleration(sim);
         reb_integrator_ias15_part2(sim);
         if (sim->t+sim->dt > t_needed){
+            if (sim->t < t_needed){
+                dt_next = sim->dt;  // a last step cut short to land on t_needed shouldn't set the next call's first step
+            }
             sim->dt = t_needed-sim->t;
         }
+        else{
+            dt_next = sim->dt;
+        }
+    }
+    if (warm_start && dt_next > 0.){
+        if (dt_last != NULL){
+            *dt_last = dt_next;
+        }
+        else{
+            rebx_set_param_double(rebx, &operator->ap, "ias15_dt_last", dt_next);
+        }
     }
     sim->t = old_t;
     sim->dt = old_dt; // reset in case this is part of a chain of steps
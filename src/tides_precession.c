@@ -39,6 +39,7 @@
  * In all cases, we need to set masses for all the particles that will feel these tidal forces. After that, we can choose to include tides raised on the primary, on the "planets", or both, by setting the respective bodies' R_tides (physical radius) and k1 (apsidal motion constant, half the tidal Love number).
  * You can specify the primary with a "primary" flag.
  * If not set, the primary will default to the particle at the 0 index in the particles array.
+ * First order variational particles get the exact derivative of this force (masses and radii are held fixed).
  * 
  * **Effect Parameters**
  * 
@@ -61,17 +62,20 @@
 #include <stdlib.h>
 #include <float.h>
 #include "reboundx.h"
+#include "rebxtools.h"
 
 static void rebx_calculate_tides_precession(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const int source_index){
     struct reb_particle* const source = &particles[source_index];
     const double m0 = source->m;
+    const int R_key = rebx_get_param_key(rebx, "R_tides");
+    const int k1_key = rebx_get_param_key(rebx, "k1");
     double R0 = 0.;
-    double* R = rebx_get_param(rebx, source->ap, "R_tides");
+    double* R = rebx_get_param_by_key(rebx, source->ap, R_key);
     if (R){
         R0 = *R;
     }
     double k10 = 0.;
-    double* k1 = rebx_get_param(rebx, source->ap, "k1");
+    double* k1 = rebx_get_param_by_key(rebx, source->ap, k1_key);
     if (k1){
         k10 = *k1;
     }
@@ -89,12 +93,12 @@ static void rebx_calculate_tides_precession(struct rebx_extras* const rebx, stru
         fac += fac0*mratio;
         
         Rp = 0.;
-        R = rebx_get_param(rebx, p->ap, "R_tides");
+        R = rebx_get_param_by_key(rebx, p->ap, R_key);
         if(R){
             Rp = *R;
         }
         k1p = 0.;
-        k1 = rebx_get_param(rebx, p->ap, "k1");
+        k1 = rebx_get_param_by_key(rebx, p->ap, k1_key);
         if(k1){
             k1p = *k1;
         }
@@ -115,31 +119,148 @@ static void rebx_calculate_tides_precession(struct rebx_extras* const rebx, stru
 	}
 }
 
-void rebx_tides_precession(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, const int N){
+static void rebx_tides_precession_term(const struct rebx_source_term* const term, struct reb_particle* const particles, const int i, const struct rebx_source_pair* const pair){
+    struct rebx_extras* const rebx = term->rebx;
+    struct reb_particle* const source = &particles[term->source_index];
+    struct reb_particle* const p = &particles[i];
+    const double fac0 = term->c[0];
+    const double m0 = term->c[1];
+    const double G = term->c[2];
+    const double mratio = p->m/m0;
+    if (mratio < DBL_MIN){ // m1 = 0. Continue to avoid overflow/nan
+        return;
+    }
+    double fac=0.; 
+    fac += fac0*mratio;
+    
+    double Rp = 0.;
+    double* R = rebx_get_param_by_key(rebx, p->ap, term->key[0]);
+    if(R){
+        Rp = *R;
+    }
+    double k1p = 0.;
+    double* k1 = rebx_get_param_by_key(rebx, p->ap, term->key[1]);
+    if(k1){
+        k1p = *k1;
+    }
+    
+    fac += k1p*Rp*Rp*Rp*Rp*Rp/mratio;
+    const double dr2 = pair->r2; 
+    const double prefac = -3*G*(m0 + p->m)/(dr2*dr2*dr2*dr2)*fac;
+
+    p->ax += prefac*pair->dx;
+    p->ay += prefac*pair->dy;
+    p->az += prefac*pair->dz;
+    source->ax -= mratio*prefac*pair->dx;
+    source->ay -= mratio*prefac*pair->dy;
+    source->az -= mratio*prefac*pair->dz;
+}
+
+int rebx_tides_precession_source_terms(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, const int N, struct rebx_source_term* const terms, const int N_max){
     struct rebx_extras* const rebx = sim->extras;
-    int source_found=0;
-    for (int i=0; i<N; i++){
-        if (rebx_get_param(rebx, particles[i].ap, "tides_primary") != NULL){
-            source_found = 1;
-            rebx_calculate_tides_precession(rebx, sim, particles, N, i);
+    const int R_key = rebx_get_param_key(rebx, "R_tides");
+    const int k1_key = rebx_get_param_key(rebx, "k1");
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "tides_primary"), particles, N);
+    const int N_sources = sources->N_indices ? sources->N_indices : 1;  // default source to index 0 if "tides_primary" not found on any particle
+    if (N_sources > N_max || N < 1){
+        return -1;
+    }
+    for (int k=0; k<N_sources; k++){
+        const int source_index = sources->N_indices ? sources->indices[k] : 0;
+        const struct reb_particle* const source = &particles[source_index];
+        double R0 = 0.;
+        double* R = rebx_get_param_by_key(rebx, source->ap, R_key);
+        if (R){
+            R0 = *R;
+        }
+        double k10 = 0.;
+        double* k1 = rebx_get_param_by_key(rebx, source->ap, k1_key);
+        if (k1){
+            k10 = *k1;
         }
+        struct rebx_source_term* const term = &terms[k];
+        *term = (struct rebx_source_term){0};
+        term->accumulate = rebx_tides_precession_term;
+        term->rebx = rebx;
+        term->source_index = source_index;
+        term->key[0] = R_key;
+        term->key[1] = k1_key;
+        term->c[0] = k10*R0*R0*R0*R0*R0;
+        term->c[1] = source->m;
+        term->c[2] = sim->G;
     }
-    if (!source_found){
+    return N_sources;
+}
+
+void rebx_tides_precession(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "tides_primary"), particles, N);
+    for (int k=0; k<sources->N_indices; k++){
+        rebx_calculate_tides_precession(rebx, sim, particles, N, sources->indices[k]);
+    }
+    if (sources->N_indices == 0){
         rebx_calculate_tides_precession(rebx, sim, particles, N, 0);    // default source to index 0 if "tides_primary" not found on any particle
     }
 }
 
+struct rebx_tides_variation_data{
+    struct rebx_extras* rebx;
+    int R_key;
+    int k1_key;
+    double fac0;
+    double m0;
+    double G;
+};
+
+static void rebx_tides_precession_variation(const void* const data, const struct reb_particle* const particles, const int i, const int source_index, const double* const d, const double* const dd, double* const da){
+    const struct rebx_tides_variation_data* const td = data;
+    const struct reb_particle* const p = &particles[i];
+    const double mratio = p->m/td->m0;
+    if (mratio < DBL_MIN){ // as in rebx_calculate_tides_precession
+        return;
+    }
+    const double* const R = rebx_get_param_by_key(td->rebx, p->ap, td->R_key);
+    const double* const k1 = rebx_get_param_by_key(td->rebx, p->ap, td->k1_key);
+    const double Rp = R ? *R : 0.;
+    const double k1p = k1 ? *k1 : 0.;
+    const double fac = td->fac0*mratio + k1p*Rp*Rp*Rp*Rp*Rp/mratio;
+    rebx_power_law_variation(-3*td->G*(td->m0 + p->m)*fac, 8., d, dd, da);
+}
+
+static void rebx_tides_precession_source_variations(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const int source_index){
+    const struct reb_particle* const source = &particles[source_index];
+    struct rebx_tides_variation_data td = {rebx, rebx_get_param_key(rebx, "R_tides"), rebx_get_param_key(rebx, "k1"), 0., source->m, sim->G};
+    const double* const R = rebx_get_param_by_key(rebx, source->ap, td.R_key);
+    const double* const k1 = rebx_get_param_by_key(rebx, source->ap, td.k1_key);
+    const double R0 = R ? *R : 0.;
+    td.fac0 = (k1 ? *k1 : 0.)*R0*R0*R0*R0*R0;
+    rebx_source_variations(sim, particles, N, source_index, rebx_tides_precession_variation, &td);
+}
+
+void rebx_tides_precession_variations(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    const struct rebx_particle_list* const sources = rebx_get_particle_list(rebx, rebx_get_param_key(rebx, "tides_primary"), particles, N);
+    for (int k=0; k<sources->N_indices; k++){
+        rebx_tides_precession_source_variations(rebx, sim, particles, N, sources->indices[k]);
+    }
+    if (sources->N_indices == 0){
+        rebx_tides_precession_source_variations(rebx, sim, particles, N, 0);
+    }
+}
+
 static double rebx_calculate_tides_precession_potential(struct rebx_extras* const rebx, struct reb_simulation* const sim, const int source_index){
     struct reb_particle* const particles = sim->particles;
     struct reb_particle* const source = &particles[source_index];
     const double m0 = source->m;
+    const int R_key = rebx_get_param_key(rebx, "R_tides");
+    const int k1_key = rebx_get_param_key(rebx, "k1");
     double R0 = 0.;
-    double* R = rebx_get_param(rebx, source->ap, "R_tides");
+    double* R = rebx_get_param_by_key(rebx, source->ap, R_key);
     if (R){
         R0 = *R;
     }
     double k10 = 0.;
-    double* k1 = rebx_get_param(rebx, source->ap, "k1");
+    double* k1 = rebx_get_param_by_key(rebx, source->ap, k1_key);
     if (k1){
         k10 = *k1;
     }
@@ -158,12 +279,12 @@ static double rebx_calculate_tides_precession_potential(struct rebx_extras* cons
         fac += fac0*mratio;
         
         Rp = 0.;
-        R = rebx_get_param(rebx, p->ap, "R_tides");
+        R = rebx_get_param_by_key(rebx, p->ap, R_key);
         if(R){
             Rp = *R;
         }
         k1p = 0.;
-        k1 = rebx_get_param(rebx, p->ap, "k1");
+        k1 = rebx_get_param_by_key(rebx, p->ap, k1_key);
         if(k1){
             k1p = *k1;
         }
@@ -188,9 +309,10 @@ double rebx_tides_precession_potential(struct rebx_extras* const rebx){
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
     int source_found=0;
+    const int source_key = rebx_get_param_key(rebx, "primary");
     double H=0.;
     for (int i=0; i<N_real; i++){
-        if (rebx_get_param(rebx, particles[i].ap, "primary") != NULL){
+        if (rebx_get_param_by_key(rebx, particles[i].ap, source_key) != NULL){
             source_found = 1;
             H = rebx_calculate_tides_precession_potential(rebx, sim, i);
         }
@@ -0,0 +1,160 @@
+/**
+ * @file    track_energy.c
+ * @brief   Keep a running total of the energy exchanged between the N-body system and the REBOUNDx forces.
+ * @author  Dan Tamayo <tamayo.daniel@gmail.com>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2015 Dan Tamayo, Hanno Rein
+ *
+ * This file is part of reboundx.
+ *
+ * reboundx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * reboundx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * $$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$
+ *
+ * $Miscellaneous Utilities$     // Effect category (must be the first non-blank line after dollar signs and between dollar signs to be detected by script).
+ *
+ * ======================= ===============================================
+ * Authors                 D. Tamayo
+ * Implementation Paper    *In progress*
+ * Based on                None
+ * C Example               None
+ * Python Example          None
+ * ======================= ===============================================
+ *
+ * Integrates the power the REBOUNDx forces deliver to the particles, sum_i m_i v_i.a_i (rebx_Edot), over every
+ * timestep. The operator's ``energy_offset`` then holds minus the energy the added forces have put into the N-body
+ * system since it was added, so that
+ *
+ *     E_nbody + energy_offset
+ *
+ * (with E_nbody from sim.calculate_energy()) stays constant up to integration error. For conservative forces
+ * energy_offset tracks the change in the effect potentials (e.g. rebx_gr_potential_potential), and for dissipative
+ * ones the energy removed, so energy conservation can be checked at every output without recomputing rebx_gr_full_hamiltonian
+ * and the like. Set energy_offset to the initial potential of the effects to get the full conserved quantity.
+ *
+ * Each call evaluates the added forces once at the end of the step (a fraction of a step's cost with IAS15) and
+ * applies the trapezoidal rule between calls, so the running total has an error of second order in the timestep.
+ * It is a cheap monitor for drift at high output cadence; the dedicated Hamiltonian functions remain exact to machine
+ * precision. The first step after the operator is added (or after particles are added or removed) uses the end point only.
+ *
+ * **Effect Parameters**
+ *
+ * ================================ =========== =======================================================
+ * Name (C type)                    Required    Description
+ * ================================ =========== =======================================================
+ * energy_offset (double)           No          Running total updated by the operator. Default 0
+ * ================================ =========== =======================================================
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "rebound.h"
+#include "reboundx.h"
+#include "rebxtools.h"
+
+#include "core.h"
+
+// Kept on the operator between calls
+struct rebx_te_workspace{
+    int N_allocated;
+    double* acc;                    // accelerations of the integrator, saved while the added forces are evaluated alone
+    int N;                          // number of particles at the previous call, or 0 before the first call
+    double t_prev;
+    double power_prev;
+};
+
+static void rebx_te_free_arrays(struct rebx_extras* rebx, struct rebx_operator* operator){
+    struct rebx_te_workspace* const ws = rebx_get_param(rebx, operator->ap, "energy_workspace");
+    if (ws){
+        free(ws->acc);
+    }
+    free(ws);
+}
+
+static struct rebx_te_workspace* rebx_te_get_workspace(struct reb_simulation* const sim, struct rebx_operator* const operator, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_te_workspace* ws = rebx_get_param(rebx, operator->ap, "energy_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for track_energy workspace.\n");
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &operator->ap, "energy_workspace", ws);
+        rebx_add_operator_free_arrays(rebx, operator, rebx_te_free_arrays);
+    }
+    if (ws->N_allocated < N){
+        free(ws->acc);
+        ws->acc = malloc(3*N*sizeof(*ws->acc));
+        if (ws->acc == NULL){
+            ws->N_allocated = 0;
+            ws->N = 0;
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for track_energy workspace.\n");
+            return NULL;
+        }
+        ws->N_allocated = N;
+    }
+    return ws;
+}
+
+// Power of the added forces alone at the current state. The accelerations the integrator left are put back afterwards.
+// Only the real particles are evaluated, so variational particles and force profiles are left as they were.
+static double rebx_te_power(struct reb_simulation* const sim, struct rebx_te_workspace* const ws, const int N){
+    struct reb_particle* const ps = sim->particles;
+    double* const acc = ws->acc;
+    for (int i=0; i<N; i++){
+        acc[3*i] = ps[i].ax;
+        acc[3*i+1] = ps[i].ay;
+        acc[3*i+2] = ps[i].az;
+    }
+    rebx_reset_accelerations(ps, N);
+    rebx_real_particle_forces(sim);
+    const double power = rebx_Edot(ps, N);
+    for (int i=0; i<N; i++){
+        ps[i].ax = acc[3*i];
+        ps[i].ay = acc[3*i+1];
+        ps[i].az = acc[3*i+2];
+    }
+    return power;
+}
+
+void rebx_track_energy(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
+    struct rebx_extras* const rebx = sim->extras;
+    const int N = sim->N - sim->N_var;
+    struct rebx_te_workspace* const ws = rebx_te_get_workspace(sim, operator, N);
+    if (ws == NULL){
+        return;
+    }
+    double* offset = rebx_get_param(rebx, operator->ap, "energy_offset");
+    if (offset == NULL){
+        rebx_set_param_double(rebx, &operator->ap, "energy_offset", 0.);
+        offset = rebx_get_param(rebx, operator->ap, "energy_offset");
+        if (offset == NULL){
+            return;
+        }
+    }
+
+    const double power = rebx->force_table.N > 0 ? rebx_te_power(sim, ws, N) : 0.;
+    if (ws->N == N){
+        *offset -= 0.5*(ws->power_prev + power)*(sim->t - ws->t_prev);
+    }
+    else{
+        *offset -= power*sim->dt_last_done;
+    }
+    ws->N = N;
+    ws->t_prev = sim->t;
+    ws->power_prev = power;
+}
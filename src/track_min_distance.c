@@ -38,7 +38,16 @@
  *
  * **Effect Parameters**
  * 
- * *None*
+ * ================================ =========== =======================================================
+ * Name (C type)                    Required    Description
+ * ================================ =========== =======================================================
+ * min_distance_interpolate (int)   No          If nonzero, also find minima between calls (see below). Default 0
+ * ================================ =========== =======================================================
+ *
+ * By default the distance is only sampled each time the operator is called, so with large timesteps the true minimum
+ * can be missed. With min_distance_interpolate set, whenever the radial velocity changes sign from approaching to
+ * receding between two calls, the closest approach is found on the cubic Hermite interpolant of the relative positions
+ * and velocities at the two calls (and min_distance_orbit is evaluated at that point).
  * 
  * **Particle Parameters**
  * 
@@ -60,36 +69,194 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "rebxtools.h"
+
+#include "core.h"
+
+// Kept on the operator between calls: resolved indices of the min_distance_from particles, and for interpolation,
+// the relative state of each tracker at the previous call. Indexed like the min_distance particle list.
+struct rebx_tmd_workspace{
+    unsigned long generation;       // rebx->param_generation the slots below were set for
+    int N;                          // number of particles they were set for
+    int N_allocated;
+    int* source;                    // cached source index, or -1
+    int* has_prev;
+    double* prev;                   // dx, dy, dz, dvx, dvy, dvz at t_prev
+    double t_prev;
+};
+
+static void rebx_tmd_free_arrays(struct rebx_extras* rebx, struct rebx_operator* operator){
+    struct rebx_tmd_workspace* const ws = rebx_get_param(rebx, operator->ap, "min_distance_workspace");
+    if (ws){
+        free(ws->source);
+        free(ws->has_prev);
+        free(ws->prev);
+    }
+    free(ws);
+}
+
+static struct rebx_tmd_workspace* rebx_tmd_get_workspace(struct reb_simulation* const sim, struct rebx_operator* const operator, const struct rebx_particle_list* const trackers, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_tmd_workspace* ws = rebx_get_param(rebx, operator->ap, "min_distance_workspace");
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for track_min_distance workspace.\n");
+            return NULL;
+        }
+        ws->generation = rebx->param_generation - 1;
+        rebx_set_param_pointer(rebx, &operator->ap, "min_distance_workspace", ws);
+        rebx_add_operator_free_arrays(rebx, operator, rebx_tmd_free_arrays);
+    }
+    const int N_trackers = trackers->N_indices;
+    if (ws->N_allocated < N_trackers){
+        free(ws->source);
+        free(ws->has_prev);
+        free(ws->prev);
+        ws->source = malloc(N_trackers*sizeof(*ws->source));
+        ws->has_prev = malloc(N_trackers*sizeof(*ws->has_prev));
+        ws->prev = malloc(6*N_trackers*sizeof(*ws->prev));
+        if (ws->source == NULL || ws->has_prev == NULL || ws->prev == NULL){
+            free(ws->source);
+            free(ws->has_prev);
+            free(ws->prev);
+            *ws = (struct rebx_tmd_workspace){0};
+            ws->generation = rebx->param_generation - 1;
+            reb_error(sim, "REBOUNDx Error: Could not allocate memory for track_min_distance workspace.\n");
+            return NULL;
+        }
+        ws->N_allocated = N_trackers;
+        ws->generation = rebx->param_generation - 1;
+    }
+    // Parameters were added or particles added/removed, so indices may have moved
+    if (ws->generation != rebx->param_generation || ws->N != N){
+        for (int k=0; k<N_trackers; k++){
+            ws->source[k] = -1;
+            ws->has_prev[k] = 0;
+        }
+        ws->generation = rebx->param_generation;
+        ws->N = N;
+    }
+    return ws;
+}
+
+// Closest approach on the cubic Hermite interpolant between relative states d0 (s=0) and d1 (s=1), with h = t1-t0.
+// Requires d.v to go from negative to positive in s. Returns the squared distance and fills the interpolated state d.
+static double rebx_tmd_refine(const double* const d0, const double* const d1, const double h, double* const d){
+    double lo = 0.;
+    double hi = 1.;
+    double s = 0.5;
+    for (int iter=0; iter<60; iter++){
+        s = 0.5*(lo+hi);
+        const double h00 = 2.*s*s*s - 3.*s*s + 1.;
+        const double h10 = s*s*s - 2.*s*s + s;
+        const double h01 = -2.*s*s*s + 3.*s*s;
+        const double h11 = s*s*s - s*s;
+        const double g00 = 6.*s*s - 6.*s;
+        const double g10 = 3.*s*s - 4.*s + 1.;
+        const double g11 = 3.*s*s - 2.*s;
+        double f = 0.;
+        for (int k=0; k<3; k++){
+            d[k] = h00*d0[k] + h10*h*d0[k+3] + h01*d1[k] + h11*h*d1[k+3];
+            d[k+3] = (g00*d0[k] + g10*h*d0[k+3] - g00*d1[k] + g11*h*d1[k+3])/h;
+            f += d[k]*d[k+3]*h;
+        }
+        if (f < 0.){
+            lo = s;
+        }
+        else{
+            hi = s;
+        }
+        if (hi - lo < 4.*DBL_EPSILON){
+            break;
+        }
+    }
+    return d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+}
+
+static void rebx_tmd_update_orbit(struct reb_simulation* const sim, struct rebx_extras* const rebx, const struct reb_particle* const p, const struct reb_particle* const source, const double* const d){
+    struct reb_orbit* const orbit = rebx_get_param(rebx, p->ap, "min_distance_orbit");
+    if (orbit == NULL){
+        return;
+    }
+    if (d == NULL){
+        *orbit = reb_tools_particle_to_orbit(sim->G, *p, *source);
+        return;
+    }
+    struct reb_particle primary = {0};
+    struct reb_particle q = {0};
+    primary.m = source->m;
+    q.m = p->m;
+    q.x = d[0];
+    q.y = d[1];
+    q.z = d[2];
+    q.vx = d[3];
+    q.vy = d[4];
+    q.vz = d[5];
+    *orbit = reb_tools_particle_to_orbit(sim->G, q, primary);
+}
 
 void rebx_track_min_distance(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
-    const struct rebx_extras* const rebx = sim->extras;
+    struct rebx_extras* const rebx = sim->extras;
     const int N = sim->N - sim->N_var;
-    for(int i=0; i<N; i++){
-        struct reb_particle* const p = &sim->particles[i];
-        double* min_distance = rebx_get_param(rebx, p->ap, "min_distance");
+    const int min_distance_key = rebx_get_param_key(rebx, "min_distance");
+    const int min_distance_from_key = rebx_get_param_key(rebx, "min_distance_from");
+    const struct rebx_particle_list* const trackers = rebx_get_particle_list(rebx, min_distance_key, sim->particles, N);
+    struct rebx_tmd_workspace* const ws = rebx_tmd_get_workspace(sim, operator, trackers, N);
+    if (ws == NULL){
+        return;
+    }
+    const int* const interpolate = rebx_get_param(rebx, operator->ap, "min_distance_interpolate");
+    const double h = sim->t - ws->t_prev;
+    for(int k=0; k<trackers->N_indices; k++){
+        struct reb_particle* const p = &sim->particles[trackers->indices[k]];
+        double* min_distance = rebx_get_param_by_key(rebx, p->ap, min_distance_key);
         if (min_distance != NULL){
-            const uint32_t* const target = rebx_get_param(rebx, p->ap, "min_distance_from");
+            const uint32_t* const target = rebx_get_param_by_key(rebx, p->ap, min_distance_from_key);
             struct reb_particle* source;
             if (target == NULL){
                 source = &sim->particles[0];
             }
+            else if (ws->source[k] >= 0 && ws->source[k] < sim->N && sim->particles[ws->source[k]].hash == *target){
+                source = &sim->particles[ws->source[k]];
+            }
             else{
                 source = reb_get_particle_by_hash(sim, *target);
+                if (source == NULL){
+                    reb_error(sim, "REBOUNDx Error: track_min_distance could not find the particle with the min_distance_from hash.\n");
+                    continue;
+                }
+                ws->source[k] = source - sim->particles;
             }
-            const double dx = p->x-source->x;
-            const double dy = p->y-source->y;
-            const double dz = p->z-source->z;
-            const double r2 = dx*dx + dy*dy + dz*dz;
+            const double d[6] = {p->x-source->x, p->y-source->y, p->z-source->z, p->vx-source->vx, p->vy-source->vy, p->vz-source->vz};
+            const double r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
             if (r2 < *min_distance*(*min_distance)){
                 *min_distance = sqrt(r2);
-                struct reb_orbit* const orbit = rebx_get_param(rebx, p->ap, "min_distance_orbit");
-                if (orbit != NULL){
-                    *orbit = reb_tools_particle_to_orbit(sim->G, *p, *source);
+                rebx_tmd_update_orbit(sim, rebx, p, source, NULL);
+            }
+            if (interpolate != NULL && *interpolate){
+                double* const d0 = &ws->prev[6*k];
+                if (ws->has_prev[k] && h != 0.){
+                    const double f0 = h*(d0[0]*d0[3] + d0[1]*d0[4] + d0[2]*d0[5]);
+                    const double f1 = h*(d[0]*d[3] + d[1]*d[4] + d[2]*d[5]);
+                    if (f0 < 0. && f1 > 0.){    // passed through a minimum since the last call
+                        double dmin[6];
+                        const double r2min = rebx_tmd_refine(d0, d, h, dmin);
+                        if (r2min < *min_distance*(*min_distance)){
+                            *min_distance = sqrt(r2min);
+                            rebx_tmd_update_orbit(sim, rebx, p, source, dmin);
+                        }
+                    }
                 }
+                for (int l=0; l<6; l++){
+                    d0[l] = d[l];
+                }
+                ws->has_prev[k] = 1;
             }
         }
     }
+    ws->t_prev = sim->t;
 }
-